@@ -0,0 +1,20 @@
+AC_DEFUN([DOVECOT_IO_URING], [
+  dnl * Do we have new enough io_uring headers (Linux v5.11+)
+  AC_CACHE_CHECK([for linux/io_uring.h],i_cv_have_linux_io_uring_h,[
+    AC_COMPILE_IFELSE([AC_LANG_PROGRAM([[
+      #include <sys/syscall.h>
+      #include <linux/io_uring.h>
+    ]], [[
+      struct io_uring_getevents_arg arg;
+      int syscall = __NR_io_uring_setup;
+      int op = IORING_OP_READ;
+    ]])],[
+      i_cv_have_linux_io_uring_h=yes
+    ],[
+      i_cv_have_linux_io_uring_h=no
+    ])
+  ])
+  AS_IF([test $i_cv_have_linux_io_uring_h = yes], [
+    AC_DEFINE(HAVE_LINUX_IO_URING_H,, [Define if you have usable linux/io_uring.h])
+  ])
+])
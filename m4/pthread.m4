@@ -0,0 +1,10 @@
+AC_DEFUN([DOVECOT_PTHREAD], [
+  dnl * Threads are used only for the lib/thread-pool.c workers
+  have_pthread=no
+  AC_CHECK_HEADER([pthread.h], [
+    AC_SEARCH_LIBS([pthread_create], [pthread], [
+      have_pthread=yes
+      AC_DEFINE(HAVE_PTHREAD,, [Define if you have POSIX threads])
+    ])
+  ])
+])
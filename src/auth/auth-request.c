@@ -175,7 +175,7 @@ struct auth_request *auth_request_new_dummy(struct event *parent_event)
 	struct auth_request *request;
 	pool_t pool;
 
-	pool = pool_alloconly_create(MEMPOOL_GROWING"auth_request", 1024);
+	pool = pool_slab_create("auth_request");
 	request = p_new(pool, struct auth_request, 1);
 	request->pool = pool;
 
@@ -265,6 +265,74 @@ static void cmd_process_status(struct doveadm_cmd_context *cctx)
 	i_stream_destroy(&input);
 }
 
+static void cmd_process_ioloop_stats(struct doveadm_cmd_context *cctx)
+{
+	const struct connection_settings set = {
+		.service_name_out = "master-admin-client",
+		.service_name_in = "master-admin-server",
+		.major_version = 1,
+		.minor_version = 0,
+	};
+	struct istream *input;
+	struct ostream *output;
+	const char *service, *path, *line, *error;
+	int64_t pid, count = 0;
+
+	if (!doveadm_cmd_param_str(cctx, "service", &service) ||
+	    !doveadm_cmd_param_int64(cctx, "pid", &pid))
+		i_fatal("service and pid parameters missing");
+	(void)doveadm_cmd_param_int64(cctx, "count", &count);
+
+	path = t_strdup_printf("%s/srv.%s/%"PRId64,
+			       doveadm_settings->base_dir, service, pid);
+	if (doveadm_blocking_connect(path, &set, &input, &output, &error) < 0)
+		i_fatal("%s", error);
+	o_stream_nsend_str(output, count <= 0 ? "IOLOOP-STATS\n" :
+		t_strdup_printf("IOLOOP-STATS\t%"PRId64"\n", count));
+	if (o_stream_flush(output) < 0) {
+		i_fatal("write(%s) failed: %s", o_stream_get_name(output),
+			o_stream_get_error(output));
+	}
+
+	doveadm_print_init(DOVEADM_PRINT_TYPE_TABLE);
+	doveadm_print_header_simple("source");
+	doveadm_print_header_simple("calls");
+	doveadm_print_header_simple("total_usecs");
+	doveadm_print_header_simple("max_usecs");
+	doveadm_print_header_simple("cpu_samples");
+	doveadm_print_header_simple("cpu_usecs");
+
+	alarm(5);
+	if ((line = i_stream_read_next_line(input)) == NULL) {
+		e_error(cctx->event, "read(%s) failed: %s",
+			i_stream_get_name(input), i_stream_get_error(input));
+		doveadm_exit_code = EX_TEMPFAIL;
+	} else if (line[0] == '-') {
+		e_error(cctx->event, "%s", line+1);
+		doveadm_exit_code = EX_TEMPFAIL;
+	} else if (line[0] != '+') {
+		e_error(cctx->event, "Unexpected input from %s: %s",
+			i_stream_get_name(input), line);
+		doveadm_exit_code = EX_TEMPFAIL;
+	} else {
+		const char *const *rows = t_strsplit_tabescaped(line + 1);
+		if (rows[0] != NULL && strcmp(rows[0], "1") != 0) {
+			e_warning(cctx->event, "ioloop_callback_stats isn't "
+				  "enabled for the process");
+		}
+		for (unsigned int i = 1; rows[0] != NULL && rows[i] != NULL; i++) {
+			const char *const *args = t_strsplit(rows[i], "\t");
+			if (str_array_length(args) < 6)
+				continue;
+			for (unsigned int j = 0; j < 6; j++)
+				doveadm_print(args[j]);
+		}
+	}
+	alarm(0);
+	o_stream_unref(&output);
+	i_stream_destroy(&input);
+}
+
 struct doveadm_cmd_ver2 doveadm_cmd_stop_ver2 = {
 	.cmd = cmd_stop,
 	.name = "stop",
@@ -307,3 +375,14 @@ DOVEADM_CMD_PARAMS_START
 DOVEADM_CMD_PARAM('\0', "service", CMD_PARAM_ARRAY, CMD_PARAM_FLAG_POSITIONAL)
 DOVEADM_CMD_PARAMS_END
 };
+
+struct doveadm_cmd_ver2 doveadm_cmd_process_ioloop_stats_ver2 = {
+	.cmd = cmd_process_ioloop_stats,
+	.name = "process ioloop-stats",
+	.usage = "[-n <count>] <service> <pid>",
+DOVEADM_CMD_PARAMS_START
+DOVEADM_CMD_PARAM('n', "count", CMD_PARAM_INT64, CMD_PARAM_FLAG_UNSIGNED)
+DOVEADM_CMD_PARAM('\0', "service", CMD_PARAM_STR, CMD_PARAM_FLAG_POSITIONAL)
+DOVEADM_CMD_PARAM('\0', "pid", CMD_PARAM_INT64, CMD_PARAM_FLAG_POSITIONAL|CMD_PARAM_FLAG_UNSIGNED)
+DOVEADM_CMD_PARAMS_END
+};
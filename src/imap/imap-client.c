@@ -138,8 +138,7 @@ struct client *client_create(int fd_in, int fd_out,
 	client->to_idle = timeout_add(CLIENT_IDLE_TIMEOUT_MSECS,
 				      client_idle_timeout, client);
 
-	client->command_pool =
-		pool_alloconly_create(MEMPOOL_GROWING"client command", 1024*2);
+	client->command_pool = pool_slab_create("client command");
 	client->user = user;
 	client->notify_count_changes = TRUE;
 	client->notify_flag_changes = TRUE;
@@ -473,6 +472,8 @@ static const char *client_get_commands_status(struct client *client)
 
 static void client_log_disconnect(struct client *client, const char *reason)
 {
+	/* the command pools' allocator statistics for the whole process */
+	pool_slab_event_add_stats(client->event);
 	e_info(client->event, "Disconnected: %s %s", reason, client_stats(client));
 }
 
@@ -0,0 +1,167 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "strnum.h"
+#include "time-util.h"
+#include "unlink-directory.h"
+#include "mail-index-private.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/**
+ * Measures the throughput of transaction log commits that require
+ * fdatasync(), as done by concurrent LMTP deliveries and flag changes to
+ * the same mailbox. Each writer process commits transactions with
+ * MAIL_INDEX_TRANSACTION_FLAG_FSYNC that change flags of a random message.
+ */
+
+#define BENCH_DIR ".bench_mail_transaction_log"
+#define BENCH_PREFIX "dovecot.index"
+#define BENCH_MESSAGE_COUNT 1000
+
+static unsigned int writer_count = 8;
+static unsigned int commit_count = 200;
+
+static struct mail_index *bench_index_open(void)
+{
+	struct mail_index *index;
+
+	index = mail_index_alloc(NULL, BENCH_DIR, BENCH_PREFIX);
+	mail_index_set_fsync_mode(index, FSYNC_MODE_OPTIMIZED, 0);
+	if (mail_index_open_or_create(index, MAIL_INDEX_OPEN_FLAG_CREATE) < 0)
+		i_fatal("mail_index_open(%s) failed", BENCH_DIR);
+	return index;
+}
+
+static void bench_index_create(void)
+{
+	struct mail_index *index;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	uint32_t seq, uid_validity = 1;
+
+	index = bench_index_open();
+	view = mail_index_view_open(index);
+	trans = mail_index_transaction_begin(view, 0);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	for (unsigned int i = 1; i <= BENCH_MESSAGE_COUNT; i++)
+		mail_index_append(trans, i, &seq);
+	if (mail_index_transaction_commit(&trans) < 0)
+		i_fatal("mail_index_transaction_commit() failed");
+	mail_index_view_close(&view);
+	mail_index_close(index);
+	mail_index_free(&index);
+}
+
+static void bench_writer(int start_fd)
+{
+	struct mail_index *index;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	char c;
+
+	index = bench_index_open();
+	/* wait until all the writers have been started */
+	if (read(start_fd, &c, 1) < 0)
+		i_fatal("read(start pipe) failed: %m");
+
+	for (unsigned int i = 0; i < commit_count; i++) {
+		view = mail_index_view_open(index);
+		if (mail_index_refresh(index) < 0)
+			i_fatal("mail_index_refresh() failed");
+		trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_FSYNC |
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+		mail_index_update_flags(trans,
+			i_rand_minmax(1, BENCH_MESSAGE_COUNT),
+			(i % 2) == 0 ? MODIFY_ADD : MODIFY_REMOVE,
+			MAIL_SEEN);
+		if (mail_index_transaction_commit(&trans) < 0)
+			i_fatal("mail_index_transaction_commit() failed");
+		mail_index_view_close(&view);
+	}
+	mail_index_close(index);
+	mail_index_free(&index);
+}
+
+static void bench_run(void)
+{
+	int start_fd[2], status;
+	unsigned int i, failed = 0;
+	uint64_t ts, nsecs;
+	pid_t pid;
+
+	if (pipe(start_fd) < 0)
+		i_fatal("pipe() failed: %m");
+	for (i = 0; i < writer_count; i++) {
+		if ((pid = fork()) < 0)
+			i_fatal("fork() failed: %m");
+		if (pid == 0) {
+			i_close_fd(&start_fd[1]);
+			bench_writer(start_fd[0]);
+			lib_exit(0);
+		}
+	}
+	i_close_fd(&start_fd[0]);
+	/* give the writers some time to open the index */
+	usleep(100000);
+
+	ts = i_nanoseconds();
+	i_close_fd(&start_fd[1]);
+	for (i = 0; i < writer_count; i++) {
+		if (wait(&status) < 0)
+			i_fatal("wait() failed: %m");
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			failed++;
+	}
+	nsecs = i_nanoseconds() - ts;
+	if (failed > 0)
+		i_fatal("%u writers failed", failed);
+
+	printf("%u writers x %u commits: %.0f commits/s, %.1f us/commit\n",
+	       writer_count, commit_count,
+	       (double)writer_count * commit_count * 1000000000 / nsecs,
+	       (double)nsecs / 1000 / commit_count);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<writers> [<commits per writer>]]\n",
+		prog);
+	fprintf(stderr, "Uses 8 writers with 200 commits each if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	const char *error;
+
+	lib_init();
+
+	if (argc > 3)
+		print_usage(argv[0]);
+	if ((argc > 1 && (str_to_uint(argv[1], &writer_count) < 0 ||
+			  writer_count == 0)) ||
+	    (argc > 2 && (str_to_uint(argv[2], &commit_count) < 0 ||
+			  commit_count == 0))) {
+		fprintf(stderr, "Invalid parameters\n");
+		print_usage(argv[0]);
+	}
+
+	/* used for the indexid */
+	ioloop_time = time(NULL);
+	(void)unlink_directory(BENCH_DIR, UNLINK_DIRECTORY_FLAG_RMDIR, &error);
+	if (mkdir(BENCH_DIR, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", BENCH_DIR);
+	bench_index_create();
+	bench_run();
+	(void)unlink_directory(BENCH_DIR, UNLINK_DIRECTORY_FLAG_RMDIR, &error);
+
+	lib_deinit();
+	return 0;
+}
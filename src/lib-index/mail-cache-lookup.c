@@ -8,6 +8,30 @@
 
 
 #define CACHE_PREFETCH IO_BLOCK_SIZE
+/* Don't map more than this in one read when prefetching a batch */
+#define CACHE_BATCH_MAX_PREFETCH (1024*1024)
+
+#define CACHE_BATCH_VALUE_NOT_FOUND UINT32_MAX
+#define CACHE_BATCH_VALUE_FAILED (UINT32_MAX-1)
+
+struct mail_cache_lookup_batch_value {
+	/* Offset to batch->data, or CACHE_BATCH_VALUE_* */
+	uint32_t offset;
+	uint32_t size;
+};
+
+struct mail_cache_lookup_batch {
+	struct mail_cache_view *view;
+	ARRAY_TYPE(seq_range) seqs;
+	unsigned int msg_count, fields_count;
+
+	/* field_idx => column + 1, or 0 if the field isn't in the batch */
+	unsigned int *field_columns;
+	unsigned int field_columns_count;
+	/* values[column * msg_count + msg_idx] */
+	struct mail_cache_lookup_batch_value *values;
+	buffer_t *data;
+};
 
 int mail_cache_get_record(struct mail_cache *cache, uint32_t offset,
 			  const struct mail_cache_record **rec_r)
@@ -346,13 +370,37 @@ static int mail_cache_seq(struct mail_cache_view *view, uint32_t seq)
 	return ret;
 }
 
+static int
+mail_cache_view_batch_get(struct mail_cache_view *view, uint32_t seq,
+			  unsigned int field_idx,
+			  const void **data_r, size_t *size_r)
+{
+	if (view->lookup_batch == NULL)
+		return -1;
+	if (view->trans_seq1 <= seq && view->trans_seq2 >= seq) {
+		/* the transaction may have added fields after the batch
+		   was looked up */
+		return -1;
+	}
+	return mail_cache_lookup_batch_get(view->lookup_batch, seq, field_idx,
+					   data_r, size_r);
+}
+
 int mail_cache_field_exists(struct mail_cache_view *view, uint32_t seq,
 			    unsigned int field)
 {
 	const uint8_t *data;
+	const void *batch_data;
+	size_t batch_size;
+	int ret;
 
 	i_assert(seq > 0);
 
+	ret = mail_cache_view_batch_get(view, seq, field,
+					&batch_data, &batch_size);
+	if (ret >= 0)
+		return ret;
+
 	/* NOTE: view might point to a non-committed transaction that has
 	   fields that don't yet exist in the cache file. So don't add any
 	   fast-paths checking whether the field exists in the file. */
@@ -417,8 +465,23 @@ int mail_cache_lookup_field(struct mail_cache_view *view, buffer_t *dest_buf,
 {
 	struct mail_cache_lookup_iterate_ctx iter;
 	struct mail_cache_iterate_field field;
+	const void *data;
+	size_t size;
 	int ret;
 
+	ret = mail_cache_view_batch_get(view, seq, field_idx, &data, &size);
+	if (ret >= 0) {
+		mail_cache_decision_state_update(view, seq, field_idx);
+		if (ret == 0)
+			return 0;
+		if (view->cache->fields[field_idx].field.type ==
+		    MAIL_CACHE_FIELD_BITMASK)
+			buffer_write(dest_buf, 0, data, size);
+		else
+			buffer_append(dest_buf, data, size);
+		return 1;
+	}
+
 	ret = mail_cache_field_exists(view, seq, field_idx);
 	mail_cache_decision_state_update(view, seq, field_idx);
 	if (ret <= 0)
@@ -445,6 +508,205 @@ int mail_cache_lookup_field(struct mail_cache_view *view, buffer_t *dest_buf,
 	return ret;
 }
 
+static void
+mail_cache_lookup_batch_prefetch(struct mail_cache_lookup_batch *batch)
+{
+	struct mail_cache *cache = batch->view->cache;
+	struct seq_range_iter iter;
+	uint32_t seq, offset, reset_id;
+	uint32_t min_offset = UINT32_MAX, max_offset = 0;
+	unsigned int n = 0;
+	const void *data;
+
+	if (MAIL_CACHE_IS_UNUSABLE(cache))
+		return;
+
+	/* Look up the first record offsets in sequence order. The records
+	   were mostly appended in the same order, so the area between the
+	   smallest and the largest offset can be read with a single read. */
+	seq_range_array_iter_init(&iter, &batch->seqs);
+	while (seq_range_array_iter_nth(&iter, n++, &seq)) {
+		offset = mail_cache_lookup_cur_offset(batch->view->view, seq,
+						      &reset_id);
+		if (offset == 0 || reset_id != cache->hdr->file_seq)
+			continue;
+		min_offset = I_MIN(min_offset, offset);
+		max_offset = I_MAX(max_offset, offset);
+	}
+	if (min_offset > max_offset ||
+	    max_offset - min_offset > CACHE_BATCH_MAX_PREFETCH)
+		return;
+	(void)mail_cache_map(cache, min_offset,
+			     max_offset - min_offset + CACHE_PREFETCH, &data);
+}
+
+static void
+mail_cache_lookup_batch_msg(struct mail_cache_lookup_batch *batch,
+			    uint32_t seq, unsigned int msg_idx)
+{
+	struct mail_cache *cache = batch->view->cache;
+	struct mail_cache_lookup_iterate_ctx iter;
+	struct mail_cache_iterate_field field;
+	struct mail_cache_lookup_batch_value *value;
+	const unsigned char *src;
+	unsigned char *dest;
+	unsigned int i, column;
+	int ret;
+
+	mail_cache_lookup_iter_init(batch->view, seq, &iter);
+	while ((ret = mail_cache_lookup_iter_next(&iter, &field)) > 0) {
+		if (field.field_idx >= batch->field_columns_count ||
+		    batch->field_columns[field.field_idx] == 0)
+			continue;
+		column = batch->field_columns[field.field_idx] - 1;
+		value = &batch->values[column * batch->msg_count + msg_idx];
+
+		if (cache->fields[field.field_idx].field.type !=
+		    MAIL_CACHE_FIELD_BITMASK) {
+			/* use the first one that's found. if there are
+			   multiple they're all identical. */
+			if (value->offset != CACHE_BATCH_VALUE_NOT_FOUND)
+				continue;
+			value->offset = batch->data->used;
+			value->size = field.size;
+			buffer_append(batch->data, field.data, field.size);
+			continue;
+		}
+
+		/* merge all bits */
+		if (value->offset == CACHE_BATCH_VALUE_NOT_FOUND) {
+			value->offset = batch->data->used;
+			value->size = I_MAX(field.size,
+				cache->fields[field.field_idx].field.field_size);
+			buffer_append_zero(batch->data, value->size);
+		}
+		src = field.data;
+		dest = buffer_get_space_unsafe(batch->data, value->offset,
+					       value->size);
+		for (i = 0; i < field.size && i < value->size; i++)
+			dest[i] |= src[i];
+	}
+	if (ret < 0) {
+		/* let the caller fall back to mail_cache_lookup_field() */
+		for (column = 0; column < batch->fields_count; column++) {
+			value = &batch->values[column * batch->msg_count +
+					       msg_idx];
+			value->offset = CACHE_BATCH_VALUE_FAILED;
+		}
+	}
+}
+
+struct mail_cache_lookup_batch *
+mail_cache_lookup_batch_init(struct mail_cache_view *view,
+			     const ARRAY_TYPE(seq_range) *seqs,
+			     const unsigned int field_idxs[],
+			     unsigned int fields_count)
+{
+	struct mail_cache_lookup_batch *batch;
+	struct seq_range_iter iter;
+	unsigned int i, n = 0;
+	uint32_t seq;
+
+	if (view->lookup_batch != NULL)
+		return NULL;
+
+	batch = i_new(struct mail_cache_lookup_batch, 1);
+	batch->view = view;
+	i_array_init(&batch->seqs, I_MAX(array_count(seqs), 1));
+	array_append_array(&batch->seqs, seqs);
+	batch->msg_count = seq_range_count(seqs);
+	batch->fields_count = fields_count;
+
+	for (i = 0; i < fields_count; i++) {
+		i_assert(field_idxs[i] < view->cache->fields_count);
+		if (batch->field_columns_count <= field_idxs[i])
+			batch->field_columns_count = field_idxs[i] + 1;
+	}
+	batch->field_columns = i_new(unsigned int,
+				     I_MAX(batch->field_columns_count, 1));
+	for (i = 0; i < fields_count; i++)
+		batch->field_columns[field_idxs[i]] = i + 1;
+
+	batch->values = i_new(struct mail_cache_lookup_batch_value,
+		I_MAX((size_t)batch->msg_count * fields_count, 1));
+	memset(batch->values, 0xff, sizeof(*batch->values) *
+	       batch->msg_count * fields_count);
+	batch->data = buffer_create_dynamic(default_pool, 1024);
+
+	if (!view->cache->opened)
+		(void)mail_cache_open_and_verify(view->cache);
+	if (fields_count > 0) {
+		mail_cache_lookup_batch_prefetch(batch);
+		seq_range_array_iter_init(&iter, &batch->seqs);
+		while (seq_range_array_iter_nth(&iter, n, &seq)) T_BEGIN {
+			mail_cache_lookup_batch_msg(batch, seq, n++);
+		} T_END;
+	}
+	view->lookup_batch = batch;
+	return batch;
+}
+
+void mail_cache_lookup_batch_deinit(struct mail_cache_lookup_batch **_batch)
+{
+	struct mail_cache_lookup_batch *batch = *_batch;
+
+	if (batch == NULL)
+		return;
+	*_batch = NULL;
+
+	i_assert(batch->view->lookup_batch == batch);
+	batch->view->lookup_batch = NULL;
+
+	buffer_free(&batch->data);
+	i_free(batch->values);
+	i_free(batch->field_columns);
+	array_free(&batch->seqs);
+	i_free(batch);
+}
+
+static bool
+mail_cache_lookup_batch_msg_idx(struct mail_cache_lookup_batch *batch,
+				uint32_t seq, unsigned int *msg_idx_r)
+{
+	const struct seq_range *range;
+	unsigned int msg_idx = 0;
+
+	array_foreach(&batch->seqs, range) {
+		if (seq < range->seq1)
+			break;
+		if (seq <= range->seq2) {
+			*msg_idx_r = msg_idx + (seq - range->seq1);
+			return TRUE;
+		}
+		msg_idx += range->seq2 - range->seq1 + 1;
+	}
+	return FALSE;
+}
+
+int mail_cache_lookup_batch_get(struct mail_cache_lookup_batch *batch,
+				uint32_t seq, unsigned int field_idx,
+				const void **data_r, size_t *size_r)
+{
+	const struct mail_cache_lookup_batch_value *value;
+	unsigned int msg_idx, column;
+
+	if (field_idx >= batch->field_columns_count ||
+	    batch->field_columns[field_idx] == 0)
+		return -1;
+	if (!mail_cache_lookup_batch_msg_idx(batch, seq, &msg_idx))
+		return -1;
+
+	column = batch->field_columns[field_idx] - 1;
+	value = &batch->values[column * batch->msg_count + msg_idx];
+	if (value->offset == CACHE_BATCH_VALUE_FAILED)
+		return -1;
+	if (value->offset == CACHE_BATCH_VALUE_NOT_FOUND)
+		return 0;
+	*data_r = CONST_PTR_OFFSET(batch->data->data, value->offset);
+	*size_r = value->size;
+	return 1;
+}
+
 struct header_lookup_data {
 	uint32_t data_size;
 	const unsigned char *data;
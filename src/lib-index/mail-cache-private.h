@@ -266,6 +266,9 @@ struct mail_cache_view {
 	uint8_t cached_exists_value;
 	uint32_t cached_exists_seq;
 
+	/* Lookup results prefetched with mail_cache_lookup_batch_init() */
+	struct mail_cache_lookup_batch *lookup_batch;
+
 	/* mail_cache_view_update_cache_decisions() has been used to disable
 	   updating cache decisions. */
 	bool no_decision_updates:1;
@@ -587,8 +587,17 @@ mail_cache_open_or_create_path(struct mail_index *index, const char *path)
 	cache->dotlock_settings.stale_timeout = MAIL_CACHE_LOCK_CHANGE_TIMEOUT;
 
 	if (!MAIL_INDEX_IS_IN_MEMORY(index) &&
-	    (index->flags & MAIL_INDEX_OPEN_FLAG_MMAP_DISABLE) != 0)
-		cache->file_cache = file_cache_new_path(-1, cache->filepath);
+	    (index->flags & MAIL_INDEX_OPEN_FLAG_MMAP_DISABLE) != 0) {
+		/* mmap_disable=yes is used with NFS and clustered
+		   filesystems, where a mapping isn't coherent with other
+		   hosts' writes. Copy the file to private memory unless the
+		   admin has explicitly said that a shared mapping is safe. */
+		enum file_cache_flags file_cache_flags =
+			index->optimization_set.cache.mmap_shared ?
+			FILE_CACHE_FLAG_MMAP : 0;
+		cache->file_cache = file_cache_new_full(-1, cache->filepath,
+							file_cache_flags);
+	}
 	cache->map_with_read =
 		(cache->index->flags & MAIL_INDEX_OPEN_FLAG_SAVEONLY) != 0;
 
@@ -969,6 +978,7 @@ void mail_cache_view_close(struct mail_cache_view **_view)
 	struct mail_cache_view *view = *_view;
 
 	i_assert(view->trans_view == NULL);
+	i_assert(view->lookup_batch == NULL);
 
 	*_view = NULL;
 	if (view->cache->field_header_write_pending &&
@@ -8,6 +8,7 @@
 struct mail_cache;
 struct mail_cache_view;
 struct mail_cache_transaction_ctx;
+struct mail_cache_lookup_batch;
 
 enum mail_cache_decision_type {
 	/* Not needed currently */
@@ -178,6 +179,29 @@ void mail_cache_decision_add(struct mail_cache_view *view, uint32_t seq,
 int mail_cache_lookup_field(struct mail_cache_view *view, buffer_t *dest_buf,
 			    uint32_t seq, unsigned int field_idx);
 
+/* Look up the given fields for all the messages in seqs with a single walk
+   of each message's cache records. The messages' record offsets are looked
+   up first in sequence order, and the cache file area containing them is
+   mapped with a single read. The results are copied, so they stay valid
+   even if the cache file is remapped or purged.
+
+   While the batch exists, mail_cache_lookup_field() and
+   mail_cache_field_exists() return the batch's results for the messages and
+   fields that it has. Only one batch can exist for a view at a time, so
+   NULL is returned if the view already has one. */
+struct mail_cache_lookup_batch *
+mail_cache_lookup_batch_init(struct mail_cache_view *view,
+			     const ARRAY_TYPE(seq_range) *seqs,
+			     const unsigned int field_idxs[],
+			     unsigned int fields_count);
+void mail_cache_lookup_batch_deinit(struct mail_cache_lookup_batch **batch);
+/* Returns 1 if the field was found, 0 if it's not cached, -1 if the batch
+   doesn't have the message or the field, or the message's lookup failed.
+   The data is valid until the batch is deinitialized. */
+int mail_cache_lookup_batch_get(struct mail_cache_lookup_batch *batch,
+				uint32_t seq, unsigned int field_idx,
+				const void **data_r, size_t *size_r);
+
 /* Return specified cached headers. Returns 1 if all fields were found,
    0 if not, -1 if error. dest is updated only if all fields were found. */
 int mail_cache_lookup_headers(struct mail_cache_view *view, string_t *dest,
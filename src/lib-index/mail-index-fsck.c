@@ -75,6 +75,11 @@ mail_index_fsck_header(struct mail_index *index, struct mail_index_map *map,
 	   isn't completely broken. */
 	if (hdr->uid_validity == 0 && hdr->next_uid != 1)
 		hdr->uid_validity = ioloop_time32;
+	if ((hdr->write_seq & 1) != 0) {
+		/* incremental write was interrupted. the counters are
+		   recalculated from the records below. */
+		hdr->write_seq++;
+	}
 
 	if (index->log->head != NULL)
 		mail_index_fsck_log_pos(index, map, hdr);
@@ -103,8 +108,8 @@ mail_index_fsck_find_keyword_count(struct mail_index_map *map,
 	kw_pos = ext_hdr->record_offset;
 	kw_size = ext_hdr->record_size;
 
-	rec = map->rec_map->records;
 	for (r = 0; r < map->rec_map->records_count; r++) {
+		rec = MAIL_INDEX_MAP_IDX(map, r);
 		kw = CONST_PTR_OFFSET(rec, kw_pos);
 		for (i = cur = 0; i < kw_size; i++) {
 			if (kw[i] != 0) {
@@ -119,7 +124,6 @@ mail_index_fsck_find_keyword_count(struct mail_index_map *map,
 			if (max == kw_size*8)
 				return max;
 		}
-		rec = CONST_PTR_OFFSET(rec, map->hdr.record_size);
 	}
 	return max;
 }
@@ -327,7 +331,7 @@ static void
 mail_index_fsck_records(struct mail_index *index, struct mail_index_map *map,
 			struct mail_index_header *hdr)
 {
-	struct mail_index_record *rec, *next_rec;
+	struct mail_index_record *rec;
 	uint32_t i, last_uid;
 	bool logged_unordered_uids = FALSE, logged_zero_uids = FALSE;
 	bool records_dropped = FALSE;
@@ -339,9 +343,9 @@ mail_index_fsck_records(struct mail_index *index, struct mail_index_map *map,
 	hdr->first_unseen_uid_lowwater = 0;
 	hdr->first_deleted_uid_lowwater = 0;
 
-	rec = map->rec_map->records; last_uid = 0;
+	last_uid = 0;
 	for (i = 0; i < map->rec_map->records_count; ) {
-		next_rec = PTR_OFFSET(rec, hdr->record_size);
+		rec = MAIL_INDEX_MAP_IDX(map, i);
 		if (rec->uid <= last_uid) {
 			/* log an error once, and skip this record */
 			if (rec->uid == 0) {
@@ -360,8 +364,8 @@ mail_index_fsck_records(struct mail_index *index, struct mail_index_map *map,
 			/* not the fastest way when we're skipping lots of
 			   records, but this should happen rarely so don't
 			   bother optimizing. */
-			memmove(rec, next_rec, hdr->record_size *
-				(map->rec_map->records_count - i - 1));
+			mail_index_map_move_records(map, i, i + 1,
+				map->rec_map->records_count - i - 1);
 			map->rec_map->records_count--;
 			records_dropped = TRUE;
 			continue;
@@ -381,7 +385,6 @@ mail_index_fsck_records(struct mail_index *index, struct mail_index_map *map,
 			hdr->first_deleted_uid_lowwater = rec->uid;
 
 		last_uid = rec->uid;
-		rec = next_rec;
 		i++;
 	}
 
@@ -431,6 +434,11 @@ mail_index_fsck_map(struct mail_index *index, struct mail_index_map *map)
 
 	mail_index_fsck_header(index, map, &hdr);
 	mail_index_fsck_extensions(index, map, &hdr);
+	if (map->rec_map->records_count > 0) {
+		mail_index_map_modify_records(map, 1,
+					      map->rec_map->records_count);
+	}
+	mail_index_map_set_all_dirty(map);
 	mail_index_fsck_records(index, map, &hdr);
 
 	hdr.flags |= MAIL_INDEX_HDR_FLAG_FSCKD;
@@ -261,6 +261,8 @@ static void mail_index_map_clear_recent_flags(struct mail_index_map *map)
 	struct mail_index_record *rec;
 	uint32_t seq;
 
+	if (map->hdr.messages_count > 0)
+		mail_index_map_modify_records(map, 1, map->hdr.messages_count);
 	for (seq = 1; seq <= map->hdr.messages_count; seq++) {
 		rec = MAIL_INDEX_REC_AT_SEQ(map, seq);
 		rec->flags &= ENUM_NEGATE(MAIL_RECENT);
@@ -324,11 +326,12 @@ int mail_index_map_check_header(struct mail_index_map *map,
 	case 1:
 		/* pre-v1.1.rc6: make sure the \Recent flags are gone */
 		mail_index_map_clear_recent_flags(map);
+		mail_index_map_set_all_dirty(map);
 		/* fall through */
 	case 2:
 		/* pre-v2.2 (although should have been done in v2.1 already):
 		   make sure the old unused fields are cleared */
-		map->hdr.unused_old_sync_size_part1 = 0;
+		map->hdr.write_seq = 0;
 		map->hdr.log2_rotate_time = 0;
 		map->hdr.last_temp_file_scan = 0;
 	}
@@ -337,6 +340,12 @@ int mail_index_map_check_header(struct mail_index_map *map,
 	   keep it as it is to avoid breaking anything. */
 	if (map->hdr.minor_version < MAIL_INDEX_MINOR_VERSION)
 		map->hdr.minor_version = MAIL_INDEX_MINOR_VERSION;
+	if ((hdr->write_seq & 1) != 0) {
+		*error_r = t_strdup_printf(
+			"Incremental write was interrupted (write_seq=%u)",
+			hdr->write_seq);
+		return 0;
+	}
 	if (hdr->first_recent_uid == 0) {
 		*error_r = "first_recent_uid=0";
 		return 0;
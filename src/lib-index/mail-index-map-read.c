@@ -5,6 +5,7 @@
 #include "nfs-workarounds.h"
 #include "mmap-util.h"
 #include "read-full.h"
+#include "sleep.h"
 #include "mail-index-private.h"
 #include "mail-index-sync-private.h"
 #include "mail-transaction-log-private.h"
@@ -37,7 +38,7 @@ static int mail_index_mmap(struct mail_index_map *map, uoff_t file_size)
 
 	i_assert(rec_map->mmap_base == NULL);
 
-	buffer_free(&rec_map->buffer);
+	mail_index_record_map_reset(rec_map);
 	if (file_size > SSIZE_T_MAX) {
 		/* too large file to map into memory */
 		mail_index_set_error(index, "Index file too large: %s",
@@ -104,6 +105,7 @@ static int mail_index_mmap(struct mail_index_map *map, uoff_t file_size)
 	buffer_append(map->hdr_copy_buf, rec_map->mmap_base, hdr->header_size);
 
 	rec_map->records = PTR_OFFSET(rec_map->mmap_base, map->hdr.header_size);
+	mail_index_map_clear_dirty(map);
 	return 1;
 }
 
@@ -143,7 +145,8 @@ mail_index_try_read_map(struct mail_index_map *map,
 	void *data = NULL;
 	ssize_t ret;
 	size_t pos, records_size, initial_buf_pos = 0;
-	unsigned int records_count = 0, extra;
+	size_t offset, size, copied;
+	unsigned int records_count = 0, extra, idx, count;
 
 	i_assert(map->rec_map->mmap_base == NULL);
 
@@ -203,27 +206,29 @@ mail_index_try_read_map(struct mail_index_map *map,
 				records_count);
 		}
 
-		if (map->rec_map->buffer == NULL) {
-			map->rec_map->buffer =
-				buffer_create_dynamic(default_pool,
-						      records_size);
-		}
-
-		/* @UNSAFE */
-		buffer_set_used_size(map->rec_map->buffer, 0);
+		/* @UNSAFE: read the records into pages. The beginning of
+		   them may already be in the initially read buffer. */
+		mail_index_record_map_reset(map->rec_map);
 		if (initial_buf_pos <= hdr->header_size)
 			extra = 0;
-		else {
+		else
 			extra = initial_buf_pos - hdr->header_size;
-			buffer_append(map->rec_map->buffer,
-				      CONST_PTR_OFFSET(buf, hdr->header_size),
-				      extra);
-		}
-		if (records_size > extra) {
-			data = buffer_append_space_unsafe(map->rec_map->buffer,
-							  records_size - extra);
-			ret = pread_full(index->fd, data, records_size - extra,
-					 hdr->header_size + extra);
+		for (idx = 0; idx < records_count && ret > 0; idx += count) {
+			data = mail_index_record_map_append_space(map->rec_map,
+				hdr->record_size, records_count - idx, &count);
+			offset = (size_t)idx * hdr->record_size;
+			size = (size_t)count * hdr->record_size;
+			copied = 0;
+			if (offset < extra) {
+				copied = I_MIN(size, extra - offset);
+				memcpy(data, CONST_PTR_OFFSET(buf,
+					hdr->header_size + offset), copied);
+			}
+			if (copied < size) {
+				ret = pread_full(index->fd,
+					PTR_OFFSET(data, copied), size - copied,
+					hdr->header_size + offset + copied);
+			}
 		}
 	}
 
@@ -243,15 +248,32 @@ mail_index_try_read_map(struct mail_index_map *map,
 		return 0;
 	}
 
-	map->rec_map->records =
-		buffer_get_modifiable_data(map->rec_map->buffer, NULL);
-	map->rec_map->records_count = records_count;
+	i_assert(map->rec_map->records_count == records_count);
 
 	mail_index_map_copy_hdr(map, hdr);
 	i_assert(map->hdr_copy_buf->used == map->hdr.header_size);
+	mail_index_map_clear_dirty(map);
 	return 1;
 }
 
+static bool mail_index_read_map_is_consistent(struct mail_index_map *map)
+{
+	unsigned char hdr_buf[sizeof(struct mail_index_header)];
+	size_t size = I_MIN(map->hdr.base_header_size, sizeof(hdr_buf));
+
+	/* The records may be rewritten in place while we're reading them.
+	   The writer increments write_seq before it starts and again when
+	   it writes the final base header, so the read is consistent if
+	   write_seq was even and the base header didn't change. */
+	if ((map->hdr.write_seq & 1) != 0)
+		return FALSE;
+	if (pread_full(map->index->fd, hdr_buf, size, 0) <= 0) {
+		/* the next read will handle the error */
+		return TRUE;
+	}
+	return memcmp(hdr_buf, map->hdr_copy_buf->data, size) == 0;
+}
+
 static int mail_index_read_map(struct mail_index_map *map, uoff_t file_size)
 {
 	struct mail_index *index = map->index;
@@ -299,6 +321,30 @@ static int mail_index_read_map(struct mail_index_map *map, uoff_t file_size)
 	return ret;
 }
 
+static int
+mail_index_read_map_consistent(struct mail_index_map *map, uoff_t file_size)
+{
+	struct mail_index *index = map->index;
+	struct stat st;
+	unsigned int i;
+	int ret;
+
+	for (i = 0;; i++) {
+		ret = mail_index_read_map(map, file_size);
+		if (ret <= 0 || mail_index_read_map_is_consistent(map) ||
+		    i == MAIL_INDEX_WRITE_SEQ_RETRY_COUNT)
+			break;
+
+		/* The index is being written. Try again after it's finished.
+		   If write_seq stays odd, the write was interrupted and fsck
+		   fixes it. */
+		i_sleep_msecs(MAIL_INDEX_WRITE_SEQ_RETRY_MSECS);
+		if (fstat(index->fd, &st) == 0)
+			file_size = st.st_size;
+	}
+	return ret;
+}
+
 /* returns -1 = error, 0 = index files are unusable,
    1 = index files are usable or at least repairable */
 static int
@@ -347,7 +393,7 @@ mail_index_map_latest_file(struct mail_index *index, const char **reason_r)
 	if (use_mmap) {
 		ret = mail_index_mmap(new_map, file_size);
 	} else {
-		ret = mail_index_read_map(new_map, file_size);
+		ret = mail_index_read_map_consistent(new_map, file_size);
 	}
 	if (ret == 0) {
 		/* the index files are unusable */
@@ -398,7 +444,8 @@ mail_index_map_latest_file(struct mail_index *index, const char **reason_r)
 		mail_index_unmap(&new_map);
 		return ret < 0 ? -1 : (unusable ? 0 : 1);
 	}
-	i_assert(new_map->rec_map->records != NULL);
+	i_assert(new_map->rec_map->records_count >=
+		 new_map->hdr.messages_count);
 
 	index->main_index_hdr_log_file_seq = new_map->hdr.log_file_seq;
 	index->main_index_hdr_log_file_tail_offset =
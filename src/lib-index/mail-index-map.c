@@ -266,19 +266,176 @@ struct mail_index_map *mail_index_map_alloc(struct mail_index *index)
 	return mail_index_map_clone(&tmp_map);
 }
 
+static struct mail_index_record_page *
+mail_index_record_page_alloc(unsigned int record_size,
+			     unsigned int alloc_count)
+{
+	struct mail_index_record_page *page;
+
+	page = i_new(struct mail_index_record_page, 1);
+	page->refcount = 1;
+	page->alloc_count = alloc_count;
+	page->records = i_malloc(alloc_count * record_size);
+	return page;
+}
+
+static void mail_index_record_page_unref(struct mail_index_record_page **_page)
+{
+	struct mail_index_record_page *page = *_page;
+
+	*_page = NULL;
+	i_assert(page->refcount > 0);
+	if (--page->refcount > 0)
+		return;
+	i_free(page->records);
+	i_free(page);
+}
+
+static struct mail_index_record_page *
+mail_index_record_map_get_private_page(struct mail_index_record_map *rec_map,
+				       unsigned int record_size,
+				       unsigned int page_idx)
+{
+	struct mail_index_record_page **pagep, *page;
+
+	pagep = array_idx_modifiable(&rec_map->pages, page_idx);
+	if ((*pagep)->refcount > 1) {
+		/* copy-on-write */
+		page = mail_index_record_page_alloc(record_size,
+						    (*pagep)->alloc_count);
+		memcpy(page->records, (*pagep)->records,
+		       page->alloc_count * record_size);
+		mail_index_record_page_unref(pagep);
+		*pagep = page;
+	}
+	return *pagep;
+}
+
+void mail_index_record_map_reset(struct mail_index_record_map *rec_map)
+{
+	mail_index_record_map_truncate(rec_map, 0);
+}
+
+void mail_index_record_map_truncate(struct mail_index_record_map *rec_map,
+				    unsigned int records_count)
+{
+	struct mail_index_record_page **pages;
+	unsigned int i, count, page_count;
+
+	i_assert(records_count <= rec_map->records_count);
+
+	rec_map->records_count = records_count;
+	if (!array_is_created(&rec_map->pages))
+		return;
+
+	page_count = (records_count + (1U << rec_map->page_shift) - 1) >>
+		rec_map->page_shift;
+	pages = array_get_modifiable(&rec_map->pages, &count);
+	if (page_count >= count)
+		return;
+	for (i = page_count; i < count; i++)
+		mail_index_record_page_unref(&pages[i]);
+	array_delete(&rec_map->pages, page_count, count - page_count);
+}
+
+void *mail_index_record_map_append_space(struct mail_index_record_map *rec_map,
+					 unsigned int record_size,
+					 unsigned int count,
+					 unsigned int *count_r)
+{
+	struct mail_index_record_page *page;
+	unsigned int page_idx, rec_idx, page_records, alloc_count;
+
+	i_assert(count > 0);
+
+	if (array_count(&rec_map->pages) == 0) {
+		/* use as many records per page as fit into the max size */
+		rec_map->page_shift = 0;
+		while ((record_size << (rec_map->page_shift + 1)) <=
+		       MAIL_INDEX_RECORD_PAGE_MAX_SIZE)
+			rec_map->page_shift++;
+	}
+	page_records = 1U << rec_map->page_shift;
+	page_idx = rec_map->records_count >> rec_map->page_shift;
+	rec_idx = rec_map->records_count & (page_records - 1);
+
+	if (page_idx == array_count(&rec_map->pages)) {
+		/* Allocate only the space that is needed. This keeps small
+		   mailboxes small, while the next appends grow the page. */
+		page = mail_index_record_page_alloc(record_size,
+			I_MIN(count, page_records));
+		array_push_back(&rec_map->pages, &page);
+	} else {
+		page = mail_index_record_map_get_private_page(rec_map,
+							      record_size,
+							      page_idx);
+		if (rec_idx + count > page->alloc_count &&
+		    page->alloc_count < page_records) {
+			alloc_count = I_MAX(rec_idx + count,
+					    page->alloc_count * 2);
+			alloc_count = I_MIN(alloc_count, page_records);
+			page->records = i_realloc(page->records,
+				page->alloc_count * record_size,
+				alloc_count * record_size);
+			page->alloc_count = alloc_count;
+		}
+	}
+	*count_r = I_MIN(count, page->alloc_count - rec_idx);
+	rec_map->records_count += *count_r;
+	return PTR_OFFSET(page->records, rec_idx * record_size);
+}
+
+void *mail_index_map_get_records(struct mail_index_map *map, uint32_t idx,
+				 uint32_t count, uint32_t *count_r)
+{
+	struct mail_index_record_map *rec_map = map->rec_map;
+	uint32_t page_records;
+
+	i_assert(idx + count <= rec_map->records_count);
+
+	if (rec_map->mmap_base != NULL)
+		*count_r = count;
+	else {
+		page_records = 1U << rec_map->page_shift;
+		*count_r = I_MIN(count, page_records - (idx & (page_records - 1)));
+	}
+	return MAIL_INDEX_MAP_IDX(map, idx);
+}
+
+void mail_index_map_move_records(struct mail_index_map *map, uint32_t dest_idx,
+				 uint32_t src_idx, uint32_t count)
+{
+	const void *src;
+	void *dest;
+	uint32_t src_count, dest_count;
+
+	i_assert(dest_idx <= src_idx);
+
+	while (count > 0) {
+		src = mail_index_map_get_records(map, src_idx, count,
+						 &src_count);
+		dest = mail_index_map_get_records(map, dest_idx, src_count,
+						  &dest_count);
+		memmove(dest, src, dest_count * map->hdr.record_size);
+		src_idx += dest_count;
+		dest_idx += dest_count;
+		count -= dest_count;
+	}
+}
+
 static void mail_index_record_map_free(struct mail_index_map *map,
 				       struct mail_index_record_map *rec_map)
 {
-	if (rec_map->buffer != NULL) {
-		i_assert(rec_map->mmap_base == NULL);
-		buffer_free(&rec_map->buffer);
-	} else if (rec_map->mmap_base != NULL) {
-		i_assert(rec_map->buffer == NULL);
+	if (rec_map->mmap_base != NULL) {
+		i_assert(array_count(&rec_map->pages) == 0);
 		if (munmap(rec_map->mmap_base, rec_map->mmap_size) < 0)
 			mail_index_set_syscall_error(map->index, "munmap()");
 		rec_map->mmap_base = NULL;
 	}
+	mail_index_record_map_reset(rec_map);
+	array_free(&rec_map->pages);
 	array_free(&rec_map->maps);
+	array_free(&rec_map->dirty_seqs);
 	i_free(rec_map);
 }
 
@@ -318,16 +475,42 @@ static void mail_index_map_copy_records(struct mail_index_record_map *dest,
 					const struct mail_index_record_map *src,
 					unsigned int record_size)
 {
-	size_t size;
-
-	size = src->records_count * record_size;
-	/* +1% so we have a bit of space to grow. useful for huge mailboxes. */
-	dest->buffer = buffer_create_dynamic(default_pool,
-					     size + I_MAX(size/100, 1024));
-	buffer_append(dest->buffer, src->records, size);
+	struct mail_index_record_page *page;
+	unsigned int idx, count, records_count = src->records_count;
+	void *data;
+
+	i_assert(array_count(&dest->pages) == 0);
+
+	if (src->mmap_base == NULL) {
+		/* share the pages until one of the rec_maps modifies them */
+		i_assert(dest != src);
+		array_foreach_elem(&src->pages, page) {
+			page->refcount++;
+			array_push_back(&dest->pages, &page);
+		}
+		dest->page_shift = src->page_shift;
+		dest->records_count = records_count;
+	} else {
+		/* dest may be the same as src, so don't rely on
+		   src->records_count while appending. */
+		dest->records_count = 0;
+		for (idx = 0; idx < records_count; idx += count) {
+			data = mail_index_record_map_append_space(dest,
+				record_size, records_count - idx, &count);
+			memcpy(data, CONST_PTR_OFFSET(src->records,
+						      idx * record_size),
+			       count * record_size);
+		}
+	}
 
-	dest->records = buffer_get_modifiable_data(dest->buffer, NULL);
-	dest->records_count = src->records_count;
+	if (dest == src)
+		return;
+	dest->dirty_all = src->dirty_all;
+	if (array_is_created(&src->dirty_seqs) && !dest->dirty_all) {
+		if (!array_is_created(&dest->dirty_seqs))
+			i_array_init(&dest->dirty_seqs, 16);
+		array_append_array(&dest->dirty_seqs, &src->dirty_seqs);
+	}
 }
 
 static void mail_index_map_copy_header(struct mail_index_map *dest,
@@ -364,7 +547,10 @@ mail_index_record_map_alloc(struct mail_index_map *map)
 
 	rec_map = i_new(struct mail_index_record_map, 1);
 	i_array_init(&rec_map->maps, 4);
+	i_array_init(&rec_map->pages, 16);
 	array_push_back(&rec_map->maps, &map);
+	/* until the records are read from the index file */
+	rec_map->dirty_all = TRUE;
 	return rec_map;
 }
 
@@ -377,11 +563,9 @@ struct mail_index_map *mail_index_map_clone(const struct mail_index_map *map)
 	mem_map = i_new(struct mail_index_map, 1);
 	mem_map->index = map->index;
 	mem_map->refcount = 1;
-	if (map->rec_map == NULL) {
+	if (map->rec_map == NULL)
 		mem_map->rec_map = mail_index_record_map_alloc(mem_map);
-		mem_map->rec_map->buffer =
-			buffer_create_dynamic(default_pool, 1024);
-	} else {
+	else {
 		mem_map->rec_map = map->rec_map;
 		array_push_back(&mem_map->rec_map->maps, &mem_map);
 	}
@@ -423,7 +607,8 @@ void mail_index_record_map_move_to_private(struct mail_index_map *map)
 
 	if (array_count(&map->rec_map->maps) > 1) {
 		/* Multiple references to the rec_map. Create a clone of the
-		   rec_map, which is in memory. */
+		   rec_map, which is in memory. The clone shares the record
+		   pages, which are copied only when they're modified. */
 		new_map = mail_index_record_map_alloc(map);
 		mail_index_map_copy_records(new_map, map->rec_map,
 					    map->hdr.record_size);
@@ -438,15 +623,14 @@ void mail_index_record_map_move_to_private(struct mail_index_map *map)
 		   These messages aren't necessary (and may confuse the caller),
 		   so truncate them away. */
 		i_assert(new_map->records_count > map->hdr.messages_count);
-		new_map->records_count = map->hdr.messages_count;
+		mail_index_record_map_truncate(new_map,
+					       map->hdr.messages_count);
 		if (new_map->records_count == 0)
 			new_map->last_appended_uid = 0;
 		else {
 			rec = MAIL_INDEX_REC_AT_SEQ(map, new_map->records_count);
 			new_map->last_appended_uid = rec->uid;
 		}
-		buffer_set_used_size(new_map->buffer, new_map->records_count *
-				     map->hdr.record_size);
 	}
 }
 
@@ -479,9 +663,54 @@ void mail_index_map_move_to_memory(struct mail_index_map *map)
 		if (munmap(new_map->mmap_base, new_map->mmap_size) < 0)
 			mail_index_set_syscall_error(map->index, "munmap()");
 		new_map->mmap_base = NULL;
+		new_map->records = NULL;
 	}
 }
 
+void mail_index_map_modify_records(struct mail_index_map *map,
+				   uint32_t seq1, uint32_t seq2)
+{
+	struct mail_index_record_map *rec_map = map->rec_map;
+	unsigned int page_idx;
+
+	if (seq1 > seq2)
+		return;
+	i_assert(seq1 > 0 && seq2 <= rec_map->records_count);
+
+	if (rec_map->mmap_base == NULL) {
+		for (page_idx = (seq1 - 1) >> rec_map->page_shift;
+		     page_idx <= (seq2 - 1) >> rec_map->page_shift; page_idx++) {
+			(void)mail_index_record_map_get_private_page(rec_map,
+				map->hdr.record_size, page_idx);
+		}
+	}
+
+	if (rec_map->dirty_all)
+		return;
+	if (!map->index->optimization_set.index.incremental_write) {
+		/* not tracking the changes */
+		rec_map->dirty_all = TRUE;
+		return;
+	}
+	if (!array_is_created(&rec_map->dirty_seqs))
+		i_array_init(&rec_map->dirty_seqs, 16);
+	seq_range_array_add_range(&rec_map->dirty_seqs, seq1, seq2);
+}
+
+void mail_index_map_set_all_dirty(struct mail_index_map *map)
+{
+	map->rec_map->dirty_all = TRUE;
+	if (array_is_created(&map->rec_map->dirty_seqs))
+		array_clear(&map->rec_map->dirty_seqs);
+}
+
+void mail_index_map_clear_dirty(struct mail_index_map *map)
+{
+	map->rec_map->dirty_all = FALSE;
+	if (array_is_created(&map->rec_map->dirty_seqs))
+		array_clear(&map->rec_map->dirty_seqs);
+}
+
 bool mail_index_map_get_ext_idx(struct mail_index_map *map,
 				uint32_t ext_id, uint32_t *idx_r)
 {
@@ -500,14 +729,11 @@ static uint32_t mail_index_bsearch_uid(struct mail_index_map *map,
 				       uint32_t uid, uint32_t left_idx,
 				       int nearest_side)
 {
-	const struct mail_index_record *rec_base, *rec;
-	uint32_t idx, right_idx, record_size;
+	const struct mail_index_record *rec;
+	uint32_t idx, right_idx;
 
 	i_assert(map->hdr.messages_count <= map->rec_map->records_count);
 
-	rec_base = map->rec_map->records;
-	record_size = map->hdr.record_size;
-
 	idx = left_idx;
 	right_idx = I_MIN(map->hdr.messages_count, uid);
 
@@ -515,7 +741,7 @@ static uint32_t mail_index_bsearch_uid(struct mail_index_map *map,
 	while (left_idx < right_idx) {
 		idx = (left_idx + right_idx) / 2;
 
-                rec = CONST_PTR_OFFSET(rec_base, idx * record_size);
+		rec = MAIL_INDEX_MAP_IDX(map, idx);
 		if (rec->uid < uid)
 			left_idx = idx+1;
 		else if (rec->uid > uid)
@@ -525,7 +751,7 @@ static uint32_t mail_index_bsearch_uid(struct mail_index_map *map,
 	}
 	i_assert(idx < map->hdr.messages_count);
 
-	rec = CONST_PTR_OFFSET(rec_base, idx * record_size);
+	rec = MAIL_INDEX_MAP_IDX(map, idx);
 	if (rec->uid != uid) {
 		if (nearest_side > 0) {
 			/* we want uid or larger */
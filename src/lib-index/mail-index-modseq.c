@@ -176,6 +176,9 @@ int mail_index_modseq_set(struct mail_index_view *view,
 	if (*modseqp > min_modseq)
 		return 0;
 	else {
+		mail_index_map_modify_records(view->map, seq, seq);
+		rec = MAIL_INDEX_REC_AT_SEQ(view->map, seq);
+		modseqp = PTR_OFFSET(rec, ext->record_offset);
 		*modseqp = min_modseq;
 		return 1;
 	}
@@ -197,6 +200,7 @@ mail_index_modseq_update(struct mail_index_modseq_sync *ctx,
 		return;
 
 	ext = array_idx(&ctx->view->map->extensions, ext_map_idx);
+	mail_index_map_modify_records(ctx->view->map, seq1, seq2);
 	for (; seq1 <= seq2; seq1++) {
 		rec = MAIL_INDEX_REC_AT_SEQ(ctx->view->map, seq1);
 		modseqp = PTR_OFFSET(rec, ext->record_offset);
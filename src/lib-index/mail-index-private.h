@@ -1,6 +1,7 @@
 #ifndef MAIL_INDEX_PRIVATE_H
 #define MAIL_INDEX_PRIVATE_H
 
+#include "array.h"
 #include "file-lock.h"
 #include "mail-index.h"
 #include "mail-index-util.h"
@@ -15,10 +16,17 @@ struct mail_index_sync_map_ctx;
 
 /* How large index files to mmap() instead of reading to memory. */
 #define MAIL_INDEX_MMAP_MIN_SIZE (1024*64)
+/* Maximum size of a page of records in memory. The number of records in a
+   page is the largest power of 2 that fits into this. */
+#define MAIL_INDEX_RECORD_PAGE_MAX_SIZE (1024*64)
 /* How many times to retry opening index files if read/fstat returns ESTALE.
    This happens with NFS when the file has been deleted (ie. index file was
    rewritten by another computer than us). */
 #define MAIL_INDEX_ESTALE_RETRY_COUNT NFS_ESTALE_RETRY_COUNT
+/* How many times to try reading the index file while another process is
+   writing it incrementally, and how long to wait between the tries. */
+#define MAIL_INDEX_WRITE_SEQ_RETRY_COUNT 10
+#define MAIL_INDEX_WRITE_SEQ_RETRY_MSECS 10
 /* Large extension header sizes are probably caused by file corruption, so
    try to catch them by limiting the header size. */
 #define MAIL_INDEX_EXT_HEADER_MAX_SIZE (1024*1024*16-1)
@@ -30,11 +38,10 @@ struct mail_index_sync_map_ctx;
 	((map)->rec_map->mmap_base == NULL)
 
 #define MAIL_INDEX_MAP_IDX(map, idx) \
-	((struct mail_index_record *) \
-	 PTR_OFFSET((map)->rec_map->records, (idx) * (map)->hdr.record_size))
-#define MAIL_INDEX_REC_AT_SEQ(map, seq)					\
-	((struct mail_index_record *)					\
-	 PTR_OFFSET((map)->rec_map->records, ((seq)-1) * (map)->hdr.record_size))
+	mail_index_record_map_idx((map)->rec_map, (map)->hdr.record_size, idx)
+#define MAIL_INDEX_REC_AT_SEQ(map, seq) \
+	mail_index_record_map_idx((map)->rec_map, (map)->hdr.record_size, \
+				  (seq)-1)
 
 #define MAIL_TRANSACTION_FLAG_UPDATE_IS_INTERNAL(u) \
 	((((u)->add_flags | (u)->remove_flags) & MAIL_INDEX_FLAGS_MASK) == 0 && \
@@ -121,20 +128,54 @@ struct mail_index_modseq_header {
 	uint32_t log_offset;
 };
 
+struct mail_index_record_page {
+	/* Number of rec_maps using this page. Shared pages are copied
+	   before they're modified. */
+	unsigned int refcount;
+	/* Number of records allocated. Only the last page of a rec_map may
+	   have space for less than a full page. */
+	unsigned int alloc_count;
+	void *records; /* struct mail_index_record[] */
+};
+
 struct mail_index_record_map {
 	ARRAY(struct mail_index_map *) maps;
 
 	void *mmap_base;
 	size_t mmap_size, mmap_used_size;
 
-	buffer_t *buffer;
+	/* In-memory records, each page containing 2^page_shift records.
+	   Clones of the rec_map share the pages until they're modified. */
+	ARRAY(struct mail_index_record_page *) pages;
+	unsigned int page_shift;
 
-	void *records; /* struct mail_index_record[] */
+	void *records; /* mmap()ed struct mail_index_record[] */
 	unsigned int records_count;
 
 	uint32_t last_appended_uid;
+
+	/* Sequences of the records that have changed since they were read
+	   from or written to the index file. */
+	ARRAY_TYPE(seq_range) dirty_seqs;
+	/* The records can't be written to the index file incrementally,
+	   because they were moved, their layout changed or they don't come
+	   from the index file in the first place. */
+	bool dirty_all;
 };
 
+static inline struct mail_index_record *
+mail_index_record_map_idx(const struct mail_index_record_map *rec_map,
+			  unsigned int record_size, uint32_t idx)
+{
+	const struct mail_index_record_page *page;
+	uint32_t page_mask = (1U << rec_map->page_shift) - 1;
+
+	if (rec_map->mmap_base != NULL)
+		return PTR_OFFSET(rec_map->records, idx * record_size);
+	page = array_idx_elem(&rec_map->pages, idx >> rec_map->page_shift);
+	return PTR_OFFSET(page->records, (idx & page_mask) * record_size);
+}
+
 #define MAIL_INDEX_MAP_HDR_OFFSET(map, hdr_offset) \
 	CONST_PTR_OFFSET((map)->hdr_copy_buf->data, hdr_offset)
 struct mail_index_map {
@@ -369,6 +410,38 @@ struct mail_index_map *mail_index_map_clone(const struct mail_index_map *map);
 void mail_index_record_map_move_to_private(struct mail_index_map *map);
 /* If map points to mmap()ed index, copy it to the memory. */
 void mail_index_map_move_to_memory(struct mail_index_map *map);
+/* Drop all the in-memory records from rec_map. */
+void mail_index_record_map_reset(struct mail_index_record_map *rec_map);
+/* Drop the records after records_count from rec_map. */
+void mail_index_record_map_truncate(struct mail_index_record_map *rec_map,
+				    unsigned int records_count);
+/* Returns space for appending up to count records to the in-memory rec_map.
+   The returned space is contiguous only within a page, so *count_r is set to
+   the number of records that fit into it. records_count is increased by
+   *count_r. */
+void *mail_index_record_map_append_space(struct mail_index_record_map *rec_map,
+					 unsigned int record_size,
+					 unsigned int count,
+					 unsigned int *count_r);
+/* Returns the records starting from idx. They're contiguous in memory only
+   up to *count_r records, which is at most count. */
+void *mail_index_map_get_records(struct mail_index_map *map, uint32_t idx,
+				 uint32_t count, uint32_t *count_r);
+/* Move count records from src_idx to a lower dest_idx. The records must
+   have already been prepared with mail_index_map_modify_records(). */
+void mail_index_map_move_records(struct mail_index_map *map, uint32_t dest_idx,
+				 uint32_t src_idx, uint32_t count);
+/* Prepare records seq1..seq2 for modification. This must be called before
+   changing them, because it copies the pages that are shared with other
+   rec_maps. It also remembers that the records were changed, so an
+   incremental index write needs to write them. */
+void mail_index_map_modify_records(struct mail_index_map *map,
+				   uint32_t seq1, uint32_t seq2);
+/* The records can no longer be written incrementally. The next index write
+   recreates the whole file. */
+void mail_index_map_set_all_dirty(struct mail_index_map *map);
+/* The records now match the ones in the index file. */
+void mail_index_map_clear_dirty(struct mail_index_map *map);
 
 void mail_index_fchown(struct mail_index *index, int fd, const char *path);
 
@@ -121,11 +121,11 @@ static void sync_ext_reorder(struct mail_index_map *map, uint32_t ext_map_idx,
 	struct mail_index_ext *ext, **sorted;
 	struct mail_index_ext_header *ext_hdr;
 	uint16_t *old_offsets, *copy_sizes, min_align, max_align;
+	struct mail_index_record_map new_rec_map;
 	uint32_t offset, new_record_size, rec_idx;
-	unsigned int i, count;
+	unsigned int i, count, dest_count;
 	const void *src;
-	buffer_t *new_buffer;
-	size_t new_buffer_size;
+	void *dest;
 
 	i_assert(MAIL_INDEX_MAP_IS_IN_MEMORY(map) && map->refcount == 1);
 
@@ -193,37 +193,35 @@ static void sync_ext_reorder(struct mail_index_map *map, uint32_t ext_map_idx,
 	new_record_size = offset;
 	i_assert(new_record_size >= sizeof(struct mail_index_record));
 
-	/* copy the records to new buffer */
-	new_buffer_size = map->rec_map->records_count * new_record_size;
-	new_buffer = buffer_create_dynamic(default_pool, new_buffer_size);
-	src = map->rec_map->records;
-	offset = 0;
-	for (rec_idx = 0; rec_idx < map->rec_map->records_count; rec_idx++) {
-		/* write the base record */
-		buffer_write(new_buffer, offset, src,
-			     sizeof(struct mail_index_record));
-
-		/* write extensions */
-		for (i = 0; i < count; i++) {
-			buffer_write(new_buffer, offset + ext[i].record_offset,
-				     CONST_PTR_OFFSET(src, old_offsets[i]),
-				     copy_sizes[i]);
+	/* copy the records to new pages */
+	i_zero(&new_rec_map);
+	i_array_init(&new_rec_map.pages,
+		     I_MAX(array_count(&map->rec_map->pages), 1));
+	for (rec_idx = 0; rec_idx < map->rec_map->records_count; ) {
+		dest = mail_index_record_map_append_space(&new_rec_map,
+			new_record_size,
+			map->rec_map->records_count - rec_idx, &dest_count);
+		memset(dest, 0, dest_count * new_record_size);
+		for (; dest_count > 0; dest_count--, rec_idx++) {
+			src = MAIL_INDEX_MAP_IDX(map, rec_idx);
+			/* write the base record */
+			memcpy(dest, src, sizeof(struct mail_index_record));
+
+			/* write extensions */
+			for (i = 0; i < count; i++) {
+				memcpy(PTR_OFFSET(dest, ext[i].record_offset),
+				       CONST_PTR_OFFSET(src, old_offsets[i]),
+				       copy_sizes[i]);
+			}
+			dest = PTR_OFFSET(dest, new_record_size);
 		}
-		src = CONST_PTR_OFFSET(src, map->hdr.record_size);
-		offset += new_record_size;
 	}
 
-	if (new_buffer->used != new_buffer_size) {
-		/* we didn't fully write the last record */
-		size_t space = new_buffer_size - new_buffer->used;
-		i_assert(space < new_record_size);
-		buffer_append_zero(new_buffer, space);
-	}
-
-	buffer_free(&map->rec_map->buffer);
-	map->rec_map->buffer = new_buffer;
-	map->rec_map->records =
-		buffer_get_modifiable_data(map->rec_map->buffer, NULL);
+	mail_index_record_map_reset(map->rec_map);
+	array_free(&map->rec_map->pages);
+	map->rec_map->pages = new_rec_map.pages;
+	map->rec_map->page_shift = new_rec_map.page_shift;
+	map->rec_map->records_count = new_rec_map.records_count;
 	map->hdr.record_size = new_record_size;
 
 	/* update record offsets in headers */
@@ -262,6 +260,7 @@ sync_ext_resize(const struct mail_transaction_ext_intro *u,
 	/* something changed. get ourself a new map before we start changing
 	   anything in it. */
 	map = mail_index_sync_get_atomic_map(ctx);
+	mail_index_map_set_all_dirty(map);
 	/* ext was duplicated to the new map. */
 	ext = array_idx_modifiable(&map->extensions, ext_map_idx);
 
@@ -370,6 +369,8 @@ mail_index_sync_ext_init_new(struct mail_index_sync_map_ctx *ctx,
 	   otherwise other map users will see the new extension but not the
 	   data records that sync_ext_reorder() adds. */
 	map = mail_index_sync_get_atomic_map(ctx);
+	/* the header grows, which moves the records */
+	mail_index_map_set_all_dirty(map);
 
 	hdr_buf = map->hdr_copy_buf;
 	i_assert(hdr_buf->used == map->hdr.header_size);
@@ -529,6 +530,10 @@ static void mail_index_sync_ext_clear(struct mail_index_view *view,
 				       ext->hdr_size), 0, ext->hdr_size);
 	i_assert(map->hdr_copy_buf->used == map->hdr.header_size);
 
+	if (view->map->rec_map->records_count > 0) {
+		mail_index_map_modify_records(view->map, 1,
+			view->map->rec_map->records_count);
+	}
 	for (seq = 1; seq <= view->map->rec_map->records_count; seq++) {
 		rec = MAIL_INDEX_REC_AT_SEQ(view->map, seq);
 		memset(PTR_OFFSET(rec, ext->record_offset), 0,
@@ -557,6 +562,7 @@ int mail_index_sync_ext_reset(struct mail_index_sync_map_ctx *ctx,
 	/* a new index file will be created, so the old data won't be
 	   accidentally used by other processes. */
 	map = mail_index_sync_get_atomic_map(ctx);
+	mail_index_map_set_all_dirty(map);
 
 	ext = array_idx_modifiable(&map->extensions, ctx->cur_ext_map_idx);
 	ext->reset_id = u->new_reset_id;
@@ -625,6 +631,7 @@ mail_index_sync_ext_rec_update(struct mail_index_sync_map_ctx *ctx,
 	i_assert(ext->record_offset + ctx->cur_ext_record_size <=
 		 view->map->hdr.record_size);
 
+	mail_index_map_modify_records(view->map, seq, seq);
 	rec = MAIL_INDEX_REC_AT_SEQ(view->map, seq);
 	old_data = PTR_OFFSET(rec, ext->record_offset);
 
@@ -664,6 +671,10 @@ mail_index_sync_ext_atomic_inc(struct mail_index_sync_map_ctx *ctx,
 	i_assert(ext->record_offset + ctx->cur_ext_record_size <=
 		 view->map->hdr.record_size);
 
+	/* Replaying the increment from the log after an interrupted
+	   incremental write would apply it twice. */
+	mail_index_map_set_all_dirty(view->map);
+	mail_index_map_modify_records(view->map, seq, seq);
 	rec = MAIL_INDEX_REC_AT_SEQ(view->map, seq);
 	data = PTR_OFFSET(rec, ext->record_offset);
 
@@ -240,7 +240,7 @@ sync_expunge_range(struct mail_index_sync_map_ctx *ctx, const ARRAY_TYPE(seq_ran
 	struct mail_index_map *map;
 	const struct seq_range *range;
 	unsigned int i, count;
-	uint32_t dest_seq1, prev_seq2, orig_rec_count;
+	uint32_t dest_seq1, prev_seq2, orig_rec_count, expunged_count = 0;
 
 	range = array_get(seqs, &count);
 	if (count == 0)
@@ -248,6 +248,10 @@ sync_expunge_range(struct mail_index_sync_map_ctx *ctx, const ARRAY_TYPE(seq_ran
 
 	/* Get a private in-memory rec_map, which we can modify. */
 	map = mail_index_sync_get_atomic_map(ctx);
+	/* the following records are moved */
+	mail_index_map_modify_records(map, range[0].seq1,
+				      map->rec_map->records_count);
+	mail_index_map_set_all_dirty(map);
 
 	/* call the expunge handlers first */
 	if (sync_expunge_handlers_init(ctx)) {
@@ -274,40 +278,30 @@ sync_expunge_range(struct mail_index_sync_map_ctx *ctx, const ARRAY_TYPE(seq_ran
 		}
 
 		if (prev_seq2+1 <= seq1-1) {
-			/* @UNSAFE: move (prev_seq2+1) .. (seq1-1) to its
-			   final location in the map if necessary */
+			/* move (prev_seq2+1) .. (seq1-1) to its final
+			   location in the map if necessary */
 			uint32_t move_count = (seq1-1) - (prev_seq2+1) + 1;
-			if (prev_seq2+1-1 != dest_seq1-1)
-				memmove(MAIL_INDEX_REC_AT_SEQ(map, dest_seq1),
-					MAIL_INDEX_REC_AT_SEQ(map, prev_seq2+1),
-					move_count * map->hdr.record_size);
+			if (prev_seq2+1-1 != dest_seq1-1) {
+				mail_index_map_move_records(map, dest_seq1-1,
+							    prev_seq2+1-1,
+							    move_count);
+			}
 			dest_seq1 += move_count;
 		}
 		seq_count = seq2 - seq1 + 1;
-		map->rec_map->records_count -= seq_count;
+		expunged_count += seq_count;
 		map->hdr.messages_count -= seq_count;
 		prev_seq2 = seq2;
 	}
 	/* Final stragglers */
 	if (orig_rec_count > prev_seq2) {
 		uint32_t final_move_count = orig_rec_count - prev_seq2;
-		memmove(MAIL_INDEX_REC_AT_SEQ(map, dest_seq1),
-			MAIL_INDEX_REC_AT_SEQ(map, prev_seq2+1),
-			final_move_count * map->hdr.record_size);
+		mail_index_map_move_records(map, dest_seq1-1, prev_seq2+1-1,
+					    final_move_count);
 	}
-}
-
-static void *sync_append_record(struct mail_index_map *map)
-{
-	size_t append_pos;
-	void *ret;
-
-	append_pos = map->rec_map->records_count * map->hdr.record_size;
-	ret = buffer_get_space_unsafe(map->rec_map->buffer, append_pos,
-				      map->hdr.record_size);
-	map->rec_map->records =
-		buffer_get_modifiable_data(map->rec_map->buffer, NULL);
-	return ret;
+	/* this also frees the pages that became unused */
+	mail_index_record_map_truncate(map->rec_map,
+				       orig_rec_count - expunged_count);
 }
 
 static bool sync_update_ignored_change(struct mail_index_sync_map_ctx *ctx)
@@ -377,6 +371,7 @@ static int sync_append(const struct mail_index_record *rec,
 	struct mail_index_map *map = view->map;
 	const struct mail_index_record *old_rec;
 	enum mail_flags new_flags;
+	unsigned int count;
 	void *dest;
 
 	if (rec->uid < map->hdr.next_uid) {
@@ -400,13 +395,11 @@ static int sync_append(const struct mail_index_record *rec,
 		i_assert(old_rec->uid == rec->uid);
 		new_flags = old_rec->flags;
 	} else {
-		/* don't rely on buffer->used being at the correct position.
-		   at least expunges can move it */
-		dest = sync_append_record(map);
+		dest = mail_index_record_map_append_space(map->rec_map,
+			map->hdr.record_size, 1, &count);
 		memcpy(dest, rec, sizeof(*rec));
 		memset(PTR_OFFSET(dest, sizeof(*rec)), 0,
 		       map->hdr.record_size - sizeof(*rec));
-		map->rec_map->records_count++;
 		map->rec_map->last_appended_uid = rec->uid;
 		new_flags = rec->flags;
 
@@ -417,6 +410,8 @@ static int sync_append(const struct mail_index_record *rec,
 
 	map->hdr.messages_count++;
 	map->hdr.next_uid = rec->uid+1;
+	mail_index_map_modify_records(map, map->hdr.messages_count,
+				      map->hdr.messages_count);
 
 	if ((new_flags & MAIL_INDEX_MAIL_FLAG_DIRTY) != 0 &&
 	    (view->index->flags & MAIL_INDEX_OPEN_FLAG_NO_DIRTY) == 0)
@@ -440,6 +435,7 @@ static int sync_flag_update(const struct mail_transaction_flag_update *u,
 
 	if (!MAIL_TRANSACTION_FLAG_UPDATE_IS_INTERNAL(u))
 		mail_index_modseq_update_to_highest(ctx->modseq_ctx, seq1, seq2);
+	mail_index_map_modify_records(view->map, seq1, seq2);
 
 	if ((u->add_flags & MAIL_INDEX_MAIL_FLAG_DIRTY) != 0 &&
 	    (view->index->flags & MAIL_INDEX_OPEN_FLAG_NO_DIRTY) == 0)
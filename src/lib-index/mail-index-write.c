@@ -1,6 +1,7 @@
 /* Copyright (c) 2003-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "nfs-workarounds.h"
 #include "read-full.h"
 #include "write-full.h"
@@ -59,6 +60,8 @@ static int mail_index_recreate(struct mail_index *index)
 	struct mail_index_map *map = index->map;
 	struct ostream *output;
 	unsigned int base_size;
+	uint32_t idx, count;
+	const void *records;
 	const char *path;
 	int ret = 0, fd;
 
@@ -84,8 +87,11 @@ static int mail_index_recreate(struct mail_index *index)
 	o_stream_nsend(output, &hdr, base_size);
 	o_stream_nsend(output, MAIL_INDEX_MAP_HDR_OFFSET(map, base_size),
 		       hdr.header_size - base_size);
-	o_stream_nsend(output, map->rec_map->records,
-		       map->rec_map->records_count * hdr.record_size);
+	for (idx = 0; idx < map->rec_map->records_count; idx += count) {
+		records = mail_index_map_get_records(map, idx,
+			map->rec_map->records_count - idx, &count);
+		o_stream_nsend(output, records, count * hdr.record_size);
+	}
 	if (o_stream_finish(output) < 0) {
 		mail_index_file_set_syscall_error(index, path, "write()");
 		ret = -1;
@@ -119,6 +125,192 @@ static int mail_index_recreate(struct mail_index *index)
 	return ret;
 }
 
+static bool
+mail_index_write_get_ranges(struct mail_index *index,
+			    const struct mail_index_header *disk_hdr,
+			    ARRAY_TYPE(seq_range) *ranges)
+{
+	struct mail_index_map *map = index->map;
+	const struct seq_range *range;
+	struct seq_range *last;
+	uint32_t seq1, seq2, max_gap;
+	uoff_t write_size = 0, file_size;
+
+	if (!array_is_created(&map->rec_map->dirty_seqs)) {
+		/* only the header has changed */
+		return disk_hdr->messages_count == map->hdr.messages_count;
+	}
+	/* records appended after the file was read must all be dirty */
+	if (disk_hdr->messages_count < map->hdr.messages_count) {
+		ARRAY_TYPE(seq_range) appends;
+
+		t_array_init(&appends, 1);
+		seq_range_array_add_range(&appends,
+					  disk_hdr->messages_count + 1,
+					  map->hdr.messages_count);
+		seq_range_array_remove_seq_range(&appends,
+						 &map->rec_map->dirty_seqs);
+		if (array_count(&appends) > 0)
+			return FALSE;
+	}
+
+	/* Coalesce records that are less than a block apart. Rewriting the
+	   unchanged records between them is cheaper than separate writes. */
+	max_gap = I_MAX(IO_BLOCK_SIZE / map->hdr.record_size, 1);
+	array_foreach(&map->rec_map->dirty_seqs, range) {
+		if (range->seq1 > map->hdr.messages_count)
+			break;
+		seq1 = range->seq1;
+		seq2 = I_MIN(range->seq2, map->hdr.messages_count);
+		last = array_count(ranges) == 0 ? NULL :
+			array_back_modifiable(ranges);
+		if (last != NULL && last->seq2 + max_gap >= seq1) {
+			write_size += (uoff_t)(seq2 - last->seq2) *
+				map->hdr.record_size;
+			last->seq2 = seq2;
+		} else {
+			last = array_append_space(ranges);
+			last->seq1 = seq1;
+			last->seq2 = seq2;
+			write_size += (uoff_t)(seq2 - seq1 + 1) *
+				map->hdr.record_size;
+		}
+	}
+
+	/* If most of the file changed, recreating it is just as fast and
+	   leaves it without the fragmentation of in-place writes. */
+	file_size = map->hdr.header_size +
+		(uoff_t)map->hdr.messages_count * map->hdr.record_size;
+	return write_size < file_size / 2;
+}
+
+static bool
+mail_index_can_write_incremental(struct mail_index *index,
+				 struct mail_index_header *disk_hdr_r)
+{
+	struct mail_index_map *map = index->map;
+	int ret;
+
+	if (!index->optimization_set.index.incremental_write ||
+	    (index->flags & MAIL_INDEX_OPEN_FLAG_MMAP_DISABLE) == 0 ||
+	    map->rec_map->dirty_all || index->fd == -1)
+		return FALSE;
+	i_assert(MAIL_INDEX_MAP_IS_IN_MEMORY(map));
+
+	/* The records in the map are the ones in the file, except for the
+	   dirty records. Make sure the file's layout still matches. */
+	i_zero(disk_hdr_r);
+	ret = pread_full(index->fd, disk_hdr_r,
+			 I_MIN(map->hdr.base_header_size, sizeof(*disk_hdr_r)),
+			 0);
+	if (ret <= 0) {
+		if (ret < 0)
+			mail_index_set_syscall_error(index, "pread_full()");
+		return FALSE;
+	}
+	return disk_hdr_r->indexid == map->hdr.indexid &&
+		disk_hdr_r->base_header_size == map->hdr.base_header_size &&
+		disk_hdr_r->header_size == map->hdr.header_size &&
+		disk_hdr_r->record_size == map->hdr.record_size &&
+		disk_hdr_r->messages_count <= map->hdr.messages_count &&
+		(disk_hdr_r->write_seq & 1) == 0;
+}
+
+static int mail_index_write_fdatasync(struct mail_index *index)
+{
+	if (index->set.fsync_mode == FSYNC_MODE_NEVER)
+		return 0;
+	if (fdatasync(index->fd) < 0) {
+		mail_index_set_syscall_error(index, "fdatasync()");
+		return -1;
+	}
+	return 0;
+}
+
+static int
+mail_index_write_incremental(struct mail_index *index,
+			     const struct mail_index_header *disk_hdr,
+			     const ARRAY_TYPE(seq_range) *ranges)
+{
+	struct mail_index_map *map = index->map;
+	const struct seq_range *range;
+	const void *records;
+	unsigned int base_size;
+	uint32_t write_seq, idx, count;
+	uoff_t offset;
+
+	/* The .log works as the write-ahead log: Mark the file as being
+	   written, write the records and the extension headers, and finally
+	   write the base header, which contains the new log offsets and
+	   marks the write finished. If the write is interrupted, write_seq
+	   stays odd and the next reader fscks the index, which recalculates
+	   the counters. All the changes since the old log offsets are then
+	   replayed from the .log, which is safe since incremental writes are
+	   done only for idempotent changes. */
+	write_seq = disk_hdr->write_seq + 1;
+	if (pwrite_full(index->fd, &write_seq, sizeof(write_seq),
+			offsetof(struct mail_index_header, write_seq)) < 0) {
+		mail_index_set_syscall_error(index, "pwrite_full()");
+		return -1;
+	}
+	if (mail_index_write_fdatasync(index) < 0)
+		return -1;
+
+	array_foreach(ranges, range) {
+		for (idx = range->seq1 - 1; idx < range->seq2; idx += count) {
+			records = mail_index_map_get_records(map, idx,
+				range->seq2 - idx, &count);
+			offset = map->hdr.header_size +
+				(uoff_t)idx * map->hdr.record_size;
+			if (pwrite_full(index->fd, records,
+					(size_t)count * map->hdr.record_size,
+					offset) < 0) {
+				mail_index_set_syscall_error(index,
+							     "pwrite_full()");
+				return -1;
+			}
+		}
+	}
+	base_size = I_MIN(map->hdr.base_header_size, sizeof(map->hdr));
+	if (pwrite_full(index->fd, MAIL_INDEX_MAP_HDR_OFFSET(map, base_size),
+			map->hdr.header_size - base_size, base_size) < 0) {
+		mail_index_set_syscall_error(index, "pwrite_full()");
+		return -1;
+	}
+	if (mail_index_write_fdatasync(index) < 0)
+		return -1;
+
+	struct mail_index_header hdr = map->hdr;
+	/* see mail_index_recreate() */
+	hdr.log_file_tail_offset = hdr.log_file_head_offset;
+	hdr.write_seq = write_seq + 1;
+	if (pwrite_full(index->fd, &hdr, base_size, 0) < 0) {
+		mail_index_set_syscall_error(index, "pwrite_full()");
+		return -1;
+	}
+	map->hdr.write_seq = hdr.write_seq;
+	buffer_write(map->hdr_copy_buf,
+		     offsetof(struct mail_index_header, write_seq),
+		     &map->hdr.write_seq, sizeof(map->hdr.write_seq));
+	mail_index_map_clear_dirty(map);
+	return 0;
+}
+
+static int mail_index_try_write_incremental(struct mail_index *index)
+{
+	struct mail_index_header disk_hdr;
+	ARRAY_TYPE(seq_range) ranges;
+
+	if (!mail_index_can_write_incremental(index, &disk_hdr))
+		return 0;
+
+	t_array_init(&ranges, 32);
+	if (!mail_index_write_get_ranges(index, &disk_hdr, &ranges))
+		return 0;
+	return mail_index_write_incremental(index, &disk_hdr, &ranges) < 0 ?
+		-1 : 1;
+}
+
 static bool mail_index_should_recreate(struct mail_index *index)
 {
 	struct stat st1, st2;
@@ -158,12 +350,25 @@ void mail_index_write(struct mail_index *index, bool want_rotate,
 {
 	struct mail_index_header *hdr = &index->map->hdr;
 	bool rotated = FALSE;
+	int ret;
 
 	i_assert(index->log_sync_locked);
 
 	if (index->readonly)
 		return;
 
+	/* The appenders fdatasync() the .log only after unlocking it. Make
+	   sure everything the index is going to point to is durable, so a
+	   crash can't leave the index pointing past the end of the .log. */
+	if (!MAIL_INDEX_IS_IN_MEMORY(index) &&
+	    index->set.fsync_mode != FSYNC_MODE_NEVER &&
+	    !MAIL_TRANSACTION_LOG_FILE_IN_MEMORY(index->log->head) &&
+	    mail_transaction_log_file_sync_durable(index->log->head,
+			index->log->head->sync_offset) < 0) {
+		(void)mail_index_move_to_memory(index);
+		return;
+	}
+
 	/* rotate the .log before writing index, so the index will point to
 	   the latest log. Note that it's the caller's responsibility to make
 	   sure that the .log can be safely rotated (i.e. everything has been
@@ -196,6 +401,15 @@ void mail_index_write(struct mail_index *index, bool want_rotate,
 	else if (!rotated && !mail_index_should_recreate(index)) {
 		/* make sure we don't keep getting back in here */
 		index->reopen_main_index = TRUE;
+	} else if (!rotated &&
+		   (ret = mail_index_try_write_incremental(index)) != 0) {
+		if (ret < 0) {
+			(void)mail_index_move_to_memory(index);
+			return;
+		}
+		e_debug(index->event, "Wrote %s incrementally "
+			"(file_seq=%u) because: %s",
+			index->filepath, hdr->log_file_seq, reason);
 	} else {
 		if (mail_index_recreate(index) < 0) {
 			(void)mail_index_move_to_memory(index);
@@ -195,6 +195,8 @@ void mail_index_set_optimization_settings(struct mail_index *index,
 		dest->index.rewrite_min_log_bytes = set->index.rewrite_min_log_bytes;
 	if (set->index.rewrite_max_log_bytes != 0)
 		dest->index.rewrite_max_log_bytes = set->index.rewrite_max_log_bytes;
+	if (set->index.incremental_write)
+		dest->index.incremental_write = TRUE;
 
 	/* log */
 	if (set->log.min_size != 0)
@@ -225,6 +227,8 @@ void mail_index_set_optimization_settings(struct mail_index *index,
 			set->cache.purge_header_continue_count;
 	if (set->cache.record_max_size != 0)
 		dest->cache.record_max_size = set->cache.record_max_size;
+	if (set->cache.mmap_shared)
+		dest->cache.mmap_shared = TRUE;
 
 	dest->cache.max_header_name_length = set->cache.max_header_name_length;
 	dest->cache.max_headers_count = set->cache.max_headers_count;
@@ -792,6 +796,10 @@ int mail_index_unlink(struct mail_index *index)
 			   MAIL_TRANSACTION_LOG_SUFFIX".2", NULL);
 	if (unlink(path) < 0 && errno != ENOENT)
 		last_errno = errno;
+	path = t_strconcat(index->filepath,
+			   MAIL_TRANSACTION_LOG_SYNC_SUFFIX, NULL);
+	if (unlink(path) < 0 && errno != ENOENT)
+		last_errno = errno;
 
 	/* cache */
 	path = t_strconcat(index->filepath, MAIL_CACHE_FILE_SUFFIX, NULL);
@@ -153,7 +153,10 @@ struct mail_index_header {
 	uint32_t log_file_tail_offset;
 	uint32_t log_file_head_offset;
 
-	uint32_t unused_old_sync_size_part1;
+	/* Incremented before and after the records are rewritten in place.
+	   If it's odd, the file is being written (or the write was
+	   interrupted) and the records may be inconsistent. */
+	uint32_t write_seq;
 	/* Timestamp of when .log was rotated into .log.2. This can be used to
 	   optimize checking when it's time to unlink it without stat()ing it.
 	   0 = unknown, -1 = .log.2 doesn't exists. */
@@ -317,6 +320,10 @@ struct mail_index_base_optimization_settings {
 	   from the .log on refresh is between these min/max values. */
 	uoff_t rewrite_min_log_bytes;
 	uoff_t rewrite_max_log_bytes;
+	/* Rewrite only the changed records and the header in place when
+	   possible, instead of recreating the whole index file. This requires
+	   that none of the processes accessing the index mmap() it. */
+	bool incremental_write;
 };
 
 struct mail_index_log_optimization_settings {
@@ -355,6 +362,10 @@ struct mail_index_cache_optimization_settings {
 	/* Purge the file when we need to follow more than n next_offsets to
 	   find the latest cache header. */
 	unsigned int purge_header_continue_count;
+	/* With mmap_disable=yes, read the cache file through a shared
+	   read-only mmap() instead of copying it to private memory. This must
+	   only be enabled when the cache files are on a local filesystem. */
+	bool mmap_shared;
 };
 
 struct mail_index_optimization_settings {
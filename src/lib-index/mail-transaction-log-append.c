@@ -87,7 +87,13 @@ static int log_buffer_write(struct mail_transaction_log_append_ctx *ctx)
 	if ((ctx->want_fsync &&
 	     file->log->index->set.fsync_mode != FSYNC_MODE_NEVER) ||
 	    file->log->index->set.fsync_mode == FSYNC_MODE_ALWAYS) {
-		if (fdatasync(file->fd) < 0) {
+		if (!ctx->log->index->log_sync_locked) {
+			/* fdatasync() after unlocking, so the other processes
+			   don't have to wait for it. */
+			ctx->fsync_file = file;
+			ctx->fsync_offset = file->sync_offset +
+				ctx->output->used;
+		} else if (fdatasync(file->fd) < 0) {
 			mail_index_file_set_syscall_error(ctx->log->index,
 							  file->filepath,
 							  "fdatasync()");
@@ -247,6 +253,15 @@ int mail_transaction_log_append_commit(struct mail_transaction_log_append_ctx **
 	ret = mail_transaction_log_append_locked(ctx);
 	if (!index->log_sync_locked)
 		mail_transaction_log_file_unlock(index->log->head, "appending");
+	if (ret == 0 && ctx->fsync_file != NULL) {
+		/* The records are already visible to other processes, so a
+		   failure can't be undone anymore by truncating the write and
+		   falling back to in-memory indexes like while the log is
+		   locked. The error is logged, but the commit still succeeds
+		   like it does with the in-memory fallback. */
+		(void)mail_transaction_log_file_sync_durable(ctx->fsync_file,
+							     ctx->fsync_offset);
+	}
 
 	buffer_free(&ctx->output);
 	i_free(ctx);
@@ -436,6 +436,100 @@ void mail_transaction_log_file_unlock(struct mail_transaction_log_file *file,
 	file_unlock(&file->file_lock);
 }
 
+static int log_sync_file_open(struct mail_transaction_log *log)
+{
+	struct mail_index *index = log->index;
+	const char *path;
+
+	if (log->sync_fd != -1)
+		return 0;
+
+	path = t_strconcat(index->filepath, MAIL_TRANSACTION_LOG_SYNC_SUFFIX,
+			   NULL);
+	log->sync_fd = open(path, O_RDWR);
+	if (log->sync_fd == -1 && errno == ENOENT) {
+		log->sync_fd = open(path, O_RDWR | O_CREAT, index->set.mode);
+		if (log->sync_fd != -1)
+			mail_index_fchown(index, log->sync_fd, path);
+	}
+	if (log->sync_fd == -1) {
+		mail_index_file_set_syscall_error(index, path, "open()");
+		return -1;
+	}
+	return 0;
+}
+
+static int log_file_fdatasync(struct mail_transaction_log_file *file)
+{
+	if (fdatasync(file->fd) < 0) {
+		log_file_set_syscall_error(file, "fdatasync()");
+		return -1;
+	}
+	return 0;
+}
+
+int mail_transaction_log_file_sync_durable(struct mail_transaction_log_file *file,
+					   uoff_t offset)
+{
+	struct mail_transaction_log *log = file->log;
+	struct mail_index *index = log->index;
+	struct mail_transaction_log_sync_record rec;
+	struct file_lock *lock;
+	struct stat st;
+	const char *path;
+	ssize_t ret;
+
+	i_assert(!MAIL_TRANSACTION_LOG_FILE_IN_MEMORY(file));
+
+	if (index->set.lock_method == FILE_LOCK_METHOD_DOTLOCK ||
+	    index->readonly || log_sync_file_open(log) < 0)
+		return log_file_fdatasync(file);
+
+	/* Only one process at a time calls fdatasync(). While it's running,
+	   the others wait for the lock. When they get it, the first one
+	   fdatasync()s everything that was written by then, and the rest
+	   usually see that their writes are already covered by it. */
+	path = t_strconcat(index->filepath, MAIL_TRANSACTION_LOG_SYNC_SUFFIX,
+			   NULL);
+	if (mail_index_lock_fd(index, path, log->sync_fd, F_WRLCK,
+			       I_MIN(MAIL_TRANSACTION_LOG_LOCK_TIMEOUT,
+				     index->set.max_lock_timeout_secs),
+			       &lock) <= 0)
+		return log_file_fdatasync(file);
+
+	ret = pread(log->sync_fd, &rec, sizeof(rec), 0);
+	if (ret < 0)
+		mail_index_file_set_syscall_error(index, path, "pread()");
+	else if (ret == sizeof(rec) &&
+		 rec.indexid == file->hdr.indexid &&
+		 rec.file_seq == file->hdr.file_seq &&
+		 rec.sync_offset >= offset) {
+		/* another process already synced our changes */
+		file_unlock(&lock);
+		return 0;
+	}
+
+	/* everything that was written before the fdatasync() call will be
+	   synced, not just our own changes */
+	if (fstat(file->fd, &st) < 0) {
+		log_file_set_syscall_error(file, "fstat()");
+		st.st_size = offset;
+	}
+	if (log_file_fdatasync(file) < 0) {
+		file_unlock(&lock);
+		return -1;
+	}
+
+	i_zero(&rec);
+	rec.indexid = file->hdr.indexid;
+	rec.file_seq = file->hdr.file_seq;
+	rec.sync_offset = I_MAX((uoff_t)st.st_size, offset);
+	if (pwrite_full(log->sync_fd, &rec, sizeof(rec), 0) < 0)
+		mail_index_file_set_syscall_error(index, path, "pwrite_full()");
+	file_unlock(&lock);
+	return 0;
+}
+
 static ssize_t
 mail_transaction_log_file_read_header(struct mail_transaction_log_file *file)
 {
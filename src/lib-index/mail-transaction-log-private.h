@@ -104,6 +104,16 @@ struct mail_transaction_log_file {
 	bool corrupted:1;
 };
 
+/* Contents of the .log.sync file. It's used to share fdatasync()s between
+   processes appending to the same transaction log. */
+struct mail_transaction_log_sync_record {
+	/* Identifies the .log file */
+	uint32_t indexid;
+	uint32_t file_seq;
+	/* The .log file has been fdatasync()ed at least up to this offset */
+	uint64_t sync_offset;
+};
+
 struct mail_transaction_log {
 	struct mail_index *index;
 	/* Linked list of all transaction log views */
@@ -133,6 +143,9 @@ struct mail_transaction_log {
 	int dotlock_refcount;
 	struct dotlock *dotlock;
 
+	/* .log.sync file descriptor, or -1 if it's not opened yet. */
+	int sync_fd;
+
 	/* This session has already checked whether an old .log.2 should be
 	   unlinked. */
 	bool log_2_unlink_checked:1;
@@ -185,6 +198,18 @@ int mail_transaction_log_lock_head(struct mail_transaction_log *log,
 				   const char *lock_reason);
 void mail_transaction_log_file_unlock(struct mail_transaction_log_file *file,
 				      const char *lock_reason);
+/* fdatasync() the log file at least up to the given offset. This should be
+   called after the log has been unlocked, so other processes can append to
+   it in the meantime. The processes waiting for their fdatasync() to finish
+   at the same time are grouped together, so that usually only one of them
+   needs to actually call it.
+
+   Other processes can read the records before they're durable. Their own
+   fsynced commits cover the earlier records too, since fdatasync() syncs
+   the whole file. mail_index_write() calls this before writing the index,
+   so the index never points past the durable end of the log. */
+int mail_transaction_log_file_sync_durable(struct mail_transaction_log_file *file,
+					   uoff_t offset);
 
 void mail_transaction_update_modseq(const struct mail_transaction_header *hdr,
 				    const void *data, uint64_t *cur_modseq,
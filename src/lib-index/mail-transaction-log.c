@@ -32,6 +32,7 @@ mail_transaction_log_alloc(struct mail_index *index)
 
 	log = i_new(struct mail_transaction_log, 1);
 	log->index = index;
+	log->sync_fd = -1;
 	return log;
 }
 
@@ -154,6 +155,7 @@ void mail_transaction_log_free(struct mail_transaction_log **_log)
 
 	mail_transaction_log_close(log);
 	log->index->log = NULL;
+	i_close_fd(&log->sync_fd);
 	i_free(log->filepath);
 	i_free(log->filepath2);
 	i_free(log);
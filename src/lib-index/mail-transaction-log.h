@@ -4,6 +4,7 @@
 #include "mail-index.h"
 
 #define MAIL_TRANSACTION_LOG_SUFFIX ".log"
+#define MAIL_TRANSACTION_LOG_SYNC_SUFFIX ".log.sync"
 
 #define MAIL_TRANSACTION_LOG_MAJOR_VERSION 1
 #define MAIL_TRANSACTION_LOG_MINOR_VERSION 3
@@ -357,6 +358,10 @@ struct mail_transaction_log_append_ctx {
 	uint64_t new_highest_modseq;
 	/* Number of transaction records added so far. */
 	unsigned int transaction_count;
+	/* If non-NULL, fsync_file needs to be fdatasync()ed up to
+	   fsync_offset after the log is unlocked. */
+	struct mail_transaction_log_file *fsync_file;
+	uoff_t fsync_offset;
 
 	/* Copied from mail_index_transaction.sync_transaction */
 	bool index_sync_transaction:1;
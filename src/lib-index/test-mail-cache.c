@@ -1,6 +1,7 @@
 /* Copyright (c) 2020 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "str.h"
 #include "write-full.h"
 #include "test-common.h"
@@ -806,6 +807,120 @@ static void test_mail_cache_duplicate_fields(void)
 	test_end();
 }
 
+static void test_mail_cache_lookup_batch(void)
+{
+	struct mail_cache_field bitmask_field = {
+		.name = "bitmask",
+		.type = MAIL_CACHE_FIELD_BITMASK,
+		.field_size = 4,
+		.decision = MAIL_CACHE_DECISION_YES,
+	};
+	struct test_mail_cache_ctx ctx;
+	struct mail_cache_view *cache_view;
+	struct mail_cache_lookup_batch *batch;
+	ARRAY_TYPE(seq_range) seqs;
+	string_t *str = t_str_new(16);
+	const void *data;
+	size_t size;
+	uint32_t seq;
+
+	test_begin("mail cache lookup batch");
+	test_mail_cache_init(test_mail_index_init(TRUE), &ctx);
+	mail_cache_register_fields(ctx.cache, &bitmask_field, 1,
+				   unsafe_data_stack_pool);
+	const unsigned int field_idxs[] = {
+		ctx.cache_field.idx,
+		ctx.cache_field2.idx,
+		bitmask_field.idx,
+	};
+
+	/* foo is cached for all mails, except for seq 3 which has nothing.
+	   bar is cached for even seqs. */
+	for (seq = 1; seq <= 5; seq++) {
+		if (seq == 3)
+			test_mail_cache_add_mail(&ctx, UINT_MAX, NULL);
+		else {
+			test_mail_cache_add_mail(&ctx, ctx.cache_field.idx,
+						 t_strdup_printf("foo%u", seq));
+		}
+		if (seq % 2 == 0) {
+			test_mail_cache_add_field(&ctx, seq,
+				ctx.cache_field2.idx,
+				t_strdup_printf("bar%u", seq));
+		}
+	}
+	/* bitmask is merged from multiple records */
+	test_mail_cache_add_field(&ctx, 1, bitmask_field.idx,
+				  "\x01\x01\x01\x10");
+	test_mail_cache_add_field(&ctx, 1, bitmask_field.idx,
+				  "\x02\x02\x02\x20");
+	test_mail_cache_view_sync(&ctx);
+
+	cache_view = mail_cache_view_open(ctx.cache, ctx.view);
+	t_array_init(&seqs, 2);
+	seq_range_array_add_range(&seqs, 1, 2);
+	seq_range_array_add_range(&seqs, 4, 5);
+	batch = mail_cache_lookup_batch_init(cache_view, &seqs, field_idxs,
+					     N_ELEMENTS(field_idxs));
+
+	for (seq = 1; seq <= 5; seq++) {
+		if (seq == 3) {
+			test_assert(mail_cache_lookup_batch_get(batch, seq,
+				ctx.cache_field.idx, &data, &size) == -1);
+			continue;
+		}
+		const char *foo = t_strdup_printf("foo%u", seq);
+		test_assert_idx(mail_cache_lookup_batch_get(batch, seq,
+			ctx.cache_field.idx, &data, &size) == 1, seq);
+		test_assert_idx(size == strlen(foo) &&
+				memcmp(data, foo, size) == 0, seq);
+
+		int ret = mail_cache_lookup_batch_get(batch, seq,
+			ctx.cache_field2.idx, &data, &size);
+		if (seq % 2 != 0)
+			test_assert_idx(ret == 0, seq);
+		else {
+			const char *bar = t_strdup_printf("bar%u", seq);
+			test_assert_idx(ret == 1 && size == strlen(bar) &&
+					memcmp(data, bar, size) == 0, seq);
+		}
+	}
+	test_assert(mail_cache_lookup_batch_get(batch, 1, bitmask_field.idx,
+						&data, &size) == 1);
+	test_assert(size == 4 && memcmp(data, "\x03\x03\x03\x30", 4) == 0);
+	test_assert(mail_cache_lookup_batch_get(batch, 2, bitmask_field.idx,
+						&data, &size) == 0);
+	/* fields not in the batch */
+	test_assert(mail_cache_lookup_batch_get(batch, 1, ctx.cache_field3.idx,
+						&data, &size) == -1);
+	test_assert(mail_cache_lookup_batch_get(batch, 6, ctx.cache_field.idx,
+						&data, &size) == -1);
+
+	/* the normal lookups use the batch, and fall back to reading the
+	   cache for anything that isn't in it */
+	test_assert(mail_cache_lookup_field(cache_view, str, 4,
+					    ctx.cache_field2.idx) == 1);
+	test_assert_strcmp(str_c(str), "bar4");
+	test_assert(mail_cache_field_exists(cache_view, 5,
+					    ctx.cache_field2.idx) == 0);
+	test_assert(mail_cache_field_exists(cache_view, 3,
+					    ctx.cache_field.idx) == 0);
+	test_assert(mail_cache_field_exists(cache_view, 1,
+					    ctx.cache_field3.idx) == 0);
+	str_truncate(str, 0);
+	test_assert(mail_cache_lookup_field(cache_view, str, 1,
+					    bitmask_field.idx) == 1);
+	test_assert(str_len(str) == 4 &&
+		    memcmp(str_data(str), "\x03\x03\x03\x30", 4) == 0);
+
+	mail_cache_lookup_batch_deinit(&batch);
+	test_assert(batch == NULL);
+	mail_cache_view_close(&cache_view);
+	test_mail_cache_deinit(&ctx);
+	test_mail_index_delete();
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
@@ -820,6 +935,7 @@ int main(void)
 		test_mail_cache_in_memory,
 		test_mail_cache_size_corruption,
 		test_mail_cache_duplicate_fields,
+		test_mail_cache_lookup_batch,
 		NULL
 	};
 	return test_run(test_functions);
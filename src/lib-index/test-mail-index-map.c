@@ -11,18 +11,22 @@ static void test_mail_index_map_lookup_seq_range_count(unsigned int messages_cou
 {
 	struct mail_index_record_map rec_map;
 	struct mail_index_map map;
+	struct mail_index_record *rec;
 	uint32_t seq, first_uid, last_uid, first_seq, last_seq, max_uid;
+	unsigned int count;
 
 	i_zero(&map);
 	i_zero(&rec_map);
 	map.rec_map = &rec_map;
 	map.hdr.messages_count = messages_count;
 	map.hdr.record_size = sizeof(struct mail_index_record);
-	rec_map.records_count = map.hdr.messages_count;
-	rec_map.records = i_new(struct mail_index_record, map.hdr.messages_count);
+	i_array_init(&rec_map.pages, 1);
 
-	for (seq = 1; seq <= map.hdr.messages_count; seq++)
-		MAIL_INDEX_REC_AT_SEQ(&map, seq)->uid = seq*2;
+	for (seq = 1; seq <= map.hdr.messages_count; seq++) {
+		rec = mail_index_record_map_append_space(&rec_map,
+			map.hdr.record_size, 1, &count);
+		rec->uid = seq*2;
+	}
 	max_uid = (seq-1)*2;
 	map.hdr.next_uid = max_uid + 1;
 
@@ -34,7 +38,8 @@ static void test_mail_index_map_lookup_seq_range_count(unsigned int messages_cou
 			test_assert((first_uid+1)/2 == first_seq && last_uid/2 == last_seq);
 		}
 	}
-	i_free(rec_map.records);
+	mail_index_record_map_reset(&rec_map);
+	array_free(&rec_map.pages);
 }
 
 static void test_mail_index_map_lookup_seq_range(void)
@@ -47,10 +52,138 @@ static void test_mail_index_map_lookup_seq_range(void)
 	test_end();
 }
 
+static size_t
+test_mail_index_map_records_memory(struct mail_index_map *const *maps,
+				   unsigned int maps_count)
+{
+	ARRAY(struct mail_index_record_page *) seen_pages;
+	struct mail_index_record_page *page;
+	size_t size = 0;
+	unsigned int i;
+
+	/* count each of the pages only once */
+	t_array_init(&seen_pages, 64);
+	for (i = 0; i < maps_count; i++) {
+		array_foreach_elem(&maps[i]->rec_map->pages, page) {
+			if (array_lsearch_ptr(&seen_pages, page) != NULL)
+				continue;
+			array_push_back(&seen_pages, &page);
+			size += page->alloc_count * maps[i]->hdr.record_size;
+		}
+	}
+	return size;
+}
+
+static void test_mail_index_map_clone_memory(void)
+{
+#define TEST_CLONE_MESSAGES_COUNT 100000
+#define TEST_CLONE_COUNT 10
+	struct mail_index index;
+	struct mail_index_map *maps[TEST_CLONE_COUNT + 1], *map;
+	struct mail_index_record *rec;
+	unsigned int i, idx, count, page_count;
+	size_t records_size;
+	uint32_t seq;
+
+	test_begin("mail index map clone memory");
+	i_zero(&index);
+	map = maps[0] = mail_index_map_alloc(&index);
+	for (idx = 0; idx < TEST_CLONE_MESSAGES_COUNT; idx += count) {
+		rec = mail_index_record_map_append_space(map->rec_map,
+			map->hdr.record_size,
+			TEST_CLONE_MESSAGES_COUNT - idx, &count);
+		for (i = 0; i < count; i++) {
+			i_zero(&rec[i]);
+			rec[i].uid = idx + i + 1;
+		}
+	}
+	map->hdr.messages_count = TEST_CLONE_MESSAGES_COUNT;
+	map->hdr.next_uid = TEST_CLONE_MESSAGES_COUNT + 1;
+	records_size = TEST_CLONE_MESSAGES_COUNT * map->hdr.record_size;
+	page_count = array_count(&map->rec_map->pages);
+	test_assert(page_count > 1);
+	test_assert(page_count == (records_size +
+		MAIL_INDEX_RECORD_PAGE_MAX_SIZE - 1) /
+		MAIL_INDEX_RECORD_PAGE_MAX_SIZE);
+	test_assert(test_mail_index_map_records_memory(maps, 1) ==
+		    records_size);
+
+	/* private clones share all the pages */
+	for (i = 1; i <= TEST_CLONE_COUNT; i++) {
+		maps[i] = mail_index_map_clone(map);
+		mail_index_record_map_move_to_private(maps[i]);
+		test_assert(maps[i]->rec_map != map->rec_map);
+		test_assert(array_count(&maps[i]->rec_map->pages) == page_count);
+	}
+	test_assert(array_idx_elem(&map->rec_map->pages, 0)->refcount ==
+		    TEST_CLONE_COUNT + 1);
+	test_assert(test_mail_index_map_records_memory(maps,
+			TEST_CLONE_COUNT + 1) == records_size);
+
+	/* modifying a record copies only its page */
+	seq = TEST_CLONE_MESSAGES_COUNT / 2;
+	mail_index_map_modify_records(maps[1], seq, seq);
+	MAIL_INDEX_REC_AT_SEQ(maps[1], seq)->flags |= MAIL_SEEN;
+	test_assert((MAIL_INDEX_REC_AT_SEQ(maps[1], seq)->flags & MAIL_SEEN) != 0);
+	test_assert((MAIL_INDEX_REC_AT_SEQ(map, seq)->flags & MAIL_SEEN) == 0);
+	test_assert((MAIL_INDEX_REC_AT_SEQ(maps[2], seq)->flags & MAIL_SEEN) == 0);
+	test_assert(test_mail_index_map_records_memory(maps,
+			TEST_CLONE_COUNT + 1) ==
+		    records_size + MAIL_INDEX_RECORD_PAGE_MAX_SIZE);
+
+	/* moving records across pages copies only the moved pages */
+	mail_index_map_modify_records(maps[2], 2, TEST_CLONE_MESSAGES_COUNT);
+	mail_index_map_move_records(maps[2], 1, 2,
+				    TEST_CLONE_MESSAGES_COUNT - 2);
+	mail_index_record_map_truncate(maps[2]->rec_map,
+				       TEST_CLONE_MESSAGES_COUNT - 1);
+	maps[2]->hdr.messages_count = TEST_CLONE_MESSAGES_COUNT - 1;
+	test_assert(MAIL_INDEX_REC_AT_SEQ(maps[2], 1)->uid == 1);
+	for (seq = 2; seq < TEST_CLONE_MESSAGES_COUNT; seq++) {
+		if (MAIL_INDEX_REC_AT_SEQ(maps[2], seq)->uid != seq + 1) {
+			test_assert_idx(FALSE, seq);
+			break;
+		}
+	}
+	test_assert(MAIL_INDEX_REC_AT_SEQ(map, 2)->uid == 2);
+	test_assert(test_mail_index_map_records_memory(maps,
+			TEST_CLONE_COUNT + 1) ==
+		    records_size * 2 + MAIL_INDEX_RECORD_PAGE_MAX_SIZE);
+
+	/* appending copies only the last page */
+	rec = mail_index_record_map_append_space(maps[3]->rec_map,
+		maps[3]->hdr.record_size, 1, &count);
+	test_assert(count == 1);
+	i_zero(rec);
+	rec->uid = TEST_CLONE_MESSAGES_COUNT + 1;
+	test_assert(maps[3]->rec_map->records_count ==
+		    TEST_CLONE_MESSAGES_COUNT + 1);
+	test_assert(map->rec_map->records_count == TEST_CLONE_MESSAGES_COUNT);
+	test_assert(array_idx_elem(&maps[3]->rec_map->pages, page_count - 1) !=
+		    array_idx_elem(&map->rec_map->pages, page_count - 1));
+	test_assert(array_idx_elem(&maps[3]->rec_map->pages, 0) ==
+		    array_idx_elem(&map->rec_map->pages, 0));
+
+	/* truncating drops the references to the unused pages */
+	maps[4]->hdr.messages_count = 1;
+	mail_index_record_map_move_to_private(maps[4]);
+	test_assert(maps[4]->rec_map->records_count == 1);
+	test_assert(maps[4]->rec_map->last_appended_uid == 1);
+	test_assert(array_count(&maps[4]->rec_map->pages) == 1);
+	test_assert(array_idx_elem(&map->rec_map->pages,
+				   page_count - 2)->refcount ==
+		    TEST_CLONE_COUNT - 1);
+
+	for (i = 0; i <= TEST_CLONE_COUNT; i++)
+		mail_index_unmap(&maps[i]);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_mail_index_map_lookup_seq_range,
+		test_mail_index_map_clone_memory,
 		NULL
 	};
 	return test_run(test_functions);
@@ -20,6 +20,7 @@ static void test_mail_index_sync_ext_atomic_inc(void)
 	struct mail_index_sync_map_ctx ctx;
 	struct mail_transaction_ext_atomic_inc u;
 	struct mail_index_ext *ext;
+	unsigned int count;
 	void *ptr;
 
 	test_begin("mail index sync ext atomic inc");
@@ -34,12 +35,14 @@ static void test_mail_index_sync_ext_atomic_inc(void)
 	ctx.view->map->hdr.next_uid = 2;
 	ctx.view->map->hdr.record_size = sizeof(struct mail_index_record) + 16;
 	ctx.view->map->rec_map = t_new(struct mail_index_record_map, 1);
-	ctx.view->map->rec_map->records =
-		t_malloc0(ctx.view->map->hdr.record_size);
+	i_array_init(&ctx.view->map->rec_map->pages, 1);
+	ptr = mail_index_record_map_append_space(ctx.view->map->rec_map,
+		ctx.view->map->hdr.record_size, 1, &count);
+	memset(ptr, 0, ctx.view->map->hdr.record_size);
 	t_array_init(&ctx.view->map->extensions, 4);
 	ext = array_append_space(&ctx.view->map->extensions);
 	ext->record_offset = sizeof(struct mail_index_record);
-	ptr = PTR_OFFSET(ctx.view->map->rec_map->records, ext->record_offset);
+	ptr = PTR_OFFSET(ptr, ext->record_offset);
 
 	i_zero(&u);
 	test_assert(mail_index_sync_ext_atomic_inc(&ctx, &u) == -1);
@@ -72,6 +75,8 @@ static void test_mail_index_sync_ext_atomic_inc(void)
 	u.diff = 0;
 	test_assert(mail_index_sync_ext_atomic_inc(&ctx, &u) == -1);
 
+	mail_index_record_map_reset(ctx.view->map->rec_map);
+	array_free(&ctx.view->map->rec_map->pages);
 	i_free(ctx.view->index->need_recreate);
 	test_end();
 }
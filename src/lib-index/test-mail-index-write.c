@@ -11,12 +11,15 @@
 
 static bool expect_index_rewrite;
 static bool rotate_fail;
+static bool sync_durable_fail;
+static uoff_t sync_durable_offset;
 
 static struct mail_transaction_log_file log_file = {
 	.hdr = {
 		.indexid = TEST_INDEXID,
 		.file_seq = 1,
 	},
+	.sync_offset = LOG_FILE1_HEAD_OFFSET,
 };
 static struct mail_transaction_log_file log_file2 = {
 	.hdr = {
@@ -62,11 +65,31 @@ int mail_index_create_tmp_file(struct mail_index *index ATTR_UNUSED,
 	return fd;
 }
 
+void mail_index_map_clear_dirty(struct mail_index_map *map ATTR_UNUSED)
+{
+}
+
+void *mail_index_map_get_records(struct mail_index_map *map ATTR_UNUSED,
+				 uint32_t idx ATTR_UNUSED,
+				 uint32_t count ATTR_UNUSED,
+				 uint32_t *count_r ATTR_UNUSED)
+{
+	i_unreached();
+}
+
 int mail_index_move_to_memory(struct mail_index *index ATTR_UNUSED)
 {
 	return -1;
 }
 
+int mail_transaction_log_file_sync_durable(
+	struct mail_transaction_log_file *file, uoff_t offset)
+{
+	test_assert(file == &log_file);
+	sync_durable_offset = offset;
+	return sync_durable_fail ? -1 : 0;
+}
+
 int mail_transaction_log_rotate(struct mail_transaction_log *log, bool reset)
 {
 	i_assert(!reset);
@@ -113,12 +136,22 @@ static void test_mail_index_write(void)
 
 	test_begin("test_mail_index_write()");
 
+	/* failing to make the .log durable prevents writing the index */
+	sync_durable_fail = TRUE;
+	expect_index_rewrite = FALSE;
+	index.fd = 1; /* anything but -1 */
+	mail_index_write(&index, TRUE, "testing");
+	test_assert(sync_durable_offset == LOG_FILE1_HEAD_OFFSET);
+	test_assert(log.head == log.files);
+	test_assert(!index.reopen_main_index);
+	sync_durable_fail = FALSE;
+
 	/* test failed rotation, no index rewrite */
 	rotate_fail = TRUE;
 	expect_index_rewrite = FALSE;
-	test_assert(!index.reopen_main_index);
-	index.fd = 1; /* anything but -1 */
+	sync_durable_offset = 0;
 	mail_index_write(&index, TRUE, "testing");
+	test_assert(sync_durable_offset == LOG_FILE1_HEAD_OFFSET);
 	test_assert(log.head == log.files);
 	test_assert(index.reopen_main_index);
 
@@ -6,6 +6,9 @@
 #include "test-mail-index.h"
 #include "mail-transaction-log-private.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
 static void test_mail_index_rotate(void)
 {
 	struct mail_index *index, *index2;
@@ -158,11 +161,223 @@ static void test_mail_index_new_extension(void)
 	test_end();
 }
 
+static void
+test_mail_index_fsync_commit(struct mail_index *index, uint32_t uid)
+{
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	uint32_t seq, uid_validity = 1;
+
+	view = mail_index_view_open(index);
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_FSYNC);
+	if (uid == 1) {
+		mail_index_update_header(trans,
+			offsetof(struct mail_index_header, uid_validity),
+			&uid_validity, sizeof(uid_validity), TRUE);
+	}
+	mail_index_append(trans, uid, &seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+}
+
+static void
+test_mail_index_sync_record_read(int fd,
+				 struct mail_transaction_log_sync_record *rec_r)
+{
+	test_assert(pread(fd, rec_r, sizeof(*rec_r), 0) == sizeof(*rec_r));
+}
+
+static void test_mail_index_fsync_group(void)
+{
+	struct mail_transaction_log_sync_record rec;
+	struct mail_transaction_log_file *file;
+	struct mail_index *index;
+	uint64_t synced_offset;
+	int fd;
+
+	test_begin("mail index fsync group commit");
+	index = test_mail_index_init(TRUE);
+	mail_index_set_fsync_mode(index, FSYNC_MODE_OPTIMIZED, 0);
+	file = index->log->head;
+
+	/* the synced offset is written after fdatasync() */
+	test_mail_index_fsync_commit(index, 1);
+	fd = open(TESTDIR_NAME"/test.dovecot.index"
+		  MAIL_TRANSACTION_LOG_SYNC_SUFFIX, O_RDWR);
+	test_assert(fd != -1);
+	test_mail_index_sync_record_read(fd, &rec);
+	test_assert(rec.indexid == file->hdr.indexid);
+	test_assert(rec.file_seq == file->hdr.file_seq);
+	test_assert(rec.sync_offset == file->sync_offset);
+
+	/* another process has already synced past our changes */
+	synced_offset = file->sync_offset + 1024*1024;
+	rec.sync_offset = synced_offset;
+	test_assert(pwrite(fd, &rec, sizeof(rec), 0) == sizeof(rec));
+	test_mail_index_fsync_commit(index, 2);
+	test_mail_index_sync_record_read(fd, &rec);
+	test_assert(rec.sync_offset == synced_offset);
+
+	/* the record is for another log file */
+	rec.file_seq++;
+	test_assert(pwrite(fd, &rec, sizeof(rec), 0) == sizeof(rec));
+	test_mail_index_fsync_commit(index, 3);
+	test_mail_index_sync_record_read(fd, &rec);
+	test_assert(rec.file_seq == file->hdr.file_seq);
+	test_assert(rec.sync_offset == file->sync_offset);
+
+	i_close_fd(&fd);
+	test_mail_index_deinit(&index);
+	test_end();
+}
+
+static struct mail_index *test_mail_index_incremental_open(void)
+{
+	struct mail_index_optimization_settings set = {
+		.index = {
+			.incremental_write = TRUE,
+		},
+	};
+	struct mail_index *index;
+
+	index = mail_index_alloc(NULL, TESTDIR_NAME, "test.dovecot.index");
+	mail_index_set_optimization_settings(index, &set);
+	test_assert(mail_index_open_or_create(index,
+		MAIL_INDEX_OPEN_FLAG_CREATE |
+		MAIL_INDEX_OPEN_FLAG_MMAP_DISABLE) >= 0);
+	return index;
+}
+
+static void
+test_mail_index_incremental_commit(struct mail_index *index,
+				   uint32_t first_uid, uint32_t append_count,
+				   uint32_t seen_seq)
+{
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	uint32_t seq, uid, uid_validity = 1, file_seq;
+	uoff_t file_offset;
+
+	view = mail_index_view_open(index);
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	if (first_uid == 1) {
+		mail_index_update_header(trans,
+			offsetof(struct mail_index_header, uid_validity),
+			&uid_validity, sizeof(uid_validity), TRUE);
+	}
+	for (uid = first_uid; uid < first_uid + append_count; uid++)
+		mail_index_append(trans, uid, &seq);
+	if (seen_seq != 0)
+		mail_index_update_flags(trans, seen_seq, MODIFY_ADD, MAIL_SEEN);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+
+	test_assert(mail_transaction_log_sync_lock(index->log, "test",
+						   &file_seq, &file_offset) == 0);
+	test_assert(mail_index_refresh(index) == 0);
+	mail_index_write(index, FALSE, "test");
+	mail_transaction_log_sync_unlock(index->log, "test");
+}
+
+static void
+test_mail_index_incremental_read_hdr(struct mail_index_header *hdr_r)
+{
+	int fd;
+
+	fd = open(TESTDIR_NAME"/test.dovecot.index", O_RDONLY);
+	test_assert(fd != -1);
+	test_assert(pread(fd, hdr_r, sizeof(*hdr_r), 0) == sizeof(*hdr_r));
+	i_close_fd(&fd);
+}
+
+static void test_mail_index_incremental_write(void)
+{
+	struct mail_index *index, *index2;
+	struct mail_index_view *view;
+	struct mail_index_header hdr;
+	struct stat st1, st2;
+	uint32_t write_seq;
+	int fd;
+
+	test_begin("mail index incremental write");
+	index = test_mail_index_init(TRUE);
+	test_mail_index_close(&index);
+
+	index = test_mail_index_incremental_open();
+	test_mail_index_incremental_commit(index, 1, 1000, 0);
+	test_mail_index_close(&index);
+	test_mail_index_incremental_read_hdr(&hdr);
+	test_assert(hdr.messages_count == 1000);
+	test_assert(hdr.write_seq == 0);
+	test_assert(stat(TESTDIR_NAME"/test.dovecot.index", &st1) == 0);
+
+	/* flag change rewrites only the changed record */
+	index = test_mail_index_incremental_open();
+	test_mail_index_incremental_commit(index, 0, 0, 500);
+	test_assert(stat(TESTDIR_NAME"/test.dovecot.index", &st2) == 0);
+	test_assert(st1.st_ino == st2.st_ino);
+	test_mail_index_incremental_read_hdr(&hdr);
+	test_assert(hdr.write_seq == 2);
+	test_assert(hdr.seen_messages_count == 1);
+	test_assert(hdr.log_file_tail_offset == index->map->hdr.log_file_head_offset);
+
+	/* appends are written to the end of the file */
+	test_mail_index_incremental_commit(index, 1001, 1, 1001);
+	test_assert(stat(TESTDIR_NAME"/test.dovecot.index", &st2) == 0);
+	test_assert(st1.st_ino == st2.st_ino);
+	test_mail_index_incremental_read_hdr(&hdr);
+	test_assert(hdr.write_seq == 4);
+	test_assert(hdr.messages_count == 1001);
+	test_assert(hdr.seen_messages_count == 2);
+
+	/* another process sees the changes without reading the log */
+	index2 = test_mail_index_incremental_open();
+	test_assert(index2->map->hdr.log_file_tail_offset ==
+		    index->map->hdr.log_file_head_offset);
+	view = mail_index_view_open(index2);
+	test_assert((mail_index_lookup(view, 500)->flags & MAIL_SEEN) != 0);
+	test_assert((mail_index_lookup(view, 1001)->flags & MAIL_SEEN) != 0);
+	test_assert((mail_index_lookup(view, 501)->flags & MAIL_SEEN) == 0);
+	mail_index_view_close(&view);
+	test_mail_index_close(&index2);
+	test_mail_index_close(&index);
+
+	/* interrupted write: the header counters are recalculated */
+	fd = open(TESTDIR_NAME"/test.dovecot.index", O_RDWR);
+	test_assert(fd != -1);
+	write_seq = 5;
+	test_assert(pwrite(fd, &write_seq, sizeof(write_seq),
+			   offsetof(struct mail_index_header, write_seq)) ==
+		    sizeof(write_seq));
+	hdr.seen_messages_count = 0;
+	test_assert(pwrite(fd, &hdr.seen_messages_count,
+			   sizeof(hdr.seen_messages_count),
+			   offsetof(struct mail_index_header,
+				    seen_messages_count)) ==
+		    sizeof(hdr.seen_messages_count));
+	i_close_fd(&fd);
+
+	test_expect_errors(2);
+	index = test_mail_index_incremental_open();
+	test_expect_no_more_errors();
+	test_assert(index->map->hdr.seen_messages_count == 2);
+	test_assert((index->map->hdr.write_seq & 1) == 0);
+	test_mail_index_incremental_read_hdr(&hdr);
+	test_assert(hdr.write_seq == 6);
+	test_assert(hdr.seen_messages_count == 2);
+	test_mail_index_deinit(&index);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_mail_index_rotate,
 		test_mail_index_new_extension,
+		test_mail_index_fsync_group,
+		test_mail_index_incremental_write,
 		NULL
 	};
 	return test_run(test_functions);
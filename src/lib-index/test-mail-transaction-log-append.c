@@ -39,6 +39,13 @@ int mail_index_move_to_memory(struct mail_index *index ATTR_UNUSED)
 	return -1;
 }
 
+int mail_transaction_log_file_sync_durable(
+	struct mail_transaction_log_file *file ATTR_UNUSED,
+	uoff_t offset ATTR_UNUSED)
+{
+	return 0;
+}
+
 static void test_append_expunge(struct mail_transaction_log *log)
 {
 	static unsigned int buf[] = { 0x12345678, 0xabcdef09 };
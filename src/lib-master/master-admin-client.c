@@ -2,8 +2,11 @@
 
 #include "lib.h"
 #include "connection.h"
+#include "ioloop.h"
 #include "ostream.h"
 #include "str.h"
+#include "strescape.h"
+#include "strnum.h"
 #include "master-service-private.h"
 #include "master-admin-client.h"
 
@@ -78,6 +81,40 @@ cmd_kick_user_signal(struct master_admin_client *client,
 	master_admin_client_unref(&client);
 }
 
+static void
+cmd_ioloop_stats(struct master_admin_client *client, const char *const *args)
+{
+	const struct ioloop_callback_stats *const *stats;
+	unsigned int i, count, max_count = UINT_MAX;
+
+	if (args[0] != NULL && str_to_uint(args[0], &max_count) < 0) {
+		master_admin_client_send_reply(client,
+					       "-Invalid max count parameter");
+		return;
+	}
+
+	/* Each callback source is a tab-escaped list of fields:
+	   source, calls, total usecs, max usecs, CPU sampled calls,
+	   CPU usecs */
+	string_t *str = t_str_new(256);
+	string_t *row = t_str_new(128);
+	str_append_c(str, '+');
+	str_append(str, io_loop_callback_stats_is_enabled() ? "1" : "0");
+	stats = io_loop_callback_stats_get_sorted(&count);
+	for (i = 0; i < count && i < max_count; i++) {
+		str_truncate(row, 0);
+		str_printfa(row, "%s:%u\t%"PRIu64"\t%"PRIu64"\t%"PRIu64
+			    "\t%"PRIu64"\t%"PRIu64,
+			    stats[i]->source_filename, stats[i]->source_linenum,
+			    stats[i]->call_count, stats[i]->total_usecs,
+			    stats[i]->max_usecs, stats[i]->cpu_sample_count,
+			    stats[i]->cpu_usecs);
+		str_append_c(str, '\t');
+		str_append_tabescaped(str, str_c(row));
+	}
+	master_admin_client_send_reply(client, str_c(str));
+}
+
 static int
 master_admin_client_input_args(struct connection *conn, const char *const *args)
 {
@@ -110,7 +147,9 @@ master_admin_client_input_args(struct connection *conn, const char *const *args)
 	else if (strcmp(cmd, "KICK-USER-SIGNAL") == 0) {
 		cmd_kick_user_signal(client, args);
 		return -1;
-	} else if (master_admin_client_callbacks.cmd == NULL ||
+	} else if (strcmp(cmd, "IOLOOP-STATS") == 0)
+		cmd_ioloop_stats(client, args);
+	else if (master_admin_client_callbacks.cmd == NULL ||
 		   !master_admin_client_callbacks.cmd(client, cmd, args)) {
 		client->reply_pending = FALSE;
 		o_stream_nsend_str(conn->output, "-Unknown command\n");
@@ -11,6 +11,7 @@
 #include "eacces-error.h"
 #include "env-util.h"
 #include "execv-const.h"
+#include "ioloop.h"
 #include "settings.h"
 #include "stats-client.h"
 #include "master-service-private.h"
@@ -25,6 +26,8 @@
 
 #define CONFIG_READ_TIMEOUT_SECS 10
 #define CONFIG_HANDSHAKE "VERSION\tconfig\t3\t0\n"
+/* With ioloop_callback_stats=yes, measure CPU usage of every Nth callback */
+#define IOLOOP_CALLBACK_STATS_CPU_SAMPLE_RATE 16
 
 #undef DEF
 #define DEF(type, name) \
@@ -50,6 +53,8 @@ static const struct setting_define master_service_setting_defines[] = {
 	DEF(BOOL, version_ignore),
 	DEF(BOOL, shutdown_clients),
 	DEF(BOOL, verbose_proctitle),
+	DEF(BOOL, ioloop_callback_stats),
+	DEF(TIME_MSECS, ioloop_callback_slow_threshold),
 
 	DEF(STR, haproxy_trusted_networks),
 	DEF(TIME, haproxy_timeout),
@@ -78,6 +83,8 @@ static const struct master_service_settings master_service_default_settings = {
 	.version_ignore = FALSE,
 	.shutdown_clients = TRUE,
 	.verbose_proctitle = FALSE,
+	.ioloop_callback_stats = FALSE,
+	.ioloop_callback_slow_threshold = 1000,
 
 	.haproxy_trusted_networks = "",
 	.haproxy_timeout = 3
@@ -544,6 +551,13 @@ int master_service_settings_read(struct master_service *service,
 
 	if (service->set->shutdown_clients)
 		master_service_set_die_with_master(master_service, TRUE);
+	if (service->set->ioloop_callback_stats) {
+		io_loop_callback_stats_enable(
+			IOLOOP_CALLBACK_STATS_CPU_SAMPLE_RATE,
+			service->set->ioloop_callback_slow_threshold);
+	} else {
+		io_loop_callback_stats_disable();
+	}
 	return 0;
 }
 
@@ -22,6 +22,8 @@ struct master_service_settings {
 	bool version_ignore;
 	bool shutdown_clients;
 	bool verbose_proctitle;
+	bool ioloop_callback_stats;
+	unsigned int ioloop_callback_slow_threshold;
 
 	const char *haproxy_trusted_networks;
 	unsigned int haproxy_timeout;
@@ -1,15 +1,22 @@
 /* Copyright (c) 2017-2018 Dovecot authors, see the included COPYING file */
 
+#define _GNU_SOURCE /* for memfd_create() and F_ADD_SEALS */
 #include "lib.h"
 #include "str.h"
 #include "strescape.h"
 #include "ostream.h"
+#include "ostream-unix.h"
 #include "time-util.h"
 #include "lib-event-private.h"
 #include "event-filter.h"
 #include "connection.h"
+#include "stats-shm.h"
 #include "stats-client.h"
 
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
 #define STATS_CLIENT_HANDSHAKE_TIMEOUT_MSECS (5*1000)
 #define STATS_CLIENT_DEINIT_TIMEOUT_MSECS (60*1000)
 #define STATS_CLIENT_RECONNECT_INTERVAL_MSECS (10*1000)
@@ -19,9 +26,31 @@ enum stats_timeout_type {
 	STATS_CLIENT_DEINIT_WAIT,
 };
 
+struct stats_client_shm_metric {
+	const char *const *fields;
+	unsigned int fields_count;
+	/* duration followed by the fields */
+	struct stats_shm_dist *dists;
+};
+
+struct stats_client_shm {
+	pool_t pool;
+	int fd;
+	struct stats_shm_header *hdr;
+	size_t size;
+
+	/* contexts are struct stats_client_shm_metric */
+	struct event_filter *filter;
+	unsigned int metrics_count;
+	struct stats_client_shm_metric *metrics;
+};
+
 struct stats_client {
 	struct connection conn;
 	struct event_filter *filter;
+	/* filter merged with shm->filter */
+	struct event_filter *send_filter;
+	struct stats_client_shm *shm;
 	struct ioloop *ioloop;
 	struct timeout *to_reconnect;
 	struct timeval wait_started;
@@ -55,6 +84,23 @@ client_handshake_filter(const char *const *args, struct event_filter **filter_r,
 	return 0;
 }
 
+static void stats_client_update_send_filter(struct stats_client *client)
+{
+	event_filter_unref(&client->send_filter);
+	if (client->shm == NULL || client->filter == NULL)
+		client->send_filter = NULL;
+	else {
+		client->send_filter = event_filter_create();
+		event_filter_merge(client->send_filter, client->filter,
+				   EVENT_FILTER_MERGE_OP_OR);
+		event_filter_merge(client->send_filter, client->shm->filter,
+				   EVENT_FILTER_MERGE_OP_OR);
+	}
+	event_set_global_debug_send_filter(client->send_filter != NULL ?
+					   client->send_filter :
+					   client->filter);
+}
+
 static int
 stats_client_handshake(struct stats_client *client, const char *const *args)
 {
@@ -77,7 +123,139 @@ stats_client_handshake(struct stats_client *client, const char *const *args)
 
 	event_filter_unref(&client->filter);
 	client->filter = filter;
-	event_set_global_debug_send_filter(client->filter);
+	stats_client_update_send_filter(client);
+	return 1;
+}
+
+static void stats_client_shm_free(struct stats_client_shm **_shm)
+{
+	struct stats_client_shm *shm = *_shm;
+
+	if (shm == NULL)
+		return;
+	*_shm = NULL;
+
+	if (munmap(shm->hdr, shm->size) < 0)
+		i_error("munmap(stats shm) failed: %m");
+	i_close_fd(&shm->fd);
+	event_filter_unref(&shm->filter);
+	pool_unref(&shm->pool);
+}
+
+static int
+stats_client_shm_create(const char *const *args, unsigned int generation,
+			struct stats_client_shm **shm_r, const char **error_r)
+{
+#if defined(HAVE_MEMFD_CREATE) && defined(F_ADD_SEALS)
+	struct stats_client_shm *shm;
+	struct event_filter *filter;
+	unsigned int i, dist_idx, count = str_array_length(args) / 2;
+	unsigned int *dist_indexes = t_new(unsigned int, count);
+	pool_t pool;
+
+	pool = pool_alloconly_create("stats client shm", 1024);
+	shm = p_new(pool, struct stats_client_shm, 1);
+	shm->pool = pool;
+	shm->fd = -1;
+	shm->filter = event_filter_create();
+	shm->metrics_count = count;
+	shm->metrics = p_new(pool, struct stats_client_shm_metric, count);
+	for (i = 0, dist_idx = 0; i < count; i++) {
+		struct stats_client_shm_metric *metric = &shm->metrics[i];
+
+		filter = event_filter_create();
+		if (!event_filter_import(filter, t_str_tabunescape(args[i*2]),
+					 error_r)) {
+			event_filter_unref(&filter);
+			stats_client_shm_free(&shm);
+			return -1;
+		}
+		event_filter_merge_with_context(shm->filter, filter,
+						EVENT_FILTER_MERGE_OP_OR,
+						metric);
+		event_filter_unref(&filter);
+
+		metric->fields = (const char *const *)
+			p_strsplit_spaces(pool,
+				t_str_tabunescape(args[i*2 + 1]), " ");
+		metric->fields_count = str_array_length(metric->fields);
+		dist_indexes[i] = dist_idx;
+		dist_idx += 1 + metric->fields_count;
+	}
+
+	shm->size = stats_shm_get_size(dist_idx);
+	shm->fd = memfd_create("dovecot-stats",
+			       MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (shm->fd == -1) {
+		*error_r = t_strdup_printf("memfd_create() failed: %m");
+		stats_client_shm_free(&shm);
+		return -1;
+	}
+	if (ftruncate(shm->fd, shm->size) < 0) {
+		*error_r = t_strdup_printf("ftruncate(stats shm) failed: %m");
+		stats_client_shm_free(&shm);
+		return -1;
+	}
+	/* the stats process refuses segments that can still be resized */
+	if (fcntl(shm->fd, F_ADD_SEALS, STATS_SHM_SEALS) < 0) {
+		*error_r = t_strdup_printf(
+			"fcntl(stats shm, F_ADD_SEALS) failed: %m");
+		stats_client_shm_free(&shm);
+		return -1;
+	}
+	shm->hdr = mmap(NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			shm->fd, 0);
+	if (shm->hdr == MAP_FAILED) {
+		shm->hdr = NULL;
+		*error_r = t_strdup_printf("mmap(stats shm) failed: %m");
+		stats_client_shm_free(&shm);
+		return -1;
+	}
+	stats_shm_init(shm->hdr, generation, dist_idx);
+	for (i = 0; i < count; i++) {
+		shm->metrics[i].dists = stats_shm_get_dists(shm->hdr) +
+			dist_indexes[i];
+	}
+	*shm_r = shm;
+	return 0;
+#else
+	*error_r = "memfd_create() with sealing not supported";
+	return -1;
+#endif
+}
+
+static int
+stats_client_shm_metrics(struct stats_client *client, const char *const *args)
+{
+	struct stats_client_shm *shm;
+	unsigned int generation;
+	const char *error;
+
+	if (args[0] == NULL || str_to_uint(args[0], &generation) < 0 ||
+	    str_array_length(args + 1) % 2 != 0) {
+		e_error(client->conn.event,
+			"stats: Received invalid SHM-METRICS input: %s",
+			t_strarray_join(args, "\t"));
+		return -1;
+	}
+	stats_client_shm_free(&client->shm);
+	stats_client_update_send_filter(client);
+
+	if (stats_client_shm_create(args + 1, generation, &shm, &error) < 0) {
+		/* the stats process keeps counting the events it receives */
+		e_debug(client->conn.event,
+			"stats: Can't use shared memory metrics: %s", error);
+		return 1;
+	}
+	if (!o_stream_unix_write_fd(client->conn.output, shm->fd)) {
+		/* a previous fd is still being sent - shouldn't happen */
+		stats_client_shm_free(&shm);
+		return 1;
+	}
+	o_stream_nsend_str(client->conn.output,
+			   t_strdup_printf("SHM\t%u\n", generation));
+	client->shm = shm;
+	stats_client_update_send_filter(client);
 	return 1;
 }
 
@@ -86,8 +264,10 @@ stats_client_input_args(struct connection *conn, const char *const *args)
 {
 	struct stats_client *client = (struct stats_client *)conn;
 
+	if (args[0] != NULL && strcmp(args[0], "SHM-METRICS") == 0 &&
+	    client->handshaked)
+		return stats_client_shm_metrics(client, args + 1);
 	return stats_client_handshake(client, args);
-
 }
 
 static void stats_client_reconnect(struct stats_client *client)
@@ -107,6 +287,10 @@ static void stats_client_destroy(struct connection *conn)
 		event->sent_to_stats_id = 0;
 
 	client->handshaked = FALSE;
+	/* the stats process scraped the segment for the last time when it
+	   noticed the disconnection */
+	stats_client_shm_free(&client->shm);
+	stats_client_update_send_filter(client);
 	connection_disconnect(conn);
 	if (client->ioloop != NULL) {
 		/* waiting for stats handshake to finish */
@@ -136,7 +320,7 @@ static const struct connection_settings stats_client_set = {
 	.service_name_in = "stats-server",
 	.service_name_out = "stats-client",
 	.major_version = 4,
-	.minor_version = 0,
+	.minor_version = 1,
 
 	.input_max_size = SIZE_MAX,
 	.output_max_size = SIZE_MAX,
@@ -195,6 +379,54 @@ stats_event_write(struct stats_client *client,
 	}
 }
 
+static void
+stats_client_shm_event_field(struct event *event, const char *key,
+			     struct stats_shm_dist *dist)
+{
+	const struct event_field *field =
+		event_find_field_recursive(event, key);
+	intmax_t num = 0;
+
+	if (field == NULL)
+		return;
+
+	/* same as in the stats process */
+	switch (field->value_type) {
+	case EVENT_FIELD_VALUE_TYPE_STR:
+	case EVENT_FIELD_VALUE_TYPE_STRLIST:
+	case EVENT_FIELD_VALUE_TYPE_IP:
+		break;
+	case EVENT_FIELD_VALUE_TYPE_INTMAX:
+		num = field->value.intmax;
+		break;
+	case EVENT_FIELD_VALUE_TYPE_TIMEVAL:
+		num = field->value.timeval.tv_sec * 1000000ULL +
+			field->value.timeval.tv_usec;
+		break;
+	}
+	stats_shm_dist_add(dist, num);
+}
+
+static void
+stats_client_shm_event(struct stats_client_shm *shm, struct event *event,
+		       const struct failure_context *ctx)
+{
+	struct event_filter_match_iter *iter;
+	struct stats_client_shm_metric *metric;
+	uintmax_t duration;
+
+	event_get_last_duration(event, &duration);
+	iter = event_filter_match_iter_init(shm->filter, event, ctx);
+	while ((metric = event_filter_match_iter_next(iter)) != NULL) {
+		stats_shm_dist_add(&metric->dists[0], duration);
+		for (unsigned int i = 0; i < metric->fields_count; i++) {
+			stats_client_shm_event_field(event, metric->fields[i],
+						     &metric->dists[i + 1]);
+		}
+	}
+	event_filter_match_iter_deinit(&iter);
+}
+
 static void
 stats_client_send_event(struct stats_client *client, struct event *event,
 			const struct failure_context *ctx)
@@ -212,6 +444,8 @@ stats_client_send_event(struct stats_client *client, struct event *event,
 		return;
 	}
 
+	if (client->shm != NULL)
+		stats_client_shm_event(client->shm, event, ctx);
 	if (!event_filter_match(client->filter, event, ctx))
 		return;
 
@@ -458,6 +692,8 @@ void stats_client_deinit(struct stats_client **_client)
 		stats_client_wait(client, STATS_CLIENT_DEINIT_WAIT);
 	}
 
+	stats_client_shm_free(&client->shm);
+	event_filter_unref(&client->send_filter);
 	event_filter_unref(&client->filter);
 	connection_deinit(&client->conn);
 	timeout_remove(&client->to_reconnect);
@@ -0,0 +1,59 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "stats-dist.h"
+#include "stats-shm.h"
+
+void stats_shm_init(struct stats_shm_header *hdr, uint32_t generation,
+		    unsigned int dist_count)
+{
+	memset(hdr, 0, stats_shm_get_size(dist_count));
+	hdr->magic = STATS_SHM_MAGIC;
+	hdr->generation = generation;
+	hdr->dist_count = dist_count;
+}
+
+void stats_shm_dist_add(struct stats_shm_dist *dist, uint64_t value)
+{
+	unsigned int idx = stats_dist_get_bucket_index(value);
+
+	if (idx >= STATS_SHM_BUCKET_COUNT)
+		idx = STATS_SHM_BUCKET_COUNT - 1;
+	if (dist->count == 0 || dist->min > value)
+		dist->min = value;
+	if (dist->count == 0 || dist->max < value)
+		dist->max = value;
+	dist->sum += value;
+	dist->sum_squares += (double)value * value;
+	dist->buckets[idx]++;
+	/* the reader checks the count first */
+	__atomic_store_n(&dist->count, dist->count + 1, __ATOMIC_RELEASE);
+}
+
+void stats_shm_dist_scrape(const struct stats_shm_dist *dist,
+			   struct stats_shm_dist *prev,
+			   struct stats_dist *stats)
+{
+	uint32_t buckets[STATS_SHM_BUCKET_COUNT];
+	uint64_t count, sum;
+	double sum_squares;
+
+	count = __atomic_load_n(&dist->count, __ATOMIC_ACQUIRE);
+	if (count == prev->count)
+		return;
+
+	for (unsigned int i = 0; i < STATS_SHM_BUCKET_COUNT; i++) {
+		uint32_t value = dist->buckets[i];
+
+		buckets[i] = value - prev->buckets[i];
+		prev->buckets[i] = value;
+	}
+	sum = dist->sum;
+	sum_squares = dist->sum_squares;
+	stats_dist_add_buckets(stats, buckets, STATS_SHM_BUCKET_COUNT,
+			       sum - prev->sum, dist->min, dist->max,
+			       sum_squares - prev->sum_squares);
+	prev->count = count;
+	prev->sum = sum;
+	prev->sum_squares = sum_squares;
+}
@@ -0,0 +1,73 @@
+#ifndef STATS_SHM_H
+#define STATS_SHM_H
+
+/* Shared memory segment used for aggregating metrics with
+   metric_shared_memory=yes. The stats client creates the segment and sends
+   its fd to the stats process, which maps it read-only. The client adds the
+   matching events' values to it directly, and the stats process merges the
+   changes to its own metrics whenever it needs up-to-date metrics.
+
+   The segment begins with a header followed by the distributions in the
+   order the stats process listed the metrics: for each metric its duration
+   followed by each of its fields.
+
+   The client seals the segment's size with STATS_SHM_SEALS before sending
+   it, so the stats process can't crash with SIGBUS on accessing it. */
+
+struct stats_dist;
+
+#define STATS_SHM_MAGIC 0x53544d31 /* "STM1" */
+/* Seals required in the segment's memfd. Using this requires <fcntl.h>
+   with _GNU_SOURCE. */
+#define STATS_SHM_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)
+
+/* Values are counted into stats_dist buckets. Values larger than
+   STATS_SHM_MAX_BUCKET_VALUE (~12 days in microseconds) are counted in the
+   last bucket. Their sum and max are still exact. */
+#define STATS_SHM_MAX_BUCKET_VALUE (1ULL << 40)
+#define STATS_SHM_BUCKET_COUNT 1153
+
+struct stats_shm_header {
+	uint32_t magic;
+	/* generation given by the stats process */
+	uint32_t generation;
+	uint32_t dist_count;
+	uint32_t unused_padding;
+};
+
+struct stats_shm_dist {
+	/* Number of values. This is updated after the rest of the fields,
+	   so the reader can skip unchanged distributions cheaply. */
+	uint64_t count;
+	uint64_t sum, min, max;
+	double sum_squares;
+	uint32_t buckets[STATS_SHM_BUCKET_COUNT];
+};
+
+static inline size_t stats_shm_get_size(unsigned int dist_count)
+{
+	return sizeof(struct stats_shm_header) +
+		sizeof(struct stats_shm_dist) * dist_count;
+}
+
+static inline struct stats_shm_dist *
+stats_shm_get_dists(struct stats_shm_header *hdr)
+{
+	return (struct stats_shm_dist *)(hdr + 1);
+}
+
+/* Initialize a new segment. */
+void stats_shm_init(struct stats_shm_header *hdr, uint32_t generation,
+		    unsigned int dist_count);
+/* Add a value to the distribution. */
+void stats_shm_dist_add(struct stats_shm_dist *dist, uint64_t value);
+/* Add the values that were added to dist since it was scraped the last
+   time to stats. prev is the reader's private copy of the dist from the
+   last scrape. It's updated to match dist. The writer may be updating dist
+   at the same time, in which case the last value may be partially added.
+   The rest of it will be added by the next scrape. */
+void stats_shm_dist_scrape(const struct stats_shm_dist *dist,
+			   struct stats_shm_dist *prev,
+			   struct stats_dist *stats);
+
+#endif
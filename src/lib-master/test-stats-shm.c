@@ -0,0 +1,80 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "stats-dist.h"
+#include "stats-shm.h"
+#include "test-common.h"
+
+static void test_stats_shm_scrape(void)
+{
+	struct stats_shm_header *hdr;
+	struct stats_shm_dist *dists, *prev;
+	struct stats_dist *stats, *expected;
+	unsigned int i;
+
+	test_begin("stats shm scrape");
+	hdr = i_malloc(stats_shm_get_size(2));
+	stats_shm_init(hdr, 1, 2);
+	test_assert(hdr->magic == STATS_SHM_MAGIC);
+	dists = stats_shm_get_dists(hdr);
+	prev = i_new(struct stats_shm_dist, 2);
+	stats = stats_dist_init();
+	expected = stats_dist_init();
+
+	/* nothing added */
+	stats_shm_dist_scrape(&dists[0], &prev[0], stats);
+	test_assert(stats_dist_get_count(stats) == 0);
+
+	for (i = 0; i < 1000; i++) {
+		uint64_t value = i_rand_limit(100000);
+
+		stats_shm_dist_add(&dists[0], value);
+		stats_dist_add(expected, value);
+	}
+	stats_shm_dist_scrape(&dists[0], &prev[0], stats);
+	test_assert(stats_dist_get_count(stats) == 1000);
+
+	/* only the new values are added */
+	stats_shm_dist_add(&dists[0], 0);
+	stats_dist_add(expected, 0);
+	stats_shm_dist_add(&dists[0], STATS_SHM_MAX_BUCKET_VALUE * 2);
+	stats_dist_add(expected, STATS_SHM_MAX_BUCKET_VALUE * 2);
+	stats_shm_dist_scrape(&dists[0], &prev[0], stats);
+	stats_shm_dist_scrape(&dists[0], &prev[0], stats);
+
+	test_assert(stats_dist_get_count(stats) ==
+		    stats_dist_get_count(expected));
+	test_assert(stats_dist_get_sum(stats) == stats_dist_get_sum(expected));
+	test_assert(stats_dist_get_min(stats) == 0);
+	test_assert(stats_dist_get_max(stats) ==
+		    STATS_SHM_MAX_BUCKET_VALUE * 2);
+	test_assert(stats_dist_get_median(stats) ==
+		    stats_dist_get_median(expected));
+	test_assert(stats_dist_get_percentile(stats, 0.9) ==
+		    stats_dist_get_percentile(expected, 0.9));
+	test_assert(stats_dist_get_variance(stats) >
+		    stats_dist_get_variance(expected) * 0.999999 &&
+		    stats_dist_get_variance(stats) <
+		    stats_dist_get_variance(expected) * 1.000001);
+	for (i = 1; i <= 65536; i *= 2) {
+		test_assert_idx(stats_dist_get_count_le(stats, i) ==
+				stats_dist_get_count_le(expected, i), i);
+	}
+	/* the other dist wasn't touched */
+	test_assert(dists[1].count == 0);
+
+	stats_dist_deinit(&stats);
+	stats_dist_deinit(&expected);
+	i_free(prev);
+	i_free(hdr);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_stats_shm_scrape,
+		NULL
+	};
+	return test_run(test_functions);
+}
@@ -134,6 +134,29 @@ openssl_iostream_set(struct ssl_iostream *ssl_io)
 	}
 }
 
+static bool
+openssl_iostream_want_socket_bio(SSL *ssl, struct istream *input,
+				 struct ostream *output)
+{
+#ifdef SSL_OP_ENABLE_KTLS
+	int fd = i_stream_get_fd(input);
+
+	if ((SSL_get_options(ssl) & SSL_OP_ENABLE_KTLS) == 0)
+		return FALSE;
+	/* OpenSSL can enable kernel TLS only when it's doing the socket I/O
+	   itself. This is possible only when the plain streams are directly
+	   the socket's fd streams and nothing is buffered in them yet. */
+	return fd != -1 && fd == o_stream_get_fd(output) &&
+		input->real_stream->parent == NULL &&
+		output->real_stream->parent == NULL &&
+		i_stream_get_data_size(input) == 0 &&
+		o_stream_get_buffer_used_size(output) == 0;
+#else
+	(void)ssl; (void)input; (void)output;
+	return FALSE;
+#endif
+}
+
 static int
 openssl_iostream_create(struct ssl_iostream_context *ctx,
 			struct event *event_parent, const char *host,
@@ -145,7 +168,8 @@ openssl_iostream_create(struct ssl_iostream_context *ctx,
 {
 	struct ssl_iostream *ssl_io;
 	SSL *ssl;
-	BIO *bio_int, *bio_ext;
+	BIO *bio_int, *bio_ext = NULL;
+	bool socket_bio;
 
 	/* Don't allow an existing io_add_istream() to be use on the input.
 	   It would seem to work, but it would also cause hangs. */
@@ -158,12 +182,21 @@ openssl_iostream_create(struct ssl_iostream_context *ctx,
 		return -1;
 	}
 
+	socket_bio = openssl_iostream_want_socket_bio(ssl, *input, *output);
+	if (socket_bio) {
+		bio_int = BIO_new_socket(i_stream_get_fd(*input), BIO_NOCLOSE);
+		if (bio_int == NULL) {
+			*error_r = t_strdup_printf("BIO_new_socket() failed: %s",
+						   openssl_iostream_error());
+			SSL_free(ssl);
+			return -1;
+		}
 	/* BIO pairs use default buffer sizes (17 kB in OpenSSL 0.9.8e).
 	   Each of the BIOs have one "write buffer". BIO_write() copies data
 	   to them, while BIO_read() reads from the other BIO's write buffer
 	   into the given buffer. The bio_int is used by OpenSSL and bio_ext
 	   is used by this library. */
-	if (BIO_new_bio_pair(&bio_int, 0, &bio_ext, 0) != 1) {
+	} else if (BIO_new_bio_pair(&bio_int, 0, &bio_ext, 0) != 1) {
 		*error_r = t_strdup_printf("BIO_new_bio_pair() failed: %s",
 					   openssl_iostream_error());
 		SSL_free(ssl);
@@ -176,6 +209,7 @@ openssl_iostream_create(struct ssl_iostream_context *ctx,
 	ssl_iostream_context_ref(ssl_io->ctx);
 	ssl_io->ssl = ssl;
 	ssl_io->bio_ext = bio_ext;
+	ssl_io->socket_bio = socket_bio;
 	ssl_io->plain_input = *input;
 	ssl_io->plain_output = *output;
 	ssl_io->connected_host = i_strdup(host);
@@ -254,7 +288,9 @@ void openssl_iostream_shutdown(struct ssl_iostream *ssl_io)
 	(void)o_stream_flush(ssl_io->plain_output);
 
 	if (!ssl_io->closed &&
-	    (ssl_io->handshaked || ssl_io->handshake_failed || ssl_io->do_shutdown)) {
+	    (ssl_io->handshaked || ssl_io->handshake_failed || ssl_io->do_shutdown) &&
+	    (!ssl_io->ktls_send ||
+	     o_stream_get_buffer_used_size(ssl_io->plain_output) == 0)) {
 		/* Try shutting down connection. If it does not succeed at once,
 		   try once more. */
 		for (int i = 0; i < 2; i++) {
@@ -309,6 +345,15 @@ static int openssl_iostream_bio_output_real(struct ssl_iostream *ssl_io)
 	int result = 0;
 	int ret;
 
+	if (ssl_io->socket_bio) {
+		/* OpenSSL writes directly to the socket. Only the data written
+		   to plain_output with kernel TLS needs to be flushed. */
+		ret = o_stream_flush(ssl_io->plain_output);
+		if (ret == 0)
+			o_stream_set_flush_pending(ssl_io->plain_output, TRUE);
+		return ret < 0 ? -1 : 0;
+	}
+
 	o_stream_cork(ssl_io->plain_output);
 	while ((bytes = BIO_ctrl_pending(ssl_io->bio_ext)) > 0) {
 		/* bytes contains how many SSL encrypted bytes we should be
@@ -398,6 +443,10 @@ openssl_iostream_bio_input(struct ssl_iostream *ssl_io,
 	int ret;
 	bool bytes_read = FALSE;
 
+	if (ssl_io->socket_bio) {
+		/* OpenSSL reads directly from the socket */
+		return 0;
+	}
 	while ((bytes = BIO_ctrl_get_write_guarantee(ssl_io->bio_ext)) > 0) {
 		/* bytes contains how many bytes we can write to bio_ext */
 		ret = openssl_iostream_read_more(ssl_io, type, bytes,
@@ -488,6 +537,11 @@ int openssl_iostream_handle_error(struct ssl_iostream *ssl_io, int ret,
 	err = SSL_get_error(ssl_io->ssl, ret);
 	switch (err) {
 	case SSL_ERROR_WANT_WRITE:
+		if (ssl_io->socket_bio) {
+			/* continue when the socket is writable again */
+			o_stream_set_flush_pending(ssl_io->plain_output, TRUE);
+			return 0;
+		}
 		if (type != OPENSSL_IOSTREAM_SYNC_TYPE_NONE &&
 		    openssl_iostream_bio_sync(ssl_io, type) == 0) {
 			if (type != OPENSSL_IOSTREAM_SYNC_TYPE_WRITE)
@@ -636,6 +690,18 @@ static int openssl_iostream_handshake(struct ssl_iostream *ssl_io)
 	i_free_and_null(ssl_io->last_error);
 	ssl_io->handshaked = TRUE;
 
+	if (ssl_io->socket_bio) {
+		ssl_io->ktls_send = BIO_get_ktls_send(SSL_get_wbio(ssl_io->ssl));
+		e_debug(ssl_io->event, "SSL: Kernel TLS send=%s recv=%s",
+			ssl_io->ktls_send ? "yes" : "no",
+			BIO_get_ktls_recv(SSL_get_rbio(ssl_io->ssl)) ?
+			"yes" : "no");
+		/* the handshake may have been finished by the ostream while
+		   the istream was waiting for it */
+		if (ssl_io->ssl_input != NULL)
+			i_stream_set_input_pending(ssl_io->ssl_input, TRUE);
+	}
+
 	const char *alpn_proto = ssl_iostream_get_application_protocol(ssl_io);
 	if (alpn_proto != NULL && *alpn_proto != '\0')
 		e_debug(ssl_io->event, "SSL: Chosen application protocol %s", alpn_proto);
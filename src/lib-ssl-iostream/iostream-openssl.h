@@ -75,6 +75,12 @@ struct ssl_iostream {
 	bool ostream_flush_waiting_input:1;
 	bool closed:1;
 	bool destroyed:1;
+	/* OpenSSL does the I/O directly to the socket instead of using
+	   the BIO pair. This is required for kernel TLS. */
+	bool socket_bio:1;
+	/* Kernel TLS is encrypting the sent data. Application data can be
+	   written directly to plain_output. */
+	bool ktls_send:1;
 };
 
 extern int dovecot_ssl_extdata_index;
@@ -82,6 +82,9 @@ struct ssl_iostream_settings {
 	bool compression;
 	/* If FALSE, set SSL_OP_NO_TICKET. See OpenSSL documentation. */
 	bool tickets;
+	/* Enable kernel TLS offload (SSL_OP_ENABLE_KTLS) if both the OpenSSL
+	   library and the kernel support it. */
+	bool ktls;
 };
 
 /* Load SSL module */
@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "istream-private.h"
+#include "ostream.h"
 #include "iostream-openssl.h"
 
 struct ssl_istream {
@@ -40,6 +41,15 @@ static ssize_t i_stream_ssl_read(struct istream_private *stream)
 		stream->istream.eof = TRUE;
 		return -1;
 	}
+	if (ssl_io->socket_bio) {
+		/* OpenSSL reads directly from the socket, which may have
+		   become readable now. */
+		ssl_io->want_read = FALSE;
+		if (ssl_io->ostream_flush_waiting_input) {
+			ssl_io->ostream_flush_waiting_input = FALSE;
+			o_stream_set_flush_pending(ssl_io->plain_output, TRUE);
+		}
+	}
 
 	if (!ssl_io->handshaked) {
 		if ((ret = ssl_iostream_handshake(ssl_io)) <= 0) {
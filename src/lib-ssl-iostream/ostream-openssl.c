@@ -97,6 +97,25 @@ o_stream_ssl_buffer(struct ssl_ostream *sstream, const struct const_iovec *iov,
 	return bytes_sent;
 }
 
+static int o_stream_ssl_flush_buffer_ktls(struct ssl_ostream *sstream)
+{
+	struct ssl_iostream *ssl_io = sstream->ssl_io;
+	ssize_t ret;
+
+	/* the kernel encrypts the data written to the socket */
+	ret = o_stream_send(ssl_io->plain_output, sstream->buffer->data,
+			    sstream->buffer->used);
+	if (ret < 0) {
+		io_stream_set_error(&sstream->ostream.iostream, "%s",
+				    o_stream_get_error(ssl_io->plain_output));
+		sstream->ostream.ostream.stream_errno =
+			ssl_io->plain_output->stream_errno;
+		return -1;
+	}
+	buffer_delete(sstream->buffer, 0, ret);
+	return sstream->buffer->used == 0 ? 1 : 0;
+}
+
 static int o_stream_ssl_flush_buffer(struct ssl_ostream *sstream)
 {
 	struct ssl_iostream *ssl_io = sstream->ssl_io;
@@ -105,6 +124,9 @@ static int o_stream_ssl_flush_buffer(struct ssl_ostream *sstream)
 
 	i_assert(!sstream->shutdown);
 
+	if (ssl_io->ktls_send)
+		return o_stream_ssl_flush_buffer_ktls(sstream);
+
 	while (pos < sstream->buffer->used) {
 		/* we're writing plaintext data to OpenSSL, which it encrypts
 		   and writes to bio_int's buffer. ssl_iostream_bio_sync()
@@ -127,6 +149,11 @@ static int o_stream_ssl_flush_buffer(struct ssl_ostream *sstream)
 				break;
 		} else {
 			pos += ret;
+			if (ssl_io->socket_bio) {
+				/* OpenSSL already wrote it to the socket */
+				ret = 1;
+				continue;
+			}
 			ret = openssl_iostream_bio_sync(
 				ssl_io, OPENSSL_IOSTREAM_SYNC_TYPE_WRITE);
 			if (ret < 0) {
@@ -181,15 +208,28 @@ static int o_stream_ssl_flush(struct ostream_private *stream)
 	/* Stream is finished; shutdown the SSL write direction once our buffer
 	   is empty. */
 	if (stream->finished && !sstream->shutdown && ret >= 0 &&
-	    (sstream->buffer == NULL || sstream->buffer->used == 0)) {
-		sstream->shutdown = TRUE;
-		if (SSL_shutdown(ssl_io->ssl) < 0) {
-			io_stream_set_error(
-				&sstream->ostream.iostream, "%s",
-				t_strdup_printf("SSL_shutdown() failed: %s",
-						openssl_iostream_error()));
-			sstream->ostream.ostream.stream_errno = EIO;
-			ret = -1;
+	    (sstream->buffer == NULL || sstream->buffer->used == 0) &&
+	    (!ssl_io->ktls_send ||
+	     o_stream_get_buffer_used_size(plain_output) == 0)) {
+		openssl_iostream_clear_errors();
+		int shutdown_ret = SSL_shutdown(ssl_io->ssl);
+		if (shutdown_ret < 0 && ssl_io->socket_bio &&
+		    SSL_get_error(ssl_io->ssl, shutdown_ret) ==
+		    SSL_ERROR_WANT_WRITE) {
+			/* OpenSSL writes directly to the socket, which is
+			   full. Try again when it's writable. */
+			o_stream_set_flush_pending(plain_output, TRUE);
+			ret = 0;
+		} else {
+			sstream->shutdown = TRUE;
+			if (shutdown_ret < 0) {
+				io_stream_set_error(
+					&sstream->ostream.iostream, "%s",
+					t_strdup_printf("SSL_shutdown() failed: %s",
+							openssl_iostream_error()));
+				sstream->ostream.ostream.stream_errno = EIO;
+				ret = -1;
+			}
 		}
 	}
 
@@ -228,6 +268,35 @@ o_stream_ssl_sendv(struct ostream_private *stream,
 	return bytes_sent;
 }
 
+static enum ostream_send_istream_result
+o_stream_ssl_send_istream(struct ostream_private *outstream,
+			  struct istream *instream)
+{
+	struct ssl_ostream *sstream = (struct ssl_ostream *)outstream;
+	struct ssl_iostream *ssl_io = sstream->ssl_io;
+	struct ostream *plain_output = ssl_io->plain_output;
+	enum ostream_send_istream_result res;
+	uoff_t old_offset;
+
+	if (!ssl_io->ktls_send ||
+	    (sstream->buffer != NULL && sstream->buffer->used > 0))
+		return io_stream_copy(&outstream->ostream, instream);
+
+	/* The kernel encrypts the data, so plain_output can send it directly.
+	   This allows it to use sendfile() or splice(). */
+	if (outstream->allow_splice)
+		o_stream_set_splice(plain_output, TRUE);
+	old_offset = plain_output->offset;
+	res = o_stream_send_istream(plain_output, instream);
+	outstream->ostream.offset += plain_output->offset - old_offset;
+	if (res == OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT) {
+		io_stream_set_error(&outstream->iostream, "%s",
+				    o_stream_get_error(plain_output));
+		outstream->ostream.stream_errno = plain_output->stream_errno;
+	}
+	return res;
+}
+
 static void o_stream_ssl_switch_ioloop_to(struct ostream_private *stream,
 					  struct ioloop *ioloop)
 {
@@ -263,13 +332,18 @@ static size_t
 o_stream_ssl_get_buffer_used_size(const struct ostream_private *stream)
 {
 	const struct ssl_ostream *sstream = (const struct ssl_ostream *)stream;
-	BIO *bio = SSL_get_wbio(sstream->ssl_io->ssl);
-	size_t wbuf_avail = BIO_ctrl_get_write_guarantee(bio);
-	size_t wbuf_total_size = BIO_get_write_buf_size(bio, 0);
 	size_t buffer_used = (sstream->buffer == NULL ? 0 :
 			      sstream->buffer->used);
-	i_assert(wbuf_avail <= wbuf_total_size);
-	return buffer_used + (wbuf_total_size - wbuf_avail) +
+
+	if (!sstream->ssl_io->socket_bio) {
+		BIO *bio = SSL_get_wbio(sstream->ssl_io->ssl);
+		size_t wbuf_avail = BIO_ctrl_get_write_guarantee(bio);
+		size_t wbuf_total_size = BIO_get_write_buf_size(bio, 0);
+
+		i_assert(wbuf_avail <= wbuf_total_size);
+		buffer_used += wbuf_total_size - wbuf_avail;
+	}
+	return buffer_used +
 		o_stream_get_buffer_used_size(sstream->ssl_io->plain_output);
 }
 
@@ -319,6 +393,7 @@ struct ostream *openssl_o_stream_create_ssl(struct ssl_iostream *ssl_io)
 	sstream->ostream.iostream.destroy = o_stream_ssl_destroy;
 	sstream->ostream.sendv = o_stream_ssl_sendv;
 	sstream->ostream.flush = o_stream_ssl_flush;
+	sstream->ostream.send_istream = o_stream_ssl_send_istream;
 	sstream->ostream.switch_ioloop_to = o_stream_ssl_switch_ioloop_to;
 
 	sstream->ostream.get_buffer_used_size =
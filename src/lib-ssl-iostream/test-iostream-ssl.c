@@ -3,15 +3,21 @@
 #include "test-lib.h"
 #include "buffer.h"
 #include "randgen.h"
+#include "net.h"
+#include "write-full.h"
 #include "istream.h"
 #include "ostream.h"
 #include "iostream-openssl.h"
 #include "iostream-ssl.h"
 #include "iostream-ssl-test.h"
 
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/socket.h>
+#include <netinet/tcp.h>
 
 #define MAX_SENT_BYTES 10000
+#define KTLS_DATA_SIZE (256*1024)
 
 struct test_endpoint {
 	pool_t pool;
@@ -35,7 +41,12 @@ struct test_endpoint {
 
 static void send_output(struct test_endpoint *ep)
 {
+	/* Without the BIO pair (ktls) only the ssl ostream's own buffer is
+	   available while the socket is full. */
 	ssize_t amt = i_rand_limit(10)+1;
+	amt = I_MIN((size_t)amt, o_stream_get_buffer_avail_size(ep->output));
+	if (amt == 0)
+		return;
 	char data[amt];
 	random_fill(data, amt);
 	buffer_append(ep->other->last_write, data, amt);
@@ -352,6 +363,17 @@ static void test_iostream_ssl_handshake(void)
 							 "failhost") != 0, idx);
 	idx++;
 
+	/* OpenSSL doing the socket I/O for kernel TLS (the kernel may not
+	   actually support it) */
+	ssl_iostream_test_settings_server(&server_set);
+	ssl_iostream_test_settings_client(&client_set);
+	client_set.verify_remote_cert = TRUE;
+	server_set.ktls = TRUE;
+	client_set.ktls = TRUE;
+	test_assert_idx(test_iostream_ssl_handshake_real(&server_set, &client_set,
+							 "127.0.0.1") == 0, idx);
+	idx++;
+
 	/* invalid client credentials: missing credentials */
 	ssl_iostream_test_settings_server(&server_set);
 	ssl_iostream_test_settings_client(&client_set);
@@ -473,7 +495,7 @@ static void test_iostream_ssl_get_buffer_avail_size(void)
 	test_end();
 }
 
-static void test_iostream_ssl_small_packets(void)
+static void test_iostream_ssl_small_packets_real(bool ktls)
 {
 	struct ssl_iostream_settings set;
 	struct test_endpoint *server, *client;
@@ -481,7 +503,7 @@ static void test_iostream_ssl_small_packets(void)
 	int fd[2];
 	const char *error;
 
-	test_begin("ssl: small packets");
+	test_begin(ktls ? "ssl: small packets (ktls)" : "ssl: small packets");
 
 	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) < 0)
 		i_fatal("socketpair() failed: %m");
@@ -491,9 +513,11 @@ static void test_iostream_ssl_small_packets(void)
 	ioloop = io_loop_create();
 
 	ssl_iostream_test_settings_server(&set);
+	set.ktls = ktls;
 	server = create_test_endpoint(fd[0], &set);
 	ssl_iostream_test_settings_client(&set);
 	set.allow_invalid_cert = TRUE;
+	set.ktls = ktls;
 	client = create_test_endpoint(fd[1], &set);
 	client->client = TRUE;
 
@@ -548,12 +572,250 @@ static void test_iostream_ssl_small_packets(void)
 	test_end();
 }
 
+static void test_iostream_ssl_small_packets(void)
+{
+	test_iostream_ssl_small_packets_real(FALSE);
+	test_iostream_ssl_small_packets_real(TRUE);
+}
+
+#if defined(SSL_OP_ENABLE_KTLS) && defined(TCP_ULP)
+struct test_ktls_ctx {
+	struct test_endpoint *server;
+	buffer_t *data, *received;
+	struct istream *file_input;
+	uoff_t plain_offset;
+	size_t sent;
+	bool passthrough;
+	bool failed;
+};
+
+static void test_tcp_socketpair(int fd[2])
+{
+	struct ip_addr ip;
+	in_port_t port = 0;
+	int listen_fd;
+
+	if (net_addr2ip("127.0.0.1", &ip) < 0)
+		i_unreached();
+	listen_fd = net_listen(&ip, &port, 1);
+	if (listen_fd == -1)
+		i_fatal("net_listen(127.0.0.1) failed: %m");
+	fd[1] = net_connect_ip_blocking(&ip, port, NULL);
+	if (fd[1] == -1)
+		i_fatal("net_connect_ip(127.0.0.1) failed: %m");
+	fd[0] = net_accept(listen_fd, NULL, NULL);
+	if (fd[0] < 0)
+		i_fatal("net_accept() failed: %m");
+	i_close_fd(&listen_fd);
+	fd_set_nonblock(fd[0], TRUE);
+	fd_set_nonblock(fd[1], TRUE);
+}
+
+static bool test_ktls_available(void)
+{
+	int fd[2];
+	bool ret;
+
+	/* the kernel's "tls" module may be missing */
+	test_tcp_socketpair(fd);
+	ret = setsockopt(fd[0], SOL_TCP, TCP_ULP, "tls", sizeof("tls")) == 0;
+	i_close_fd(&fd[0]);
+	i_close_fd(&fd[1]);
+	return ret;
+}
+
+static int test_ktls_flush_callback(struct test_ktls_ctx *ctx)
+{
+	struct ostream *output = ctx->server->output;
+	struct ostream *plain_output = ctx->server->iostream->plain_output;
+	size_t half = ctx->data->used / 2;
+	ssize_t sent;
+	int ret;
+
+	if (ctx->sent < half) {
+		/* the first half goes through the ssl ostream's buffer */
+		sent = o_stream_send(output, CONST_PTR_OFFSET(ctx->data->data,
+							      ctx->sent),
+				     half - ctx->sent);
+		if (sent < 0) {
+			ctx->failed = TRUE;
+			io_loop_stop(current_ioloop);
+			return -1;
+		}
+		ctx->sent += sent;
+		if (ctx->sent < half)
+			return 0;
+	}
+	if ((ret = o_stream_flush(output)) <= 0) {
+		if (ret < 0) {
+			ctx->failed = TRUE;
+			io_loop_stop(current_ioloop);
+		}
+		return ret;
+	}
+	if (!ctx->passthrough) {
+		/* the kernel encrypts the data, so plain_output must have
+		   received it as-is */
+		test_assert(plain_output->offset - ctx->plain_offset == half);
+		ctx->plain_offset = plain_output->offset;
+		ctx->passthrough = TRUE;
+	}
+	if (ctx->sent < ctx->data->used) {
+		/* the second half is passed through to the plain ostream */
+		switch (o_stream_send_istream(output, ctx->file_input)) {
+		case OSTREAM_SEND_ISTREAM_RESULT_FINISHED:
+			break;
+		case OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT:
+			return 0;
+		case OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT:
+			i_unreached();
+		case OSTREAM_SEND_ISTREAM_RESULT_ERROR_INPUT:
+		case OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT:
+			ctx->failed = TRUE;
+			io_loop_stop(current_ioloop);
+			return -1;
+		}
+		ctx->sent = ctx->data->used;
+		test_assert(plain_output->offset - ctx->plain_offset ==
+			    ctx->data->used - half);
+	}
+	return o_stream_flush(output);
+}
+
+static void test_ktls_input_callback(struct test_ktls_ctx *ctx)
+{
+	struct test_endpoint *client = ctx->server->other;
+	const unsigned char *data;
+	size_t size;
+
+	while (i_stream_read_more(client->input, &data, &size) > 0) {
+		buffer_append(ctx->received, data, size);
+		i_stream_skip(client->input, size);
+	}
+	if (client->input->stream_errno != 0 || client->input->eof ||
+	    ctx->received->used >= ctx->data->used)
+		io_loop_stop(current_ioloop);
+}
+
+static void test_iostream_ssl_ktls(void)
+{
+	struct ssl_iostream_settings set;
+	struct test_endpoint *server, *client;
+	struct test_ktls_ctx ctx;
+	struct ioloop *ioloop;
+	struct timeout *to;
+	const char *error;
+	int fd[2], file_fd;
+
+	if (!test_ktls_available()) {
+		i_info("Kernel TLS not available - skipping ssl ktls test");
+		return;
+	}
+	test_begin("ssl: ktls over tcp");
+
+	test_tcp_socketpair(fd);
+	ioloop = io_loop_create();
+
+	ssl_iostream_test_settings_server(&set);
+	set.ktls = TRUE;
+	server = create_test_endpoint(fd[0], &set);
+	ssl_iostream_test_settings_client(&set);
+	set.allow_invalid_cert = TRUE;
+	set.ktls = TRUE;
+	client = create_test_endpoint(fd[1], &set);
+	client->client = TRUE;
+	client->other = server;
+	server->other = client;
+
+	test_assert(ssl_iostream_context_init_server(server->set, &server->ctx,
+		    &error) == 0);
+	test_assert(ssl_iostream_context_init_client(client->set, &client->ctx,
+		    &error) == 0);
+	test_assert(io_stream_create_ssl_server(server->ctx, NULL,
+						&server->input, &server->output,
+						&server->iostream, &error) == 0);
+	test_assert(io_stream_create_ssl_client(client->ctx, "localhost", NULL, 0,
+						&client->input, &client->output,
+						&client->iostream, &error) == 0);
+
+	to = timeout_add(5000, io_loop_stop, ioloop);
+	server->io = io_add_istream(server->input, handshake_input_callback,
+				    server);
+	client->io = io_add_istream(client->input, handshake_input_callback,
+				    client);
+	test_assert(ssl_iostream_handshake(client->iostream) == 0);
+	io_loop_run(ioloop);
+	io_remove(&server->io);
+	io_remove(&client->io);
+
+	test_assert(ssl_iostream_is_handshaked(server->iostream) &&
+		    ssl_iostream_is_handshaked(client->iostream));
+	test_assert(server->iostream->ktls_send);
+	test_assert(client->iostream->ktls_send);
+
+	i_zero(&ctx);
+	ctx.server = server;
+	ctx.data = buffer_create_dynamic(default_pool, KTLS_DATA_SIZE);
+	random_fill(buffer_append_space_unsafe(ctx.data, KTLS_DATA_SIZE),
+		    KTLS_DATA_SIZE);
+	ctx.received = buffer_create_dynamic(default_pool, KTLS_DATA_SIZE);
+	ctx.plain_offset = server->iostream->plain_output->offset;
+
+	/* the second half is sent from a file, so the plain ostream can use
+	   sendfile() */
+	file_fd = open(".test-iostream-ssl-ktls", O_RDWR | O_CREAT | O_TRUNC,
+		       0600);
+	if (file_fd == -1)
+		i_fatal("creat(.test-iostream-ssl-ktls) failed: %m");
+	i_unlink(".test-iostream-ssl-ktls");
+	if (write_full(file_fd, CONST_PTR_OFFSET(ctx.data->data,
+						 KTLS_DATA_SIZE / 2),
+		       KTLS_DATA_SIZE - KTLS_DATA_SIZE / 2) < 0)
+		i_fatal("write(.test-iostream-ssl-ktls) failed: %m");
+	ctx.file_input = i_stream_create_fd_autoclose(&file_fd, IO_BLOCK_SIZE);
+
+	o_stream_set_flush_callback(server->output, test_ktls_flush_callback,
+				    &ctx);
+	o_stream_set_flush_pending(server->output, TRUE);
+	client->io = io_add_istream(client->input, test_ktls_input_callback,
+				    &ctx);
+	io_loop_run(ioloop);
+	timeout_remove(&to);
+
+	test_assert(!ctx.failed);
+	test_assert(ctx.sent == KTLS_DATA_SIZE);
+	test_assert(client->input->stream_errno == 0);
+	test_assert(buffer_cmp(ctx.received, ctx.data));
+
+	o_stream_unset_flush_callback(server->output);
+	i_stream_unref(&ctx.file_input);
+	buffer_free(&ctx.data);
+	buffer_free(&ctx.received);
+
+	i_stream_unref(&server->input);
+	o_stream_unref(&server->output);
+	i_stream_unref(&client->input);
+	o_stream_unref(&client->output);
+
+	destroy_test_endpoint(&server);
+	destroy_test_endpoint(&client);
+
+	io_loop_destroy(&ioloop);
+	ssl_iostream_context_cache_free();
+
+	test_end();
+}
+#endif
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_iostream_ssl_handshake,
 		test_iostream_ssl_get_buffer_avail_size,
 		test_iostream_ssl_small_packets,
+#if defined(SSL_OP_ENABLE_KTLS) && defined(TCP_ULP)
+		test_iostream_ssl_ktls,
+#endif
 		NULL
 	};
 	ssl_iostream_openssl_init();
@@ -225,6 +225,8 @@ static int dbox_file_open_full(struct dbox_file *file, bool try_altpath,
 	file->input = i_stream_create_fd_autoclose(&fd, DBOX_READ_BLOCK_SIZE);
 	i_stream_set_name(file->input, file->cur_path);
 	i_stream_set_init_buffer_size(file->input, DBOX_READ_BLOCK_SIZE);
+	if (file->storage->storage.set->mail_read_async)
+		(void)i_stream_file_set_async(file->input, FALSE);
 	return dbox_file_read_header(file);
 }
 
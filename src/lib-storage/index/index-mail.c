@@ -80,6 +80,62 @@ struct mail_cache_field *index_mail_global_cache_fields_dup(void)
 	return i_memdup(global_cache_fields, sizeof(global_cache_fields));
 }
 
+static const struct {
+	enum mail_fetch_field fetch_field;
+	enum index_cache_field cache_field;
+} wanted_cache_fields[] = {
+	{ MAIL_FETCH_MESSAGE_PARTS, MAIL_CACHE_MESSAGE_PARTS },
+	{ MAIL_FETCH_DATE, MAIL_CACHE_SENT_DATE },
+	{ MAIL_FETCH_RECEIVED_DATE, MAIL_CACHE_RECEIVED_DATE },
+	{ MAIL_FETCH_SAVE_DATE, MAIL_CACHE_SAVE_DATE },
+	{ MAIL_FETCH_PHYSICAL_SIZE, MAIL_CACHE_PHYSICAL_FULL_SIZE },
+	{ MAIL_FETCH_VIRTUAL_SIZE, MAIL_CACHE_VIRTUAL_FULL_SIZE },
+	{ MAIL_FETCH_NUL_STATE, MAIL_CACHE_FLAGS },
+	{ MAIL_FETCH_IMAP_BODY, MAIL_CACHE_FLAGS },
+	{ MAIL_FETCH_IMAP_BODY, MAIL_CACHE_IMAP_BODY },
+	{ MAIL_FETCH_IMAP_BODY, MAIL_CACHE_IMAP_BODYSTRUCTURE },
+	{ MAIL_FETCH_IMAP_BODYSTRUCTURE, MAIL_CACHE_FLAGS },
+	{ MAIL_FETCH_IMAP_BODYSTRUCTURE, MAIL_CACHE_IMAP_BODYSTRUCTURE },
+	{ MAIL_FETCH_IMAP_ENVELOPE, MAIL_CACHE_IMAP_ENVELOPE },
+	{ MAIL_FETCH_UIDL_BACKEND, MAIL_CACHE_POP3_UIDL },
+	{ MAIL_FETCH_POP3_ORDER, MAIL_CACHE_POP3_ORDER },
+	{ MAIL_FETCH_GUID, MAIL_CACHE_GUID },
+	{ MAIL_FETCH_BODY_SNIPPET, MAIL_CACHE_BODY_SNIPPET },
+};
+
+static void
+wanted_cache_field_add(ARRAY_TYPE(uint) *field_idxs, unsigned int field_idx)
+{
+	unsigned int idx;
+
+	array_foreach_elem(field_idxs, idx) {
+		if (idx == field_idx)
+			return;
+	}
+	array_push_back(field_idxs, &field_idx);
+}
+
+void index_mail_get_wanted_cache_fields(struct mailbox *box,
+	enum mail_fetch_field wanted_fields,
+	struct mailbox_header_lookup_ctx *wanted_headers,
+	ARRAY_TYPE(uint) *field_idxs)
+{
+	struct index_mailbox_context *ibox = INDEX_STORAGE_CONTEXT(box);
+	const struct mail_cache_field *cache_fields = ibox->cache_fields;
+	unsigned int i;
+
+	for (i = 0; i < N_ELEMENTS(wanted_cache_fields); i++) {
+		if ((wanted_fields & wanted_cache_fields[i].fetch_field) != 0) {
+			wanted_cache_field_add(field_idxs,
+				cache_fields[wanted_cache_fields[i].cache_field].idx);
+		}
+	}
+	if (wanted_headers != NULL) {
+		for (i = 0; i < wanted_headers->count; i++)
+			wanted_cache_field_add(field_idxs, wanted_headers->idx[i]);
+	}
+}
+
 int index_mail_cache_lookup_field(struct index_mail *mail, buffer_t *buf,
 				  unsigned int field_idx)
 {
@@ -1770,7 +1826,7 @@ index_mail_alloc(struct mailbox_transaction_context *t,
 	struct index_mail *mail;
 	pool_t pool;
 
-	pool = pool_alloconly_create("mail", 2048);
+	pool = pool_slab_create("mail");
 	mail = p_new(pool, struct index_mail, 1);
 
 	index_mail_init(mail, t, wanted_fields, wanted_headers, pool, NULL);
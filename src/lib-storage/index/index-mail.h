@@ -163,6 +163,12 @@ struct index_mail {
 #define INDEX_MAIL(s)	container_of(s, struct index_mail, mail.mail)
 
 struct mail_cache_field *index_mail_global_cache_fields_dup(void);
+/* Add the cache fields that are looked up for the wanted fields and
+   headers to field_idxs. */
+void index_mail_get_wanted_cache_fields(struct mailbox *box,
+	enum mail_fetch_field wanted_fields,
+	struct mailbox_header_lookup_ctx *wanted_headers,
+	ARRAY_TYPE(uint) *field_idxs);
 
 struct mail *
 index_mail_alloc(struct mailbox_transaction_context *t,
@@ -19,6 +19,11 @@ struct index_search_context {
 	struct mailbox_header_lookup_ctx *extra_wanted_headers;
 
 	uint32_t seq1, seq2;
+	/* Cache fields for wanted_fields and wanted_headers, which are looked
+	   up with cache_batch for the messages up to cache_batch_seq2. */
+	ARRAY_TYPE(uint) cache_batch_fields;
+	struct mail_cache_lookup_batch *cache_batch;
+	uint32_t cache_batch_seq2;
 	struct mail *cur_mail;
 	struct index_mail *cur_imail;
 	struct mail_thread_context *thread_ctx;
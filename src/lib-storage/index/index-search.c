@@ -25,6 +25,9 @@
 
 #include <ctype.h>
 
+/* Number of messages whose wanted cache fields are looked up at once */
+#define SEARCH_CACHE_BATCH_MESSAGES 256
+
 #define SEARCH_COST_DENTRY 3ULL
 #define SEARCH_COST_ATTR 1ULL
 #define SEARCH_COST_FILES_READ 25ULL
@@ -1350,6 +1353,11 @@ index_storage_search_init(struct mailbox_transaction_context *t,
 	search_get_seqset(ctx, status.messages, args->args);
 	(void)mail_search_args_foreach(args->args, search_init_arg, ctx);
 
+	i_array_init(&ctx->cache_batch_fields, 8);
+	index_mail_get_wanted_cache_fields(t->box, ctx->mail_ctx.wanted_fields,
+					   ctx->mail_ctx.wanted_headers,
+					   &ctx->cache_batch_fields);
+
 	/* Need to reset results for match_always cases */
 	mail_search_args_reset(ctx->mail_ctx.args->args, FALSE);
 	return &ctx->mail_ctx;
@@ -1384,6 +1392,8 @@ int index_storage_search_deinit(struct mail_search_context *_ctx)
 	(void)mail_search_args_foreach(ctx->mail_ctx.args->args,
 				       search_arg_deinit, ctx);
 
+	mail_cache_lookup_batch_deinit(&ctx->cache_batch);
+	array_free(&ctx->cache_batch_fields);
 	mailbox_header_lookup_unref(&ctx->mail_ctx.wanted_headers);
 	if (ctx->mail_ctx.sort_program != NULL) {
 		if (index_sort_program_deinit(&ctx->mail_ctx.sort_program) < 0)
@@ -1885,9 +1895,38 @@ bool index_storage_search_next_nonblock(struct mail_search_context *_ctx,
 	return TRUE;
 }
 
-bool index_storage_search_next_update_seq(struct mail_search_context *_ctx)
+static void search_cache_batch_update(struct index_search_context *ctx)
 {
-        struct index_search_context *ctx = (struct index_search_context *)_ctx;
+	struct mail_cache_view *cache_view =
+		ctx->mail_ctx.transaction->cache_view;
+	const struct mail_search_arg *arg;
+	ARRAY_TYPE(seq_range) seqs;
+	uint32_t seq = ctx->mail_ctx.seq;
+
+	if (array_count(&ctx->cache_batch_fields) == 0 ||
+	    seq <= ctx->cache_batch_seq2)
+		return;
+
+	/* Look up the wanted cache fields for the next window of messages
+	   at once. Skip the messages that the top level sequence sets don't
+	   match, so sparse FETCH sequence sets don't waste lookups. */
+	mail_cache_lookup_batch_deinit(&ctx->cache_batch);
+	ctx->cache_batch_seq2 = seq + I_MIN(ctx->seq2 - seq,
+					    SEARCH_CACHE_BATCH_MESSAGES - 1);
+	t_array_init(&seqs, 8);
+	seq_range_array_add_range(&seqs, seq, ctx->cache_batch_seq2);
+	for (arg = ctx->mail_ctx.args->args; arg != NULL; arg = arg->next) {
+		if (arg->type == SEARCH_SEQSET && !arg->match_not)
+			seq_range_array_intersect(&seqs, &arg->value.seqset);
+	}
+	ctx->cache_batch = mail_cache_lookup_batch_init(cache_view, &seqs,
+		array_front(&ctx->cache_batch_fields),
+		array_count(&ctx->cache_batch_fields));
+}
+
+static bool search_next_update_seq(struct index_search_context *ctx)
+{
+	struct mail_search_context *_ctx = &ctx->mail_ctx;
 	uint32_t uid;
 	int ret;
 
@@ -1941,3 +1980,13 @@ bool index_storage_search_next_update_seq(struct mail_search_context *_ctx)
 	ctx->mail_ctx.progress_cur = _ctx->seq;
 	return ret != 0;
 }
+
+bool index_storage_search_next_update_seq(struct mail_search_context *_ctx)
+{
+        struct index_search_context *ctx = (struct index_search_context *)_ctx;
+
+	if (!search_next_update_seq(ctx))
+		return FALSE;
+	search_cache_batch_update(ctx);
+	return TRUE;
+}
@@ -8,6 +8,8 @@ struct mail_search_sort_program {
 	enum mail_sort_type sort_program[MAX_SORT_PROGRAM_SIZE];
 	struct mail *temp_mail;
 	unsigned int slow_mails_left;
+	/* Record extensions containing the numeric sort keys */
+	uint32_t arrival_ext_id, date_ext_id;
 
 	void (*sort_list_add)(struct mail_search_sort_program *program,
 			      struct mail *mail);
@@ -11,6 +11,18 @@
 #include "index-sort-private.h"
 
 
+/* Record extensions for the numeric sort keys. Each message's key is
+   written to the index the first time it's sorted by it, so the following
+   sorts can read the keys from the index records without going through
+   the cache file. 0 means the key isn't known yet. These are record
+   extensions rather than a separate per-field file, because the
+   transaction log then keeps them consistent between processes and
+   through expunges, the same way as the "sort-*" string sort IDs.
+   SIZE uses the existing "vsize" extension, which is already filled when
+   mails are saved. */
+#define INDEX_SORT_ARRIVAL_EXT_NAME "sort-arrival"
+#define INDEX_SORT_DATE_EXT_NAME "sort-date"
+
 struct mail_sort_node_date {
 	uint32_t seq;
 	time_t date;
@@ -71,6 +83,96 @@ index_sort_program_set_date_failed(struct mail_search_sort_program *program,
 	}
 }
 
+static bool
+index_sort_key_lookup(struct mail_search_sort_program *program,
+		      uint32_t ext_id, uint32_t seq, uint32_t *key_r)
+{
+	const void *data;
+	bool expunged;
+
+	mail_index_lookup_ext(program->t->view, seq, ext_id, &data, &expunged);
+	if (data == NULL || *(const uint32_t *)data == 0)
+		return FALSE;
+	*key_r = *(const uint32_t *)data;
+	return TRUE;
+}
+
+static void
+index_sort_key_update(struct mail_search_sort_program *program,
+		      uint32_t ext_id, uint32_t seq, uint32_t key)
+{
+	if (key == 0 || mail_index_is_expunged(program->t->view, seq))
+		return;
+	mail_index_update_ext(program->t->itrans, seq, ext_id, &key, NULL);
+}
+
+static void
+index_sort_date_key_update(struct mail_search_sort_program *program,
+			   uint32_t ext_id, uint32_t seq, time_t date)
+{
+	/* dates before 1970 or after 2106 are always looked up */
+	if (date > 0 && (uintmax_t)date < (uint32_t)-1)
+		index_sort_key_update(program, ext_id, seq, date);
+}
+
+static int
+index_sort_get_received_date(struct mail_search_sort_program *program,
+			     struct mail *mail, time_t *date_r)
+{
+	uint32_t key;
+
+	if (index_sort_key_lookup(program, program->arrival_ext_id,
+				  mail->seq, &key)) {
+		*date_r = key;
+		return 0;
+	}
+	if (mail_get_received_date(mail, date_r) < 0)
+		return -1;
+	index_sort_date_key_update(program, program->arrival_ext_id,
+				   mail->seq, *date_r);
+	return 0;
+}
+
+static int
+index_sort_get_date(struct mail_search_sort_program *program,
+		    struct mail *mail, time_t *date_r)
+{
+	uint32_t key;
+	int tz;
+
+	if (index_sort_key_lookup(program, program->date_ext_id,
+				  mail->seq, &key)) {
+		*date_r = key;
+		return 0;
+	}
+	if (mail_get_date(mail, date_r, &tz) < 0)
+		return -1;
+	if (*date_r == 0) {
+		/* no Date: header - use the received date instead */
+		if (index_sort_get_received_date(program, mail, date_r) < 0)
+			return -1;
+	}
+	index_sort_date_key_update(program, program->date_ext_id,
+				   mail->seq, *date_r);
+	return 0;
+}
+
+static int
+index_sort_get_size(struct mail_search_sort_program *program,
+		    struct mail *mail, uoff_t *size_r)
+{
+	uint32_t key;
+
+	/* "vsize" contains the virtual size + 1 */
+	if (index_sort_key_lookup(program, mail->box->mail_vsize_ext_id,
+				  mail->seq, &key)) {
+		*size_r = key - 1;
+		return 0;
+	}
+	/* this also adds the size to the "vsize" extension */
+	return mail_get_virtual_size(mail, size_r);
+}
+
 static void
 index_sort_list_add_arrival(struct mail_search_sort_program *program,
 			    struct mail *mail)
@@ -80,7 +182,7 @@ index_sort_list_add_arrival(struct mail_search_sort_program *program,
 
 	node = array_append_space(nodes);
 	node->seq = mail->seq;
-	if (mail_get_received_date(mail, &node->date) < 0)
+	if (index_sort_get_received_date(program, mail, &node->date) < 0)
 		node->date = index_sort_program_set_date_failed(program, mail);
 }
 
@@ -90,16 +192,11 @@ index_sort_list_add_date(struct mail_search_sort_program *program,
 {
 	ARRAY_TYPE(mail_sort_node_date) *nodes = program->context;
 	struct mail_sort_node_date *node;
-	int tz;
 
 	node = array_append_space(nodes);
 	node->seq = mail->seq;
-	if (mail_get_date(mail, &node->date, &tz) < 0)
+	if (index_sort_get_date(program, mail, &node->date) < 0)
 		node->date = index_sort_program_set_date_failed(program, mail);
-	else if (node->date == 0) {
-		if (mail_get_received_date(mail, &node->date) < 0)
-			node->date = index_sort_program_set_date_failed(program, mail);
-	}
 }
 
 static void
@@ -111,7 +208,7 @@ index_sort_list_add_size(struct mail_search_sort_program *program,
 
 	node = array_append_space(nodes);
 	node->seq = mail->seq;
-	if (mail_get_virtual_size(mail, &node->size) < 0) {
+	if (index_sort_get_size(program, mail, &node->size) < 0) {
 		index_sort_program_set_mail_failed(program, mail);
 		node->size = 0;
 	}
@@ -390,6 +487,15 @@ index_sort_program_init(struct mailbox_transaction_context *t,
 	if (wanted_headers != NULL)
 		mailbox_header_lookup_unref(&wanted_headers);
 
+	program->arrival_ext_id =
+		mail_index_ext_register(t->box->index,
+					INDEX_SORT_ARRIVAL_EXT_NAME, 0,
+					sizeof(uint32_t), sizeof(uint32_t));
+	program->date_ext_id =
+		mail_index_ext_register(t->box->index,
+					INDEX_SORT_DATE_EXT_NAME, 0,
+					sizeof(uint32_t), sizeof(uint32_t));
+
 	program->slow_mails_left =
 		program->t->box->storage->set->mail_sort_max_read_count;
 	if (program->slow_mails_left == 0)
@@ -622,7 +728,7 @@ int index_sort_node_cmp_type(struct mail_search_sort_program *program,
 	time_t time1, time2;
 	uoff_t size1, size2;
 	float float1, float2;
-	int tz, ret = 0;
+	int ret = 0;
 
 	sort_type = *sort_program & MAIL_SORT_MASK;
 	switch (sort_type) {
@@ -647,11 +753,11 @@ int index_sort_node_cmp_type(struct mail_search_sort_program *program,
 		break;
 	case MAIL_SORT_ARRIVAL:
 		index_sort_set_seq(program, mail, seq1);
-		if (mail_get_received_date(mail, &time1) < 0)
+		if (index_sort_get_received_date(program, mail, &time1) < 0)
 			time1 = index_sort_program_set_date_failed(program, mail);
 
 		index_sort_set_seq(program, mail, seq2);
-		if (mail_get_received_date(mail, &time2) < 0)
+		if (index_sort_get_received_date(program, mail, &time2) < 0)
 			time2 = index_sort_program_set_date_failed(program, mail);
 
 		ret = time1 < time2 ? -1 :
@@ -659,33 +765,25 @@ int index_sort_node_cmp_type(struct mail_search_sort_program *program,
 		break;
 	case MAIL_SORT_DATE:
 		index_sort_set_seq(program, mail, seq1);
-		if (mail_get_date(mail, &time1, &tz) < 0)
+		if (index_sort_get_date(program, mail, &time1) < 0)
 			time1 = index_sort_program_set_date_failed(program, mail);
-		else if (time1 == 0) {
-			if (mail_get_received_date(mail, &time1) < 0)
-				time1 = index_sort_program_set_date_failed(program, mail);
-		}
 
 		index_sort_set_seq(program, mail, seq2);
-		if (mail_get_date(mail, &time2, &tz) < 0)
+		if (index_sort_get_date(program, mail, &time2) < 0)
 			time2 = index_sort_program_set_date_failed(program, mail);
-		else if (time2 == 0) {
-			if (mail_get_received_date(mail, &time2) < 0)
-				time2 = index_sort_program_set_date_failed(program, mail);
-		}
 
 		ret = time1 < time2 ? -1 :
 			(time1 > time2 ? 1 : 0);
 		break;
 	case MAIL_SORT_SIZE:
 		index_sort_set_seq(program, mail, seq1);
-		if (mail_get_virtual_size(mail, &size1) < 0) {
+		if (index_sort_get_size(program, mail, &size1) < 0) {
 			index_sort_program_set_mail_failed(program, mail);
 			size1 = 0;
 		}
 
 		index_sort_set_seq(program, mail, seq2);
-		if (mail_get_virtual_size(mail, &size2) < 0) {
+		if (index_sort_get_size(program, mail, &size2) < 0) {
 			index_sort_program_set_mail_failed(program, mail);
 			size2 = 0;
 		}
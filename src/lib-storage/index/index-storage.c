@@ -280,6 +280,7 @@ int index_storage_mailbox_alloc_index(struct mailbox *box)
 		.index = {
 			.rewrite_min_log_bytes = set->mail_index_rewrite_min_log_bytes,
 			.rewrite_max_log_bytes = set->mail_index_rewrite_max_log_bytes,
+			.incremental_write = set->mail_index_incremental_write,
 		},
 		.log = {
 			.min_size = set->mail_index_log_rotate_min_size,
@@ -297,6 +298,7 @@ int index_storage_mailbox_alloc_index(struct mailbox *box)
 			.purge_delete_percentage = set->mail_cache_purge_delete_percentage,
 			.purge_continued_percentage = set->mail_cache_purge_continued_percentage,
 			.purge_header_continue_count = set->mail_cache_purge_header_continue_count,
+			.mmap_shared = set->mail_cache_mmap_shared,
 		},
 	};
 	mail_index_set_optimization_settings(box->index, &optimization_set);
@@ -98,6 +98,8 @@ maildir_open_mail(struct maildir_mailbox *mbox, struct mail *mail,
 	} else {
 		i_stream_set_name(input, ctx.path);
 		index_mail_set_read_buffer_size(mail, input);
+		if (mbox->storage->storage.set->mail_read_async)
+			(void)i_stream_file_set_async(input, FALSE);
 	}
 	i_free(ctx.path);
 	return input;
@@ -467,8 +467,8 @@ mail_duplicate_transaction_begin(struct mail_duplicate_db *db)
 	e_debug(trans->event, "Transaction begin; lock %s", db->path);
 
 	trans->path = p_strdup(pool, db->path);
-	hash_table_create(&trans->hash, pool, 0,
-			  mail_duplicate_hash, mail_duplicate_cmp);
+	hash_table_create_flat(&trans->hash, pool, 0,
+			       mail_duplicate_hash, mail_duplicate_cmp);
 
 	mail_duplicate_read(trans);
 
@@ -57,8 +57,10 @@ static const struct setting_define mail_storage_setting_defines[] = {
 	DEF(UINT_HIDDEN, mail_cache_purge_delete_percentage),
 	DEF(UINT_HIDDEN, mail_cache_purge_continued_percentage),
 	DEF(UINT_HIDDEN, mail_cache_purge_header_continue_count),
+	DEF(BOOL_HIDDEN, mail_cache_mmap_shared),
 	DEF(SIZE_HIDDEN, mail_index_rewrite_min_log_bytes),
 	DEF(SIZE_HIDDEN, mail_index_rewrite_max_log_bytes),
+	DEF(BOOL_HIDDEN, mail_index_incremental_write),
 	DEF(SIZE_HIDDEN, mail_index_log_rotate_min_size),
 	DEF(SIZE_HIDDEN, mail_index_log_rotate_max_size),
 	DEF(TIME_HIDDEN, mail_index_log_rotate_min_age),
@@ -70,6 +72,7 @@ static const struct setting_define mail_storage_setting_defines[] = {
 	DEF(UINT, mail_vsize_bg_after_count),
 	DEF(UINT, mail_sort_max_read_count),
 	DEF(BOOL_HIDDEN, mail_save_crlf),
+	DEF(BOOL_HIDDEN, mail_read_async),
 	DEF(ENUM, mail_fsync),
 	DEF(BOOL, mmap_disable),
 	DEF(BOOL, dotlock_use_excl),
@@ -135,8 +138,10 @@ const struct mail_storage_settings mail_storage_default_settings = {
 	.mail_cache_purge_delete_percentage = 20,
 	.mail_cache_purge_continued_percentage = 200,
 	.mail_cache_purge_header_continue_count = 4,
+	.mail_cache_mmap_shared = FALSE,
 	.mail_index_rewrite_min_log_bytes = 8 * 1024,
 	.mail_index_rewrite_max_log_bytes = 128 * 1024,
+	.mail_index_incremental_write = FALSE,
 	.mail_index_log_rotate_min_size = 32 * 1024,
 	.mail_index_log_rotate_max_size = 1024 * 1024,
 	.mail_index_log_rotate_min_age = 5 * 60,
@@ -148,6 +153,7 @@ const struct mail_storage_settings mail_storage_default_settings = {
 	.mail_vsize_bg_after_count = 0,
 	.mail_sort_max_read_count = 0,
 	.mail_save_crlf = FALSE,
+	.mail_read_async = FALSE,
 	.mail_fsync = "optimized:never:always",
 	.mmap_disable = FALSE,
 	.dotlock_use_excl = TRUE,
@@ -596,6 +602,18 @@ mail_storage_settings_ext_check(struct event *event ATTR_UNUSED,
 		return FALSE;
 	}
 
+	if (set->mail_index_incremental_write && !set->mmap_disable) {
+		*error_r = "mail_index_incremental_write=yes requires mmap_disable=yes";
+		return FALSE;
+	}
+	if (set->mail_cache_mmap_shared && !set->mmap_disable) {
+		*error_r = "mail_cache_mmap_shared=yes requires mmap_disable=yes";
+		return FALSE;
+	}
+	if (set->mail_cache_mmap_shared && set->mail_nfs_index) {
+		*error_r = "mail_cache_mmap_shared=yes can't be used with mail_nfs_index=yes";
+		return FALSE;
+	}
 	if (set->mail_nfs_index && !set->mmap_disable) {
 		*error_r = "mail_nfs_index=yes requires mmap_disable=yes";
 		return FALSE;
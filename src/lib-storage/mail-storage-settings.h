@@ -38,8 +38,10 @@ struct mail_storage_settings {
 	unsigned int mail_cache_purge_delete_percentage;
 	unsigned int mail_cache_purge_continued_percentage;
 	unsigned int mail_cache_purge_header_continue_count;
+	bool mail_cache_mmap_shared;
 	uoff_t mail_index_rewrite_min_log_bytes;
 	uoff_t mail_index_rewrite_max_log_bytes;
+	bool mail_index_incremental_write;
 	uoff_t mail_index_log_rotate_min_size;
 	uoff_t mail_index_log_rotate_max_size;
 	unsigned int mail_index_log_rotate_min_age;
@@ -51,6 +53,7 @@ struct mail_storage_settings {
 	unsigned int mail_vsize_bg_after_count;
 	unsigned int mail_sort_max_read_count;
 	bool mail_save_crlf;
+	bool mail_read_async;
 	const char *mail_fsync;
 	bool mmap_disable;
 	bool dotlock_use_excl;
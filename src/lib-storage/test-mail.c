@@ -5,6 +5,7 @@
 #include "istream.h"
 #include "master-service.h"
 #include "message-size.h"
+#include "mail-search-build.h"
 #include "test-mail-storage-common.h"
 
 static struct event *test_event;
@@ -724,6 +725,144 @@ static void test_mail_get_last_internal_error(void)
 	test_mail_storage_deinit(&ctx);
 }
 
+static void
+test_mail_sort(struct mailbox *box, enum mail_sort_type sort_type,
+	       ARRAY_TYPE(uint32_t) *seqs)
+{
+	const enum mail_sort_type sort_program[] = { sort_type, MAIL_SORT_END };
+	struct mailbox_transaction_context *trans;
+	struct mail_search_context *search_ctx;
+	struct mail_search_args *args;
+	struct mail *mail;
+
+	array_clear(seqs);
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	args = mail_search_build_init();
+	mail_search_build_add_all(args);
+	search_ctx = mailbox_search_init(trans, args, sort_program, 0, NULL);
+	while (mailbox_search_next(search_ctx, &mail))
+		array_push_back(seqs, &mail->seq);
+	test_assert(mailbox_search_deinit(&search_ctx) == 0);
+	mail_search_args_unref(&args);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	if (mailbox_sync(box, 0) < 0)
+		i_fatal("Failed to sync mailbox: %s",
+			mailbox_get_last_internal_error(box, NULL));
+}
+
+static bool
+test_mail_sort_key_exists(struct mailbox *box, const char *ext_name,
+			  uint32_t seq)
+{
+	const void *data;
+	uint32_t ext_id;
+	bool expunged;
+
+	if (!mail_index_ext_lookup(box->index, ext_name, &ext_id))
+		return FALSE;
+	mail_index_lookup_ext(box->view, seq, ext_id, &data, &expunged);
+	return data != NULL && *(const uint32_t *)data != 0;
+}
+
+static void
+test_mail_sort_key_set(struct mailbox *box, const char *ext_name,
+		       uint32_t seq, uint32_t key)
+{
+	struct mail_index_transaction *trans;
+	uint32_t ext_id;
+
+	if (!mail_index_ext_lookup(box->index, ext_name, &ext_id))
+		i_unreached();
+	trans = mail_index_transaction_begin(box->view, 0);
+	mail_index_update_ext(trans, seq, ext_id, &key, NULL);
+	if (mail_index_transaction_commit(&trans) < 0)
+		i_fatal("Failed to commit index transaction");
+	if (mailbox_sync(box, 0) < 0)
+		i_fatal("Failed to sync mailbox: %s",
+			mailbox_get_last_internal_error(box, NULL));
+}
+
+static void test_mail_sort_keys(void)
+{
+	static const struct {
+		enum mail_sort_type sort_type;
+		const char *ext_name;
+		uint32_t seqs[4];
+	} tests[] = {
+		{ MAIL_SORT_DATE, "sort-date", { 3, 1, 4, 2 } },
+		{ MAIL_SORT_SIZE, "vsize", { 4, 2, 1, 3 } },
+		{ MAIL_SORT_DATE | MAIL_SORT_FLAG_REVERSE, "sort-date",
+		  { 2, 4, 1, 3 } },
+	};
+	struct test_mail_storage_ctx *ctx;
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+	};
+	ARRAY_TYPE(uint32_t) seqs;
+	struct mailbox *box;
+	const uint32_t *seqp;
+	unsigned int i, j, count;
+	uint32_t key;
+	bool reverse;
+
+	test_begin("mail sort keys");
+	ctx = test_mail_storage_init();
+	test_mail_storage_init_user(ctx, &set);
+	box = mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	if (mailbox_open(box) < 0)
+		i_fatal("Failed to open mailbox: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	test_mail_save(box, "Date: Tue, 1 Feb 2011 10:00:00 +0000\n"
+		       "Subject: medium\n\nmedium body\n");
+	test_mail_save(box, "Date: Sat, 1 Feb 2020 10:00:00 +0000\n"
+		       "Subject: small\n\nsmall\n");
+	test_mail_save(box, "Date: Fri, 1 Feb 2002 10:00:00 +0000\n"
+		       "Subject: large\n\nlarge body large body\n");
+	test_mail_save(box, "Date: Mon, 1 Feb 2016 10:00:00 +0000\n"
+		       "Subject: tiny\n\n\n");
+
+	i_array_init(&seqs, 4);
+	for (i = 0; i < N_ELEMENTS(tests); i++) {
+		/* the first sort writes the keys to index */
+		test_mail_sort(box, tests[i].sort_type, &seqs);
+		seqp = array_get(&seqs, &count);
+		test_assert_idx(count == N_ELEMENTS(tests[i].seqs), i);
+		for (j = 0; j < count && j < N_ELEMENTS(tests[i].seqs); j++)
+			test_assert_idx(seqp[j] == tests[i].seqs[j], i);
+		for (j = 1; j <= N_ELEMENTS(tests[i].seqs); j++) {
+			test_assert_idx(test_mail_sort_key_exists(box,
+					tests[i].ext_name, j), i);
+		}
+
+		/* replace the keys with ones giving the opposite order. The
+		   second sort must follow them, so it didn't look up the
+		   values from the cache. */
+		reverse = (tests[i].sort_type & MAIL_SORT_FLAG_REVERSE) != 0;
+		count = N_ELEMENTS(tests[i].seqs);
+		for (j = 0; j < count; j++) {
+			key = 1000 + (reverse ? j : count - j);
+			test_mail_sort_key_set(box, tests[i].ext_name,
+					       tests[i].seqs[j], key);
+		}
+		test_mail_sort(box, tests[i].sort_type, &seqs);
+		seqp = array_get(&seqs, &count);
+		test_assert_idx(count == N_ELEMENTS(tests[i].seqs), i);
+		for (j = 0; j < count && j < N_ELEMENTS(tests[i].seqs); j++)
+			test_assert_idx(seqp[j] == tests[i].seqs[count-1-j], i);
+
+		/* forget the fake keys, so they're looked up again */
+		for (j = 1; j <= N_ELEMENTS(tests[i].seqs); j++)
+			test_mail_sort_key_set(box, tests[i].ext_name, j, 0);
+	}
+	test_assert(!test_mail_sort_key_exists(box, "sort-arrival", 1));
+	array_free(&seqs);
+
+	mailbox_free(&box);
+	test_mail_storage_deinit_user(ctx);
+	test_mail_storage_deinit(&ctx);
+	test_end();
+}
+
 int main(int argc, char **argv)
 {
 	void (*const tests[])(void) = {
@@ -734,6 +873,7 @@ int main(int argc, char **argv)
 		test_mail_set_critical,
 		test_mail_set_critical_different_mailboxes,
 		test_mail_get_last_internal_error,
+		test_mail_sort_keys,
 		NULL
 	};
 	int ret;
@@ -4,6 +4,427 @@
 #include "base64.h"
 #include "buffer.h"
 
+/*
+ * Bulk encoding and decoding
+ */
+
+/* The SIMD code assumes that the first 62 characters of the encoding map are
+   A-Z, a-z and 0-9 in that order, which is true for all the schemes defined
+   in this file. Only the last two characters are taken from the scheme. */
+#if defined(__x86_64__) && defined(__GNUC__) && \
+	(__GNUC__ >= 5 || defined(__clang__))
+#  define HAVE_BASE64_X86_SIMD
+#  include <immintrin.h>
+#  define ATTR_TARGET_SSSE3 __attribute__((target("ssse3")))
+#  define ATTR_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+/* Number of 4 character blocks decoded at once to a stack buffer */
+#define BASE64_DECODE_BULK_BLOCKS 256
+
+enum base64_simd {
+	BASE64_SIMD_UNKNOWN = 0,
+	BASE64_SIMD_NONE,
+	BASE64_SIMD_SSSE3,
+	BASE64_SIMD_AVX2,
+};
+
+static enum base64_simd base64_simd = BASE64_SIMD_UNKNOWN;
+
+static enum base64_simd base64_simd_detect(void)
+{
+#ifdef HAVE_BASE64_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return BASE64_SIMD_AVX2;
+	if (__builtin_cpu_supports("ssse3"))
+		return BASE64_SIMD_SSSE3;
+#endif
+	return BASE64_SIMD_NONE;
+}
+
+static inline enum base64_simd
+base64_get_scheme_simd(const struct base64_scheme *b64)
+{
+	if (b64 != &base64_scheme && b64 != &base64url_scheme)
+		return BASE64_SIMD_NONE;
+	if (unlikely(base64_simd == BASE64_SIMD_UNKNOWN))
+		base64_simd = base64_simd_detect();
+	return base64_simd;
+}
+
+const char *base64_get_simd(void)
+{
+	switch (base64_get_scheme_simd(&base64_scheme)) {
+	case BASE64_SIMD_UNKNOWN:
+	case BASE64_SIMD_NONE:
+		break;
+	case BASE64_SIMD_SSSE3:
+		return "ssse3";
+	case BASE64_SIMD_AVX2:
+		return "avx2";
+	}
+	return NULL;
+}
+
+void base64_set_simd(bool enabled)
+{
+	base64_simd = enabled ? base64_simd_detect() : BASE64_SIMD_NONE;
+}
+
+static void
+base64_encode_blocks_scalar(const struct base64_scheme *b64,
+			    const unsigned char *src, unsigned char *dst,
+			    size_t blocks)
+{
+	const char *b64enc = b64->encmap;
+
+	for (; blocks > 0; blocks--, src += 3, dst += 4) {
+		dst[0] = b64enc[src[0] >> 2];
+		dst[1] = b64enc[((src[0] & 0x03) << 4) | (src[1] >> 4)];
+		dst[2] = b64enc[((src[1] & 0x0f) << 2) | (src[2] >> 6)];
+		dst[3] = b64enc[src[2] & 0x3f];
+	}
+}
+
+/* Decode 4 character blocks until a block containing a character that isn't
+   in the scheme's alphabet (whitespace, padding, garbage). Returns the number
+   of blocks decoded. */
+static size_t
+base64_decode_blocks_scalar(const struct base64_scheme *b64,
+			    const unsigned char *src, unsigned char *dst,
+			    size_t blocks)
+{
+	const unsigned char *b64dec = b64->decmap;
+	unsigned int d0, d1, d2, d3;
+	size_t i;
+
+	for (i = 0; i < blocks; i++, src += 4, dst += 3) {
+		d0 = b64dec[src[0]];
+		d1 = b64dec[src[1]];
+		d2 = b64dec[src[2]];
+		d3 = b64dec[src[3]];
+		if (((d0 | d1 | d2 | d3) & 0x80) != 0)
+			break;
+		dst[0] = ((d0 << 2) | (d1 >> 4)) & 0xff;
+		dst[1] = ((d1 << 4) | (d2 >> 2)) & 0xff;
+		dst[2] = ((d2 << 6) | d3) & 0xff;
+	}
+	return i;
+}
+
+#ifdef HAVE_BASE64_X86_SIMD
+/* Each 128bit lane encodes 12 bytes into 16 characters: the bytes are first
+   shuffled so that each 32bit word contains one 3 byte group, and the 6bit
+   values are then moved into their own bytes with multiplications. The values
+   are converted to characters by adding an offset that depends on the value's
+   range. */
+
+static inline __m128i ATTR_TARGET_SSSE3
+base64_encode_unpack_ssse3(__m128i in)
+{
+	__m128i t0, t1;
+
+	in = _mm_shuffle_epi8(in, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+						7, 6, 8, 7, 10, 9, 11, 10));
+	t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)),
+			     _mm_set1_epi32(0x04000040));
+	t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)),
+			     _mm_set1_epi32(0x01000010));
+	return _mm_or_si128(t0, t1);
+}
+
+static inline __m128i ATTR_TARGET_SSSE3
+base64_encode_map_ssse3(__m128i idx, char c62, char c63)
+{
+	__m128i offset = _mm_set1_epi8('A');
+
+	offset = _mm_add_epi8(offset, _mm_and_si128(
+		_mm_cmpgt_epi8(idx, _mm_set1_epi8(25)),
+		_mm_set1_epi8(('a' - 26) - 'A')));
+	offset = _mm_add_epi8(offset, _mm_and_si128(
+		_mm_cmpgt_epi8(idx, _mm_set1_epi8(51)),
+		_mm_set1_epi8(('0' - 52) - ('a' - 26))));
+	offset = _mm_add_epi8(offset, _mm_and_si128(
+		_mm_cmpeq_epi8(idx, _mm_set1_epi8(62)),
+		_mm_set1_epi8((c62 - 62) - ('0' - 52))));
+	offset = _mm_add_epi8(offset, _mm_and_si128(
+		_mm_cmpeq_epi8(idx, _mm_set1_epi8(63)),
+		_mm_set1_epi8((c63 - 63) - ('0' - 52))));
+	return _mm_add_epi8(idx, offset);
+}
+
+static inline size_t ATTR_TARGET_SSSE3
+base64_encode_blocks_ssse3(const struct base64_scheme *b64,
+			   const unsigned char *src, unsigned char *dst,
+			   size_t blocks)
+{
+	char c62 = b64->encmap[62], c63 = b64->encmap[63];
+	__m128i in;
+	size_t i;
+
+	/* 16 bytes are read for each 12 byte step */
+	for (i = 0; blocks - i >= 6; i += 4, src += 12, dst += 16) {
+		in = _mm_loadu_si128((const void *)src);
+		in = base64_encode_unpack_ssse3(in);
+		_mm_storeu_si128((void *)dst,
+				 base64_encode_map_ssse3(in, c62, c63));
+	}
+	return i;
+}
+
+static inline __m256i ATTR_TARGET_AVX2
+base64_encode_unpack_avx2(__m256i in)
+{
+	__m256i t0, t1;
+
+	in = _mm256_shuffle_epi8(in, _mm256_setr_epi8(
+		1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+		1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+	t0 = _mm256_mulhi_epu16(
+		_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)),
+		_mm256_set1_epi32(0x04000040));
+	t1 = _mm256_mullo_epi16(
+		_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)),
+		_mm256_set1_epi32(0x01000010));
+	return _mm256_or_si256(t0, t1);
+}
+
+static inline __m256i ATTR_TARGET_AVX2
+base64_encode_map_avx2(__m256i idx, char c62, char c63)
+{
+	__m256i offset = _mm256_set1_epi8('A');
+
+	offset = _mm256_add_epi8(offset, _mm256_and_si256(
+		_mm256_cmpgt_epi8(idx, _mm256_set1_epi8(25)),
+		_mm256_set1_epi8(('a' - 26) - 'A')));
+	offset = _mm256_add_epi8(offset, _mm256_and_si256(
+		_mm256_cmpgt_epi8(idx, _mm256_set1_epi8(51)),
+		_mm256_set1_epi8(('0' - 52) - ('a' - 26))));
+	offset = _mm256_add_epi8(offset, _mm256_and_si256(
+		_mm256_cmpeq_epi8(idx, _mm256_set1_epi8(62)),
+		_mm256_set1_epi8((c62 - 62) - ('0' - 52))));
+	offset = _mm256_add_epi8(offset, _mm256_and_si256(
+		_mm256_cmpeq_epi8(idx, _mm256_set1_epi8(63)),
+		_mm256_set1_epi8((c63 - 63) - ('0' - 52))));
+	return _mm256_add_epi8(idx, offset);
+}
+
+static size_t ATTR_TARGET_AVX2
+base64_encode_blocks_avx2(const struct base64_scheme *b64,
+			  const unsigned char *src, unsigned char *dst,
+			  size_t blocks)
+{
+	char c62 = b64->encmap[62], c63 = b64->encmap[63];
+	__m256i in;
+	size_t i;
+
+	/* 28 bytes are read for each 24 byte step */
+	for (i = 0; blocks - i >= 10; i += 8, src += 24, dst += 32) {
+		in = _mm256_inserti128_si256(
+			_mm256_castsi128_si256(
+				_mm_loadu_si128((const void *)src)),
+			_mm_loadu_si128((const void *)(src + 12)), 1);
+		in = base64_encode_unpack_avx2(in);
+		_mm256_storeu_si256((void *)dst,
+				    base64_encode_map_avx2(in, c62, c63));
+	}
+	/* Continue with 128bit vectors. This is common with MIME lines, which
+	   are only 19 blocks long. The SSSE3 code gets inlined here with VEX
+	   encoding, so it doesn't cause SSE/AVX transition penalties. */
+	return i + base64_encode_blocks_ssse3(b64, src, dst, blocks - i);
+}
+
+/* Each 128bit lane decodes 16 characters into 12 bytes. The characters are
+   validated and converted to their 6bit values with range comparisons, and
+   the values are then packed together with multiply-adds. */
+
+static inline bool ATTR_TARGET_SSSE3
+base64_decode_map_ssse3(__m128i *in, char c62, char c63)
+{
+	__m128i c = *in, upper, lower, digit, m62, m63, valid, offset;
+
+	/* bytes >= 0x80 are negative and never match any range */
+	upper = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('A' - 1)),
+			      _mm_cmplt_epi8(c, _mm_set1_epi8('Z' + 1)));
+	lower = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('a' - 1)),
+			      _mm_cmplt_epi8(c, _mm_set1_epi8('z' + 1)));
+	digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+			      _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+	m62 = _mm_cmpeq_epi8(c, _mm_set1_epi8(c62));
+	m63 = _mm_cmpeq_epi8(c, _mm_set1_epi8(c63));
+	valid = _mm_or_si128(_mm_or_si128(upper, lower),
+			     _mm_or_si128(_mm_or_si128(digit, m62), m63));
+	if (_mm_movemask_epi8(valid) != 0xffff)
+		return FALSE;
+
+	offset = _mm_and_si128(upper, _mm_set1_epi8(-'A'));
+	offset = _mm_or_si128(offset, _mm_and_si128(
+		lower, _mm_set1_epi8(26 - 'a')));
+	offset = _mm_or_si128(offset, _mm_and_si128(
+		digit, _mm_set1_epi8(52 - '0')));
+	offset = _mm_or_si128(offset, _mm_and_si128(
+		m62, _mm_set1_epi8(62 - c62)));
+	offset = _mm_or_si128(offset, _mm_and_si128(
+		m63, _mm_set1_epi8(63 - c63)));
+	*in = _mm_add_epi8(c, offset);
+	return TRUE;
+}
+
+static inline __m128i ATTR_TARGET_SSSE3
+base64_decode_pack_ssse3(__m128i in)
+{
+	in = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+	in = _mm_madd_epi16(in, _mm_set1_epi32(0x00011000));
+	return _mm_shuffle_epi8(in, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9,
+						  8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+static inline size_t ATTR_TARGET_SSSE3
+base64_decode_blocks_ssse3(const struct base64_scheme *b64,
+			   const unsigned char *src, unsigned char *dst,
+			   size_t blocks)
+{
+	char c62 = b64->encmap[62], c63 = b64->encmap[63];
+	__m128i in;
+	size_t i;
+
+	/* 16 bytes are written for each 12 byte step */
+	for (i = 0; blocks - i >= 6; i += 4, src += 16, dst += 12) {
+		in = _mm_loadu_si128((const void *)src);
+		if (!base64_decode_map_ssse3(&in, c62, c63))
+			break;
+		_mm_storeu_si128((void *)dst, base64_decode_pack_ssse3(in));
+	}
+	return i;
+}
+
+static inline bool ATTR_TARGET_AVX2
+base64_decode_map_avx2(__m256i *in, char c62, char c63)
+{
+	__m256i c = *in, upper, lower, digit, m62, m63, valid, offset;
+
+	upper = _mm256_and_si256(
+		_mm256_cmpgt_epi8(c, _mm256_set1_epi8('A' - 1)),
+		_mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), c));
+	lower = _mm256_and_si256(
+		_mm256_cmpgt_epi8(c, _mm256_set1_epi8('a' - 1)),
+		_mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), c));
+	digit = _mm256_and_si256(
+		_mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)),
+		_mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), c));
+	m62 = _mm256_cmpeq_epi8(c, _mm256_set1_epi8(c62));
+	m63 = _mm256_cmpeq_epi8(c, _mm256_set1_epi8(c63));
+	valid = _mm256_or_si256(_mm256_or_si256(upper, lower),
+				_mm256_or_si256(_mm256_or_si256(digit, m62),
+						m63));
+	if (_mm256_movemask_epi8(valid) != -1)
+		return FALSE;
+
+	offset = _mm256_and_si256(upper, _mm256_set1_epi8(-'A'));
+	offset = _mm256_or_si256(offset, _mm256_and_si256(
+		lower, _mm256_set1_epi8(26 - 'a')));
+	offset = _mm256_or_si256(offset, _mm256_and_si256(
+		digit, _mm256_set1_epi8(52 - '0')));
+	offset = _mm256_or_si256(offset, _mm256_and_si256(
+		m62, _mm256_set1_epi8(62 - c62)));
+	offset = _mm256_or_si256(offset, _mm256_and_si256(
+		m63, _mm256_set1_epi8(63 - c63)));
+	*in = _mm256_add_epi8(c, offset);
+	return TRUE;
+}
+
+static inline __m256i ATTR_TARGET_AVX2
+base64_decode_pack_avx2(__m256i in)
+{
+	in = _mm256_maddubs_epi16(in, _mm256_set1_epi32(0x01400140));
+	in = _mm256_madd_epi16(in, _mm256_set1_epi32(0x00011000));
+	return _mm256_shuffle_epi8(in, _mm256_setr_epi8(
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+static size_t ATTR_TARGET_AVX2
+base64_decode_blocks_avx2(const struct base64_scheme *b64,
+			  const unsigned char *src, unsigned char *dst,
+			  size_t blocks)
+{
+	char c62 = b64->encmap[62], c63 = b64->encmap[63];
+	__m256i in;
+	size_t i;
+
+	/* 28 bytes are written for each 24 byte step */
+	for (i = 0; blocks - i >= 10; i += 8, src += 32, dst += 24) {
+		in = _mm256_loadu_si256((const void *)src);
+		if (!base64_decode_map_avx2(&in, c62, c63))
+			break;
+		in = base64_decode_pack_avx2(in);
+		_mm_storeu_si128((void *)dst, _mm256_castsi256_si128(in));
+		_mm_storeu_si128((void *)(dst + 12),
+				 _mm256_extracti128_si256(in, 1));
+	}
+	/* continue with 128bit vectors, see base64_encode_blocks_avx2() */
+	return i + base64_decode_blocks_ssse3(b64, src, dst, blocks - i);
+}
+#endif
+
+static void
+base64_encode_blocks(const struct base64_scheme *b64,
+		     const unsigned char *src, unsigned char *dst,
+		     size_t blocks)
+{
+	size_t done = 0;
+
+	switch (base64_get_scheme_simd(b64)) {
+	case BASE64_SIMD_UNKNOWN:
+	case BASE64_SIMD_NONE:
+		break;
+#ifdef HAVE_BASE64_X86_SIMD
+	case BASE64_SIMD_SSSE3:
+		done = base64_encode_blocks_ssse3(b64, src, dst, blocks);
+		break;
+	case BASE64_SIMD_AVX2:
+		done = base64_encode_blocks_avx2(b64, src, dst, blocks);
+		break;
+#else
+	default:
+		i_unreached();
+#endif
+	}
+	base64_encode_blocks_scalar(b64, src + done * 3, dst + done * 4,
+				    blocks - done);
+}
+
+static size_t
+base64_decode_blocks(const struct base64_scheme *b64,
+		     const unsigned char *src, unsigned char *dst,
+		     size_t blocks)
+{
+	size_t done = 0;
+
+	switch (base64_get_scheme_simd(b64)) {
+	case BASE64_SIMD_UNKNOWN:
+	case BASE64_SIMD_NONE:
+		break;
+#ifdef HAVE_BASE64_X86_SIMD
+	case BASE64_SIMD_SSSE3:
+		done = base64_decode_blocks_ssse3(b64, src, dst, blocks);
+		break;
+	case BASE64_SIMD_AVX2:
+		done = base64_decode_blocks_avx2(b64, src, dst, blocks);
+		break;
+#else
+	default:
+		i_unreached();
+#endif
+	}
+	/* the SIMD code stops at the first vector containing something else
+	   than the alphabet - find out the exact block */
+	return done + base64_decode_blocks_scalar(b64, src + done * 4,
+						  dst + done * 3,
+						  blocks - done);
+}
+
 /*
  * Low-level Base64 encoder
  */
@@ -223,7 +644,7 @@ base64_encode_more_data(struct base64_encoder *enc,
 	const char *b64enc = b64->encmap;
 	size_t res_size;
 	unsigned char *start, *ptr, *end;
-	size_t src_pos;
+	size_t src_pos, blocks;
 
 	i_assert(!enc->pending_lf);
 
@@ -307,15 +728,10 @@ base64_encode_more_data(struct base64_encoder *enc,
 	}
 
 	/* Convert the bulk */
-	for (; src_size - src_pos > 2 && &ptr[3] < end;
-	     src_pos += 3, ptr += 4) {
-		ptr[0] = b64enc[src_c[src_pos] >> 2];
-		ptr[1] = b64enc[((src_c[src_pos] & 0x03) << 4) |
-				(src_c[src_pos+1] >> 4)];
-		ptr[2] = b64enc[((src_c[src_pos+1] & 0x0f) << 2) |
-				((src_c[src_pos+2] & 0xc0) >> 6)];
-		ptr[3] = b64enc[src_c[src_pos+2] & 0x3f];
-	}
+	blocks = I_MIN((src_size - src_pos) / 3, (size_t)(end - ptr) / 4);
+	base64_encode_blocks(b64, src_c + src_pos, ptr, blocks);
+	src_pos += blocks * 3;
+	ptr += blocks * 4;
 
 	/* Convert the bytes beyond the last 3-byte boundary and update state
 	   for next call */
@@ -599,6 +1015,27 @@ base64_skip_whitespace(struct base64_decoder *dec, const unsigned char *src_c,
 		(*src_pos)++;
 }
 
+static void
+base64_decode_more_bulk(const struct base64_scheme *b64,
+			const unsigned char *src_c, size_t src_size,
+			size_t *src_pos, size_t *dst_avail, buffer_t *dest)
+{
+	unsigned char out[BASE64_DECODE_BULK_BLOCKS * 3];
+	size_t blocks, done;
+
+	/* Decode via a stack buffer rather than directly to dest, because
+	   reserving space in dest that ends up unused would make the buffer
+	   clear it again later on. */
+	do {
+		blocks = I_MIN((src_size - *src_pos) / 4, *dst_avail / 3);
+		blocks = I_MIN(blocks, BASE64_DECODE_BULK_BLOCKS);
+		done = base64_decode_blocks(b64, src_c + *src_pos, out, blocks);
+		buffer_append(dest, out, done * 3);
+		*src_pos += done * 4;
+		*dst_avail -= done * 3;
+	} while (done == BASE64_DECODE_BULK_BLOCKS);
+}
+
 int base64_decode_more(struct base64_decoder *dec,
 		       const void *src, size_t src_size, size_t *src_pos_r,
 		       buffer_t *dest)
@@ -661,8 +1098,19 @@ int base64_decode_more(struct base64_decoder *dec,
 	}
 
 	for (; !dec->seen_padding && src_pos < src_size; src_pos++) {
-		unsigned char in = src_c[src_pos];
-		unsigned char dm = b64->decmap[in];
+		unsigned char in, dm;
+
+		if (dec->sub_pos == 0 && src_size - src_pos >= 4 &&
+		    dst_avail >= 3) {
+			/* decode all the following complete blocks at once */
+			base64_decode_more_bulk(b64, src_c, src_size,
+						&src_pos, &dst_avail, dest);
+			if (src_pos == src_size)
+				break;
+		}
+
+		in = src_c[src_pos];
+		dm = b64->decmap[in];
 
 		if (dm == 0xff) {
 			if (no_whitespace) {
@@ -17,6 +17,14 @@ struct base64_scheme {
 	const unsigned char decmap[256];
 };
 
+/* Returns the name of the SIMD instruction set used for encoding and decoding
+   large inputs ("ssse3" or "avx2"), or NULL if only the portable code is
+   used. */
+const char *base64_get_simd(void);
+/* Enable or disable using SIMD instructions. They're enabled by default if the
+   CPU supports them. This is mainly useful for testing and benchmarking. */
+void base64_set_simd(bool enabled);
+
 /*
  * Low-level Base64 encoder
  */
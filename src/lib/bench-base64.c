@@ -0,0 +1,117 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "base64.h"
+#include "time-util.h"
+#include "strnum.h"
+
+#include <stdio.h>
+
+/**
+ * Measures the base64 encoding and decoding throughput with the SIMD code
+ * (if the CPU supports it) and with the portable code. The data is encoded
+ * both without line breaks and with 76 character MIME lines, which is what
+ * most attachments look like.
+ */
+
+static unsigned int data_size = 1024 * 1024;
+static unsigned int rounds = 50;
+
+static void
+bench_print(const char *name, const char *op, uint64_t nsecs, size_t bytes)
+{
+	printf("%-8s %-16s %8.1f MB/s\n", name, op,
+	       (double)bytes * 1000.0 / (double)nsecs);
+}
+
+static void
+bench_base64(const char *name, const unsigned char *data, buffer_t *encoded,
+	     buffer_t *decoded)
+{
+	static const size_t line_lens[] = { 0, 76 };
+	struct base64_decoder dec;
+	const char *op;
+	uint64_t ts;
+	unsigned int i, j;
+
+	for (i = 0; i < N_ELEMENTS(line_lens); i++) {
+		op = line_lens[i] == 0 ? "encode" : "encode lines";
+		ts = i_nanoseconds();
+		for (j = 0; j < rounds; j++) {
+			buffer_set_used_size(encoded, 0);
+			base64_scheme_encode(&base64_scheme,
+					     BASE64_ENCODE_FLAG_CRLF,
+					     line_lens[i], data, data_size,
+					     encoded);
+		}
+		bench_print(name, op, i_nanoseconds() - ts,
+			    (size_t)data_size * rounds);
+
+		op = line_lens[i] == 0 ? "decode" : "decode lines";
+		ts = i_nanoseconds();
+		for (j = 0; j < rounds; j++) {
+			buffer_set_used_size(decoded, 0);
+			base64_decode_init(&dec, &base64_scheme, 0);
+			if (base64_decode_more(&dec, encoded->data,
+					       encoded->used, NULL,
+					       decoded) < 0 ||
+			    base64_decode_finish(&dec) < 0)
+				i_unreached();
+		}
+		bench_print(name, op, i_nanoseconds() - ts,
+			    (size_t)data_size * rounds);
+		i_assert(decoded->used == data_size &&
+			 memcmp(decoded->data, data, data_size) == 0);
+	}
+	printf("\n");
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<data size> [<rounds>]]\n", prog);
+	fprintf(stderr, "Runs with 1048576 bytes and 50 rounds "
+		"if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	unsigned char *data;
+	buffer_t *encoded, *decoded;
+	const char *simd;
+	unsigned int i;
+
+	lib_init();
+
+	if (argc > 3)
+		print_usage(argv[0]);
+	if ((argc > 1 && (str_to_uint(argv[1], &data_size) < 0 ||
+			  data_size == 0)) ||
+	    (argc > 2 && (str_to_uint(argv[2], &rounds) < 0 ||
+			  rounds == 0))) {
+		fprintf(stderr, "Invalid parameters\n");
+		print_usage(argv[0]);
+	}
+	simd = base64_get_simd();
+	printf("%u bytes, %u rounds, SIMD: %s\n\n", data_size, rounds,
+	       simd == NULL ? "not supported" : simd);
+
+	data = i_malloc(data_size);
+	for (i = 0; i < data_size; i++)
+		data[i] = i_rand_uchar();
+	encoded = buffer_create_dynamic(default_pool,
+		MAX_BASE64_ENCODED_SIZE(data_size) * 2);
+	decoded = buffer_create_dynamic(default_pool, data_size);
+
+	if (simd != NULL)
+		bench_base64(simd, data, encoded, decoded);
+	base64_set_simd(FALSE);
+	bench_base64("scalar", data, encoded, decoded);
+
+	buffer_free(&encoded);
+	buffer_free(&decoded);
+	i_free(data);
+	lib_deinit();
+	return 0;
+}
@@ -0,0 +1,102 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "crc32.h"
+#include "time-util.h"
+#include "strnum.h"
+
+#include <stdio.h>
+
+/**
+ * Measures the crc32_data() throughput with different input sizes: short
+ * strings such as mail-cache fields use the slice-by-8 code, while larger
+ * inputs use the CPU specific code if there is any. The byte-at-a-time
+ * table lookup that crc32_data() used to do is measured for comparison.
+ */
+
+static unsigned int total_size = 256 * 1024 * 1024;
+
+static uint32_t bench_table[256];
+
+static void bench_table_init(void)
+{
+	uint32_t crc;
+	unsigned int i, j;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+		bench_table[i] = crc;
+	}
+}
+
+static uint32_t
+bench_crc32_bytewise(uint32_t crc, const unsigned char *p, size_t size)
+{
+	crc ^= 0xffffffff;
+	for (; size > 0; size--, p++)
+		crc = (crc >> 8) ^ bench_table[(crc ^ *p) & 0xff];
+	return crc ^ 0xffffffff;
+}
+
+static void
+bench_print(const char *name, size_t size, uint64_t nsecs, size_t bytes)
+{
+	printf("%-10s %7zu bytes %8.1f MB/s\n", name, size,
+	       (double)bytes * 1000.0 / (double)nsecs);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<total bytes per test>]\n", prog);
+	fprintf(stderr, "Runs with 268435456 bytes if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	static const size_t sizes[] = { 16, 64, 256, 4096, 65536 };
+	unsigned char *data;
+	unsigned int i, j, count;
+	uint32_t crc1 = 0, crc2 = 0;
+	uint64_t ts;
+
+	lib_init();
+
+	if (argc > 2)
+		print_usage(argv[0]);
+	if (argc > 1 && (str_to_uint(argv[1], &total_size) < 0 ||
+			 total_size == 0)) {
+		fprintf(stderr, "Invalid parameters\n");
+		print_usage(argv[0]);
+	}
+	bench_table_init();
+
+	data = i_malloc(sizes[N_ELEMENTS(sizes) - 1]);
+	for (i = 0; i < sizes[N_ELEMENTS(sizes) - 1]; i++)
+		data[i] = i_rand_uchar();
+
+	for (i = 0; i < N_ELEMENTS(sizes); i++) {
+		count = I_MAX(total_size / sizes[i], 1);
+		/* the CRCs are chained, so the pure function calls can't be
+		   optimized away */
+
+		ts = i_nanoseconds();
+		for (j = 0; j < count; j++)
+			crc1 = crc32_data_more(crc1, data, sizes[i]);
+		bench_print("crc32", sizes[i], i_nanoseconds() - ts,
+			    sizes[i] * count);
+
+		ts = i_nanoseconds();
+		for (j = 0; j < count; j++)
+			crc2 = bench_crc32_bytewise(crc2, data, sizes[i]);
+		bench_print("bytewise", sizes[i], i_nanoseconds() - ts,
+			    sizes[i] * count);
+		i_assert(crc1 == crc2);
+		printf("\n");
+	}
+	i_free(data);
+	lib_deinit();
+	return 0;
+}
@@ -0,0 +1,159 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "event-filter.h"
+#include "time-util.h"
+#include "strnum.h"
+
+#include <stdio.h>
+
+/**
+ * Measures how fast events go through a merged filter of many stats
+ * metrics. Each metric is a query with its own context, like the stats
+ * process' metrics filter, and the matching metrics are found with
+ * event_filter_match_iter_*(). Most of the metrics require a specific
+ * event name, and some of them also check fields. The events are a mix of
+ * named events that some metrics want, named events that no metric wants,
+ * and unnamed events.
+ */
+
+static const char *const event_names[] = {
+	"imap_command_finished", "pop3_command_finished",
+	"smtp_server_command_finished", "smtp_server_transaction_finished",
+	"smtp_client_transaction_finished", "http_request_finished",
+	"http_server_request_finished", "auth_request_finished",
+	"auth_passdb_request_finished", "auth_userdb_request_finished",
+	"mail_delivery_finished", "mail_opened", "mail_expunged",
+	"mailbox_opened", "mail_index_recreated", "dns_request_finished",
+	"sql_query_finished", "sql_transaction_finished",
+	"fs_file_finished", "fs_iter_finished", "dict_lookup_finished",
+	"dict_iteration_finished", "dict_transaction_finished",
+	"proxy_session_finished", "login_aborted",
+};
+static const char *const metric_conditions[] = {
+	"",
+	" AND cmd_name=FETCH",
+	" AND success=yes",
+	" AND (error=* OR status_code>=500)",
+	" AND user=\"*@example.com\"",
+};
+
+static unsigned int metric_count = 50;
+static unsigned int event_count = 1000000;
+
+static struct event_filter *bench_create_filter(unsigned int *contexts)
+{
+	struct event_filter *filter, *metric_filter;
+	const char *query, *error;
+	unsigned int i;
+
+	filter = event_filter_create();
+	for (i = 0; i < metric_count; i++) {
+		query = t_strdup_printf("event=%s%s",
+			event_names[i % N_ELEMENTS(event_names)],
+			metric_conditions[(i / N_ELEMENTS(event_names)) %
+					  N_ELEMENTS(metric_conditions)]);
+		metric_filter = event_filter_create();
+		if (event_filter_parse(query, metric_filter, &error) < 0)
+			i_fatal("event_filter_parse(%s) failed: %s", query, error);
+		event_filter_merge_with_context(filter, metric_filter,
+						EVENT_FILTER_MERGE_OP_OR,
+						&contexts[i]);
+		event_filter_unref(&metric_filter);
+	}
+	return filter;
+}
+
+static struct event *bench_create_event(struct event *parent, unsigned int i)
+{
+	struct event *event = event_create(parent);
+
+	switch (i % 4) {
+	case 0:
+		/* unnamed */
+		break;
+	case 1:
+		/* a name that no metric wants */
+		event_set_name(event, t_strdup_printf("unwanted_event_%u", i));
+		break;
+	default:
+		event_set_name(event,
+			event_names[i % N_ELEMENTS(event_names)]);
+		break;
+	}
+	event_add_str(event, "cmd_name", i % 3 == 0 ? "FETCH" : "SELECT");
+	event_add_str(event, "success", i % 5 == 0 ? "no" : "yes");
+	event_add_int(event, "status_code", i % 7 == 0 ? 503 : 200);
+	return event;
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<metric count> [<event count>]]\n", prog);
+	fprintf(stderr, "Runs with 50 metrics and 1000000 events "
+		"if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	const struct failure_context failure_ctx = { .type = LOG_TYPE_DEBUG };
+	struct event_filter_match_iter *iter;
+	struct event_filter *filter;
+	struct event *parent, *events[100];
+	unsigned int *contexts, i, matches = 0;
+	uint64_t ts, nsecs;
+
+	lib_init();
+
+	if (argc > 3)
+		print_usage(argv[0]);
+	if ((argc > 1 && (str_to_uint(argv[1], &metric_count) < 0 ||
+			  metric_count == 0)) ||
+	    (argc > 2 && (str_to_uint(argv[2], &event_count) < 0 ||
+			  event_count == 0))) {
+		fprintf(stderr, "Invalid parameters\n");
+		print_usage(argv[0]);
+	}
+	printf("%u metrics, %u events\n\n", metric_count, event_count);
+
+	contexts = i_new(unsigned int, metric_count);
+	filter = bench_create_filter(contexts);
+	parent = event_create(NULL);
+	event_add_str(parent, "user", "user@example.com");
+	for (i = 0; i < N_ELEMENTS(events); i++)
+		events[i] = bench_create_event(parent, i);
+
+	ts = i_nanoseconds();
+	for (i = 0; i < event_count; i++) {
+		if (event_filter_match(filter, events[i % N_ELEMENTS(events)],
+				       &failure_ctx))
+			matches++;
+	}
+	nsecs = i_nanoseconds() - ts;
+	printf("%-10s %8.1f ns/event %10.0f events/s (%u matched)\n",
+	       "match", (double)nsecs / event_count,
+	       event_count * 1e9 / nsecs, matches);
+
+	matches = 0;
+	ts = i_nanoseconds();
+	for (i = 0; i < event_count; i++) {
+		iter = event_filter_match_iter_init(filter,
+			events[i % N_ELEMENTS(events)], &failure_ctx);
+		while (event_filter_match_iter_next(iter) != NULL)
+			matches++;
+		event_filter_match_iter_deinit(&iter);
+	}
+	nsecs = i_nanoseconds() - ts;
+	printf("%-10s %8.1f ns/event %10.0f events/s (%u metrics matched)\n",
+	       "iter", (double)nsecs / event_count,
+	       event_count * 1e9 / nsecs, matches);
+
+	for (i = 0; i < N_ELEMENTS(events); i++)
+		event_unref(&events[i]);
+	event_unref(&parent);
+	event_filter_unref(&filter);
+	i_free(contexts);
+	lib_deinit();
+	return 0;
+}
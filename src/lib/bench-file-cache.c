@@ -0,0 +1,169 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "randgen.h"
+#include "file-cache.h"
+#include "time-util.h"
+#include "strnum.h"
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * Compares the file_cache copy mode against FILE_CACHE_FLAG_MMAP with the
+ * access patterns that mail-cache has:
+ *  - open: a new cache reads the header and a few records, as a process
+ *    does when it opens a mailbox and fetches a few cached fields
+ *  - lookup: random small record reads from a long-lived cache
+ *  - append: records are appended to the file, then read back
+ *  - lock: the header is invalidated and read again, as done whenever the
+ *    cache file is locked
+ */
+
+#define BENCH_FILENAME ".bench_file_cache"
+#define BENCH_HEADER_SIZE 64
+#define BENCH_OPEN_RECORDS 16
+#define BENCH_LOOKUP_COUNT 1000000
+#define BENCH_APPEND_COUNT 100000
+#define BENCH_LOCK_COUNT 1000000
+
+static unsigned int file_size_mb = 64;
+
+static void
+bench_print(const char *name, const char *op, uint64_t nsecs,
+	    unsigned int count)
+{
+	printf("%-6s %-8s %10.1f ns/op\n", name, op,
+	       (double)nsecs / (double)count);
+}
+
+static size_t bench_record_size(void)
+{
+	return 32 + i_rand_limit(480);
+}
+
+static uoff_t bench_record_offset(uoff_t file_size, size_t size)
+{
+	return BENCH_HEADER_SIZE +
+		i_rand_limit(file_size - BENCH_HEADER_SIZE - size);
+}
+
+static unsigned int
+bench_access(struct file_cache *cache, uoff_t offset, size_t size)
+{
+	const unsigned char *data;
+	size_t map_size;
+
+	if (file_cache_read(cache, offset, size) < (ssize_t)size)
+		i_fatal("file_cache_read(%"PRIuUOFF_T") failed", offset);
+	data = file_cache_get_map(cache, &map_size);
+	return data[offset] + data[offset + size - 1];
+}
+
+static void bench_file_cache(int fd, uoff_t file_size, const char *name,
+			     enum file_cache_flags flags)
+{
+	struct file_cache *cache;
+	unsigned char record[512];
+	unsigned int i, j, open_count, sum = 0;
+	uoff_t offset;
+	size_t size;
+	uint64_t ts;
+
+	open_count = I_MAX(file_size_mb * 16, 100);
+	ts = i_nanoseconds();
+	for (i = 0; i < open_count; i++) {
+		cache = file_cache_new_full(fd, BENCH_FILENAME, flags);
+		(void)file_cache_set_size(cache, file_size);
+		sum += bench_access(cache, 0, BENCH_HEADER_SIZE);
+		for (j = 0; j < BENCH_OPEN_RECORDS; j++) {
+			size = bench_record_size();
+			offset = bench_record_offset(file_size, size);
+			sum += bench_access(cache, offset, size);
+		}
+		file_cache_free(&cache);
+	}
+	bench_print(name, "open", i_nanoseconds() - ts, open_count);
+
+	cache = file_cache_new_full(fd, BENCH_FILENAME, flags);
+	(void)file_cache_set_size(cache, file_size);
+	ts = i_nanoseconds();
+	for (i = 0; i < BENCH_LOOKUP_COUNT; i++) {
+		size = bench_record_size();
+		offset = bench_record_offset(file_size, size);
+		sum += bench_access(cache, offset, size);
+	}
+	bench_print(name, "lookup", i_nanoseconds() - ts, BENCH_LOOKUP_COUNT);
+
+	memset(record, 'x', sizeof(record));
+	offset = file_size;
+	ts = i_nanoseconds();
+	for (i = 0; i < BENCH_APPEND_COUNT; i++) {
+		size = bench_record_size();
+		if (pwrite(fd, record, size, offset) != (ssize_t)size)
+			i_fatal("pwrite(%s) failed: %m", BENCH_FILENAME);
+		file_cache_write(cache, record, size, offset);
+		sum += bench_access(cache, offset, size);
+		offset += size;
+	}
+	bench_print(name, "append", i_nanoseconds() - ts, BENCH_APPEND_COUNT);
+	if (ftruncate(fd, file_size) < 0)
+		i_fatal("ftruncate(%s) failed: %m", BENCH_FILENAME);
+	file_cache_set_fd(cache, fd);
+
+	ts = i_nanoseconds();
+	for (i = 0; i < BENCH_LOCK_COUNT; i++) {
+		file_cache_invalidate(cache, 0, BENCH_HEADER_SIZE);
+		sum += bench_access(cache, 0, BENCH_HEADER_SIZE);
+	}
+	bench_print(name, "lock", i_nanoseconds() - ts, BENCH_LOCK_COUNT);
+	file_cache_free(&cache);
+
+	/* make sure the reads aren't optimized away */
+	if (sum == 0)
+		printf("\n");
+	printf("\n");
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<file size in MB>]\n", prog);
+	fprintf(stderr, "Uses a 64 MB file if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	unsigned char buf[IO_BLOCK_SIZE];
+	uoff_t file_size, offset;
+	int fd;
+
+	lib_init();
+
+	if (argc > 2)
+		print_usage(argv[0]);
+	if (argc > 1 && (str_to_uint(argv[1], &file_size_mb) < 0 ||
+			 file_size_mb == 0)) {
+		fprintf(stderr, "Invalid parameters\n");
+		print_usage(argv[0]);
+	}
+	file_size = (uoff_t)file_size_mb * 1024 * 1024;
+
+	fd = open(BENCH_FILENAME, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1)
+		i_fatal("open(%s) failed: %m", BENCH_FILENAME);
+	for (offset = 0; offset < file_size; offset += sizeof(buf)) {
+		random_fill(buf, sizeof(buf));
+		if (pwrite(fd, buf, sizeof(buf), offset) != sizeof(buf))
+			i_fatal("pwrite(%s) failed: %m", BENCH_FILENAME);
+	}
+
+	bench_file_cache(fd, file_size, "copy", 0);
+	bench_file_cache(fd, file_size, "mmap", FILE_CACHE_FLAG_MMAP);
+
+	i_close_fd(&fd);
+	i_unlink(BENCH_FILENAME);
+	lib_deinit();
+	return 0;
+}
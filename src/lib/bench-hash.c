@@ -0,0 +1,163 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "hash.h"
+#include "time-util.h"
+#include "strnum.h"
+
+#include <stdio.h>
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+#  include <malloc.h>
+#  define HAVE_BENCH_MALLINFO2
+#endif
+
+/**
+ * Compares the chained hash tables against the flat (open addressing) ones:
+ * insert and lookup throughput with string keys and with direct pointer
+ * keys, and the memory used per entry. The lookups are done in random order,
+ * so they don't benefit from the keys being inserted in the memory order.
+ */
+
+static unsigned int key_count = 1000000;
+static unsigned int lookup_rounds = 5;
+
+static size_t bench_memory_used(void)
+{
+#ifdef HAVE_BENCH_MALLINFO2
+	struct mallinfo2 mi = mallinfo2();
+
+	return mi.uordblks + mi.hblkhd;
+#else
+	return 0;
+#endif
+}
+
+static void
+bench_print(const char *name, const char *op, uint64_t nsecs,
+	    unsigned int count)
+{
+	printf("%-16s %-12s %8.1f ns/op\n", name, op,
+	       (double)nsecs / (double)count);
+}
+
+static void
+bench_hash(const char *name, bool flat, bool direct, char *const *keys,
+	   char *const *missing_keys, const unsigned int *order)
+{
+	HASH_TABLE(char *, char *) hash;
+	uint64_t ts;
+	size_t mem_before, mem_after;
+	unsigned int i, round, found = 0;
+
+	mem_before = bench_memory_used();
+	if (direct && flat)
+		hash_table_create_direct_flat(&hash, default_pool, 0);
+	else if (direct)
+		hash_table_create_direct(&hash, default_pool, 0);
+	else if (flat)
+		hash_table_create_flat(&hash, default_pool, 0, str_hash, strcmp);
+	else
+		hash_table_create(&hash, default_pool, 0, str_hash, strcmp);
+
+	ts = i_nanoseconds();
+	for (i = 0; i < key_count; i++)
+		hash_table_insert(hash, keys[i], keys[i]);
+	bench_print(name, "insert", i_nanoseconds() - ts, key_count);
+	mem_after = bench_memory_used();
+
+	ts = i_nanoseconds();
+	for (round = 0; round < lookup_rounds; round++) {
+		for (i = 0; i < key_count; i++) {
+			if (hash_table_lookup(hash, keys[order[i]]) != NULL)
+				found++;
+		}
+	}
+	bench_print(name, "lookup hit", i_nanoseconds() - ts,
+		    key_count * lookup_rounds);
+	i_assert(found == key_count * lookup_rounds);
+
+	ts = i_nanoseconds();
+	for (round = 0; round < lookup_rounds; round++) {
+		for (i = 0; i < key_count; i++) {
+			if (hash_table_lookup(hash, missing_keys[order[i]]) != NULL)
+				found++;
+		}
+	}
+	bench_print(name, "lookup miss", i_nanoseconds() - ts,
+		    key_count * lookup_rounds);
+	i_assert(found == key_count * lookup_rounds);
+
+	ts = i_nanoseconds();
+	for (i = 0; i < key_count; i++)
+		hash_table_remove(hash, keys[i]);
+	bench_print(name, "remove", i_nanoseconds() - ts, key_count);
+
+#ifdef HAVE_BENCH_MALLINFO2
+	printf("%-16s %-12s %8.1f bytes/entry\n", name, "memory",
+	       (double)(mem_after - mem_before) / (double)key_count);
+#else
+	(void)mem_before; (void)mem_after;
+#endif
+	hash_table_destroy(&hash);
+	printf("\n");
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<key count> [<lookup rounds>]]\n", prog);
+	fprintf(stderr, "Runs with 1000000 keys and 5 lookup rounds "
+		"if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	char **keys, **missing_keys;
+	unsigned int *order, i, j, tmp;
+
+	lib_init();
+
+	if (argc > 3)
+		print_usage(argv[0]);
+	if ((argc > 1 && (str_to_uint(argv[1], &key_count) < 0 ||
+			  key_count == 0)) ||
+	    (argc > 2 && (str_to_uint(argv[2], &lookup_rounds) < 0 ||
+			  lookup_rounds == 0))) {
+		fprintf(stderr, "Invalid parameters\n");
+		print_usage(argv[0]);
+	}
+	printf("%u keys, %u lookup rounds\n\n", key_count, lookup_rounds);
+
+	keys = i_new(char *, key_count);
+	missing_keys = i_new(char *, key_count);
+	for (i = 0; i < key_count; i++) {
+		keys[i] = i_strdup_printf("user%u@example.com", i);
+		missing_keys[i] = i_strdup_printf("nouser%u@example.com", i);
+	}
+	order = i_new(unsigned int, key_count);
+	for (i = 0; i < key_count; i++)
+		order[i] = i;
+	for (i = key_count - 1; i > 0; i--) {
+		j = i_rand_limit(i + 1);
+		tmp = order[i]; order[i] = order[j]; order[j] = tmp;
+	}
+
+	bench_hash("chained str", FALSE, FALSE, keys, missing_keys,
+		   order);
+	bench_hash("flat str", TRUE, FALSE, keys, missing_keys,
+		   order);
+	bench_hash("chained direct", FALSE, TRUE, keys, missing_keys,
+		   order);
+	bench_hash("flat direct", TRUE, TRUE, keys, missing_keys,
+		   order);
+
+	for (i = 0; i < key_count; i++) {
+		i_free(keys[i]);
+		i_free(missing_keys[i]);
+	}
+	i_free(keys);
+	i_free(missing_keys);
+	i_free(order);
+	lib_deinit();
+	return 0;
+}
@@ -0,0 +1,191 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "priorityq.h"
+#include "timer-wheel.h"
+#include "time-util.h"
+#include "strnum.h"
+
+#include <stdio.h>
+
+/**
+ * Compares the ioloop's timeout queues: the priorityq heap used for absolute
+ * and 0 ms timeouts and the timer wheel used for all the other timeouts.
+ * Mimics a login process with many idle connections: each connection has a
+ * timeout that is reset whenever the connection sends a command, and the
+ * clock advances by 1 ms between commands.
+ */
+
+struct bench_reset {
+	unsigned int timer_idx;
+	unsigned int msecs;
+};
+
+struct bench_timer {
+	struct priorityq_item pq_item;
+	struct timer_wheel_item wheel_item;
+	uint64_t expires;
+};
+
+static unsigned int timer_count = 50000;
+static unsigned int reset_count = 1000000;
+
+static int bench_timer_cmp(const void *p1, const void *p2)
+{
+	const struct bench_timer *t1 = p1, *t2 = p2;
+
+	if (t1->expires < t2->expires)
+		return -1;
+	return t1->expires > t2->expires ? 1 : 0;
+}
+
+static unsigned int bench_timer_msecs(void)
+{
+	/* 1..30 minutes */
+	return 60 * 1000 + i_rand_limit(29 * 60 * 1000);
+}
+
+static void
+bench_print(const char *name, const char *op, uint64_t nsecs,
+	    unsigned int count)
+{
+	printf("%-10s %-8s %8.1f ns/op\n", name, op,
+	       (double)nsecs / (double)count);
+}
+
+static void
+bench_priorityq(struct bench_timer *timers, const struct bench_reset *resets)
+{
+	struct priorityq *pq;
+	struct priorityq_item *item;
+	uint64_t now = 0, ts;
+	unsigned int i, count;
+
+	pq = priorityq_init(bench_timer_cmp, timer_count);
+
+	ts = i_nanoseconds();
+	for (i = 0; i < timer_count; i++)
+		priorityq_add(pq, &timers[i].pq_item);
+	bench_print("priorityq", "add", i_nanoseconds() - ts, timer_count);
+
+	ts = i_nanoseconds();
+	for (i = 0; i < reset_count; i++) {
+		struct bench_timer *timer = &timers[resets[i].timer_idx];
+
+		now++;
+		if (timer->pq_item.idx != UINT_MAX)
+			priorityq_remove(pq, &timer->pq_item);
+		timer->expires = now + resets[i].msecs;
+		priorityq_add(pq, &timer->pq_item);
+
+		while ((item = priorityq_peek(pq)) != NULL &&
+		       ((struct bench_timer *)item)->expires <= now)
+			priorityq_remove(pq, item);
+	}
+	bench_print("priorityq", "reset", i_nanoseconds() - ts, reset_count);
+
+	count = priorityq_count(pq);
+	ts = i_nanoseconds();
+	while (priorityq_pop(pq) != NULL)
+		;
+	bench_print("priorityq", "expire", i_nanoseconds() - ts, count);
+	priorityq_deinit(&pq);
+}
+
+static void
+bench_timer_wheel(struct bench_timer *timers, const struct bench_reset *resets)
+{
+	struct timer_wheel *wheel;
+	struct timer_wheel_item *item;
+	uint64_t now = 0, tick, ts;
+	unsigned int i, count;
+
+	wheel = timer_wheel_init(now);
+
+	ts = i_nanoseconds();
+	for (i = 0; i < timer_count; i++) {
+		timer_wheel_add(wheel, &timers[i].wheel_item,
+				timers[i].expires);
+	}
+	bench_print("wheel", "add", i_nanoseconds() - ts, timer_count);
+
+	ts = i_nanoseconds();
+	for (i = 0; i < reset_count; i++) {
+		struct bench_timer *timer = &timers[resets[i].timer_idx];
+
+		now++;
+		if (timer_wheel_item_is_queued(&timer->wheel_item))
+			timer_wheel_remove(wheel, &timer->wheel_item);
+		timer->expires = now + resets[i].msecs;
+		timer_wheel_add(wheel, &timer->wheel_item, timer->expires);
+
+		while ((item = timer_wheel_peek_expired(wheel, now)) != NULL)
+			timer_wheel_remove(wheel, item);
+	}
+	bench_print("wheel", "reset", i_nanoseconds() - ts, reset_count);
+
+	/* run the wheel until all the timers have expired */
+	count = timer_wheel_count(wheel);
+	ts = i_nanoseconds();
+	while (timer_wheel_get_next_tick(wheel, &tick)) {
+		while ((item = timer_wheel_peek_expired(wheel, tick)) != NULL)
+			timer_wheel_remove(wheel, item);
+	}
+	bench_print("wheel", "expire", i_nanoseconds() - ts, count);
+	timer_wheel_deinit(&wheel);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<timer count> [<reset count>]]\n", prog);
+	fprintf(stderr, "Runs with 50000 timers and 1000000 resets "
+		"if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	struct bench_timer *timers;
+	struct bench_reset *resets;
+	unsigned int *initial;
+	unsigned int i;
+
+	lib_init();
+
+	if (argc > 3)
+		print_usage(argv[0]);
+	if ((argc > 1 && (str_to_uint(argv[1], &timer_count) < 0 ||
+			  timer_count == 0)) ||
+	    (argc > 2 && str_to_uint(argv[2], &reset_count) < 0)) {
+		fprintf(stderr, "Invalid parameters\n");
+		print_usage(argv[0]);
+	}
+	printf("%u timers, %u resets\n\n", timer_count, reset_count);
+
+	/* use the same timers and resets for both */
+	timers = i_new(struct bench_timer, timer_count);
+	initial = i_new(unsigned int, timer_count);
+	resets = i_new(struct bench_reset, reset_count);
+	for (i = 0; i < timer_count; i++)
+		initial[i] = bench_timer_msecs();
+	for (i = 0; i < reset_count; i++) {
+		resets[i].timer_idx = i_rand_limit(timer_count);
+		resets[i].msecs = bench_timer_msecs();
+	}
+
+	for (i = 0; i < timer_count; i++)
+		timers[i].expires = initial[i];
+	bench_priorityq(timers, resets);
+
+	printf("\n");
+	memset(timers, 0, sizeof(*timers) * timer_count);
+	for (i = 0; i < timer_count; i++)
+		timers[i].expires = initial[i];
+	bench_timer_wheel(timers, resets);
+
+	i_free(timers);
+	i_free(initial);
+	i_free(resets);
+	lib_deinit();
+	return 0;
+}
@@ -1,6 +1,7 @@
 #ifndef EVENT_FILTER_PRIVATE_H
 #define EVENT_FILTER_PRIVATE_H
 
+#include "hash.h"
 #include "event-filter.h"
 
 enum event_filter_node_op {
@@ -24,6 +25,15 @@ struct event_filter {
 	int refcount;
 	ARRAY(struct event_filter_query_internal) queries;
 
+	/* Lookup index of the queries, built when matching the first event
+	   and freed whenever the queries change. Queries that can only match
+	   specific event names are looked up by the event's name. The rest
+	   are in index_other_queries and are always checked. Both contain
+	   indexes to the queries array in ascending order. */
+	pool_t index_pool;
+	HASH_TABLE(const char *, ARRAY_TYPE(uint) *) index_names;
+	ARRAY_TYPE(uint) index_other_queries;
+
 	bool fragment;
 	bool named_queries_only;
 };
@@ -43,6 +43,8 @@ struct event_filter_query_internal {
 
 static struct event_filter *event_filters = NULL;
 
+static void event_filter_index_free(struct event_filter *filter);
+
 static struct event_filter *event_filter_create_real(pool_t pool, bool fragment)
 {
 	struct event_filter *filter;
@@ -91,6 +93,7 @@ void event_filter_unref(struct event_filter **_filter)
 	if (--filter->refcount > 0)
 		return;
 
+	event_filter_index_free(filter);
 	if (!filter->fragment) {
 		DLLIST_REMOVE(&event_filters, filter);
 
@@ -132,6 +135,9 @@ event_filter_get_or_alloc_internal_query(struct event_filter *filter,
 {
 	struct event_filter_query_internal *query;
 
+	/* the returned query is going to be modified */
+	event_filter_index_free(filter);
+
 	array_foreach_modifiable(&filter->queries, query) {
 		if (query->context == context)
 			return query;
@@ -473,6 +479,7 @@ bool event_filter_remove_queries_with_context(struct event_filter *filter,
 		if (int_query->context == context) {
 			idx = array_foreach_idx(&filter->queries, int_query);
 			array_delete(&filter->queries, idx, 1);
+			event_filter_index_free(filter);
 			return TRUE;
 		}
 	}
@@ -1103,6 +1110,117 @@ event_filter_match_fastpath(struct event_filter *filter, struct event *event)
 	return TRUE;
 }
 
+static bool
+event_filter_node_get_names(const struct event_filter_node *node,
+			    ARRAY_TYPE(const_string) *names)
+{
+	unsigned int count;
+
+	/* Get the event names, which the event must have one of for the node
+	   to match. Returns FALSE if the node may match any event name. */
+	switch (node->op) {
+	case EVENT_FILTER_OP_CMP_EQ:
+		if (node->type != EVENT_FILTER_NODE_TYPE_EVENT_NAME_EXACT)
+			return FALSE;
+		array_push_back(names, &node->field.value.str);
+		return TRUE;
+	case EVENT_FILTER_OP_AND:
+		count = array_count(names);
+		if (event_filter_node_get_names(node->children[0], names))
+			return TRUE;
+		array_delete(names, count, array_count(names) - count);
+		return event_filter_node_get_names(node->children[1], names);
+	case EVENT_FILTER_OP_OR:
+		return event_filter_node_get_names(node->children[0], names) &&
+			event_filter_node_get_names(node->children[1], names);
+	default:
+		return FALSE;
+	}
+}
+
+static void
+event_filter_index_add(ARRAY_TYPE(uint) *query_idxs, unsigned int idx)
+{
+	const unsigned int *last;
+
+	/* the same name may be in the query multiple times */
+	last = array_is_empty(query_idxs) ? NULL : array_back(query_idxs);
+	if (last == NULL || *last != idx)
+		array_push_back(query_idxs, &idx);
+}
+
+static void event_filter_index_build(struct event_filter *filter)
+{
+	const struct event_filter_query_internal *query;
+	ARRAY_TYPE(const_string) names;
+	ARRAY_TYPE(uint) *query_idxs;
+	const char *name;
+	unsigned int idx;
+
+	filter->index_pool = pool_alloconly_create("event filter index", 1024);
+	hash_table_create(&filter->index_names, filter->index_pool, 0,
+			  str_hash, strcmp);
+	p_array_init(&filter->index_other_queries, filter->index_pool, 8);
+
+	t_array_init(&names, 4);
+	array_foreach(&filter->queries, query) {
+		idx = array_foreach_idx(&filter->queries, query);
+		array_clear(&names);
+		if (query->expr == NULL ||
+		    !event_filter_node_get_names(query->expr, &names)) {
+			array_push_back(&filter->index_other_queries, &idx);
+			continue;
+		}
+		array_foreach_elem(&names, name) {
+			query_idxs = hash_table_lookup(filter->index_names,
+						       name);
+			if (query_idxs == NULL) {
+				query_idxs = p_new(filter->index_pool,
+						   ARRAY_TYPE(uint), 1);
+				p_array_init(query_idxs, filter->index_pool, 4);
+				hash_table_insert(filter->index_names,
+						  name, query_idxs);
+			}
+			event_filter_index_add(query_idxs, idx);
+		}
+	}
+}
+
+static void event_filter_index_free(struct event_filter *filter)
+{
+	if (filter->index_pool == NULL)
+		return;
+	hash_table_destroy(&filter->index_names);
+	pool_unref(&filter->index_pool);
+}
+
+static void
+event_filter_index_lookup(struct event_filter *filter, struct event *event,
+			  const unsigned int **name_idxs_r,
+			  unsigned int *name_count_r,
+			  const unsigned int **other_idxs_r,
+			  unsigned int *other_count_r)
+{
+	ARRAY_TYPE(uint) *query_idxs = NULL;
+
+	if (filter->index_pool == NULL) T_BEGIN {
+		event_filter_index_build(filter);
+	} T_END;
+
+	if (event->sending_name != NULL) {
+		const char *name = event->sending_name;
+
+		query_idxs = hash_table_lookup(filter->index_names, name);
+	}
+	if (query_idxs == NULL) {
+		*name_idxs_r = NULL;
+		*name_count_r = 0;
+	} else {
+		*name_idxs_r = array_get(query_idxs, name_count_r);
+	}
+	*other_idxs_r = array_get(&filter->index_other_queries, other_count_r);
+}
+
 bool event_filter_match(struct event_filter *filter, struct event *event,
 			const struct failure_context *ctx)
 {
@@ -1117,16 +1235,29 @@ bool event_filter_match_source(struct event_filter *filter, struct event *event,
 			       unsigned int source_linenum,
 			       const struct failure_context *ctx)
 {
-	const struct event_filter_query_internal *query;
+	const struct event_filter_query_internal *queries;
+	const unsigned int *name_idxs, *other_idxs;
+	unsigned int i, count, name_count, other_count;
 
 	i_assert(!filter->fragment);
 
 	if (!event_filter_match_fastpath(filter, event))
 		return FALSE;
 
-	array_foreach(&filter->queries, query) {
-		if (event_filter_query_match(query, event, source_filename,
-					     source_linenum, ctx))
+	event_filter_index_lookup(filter, event, &name_idxs, &name_count,
+				  &other_idxs, &other_count);
+	queries = array_get(&filter->queries, &count);
+	i_assert(name_count + other_count <= count);
+	for (i = 0; i < name_count; i++) {
+		if (event_filter_query_match(&queries[name_idxs[i]], event,
+					     source_filename, source_linenum,
+					     ctx))
+			return TRUE;
+	}
+	for (i = 0; i < other_count; i++) {
+		if (event_filter_query_match(&queries[other_idxs[i]], event,
+					     source_filename, source_linenum,
+					     ctx))
 			return TRUE;
 	}
 	return FALSE;
@@ -1147,7 +1278,11 @@ struct event_filter_match_iter {
 	struct event_filter *filter;
 	struct event *event;
 	const struct failure_context *failure_ctx;
-	unsigned int idx;
+
+	/* merged in ascending order from the filter's index */
+	const unsigned int *name_idxs, *other_idxs;
+	unsigned int name_count, other_count;
+	unsigned int name_pos, other_pos;
 };
 
 struct event_filter_match_iter *
@@ -1162,22 +1297,33 @@ event_filter_match_iter_init(struct event_filter *filter, struct event *event,
 	iter->filter = filter;
 	iter->event = event;
 	iter->failure_ctx = ctx;
-	if (!event_filter_match_fastpath(filter, event))
-		iter->idx = UINT_MAX;
+	if (event_filter_match_fastpath(filter, event)) {
+		event_filter_index_lookup(filter, event,
+					  &iter->name_idxs, &iter->name_count,
+					  &iter->other_idxs,
+					  &iter->other_count);
+	}
 	return iter;
 }
 
 void *event_filter_match_iter_next(struct event_filter_match_iter *iter)
 {
 	const struct event_filter_query_internal *queries;
-	unsigned int count;
+	unsigned int idx, count;
 
 	queries = array_get(&iter->filter->queries, &count);
-	while (iter->idx < count) {
-		const struct event_filter_query_internal *query =
-			&queries[iter->idx];
+	while (iter->name_pos < iter->name_count ||
+	       iter->other_pos < iter->other_count) {
+		if (iter->other_pos == iter->other_count ||
+		    (iter->name_pos < iter->name_count &&
+		     iter->name_idxs[iter->name_pos] <
+		     iter->other_idxs[iter->other_pos]))
+			idx = iter->name_idxs[iter->name_pos++];
+		else
+			idx = iter->other_idxs[iter->other_pos++];
+		i_assert(idx < count);
 
-		iter->idx++;
+		const struct event_filter_query_internal *query = &queries[idx];
 		if (query->context != NULL &&
 		    event_filter_query_match(query, iter->event,
 					     iter->event->source_filename,
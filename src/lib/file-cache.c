@@ -7,11 +7,19 @@
 
 #include <sys/stat.h>
 
+/* With FILE_CACHE_FLAG_MMAP map at least this much past the end of file */
+#define FILE_CACHE_MMAP_MIN_GROW (1024*1024)
+
 struct file_cache {
 	int fd;
 	char *path;
+	enum file_cache_flags flags;
 	buffer_t *page_bitmask;
 
+	/* With FILE_CACHE_FLAG_MMAP this is a shared mapping of the file,
+	   and read_highwater is the file size when it was last checked.
+	   Otherwise it's anonymous memory where the pages marked in
+	   page_bitmask have been read from the file. */
 	void *mmap_base;
 	size_t mmap_length;
 	size_t read_highwater;
@@ -23,23 +31,43 @@ struct file_cache *file_cache_new(int fd)
 }
 
 struct file_cache *file_cache_new_path(int fd, const char *path)
+{
+	return file_cache_new_full(fd, path, 0);
+}
+
+struct file_cache *file_cache_new_full(int fd, const char *path,
+				       enum file_cache_flags flags)
 {
 	struct file_cache *cache;
 
 	cache = i_new(struct file_cache, 1);
 	cache->fd = fd;
 	cache->path = i_strdup(path);
+	cache->flags = flags;
 	cache->page_bitmask = buffer_create_dynamic(default_pool, 128);
 	return cache;
 }
 
+static void file_cache_unmap(struct file_cache *cache)
+{
+	if (cache->mmap_base != NULL) {
+		if (munmap(cache->mmap_base, cache->mmap_length) < 0)
+			i_error("munmap(%s) failed: %m", cache->path);
+	}
+	cache->mmap_base = NULL;
+	cache->mmap_length = 0;
+	cache->read_highwater = 0;
+}
+
 void file_cache_free(struct file_cache **_cache)
 {
 	struct file_cache *cache = *_cache;
 
 	*_cache = NULL;
 
-	if (cache->mmap_base != NULL) {
+	if ((cache->flags & FILE_CACHE_FLAG_MMAP) != 0)
+		file_cache_unmap(cache);
+	else if (cache->mmap_base != NULL) {
 		if (munmap_anon(cache->mmap_base, cache->mmap_length) < 0)
 			i_error("munmap_anon(%s) failed: %m", cache->path);
 	}
@@ -51,7 +79,10 @@ void file_cache_free(struct file_cache **_cache)
 void file_cache_set_fd(struct file_cache *cache, int fd)
 {
 	cache->fd = fd;
-	file_cache_invalidate(cache, 0, cache->mmap_length);
+	if ((cache->flags & FILE_CACHE_FLAG_MMAP) != 0)
+		file_cache_unmap(cache);
+	else
+		file_cache_invalidate(cache, 0, cache->mmap_length);
 }
 
 int file_cache_set_size(struct file_cache *cache, uoff_t size)
@@ -62,6 +93,11 @@ int file_cache_set_size(struct file_cache *cache, uoff_t size)
 
 	i_assert(page_size > 0);
 
+	if ((cache->flags & FILE_CACHE_FLAG_MMAP) != 0) {
+		/* the mapping is sized by the file */
+		return 0;
+	}
+
 	diff = size % page_size;
 	if (diff != 0)
 		size += page_size - diff;
@@ -101,6 +137,58 @@ int file_cache_set_size(struct file_cache *cache, uoff_t size)
 	return 0;
 }
 
+static ssize_t
+file_cache_read_mmap(struct file_cache *cache, uoff_t offset, size_t size)
+{
+	size_t page_size = mmap_get_page_size();
+	struct stat st;
+	uoff_t map_size;
+
+	if (offset + size > cache->read_highwater) {
+		/* the file may have grown since it was mapped */
+		if (fstat(cache->fd, &st) < 0) {
+			if (errno != ESTALE)
+				i_error("fstat(%s) failed: %m", cache->path);
+			return -1;
+		}
+		if ((uoff_t)st.st_size > cache->mmap_length) {
+			/* leave room for the file to grow, so appends don't
+			   need to remap it every time. the pages past the
+			   end of file are never accessed. */
+			map_size = st.st_size + I_MAX(st.st_size / 8,
+						       FILE_CACHE_MMAP_MIN_GROW);
+			map_size += page_size - map_size % page_size;
+			if (map_size > SIZE_MAX) {
+				i_error("file_cache_read(%s): "
+					"File too large to mmap: "
+					"%"PRIuUOFF_T" bytes",
+					cache->path, st.st_size);
+				return -1;
+			}
+			file_cache_unmap(cache);
+			cache->mmap_base = mmap(NULL, map_size, PROT_READ,
+						MAP_SHARED, cache->fd, 0);
+			if (cache->mmap_base == MAP_FAILED) {
+				/* e.g. the filesystem doesn't support mmap()
+				   or we hit the mapping limits. fall back to
+				   copying the file's pages permanently. */
+				i_error("mmap(%s, %"PRIuUOFF_T") failed: %m - "
+					"falling back to reading the file",
+					cache->path, map_size);
+				cache->mmap_base = NULL;
+				cache->flags &= ENUM_NEGATE(FILE_CACHE_FLAG_MMAP);
+				return file_cache_read(cache, offset, size);
+			}
+			cache->mmap_length = map_size;
+		}
+		cache->read_highwater = I_MIN((uoff_t)st.st_size,
+					      cache->mmap_length);
+	}
+	if (offset >= cache->read_highwater)
+		return 0;
+	return I_MIN(size, cache->read_highwater - offset);
+}
+
 ssize_t file_cache_read(struct file_cache *cache, uoff_t offset, size_t size)
 {
 	size_t page_size = mmap_get_page_size();
@@ -119,6 +207,9 @@ ssize_t file_cache_read(struct file_cache *cache, uoff_t offset, size_t size)
 	if (offset >= UOFF_T_MAX - size)
 		size = UOFF_T_MAX - offset;
 
+	if ((cache->flags & FILE_CACHE_FLAG_MMAP) != 0)
+		return file_cache_read_mmap(cache, offset, size);
+
 	if (offset + size > cache->mmap_length &&
 	    offset + size - cache->mmap_length > 1024*1024) {
 		/* growing more than a megabyte, make sure that the
@@ -244,6 +335,12 @@ void file_cache_write(struct file_cache *cache, const void *data, size_t size,
 	i_assert(page_size > 0);
 	i_assert(UOFF_T_MAX - offset > size);
 
+	if ((cache->flags & FILE_CACHE_FLAG_MMAP) != 0) {
+		/* the data is already in the file. if it's past the mapped
+		   area, the next file_cache_read() maps it. */
+		return;
+	}
+
 	if (file_cache_set_size(cache, offset + size) < 0) {
 		/* couldn't grow mapping. just make sure the written memory
 		   area is invalidated then. */
@@ -289,6 +386,20 @@ void file_cache_invalidate(struct file_cache *cache, uoff_t offset, uoff_t size)
 
 	i_assert(page_size > 0);
 
+	if ((cache->flags & FILE_CACHE_FLAG_MMAP) != 0) {
+		uoff_t start = offset & ~(page_size-1);
+
+		/* offset < read_highwater was checked above. nothing is
+		   mapped if the mapping failed or was dropped. */
+		if (cache->mmap_base == NULL)
+			return;
+		if (size > cache->read_highwater - offset)
+			size = cache->read_highwater - offset;
+		(void)msync(PTR_OFFSET(cache->mmap_base, start),
+			    offset + size - start, MS_INVALIDATE);
+		return;
+	}
+
 	if (size > cache->read_highwater - offset) {
 		/* ignore anything after read highwater */
 		size = cache->read_highwater - offset;
@@ -1,10 +1,21 @@
 #ifndef FILE_CACHE_H
 #define FILE_CACHE_H
 
+enum file_cache_flags {
+	/* Serve reads directly from a shared read-only mmap() of the file
+	   instead of copying the file's pages to private memory. This must
+	   not be used for files on NFS, or for files that may be truncated
+	   while they're mapped. file_cache_write() doesn't modify the mapping,
+	   so the data must be written to the file before calling it. */
+	FILE_CACHE_FLAG_MMAP = BIT(0),
+};
+
 /* Create a new file cache. It works very much like file-backed mmap()ed
    memory, but it works more nicely with remote filesystems (no SIGBUS). */
 struct file_cache *file_cache_new(int fd);
 struct file_cache *file_cache_new_path(int fd, const char *path);
+struct file_cache *file_cache_new_full(int fd, const char *path,
+				       enum file_cache_flags flags);
 /* Destroy the cache and set cache pointer to NULL. */
 void file_cache_free(struct file_cache **cache);
 
@@ -30,7 +41,9 @@ void file_cache_write(struct file_cache *cache, const void *data, size_t size,
 		      uoff_t offset);
 
 /* Invalidate cached memory area. It will be read again next time it's tried
-   to be accessed. */
+   to be accessed. With FILE_CACHE_FLAG_MMAP the mapping already shows the
+   file's current contents on systems with a unified buffer cache, so this
+   only asks the kernel to invalidate any stale pages in the area. */
 void file_cache_invalidate(struct file_cache *cache,
 			   uoff_t offset, uoff_t size);
 
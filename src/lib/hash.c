@@ -3,6 +3,7 @@
 /* @UNSAFE: whole file */
 
 #include "lib.h"
+#include "byteorder.h"
 #include "hash.h"
 #include "primes.h"
 
@@ -10,8 +11,24 @@
 
 #define HASH_TABLE_MIN_SIZE 67
 
+/* Flat tables are split into groups of 8 slots. Each slot has a control byte,
+   which is either EMPTY, DELETED or the lowest 7 bits of the key's hash.
+   Lookups compare a whole group's control bytes at once and call the key
+   comparison callback only for slots whose hash bits match. */
+#define HASH_FLAT_GROUP_SIZE 8
+#define HASH_FLAT_MIN_SIZE 16
+#define HASH_FLAT_CTRL_EMPTY 0x80
+#define HASH_FLAT_CTRL_DELETED 0xfe
+#define HASH_FLAT_LSBS 0x0101010101010101ULL
+#define HASH_FLAT_MSBS 0x8080808080808080ULL
+#define HASH_FLAT_CTRL_IS_FULL(ctrl) (((ctrl) & 0x80) == 0)
+/* Maximum load factor is 7/8 */
+#define HASH_FLAT_MAX_COUNT(size) ((size) - (size) / 8)
+
 #undef hash_table_create
 #undef hash_table_create_direct
+#undef hash_table_create_flat
+#undef hash_table_create_direct_flat
 #undef hash_table_destroy
 #undef hash_table_clear
 #undef hash_table_lookup
@@ -32,6 +49,11 @@ struct hash_node {
 	void *value;
 };
 
+struct hash_flat_slot {
+	void *key;
+	void *value;
+};
+
 struct hash_table {
 	pool_t node_pool;
 
@@ -42,6 +64,14 @@ struct hash_table {
 	struct hash_node *nodes;
 	struct hash_node *free_nodes;
 
+	/* Flat tables (size is a power of 2): */
+	unsigned char *ctrl;
+	struct hash_flat_slot *slots;
+	/* Number of EMPTY slots that can still be used before the table
+	   needs to be rehashed. */
+	unsigned int growth_left;
+	bool flat;
+
 	hash_callback_t *hash_cb;
 	hash_cmp_callback_t *key_compare_cb;
 };
@@ -59,6 +89,8 @@ enum hash_table_operation{
 };
 
 static bool hash_table_resize(struct hash_table *table, bool grow);
+static void hash_flat_init_size(struct hash_table *table, unsigned int size);
+static unsigned int hash_flat_size_for(unsigned int count);
 
 void hash_table_create(struct hash_table **table_r, pool_t node_pool,
 		       unsigned int initial_size, hash_callback_t *hash_cb,
@@ -98,6 +130,270 @@ void hash_table_create_direct(struct hash_table **table_r, pool_t node_pool,
 			  direct_hash, direct_cmp);
 }
 
+void hash_table_create_flat(struct hash_table **table_r, pool_t node_pool,
+			    unsigned int initial_size,
+			    hash_callback_t *hash_cb,
+			    hash_cmp_callback_t *key_compare_cb)
+{
+	struct hash_table *table;
+
+	pool_ref(node_pool);
+	table = i_new(struct hash_table, 1);
+	table->node_pool = node_pool;
+	table->flat = TRUE;
+	table->initial_size = hash_flat_size_for(initial_size);
+
+	table->hash_cb = hash_cb;
+	table->key_compare_cb = key_compare_cb;
+
+	hash_flat_init_size(table, table->initial_size);
+	*table_r = table;
+}
+
+void hash_table_create_direct_flat(struct hash_table **table_r,
+				   pool_t node_pool, unsigned int initial_size)
+{
+	hash_table_create_flat(table_r, node_pool, initial_size,
+			       direct_hash, direct_cmp);
+}
+
+static void hash_flat_init_size(struct hash_table *table, unsigned int size)
+{
+	i_assert(size >= HASH_FLAT_MIN_SIZE && (size & (size - 1)) == 0);
+
+	table->size = size;
+	table->ctrl = i_malloc(size);
+	memset(table->ctrl, HASH_FLAT_CTRL_EMPTY, size);
+	table->slots = i_new(struct hash_flat_slot, size);
+	table->growth_left = HASH_FLAT_MAX_COUNT(size);
+}
+
+static unsigned int hash_flat_size_for(unsigned int count)
+{
+	unsigned int size = HASH_FLAT_MIN_SIZE;
+
+	while (HASH_FLAT_MAX_COUNT(size) < count) {
+		i_assert(size < (1U << 31));
+		size <<= 1;
+	}
+	return size;
+}
+
+static inline uint64_t hash_flat_mix(unsigned int hash)
+{
+	/* Many of the hash functions (especially direct_hash()) have poorly
+	   distributed low bits. Mix them so that both the group index and
+	   the control byte get good bits. */
+	return (uint64_t)hash * 0x9e3779b97f4a7c15ULL;
+}
+
+static inline unsigned int
+hash_flat_group(const struct hash_table *table, uint64_t mixed)
+{
+	return (unsigned int)(mixed >> 32) &
+		(table->size / HASH_FLAT_GROUP_SIZE - 1);
+}
+
+static inline unsigned char hash_flat_h2(uint64_t mixed)
+{
+	return (mixed >> 25) & 0x7f;
+}
+
+static inline uint64_t
+hash_flat_group_ctrl(const struct hash_table *table, unsigned int group)
+{
+	return le64_to_cpu_unaligned(table->ctrl + group * HASH_FLAT_GROUP_SIZE);
+}
+
+/* Returns the highest bit set for each control byte that may match h2.
+   There can be false positives. */
+static inline uint64_t hash_flat_match_h2(uint64_t ctrl, unsigned char h2)
+{
+	uint64_t x = ctrl ^ (HASH_FLAT_LSBS * h2);
+
+	return (x - HASH_FLAT_LSBS) & ~x & HASH_FLAT_MSBS;
+}
+
+static inline uint64_t hash_flat_match_empty(uint64_t ctrl)
+{
+	/* only EMPTY has the highest bit set and the second lowest unset */
+	return ctrl & ~(ctrl << 6) & HASH_FLAT_MSBS;
+}
+
+static inline uint64_t hash_flat_match_free(uint64_t ctrl)
+{
+	/* EMPTY or DELETED */
+	return ctrl & HASH_FLAT_MSBS;
+}
+
+static inline unsigned int hash_flat_match_first(uint64_t match)
+{
+	return __builtin_ctzll(match) / 8;
+}
+
+static unsigned int
+hash_flat_find(const struct hash_table *table, const void *key,
+	       unsigned int hash)
+{
+	uint64_t mixed = hash_flat_mix(hash), ctrl, match;
+	unsigned int group = hash_flat_group(table, mixed);
+	unsigned int group_mask = table->size / HASH_FLAT_GROUP_SIZE - 1;
+	unsigned char h2 = hash_flat_h2(mixed);
+	unsigned int probe, idx;
+
+	/* triangular probing visits all the groups once */
+	for (probe = 0; probe <= group_mask; probe++) {
+		ctrl = hash_flat_group_ctrl(table, group);
+		match = hash_flat_match_h2(ctrl, h2);
+		for (; match != 0; match &= match - 1) {
+			idx = group * HASH_FLAT_GROUP_SIZE +
+				hash_flat_match_first(match);
+			if (table->ctrl[idx] == h2 &&
+			    table->key_compare_cb(table->slots[idx].key,
+						  key) == 0)
+				return idx;
+		}
+		/* keys are never placed beyond a group with EMPTY slots */
+		if (hash_flat_match_empty(ctrl) != 0)
+			break;
+		group = (group + probe + 1) & group_mask;
+	}
+	return UINT_MAX;
+}
+
+static unsigned int
+hash_flat_find_free(const struct hash_table *table, uint64_t mixed)
+{
+	unsigned int group = hash_flat_group(table, mixed);
+	unsigned int group_mask = table->size / HASH_FLAT_GROUP_SIZE - 1;
+	unsigned int probe;
+	uint64_t match;
+
+	for (probe = 0; probe <= group_mask; probe++) {
+		match = hash_flat_match_free(hash_flat_group_ctrl(table, group));
+		if (match != 0) {
+			return group * HASH_FLAT_GROUP_SIZE +
+				hash_flat_match_first(match);
+		}
+		group = (group + probe + 1) & group_mask;
+	}
+	i_unreached();
+}
+
+static void
+hash_flat_insert_new(struct hash_table *table, void *key, void *value)
+{
+	uint64_t mixed = hash_flat_mix(table->hash_cb(key));
+	unsigned int idx;
+
+	idx = hash_flat_find_free(table, mixed);
+	if (table->ctrl[idx] == HASH_FLAT_CTRL_EMPTY &&
+	    table->growth_left > 0)
+		table->growth_left--;
+	table->ctrl[idx] = hash_flat_h2(mixed);
+	table->slots[idx].key = key;
+	table->slots[idx].value = value;
+	table->nodes_count++;
+}
+
+static void hash_flat_rehash(struct hash_table *table, unsigned int new_size)
+{
+	unsigned char *old_ctrl = table->ctrl;
+	struct hash_flat_slot *old_slots = table->slots;
+	unsigned int i, old_size = table->size;
+
+	i_assert(table->frozen == 0);
+
+	hash_flat_init_size(table, new_size);
+	table->nodes_count = 0;
+	for (i = 0; i < old_size; i++) {
+		if (HASH_FLAT_CTRL_IS_FULL(old_ctrl[i])) {
+			hash_flat_insert_new(table, old_slots[i].key,
+					     old_slots[i].value);
+		}
+	}
+	i_free(old_ctrl);
+	i_free(old_slots);
+}
+
+static void hash_flat_reserve(struct hash_table *table, unsigned int count)
+{
+	if (table->nodes_count + table->growth_left >= count)
+		return;
+	if (count <= table->size / 32 * 25) {
+		/* there are a lot of DELETED slots - rehashing at the
+		   same size is enough */
+		hash_flat_rehash(table, table->size);
+	} else {
+		hash_flat_rehash(table,
+			I_MAX(hash_flat_size_for(count), table->size * 2));
+	}
+}
+
+static void hash_flat_shrink(struct hash_table *table)
+{
+	if (table->nodes_count >= table->size / 8 ||
+	    table->size <= table->initial_size)
+		return;
+	hash_flat_rehash(table, I_MAX(hash_flat_size_for(table->nodes_count * 2),
+				      table->initial_size));
+}
+
+static void
+hash_flat_insert(struct hash_table *table, void *key, void *value,
+		 bool update)
+{
+	unsigned int idx;
+
+	i_assert(table->nodes_count < UINT_MAX);
+	i_assert(key != NULL);
+
+	idx = hash_flat_find(table, key, table->hash_cb(key));
+	if (idx != UINT_MAX) {
+		i_assert(update);
+		table->slots[idx].value = value;
+		return;
+	}
+
+	if (table->growth_left == 0) {
+		/* A frozen table can't be rehashed, because that would move
+		   the nodes under the iterators. It can only use the slots
+		   that are still free - see hash_table_create_flat(). */
+		if (table->frozen == 0)
+			hash_flat_reserve(table, table->nodes_count + 1);
+		else
+			i_assert(table->nodes_count < table->size);
+	}
+	hash_flat_insert_new(table, key, value);
+}
+
+static bool hash_flat_try_remove(struct hash_table *table, const void *key)
+{
+	unsigned int idx;
+
+	idx = hash_flat_find(table, key, table->hash_cb(key));
+	if (idx == UINT_MAX)
+		return FALSE;
+
+	/* If the group still has EMPTY slots, no lookup has continued past
+	   it. Then the slot can become EMPTY as well. Otherwise it must be
+	   DELETED, so the lookups continue to the following groups. */
+	if (hash_flat_match_empty(hash_flat_group_ctrl(table,
+			idx / HASH_FLAT_GROUP_SIZE)) != 0) {
+		table->ctrl[idx] = HASH_FLAT_CTRL_EMPTY;
+		table->growth_left++;
+	} else {
+		table->ctrl[idx] = HASH_FLAT_CTRL_DELETED;
+	}
+	table->slots[idx].key = NULL;
+	table->slots[idx].value = NULL;
+	table->nodes_count--;
+
+	if (table->frozen == 0)
+		hash_flat_shrink(table);
+	return TRUE;
+}
+
 static void free_node(struct hash_table *table, struct hash_node *node)
 {
 	if (!table->node_pool->alloconly_pool)
@@ -139,13 +435,15 @@ void hash_table_destroy(struct hash_table **_table)
 
 	i_assert(table->frozen == 0);
 
-	if (!table->node_pool->alloconly_pool) {
+	if (!table->node_pool->alloconly_pool && !table->flat) {
 		hash_table_destroy_nodes(table);
 		destroy_node_list(table, table->free_nodes);
 	}
 
 	pool_unref(&table->node_pool);
 	i_free(table->nodes);
+	i_free(table->ctrl);
+	i_free(table->slots);
 	i_free(table);
 }
 
@@ -153,6 +451,14 @@ void hash_table_clear(struct hash_table *table, bool free_nodes)
 {
 	i_assert(table->frozen == 0);
 
+	if (table->flat) {
+		memset(table->ctrl, HASH_FLAT_CTRL_EMPTY, table->size);
+		memset(table->slots, 0, sizeof(*table->slots) * table->size);
+		table->growth_left = HASH_FLAT_MAX_COUNT(table->size);
+		table->nodes_count = 0;
+		return;
+	}
+
 	if (!table->node_pool->alloconly_pool)
 		hash_table_destroy_nodes(table);
 
@@ -191,6 +497,12 @@ void *hash_table_lookup(const struct hash_table *table, const void *key)
 {
 	struct hash_node *node;
 
+	if (table->flat) {
+		unsigned int idx = hash_flat_find(table, key,
+						  table->hash_cb(key));
+		return idx != UINT_MAX ? table->slots[idx].value : NULL;
+	}
+
 	node = hash_table_lookup_node(table, key, table->hash_cb(key));
 	return node != NULL ? node->value : NULL;
 }
@@ -201,6 +513,16 @@ bool hash_table_lookup_full(const struct hash_table *table,
 {
 	struct hash_node *node;
 
+	if (table->flat) {
+		unsigned int idx = hash_flat_find(table, lookup_key,
+						  table->hash_cb(lookup_key));
+		if (idx == UINT_MAX)
+			return FALSE;
+		*orig_key = table->slots[idx].key;
+		*value = table->slots[idx].value;
+		return TRUE;
+	}
+
 	node = hash_table_lookup_node(table, lookup_key,
 				      table->hash_cb(lookup_key));
 	if (node == NULL)
@@ -297,12 +619,18 @@ hash_table_insert_node(struct hash_table *table, void *key, void *value,
 
 void hash_table_insert(struct hash_table *table, void *key, void *value)
 {
-	hash_table_insert_node(table, key, value, HASH_TABLE_OP_INSERT);
+	if (table->flat)
+		hash_flat_insert(table, key, value, FALSE);
+	else
+		hash_table_insert_node(table, key, value, HASH_TABLE_OP_INSERT);
 }
 
 void hash_table_update(struct hash_table *table, void *key, void *value)
 {
-	hash_table_insert_node(table, key, value, HASH_TABLE_OP_UPDATE);
+	if (table->flat)
+		hash_flat_insert(table, key, value, TRUE);
+	else
+		hash_table_insert_node(table, key, value, HASH_TABLE_OP_UPDATE);
 }
 
 static void
@@ -347,6 +675,9 @@ bool hash_table_try_remove(struct hash_table *table, const void *key)
 	struct hash_node *node;
 	unsigned int hash;
 
+	if (table->flat)
+		return hash_flat_try_remove(table, key);
+
 	hash = table->hash_cb(key);
 
 	node = hash_table_lookup_node(table, key, hash);
@@ -376,7 +707,8 @@ struct hash_iterate_context *hash_table_iterate_init(struct hash_table *table)
 
 	ctx = i_new(struct hash_iterate_context, 1);
 	ctx->table = table;
-	ctx->next = &table->nodes[0];
+	if (!table->flat)
+		ctx->next = &table->nodes[0];
 	return ctx;
 }
 
@@ -398,11 +730,34 @@ hash_table_iterate_next(struct hash_iterate_context *ctx,
 	return node;
 }
 
+static bool
+hash_flat_iterate(struct hash_iterate_context *ctx,
+		  void **key_r, void **value_r)
+{
+	const struct hash_table *table = ctx->table;
+
+	/* the table can't be rehashed while it's frozen, so slots don't move
+	   during the iteration */
+	for (; ctx->pos < table->size; ctx->pos++) {
+		if (HASH_FLAT_CTRL_IS_FULL(table->ctrl[ctx->pos])) {
+			*key_r = table->slots[ctx->pos].key;
+			*value_r = table->slots[ctx->pos].value;
+			ctx->pos++;
+			return TRUE;
+		}
+	}
+	*key_r = *value_r = NULL;
+	return FALSE;
+}
+
 bool hash_table_iterate(struct hash_iterate_context *ctx,
 			void **key_r, void **value_r)
 {
 	struct hash_node *node;
 
+	if (ctx->table->flat)
+		return hash_flat_iterate(ctx, key_r, value_r);
+
 	node = ctx->next;
 	if (node != NULL && node->key == NULL)
 		node = hash_table_iterate_next(ctx, node);
@@ -441,6 +796,14 @@ void hash_table_thaw(struct hash_table *table)
 	if (--table->frozen > 0)
 		return;
 
+	if (table->flat) {
+		/* inserts may have used up the spare EMPTY slots */
+		if (table->growth_left == 0)
+			hash_flat_reserve(table, table->nodes_count + 1);
+		else
+			hash_flat_shrink(table);
+		return;
+	}
 	if (table->removed_count > 0) {
 		if (!hash_table_resize(table, FALSE))
 			hash_table_compress_removed(table);
@@ -509,6 +872,9 @@ void hash_table_copy(struct hash_table *dest, struct hash_table *src)
 	struct hash_iterate_context *iter;
 	void *key, *value;
 
+	/* flat tables can't grow while frozen */
+	if (dest->flat && dest->frozen == 0)
+		hash_flat_reserve(dest, dest->nodes_count + src->nodes_count);
 	hash_table_freeze(dest);
 
 	iter = hash_table_iterate_init(src);
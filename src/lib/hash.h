@@ -55,6 +55,50 @@ void hash_table_create_direct(struct hash_table **table_r, pool_t node_pool,
 	/* NOLINTEND(bugprone-sizeof-expression) */ \
 	hash_table_create_direct(&(*table)._table, pool, size))
 
+/* Like hash_table_create() and hash_table_create_direct(), but create an
+   open addressing table. Its nodes are kept in a single array, so lookups
+   don't need to follow pointers and there are no per-node allocations.
+
+   The table can't be resized while it's frozen or being iterated. Inserts
+   can then use only the slots that are still free, and inserting into a
+   completely full frozen table assert-crashes. Use these tables only when
+   nodes aren't added while iterating, or when the number of such nodes is
+   known to fit (hash_table_copy() reserves the space before freezing). */
+void hash_table_create_flat(struct hash_table **table_r, pool_t node_pool,
+			    unsigned int initial_size,
+			    hash_callback_t *hash_cb,
+			    hash_cmp_callback_t *key_compare_cb);
+#define hash_table_create_flat(table, pool, size, hash_cb, key_cmp_cb) \
+	TYPE_CHECKS(void, \
+	/* NOLINTBEGIN(bugprone-sizeof-expression) */ \
+	COMPILE_ERROR_IF_TRUE( \
+		sizeof((*table)._key) != sizeof(void *) || \
+		sizeof((*table)._value) != sizeof(void *)) || \
+	COMPILE_ERROR_IF_TRUE( \
+               !__builtin_types_compatible_p(typeof(&key_cmp_cb), \
+                       int (*)(typeof((*table)._key), typeof((*table)._key))) && \
+               !__builtin_types_compatible_p(typeof(&key_cmp_cb), \
+                       int (*)(typeof((*table)._const_key), typeof((*table)._const_key)))) || \
+	COMPILE_ERROR_IF_TRUE( \
+		!__builtin_types_compatible_p(typeof(&hash_cb), \
+			unsigned int (*)(typeof((*table)._key))) && \
+		!__builtin_types_compatible_p(typeof(&hash_cb), \
+		unsigned int (*)(typeof((*table)._const_key)))), \
+	/* NOLINTEND(bugprone-sizeof-expression) */ \
+	hash_table_create_flat(&(*table)._table, pool, size, \
+		(hash_callback_t *)hash_cb, \
+		(hash_cmp_callback_t *)key_cmp_cb))
+void hash_table_create_direct_flat(struct hash_table **table_r,
+				   pool_t node_pool, unsigned int initial_size);
+#define hash_table_create_direct_flat(table, pool, size) \
+	TYPE_CHECKS(void, \
+	/* NOLINTBEGIN(bugprone-sizeof-expression) */ \
+	COMPILE_ERROR_IF_TRUE( \
+		sizeof((*table)._key) != sizeof(void *) || \
+		sizeof((*table)._value) != sizeof(void *)), \
+	/* NOLINTEND(bugprone-sizeof-expression) */ \
+	hash_table_create_direct_flat(&(*table)._table, pool, size))
+
 #define hash_table_is_created(table) \
 	((table)._table != NULL)
 
@@ -2,6 +2,7 @@
 #define IOLOOP_PRIVATE_H
 
 #include "priorityq.h"
+#include "timer-wheel.h"
 #include "ioloop.h"
 #include "array-decl.h"
 
@@ -16,7 +17,10 @@ struct ioloop {
 
 	struct io_file *io_files;
 	struct io_file *next_io_file;
+	/* absolute and 0 ms timeouts */
 	struct priorityq *timeouts;
+	/* all the other started timeouts */
+	struct timer_wheel *timeout_wheel;
 	ARRAY(struct timeout *) timeouts_new;
 	struct io_wait_timer *wait_timers;
 
@@ -52,6 +56,8 @@ struct io {
 
 	struct ioloop *ioloop;
 	struct ioloop_context *ctx;
+	/* Cached statistics entry for the source location */
+	struct ioloop_callback_stats *stats;
 };
 
 struct io_file {
@@ -69,6 +75,7 @@ struct io_file {
 
 struct timeout {
 	struct priorityq_item item;
+	struct timer_wheel_item wheel_item;
 	const char *source_filename;
 	unsigned int source_linenum;
 
@@ -80,6 +87,8 @@ struct timeout {
 
 	struct ioloop *ioloop;
 	struct ioloop_context *ctx;
+	/* Cached statistics entry for the source location */
+	struct ioloop_callback_stats *stats;
 
 	bool one_shot:1;
 };
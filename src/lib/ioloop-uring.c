@@ -0,0 +1,371 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+/* @UNSAFE: whole file */
+
+#include "lib.h"
+#include "array.h"
+#include "sleep.h"
+#include "ioloop-private.h"
+#include "ioloop-iolist.h"
+#include "uring.h"
+
+#ifdef IOLOOP_URING
+
+#include <poll.h>
+
+/* Number of submission queue entries. The completion queue is twice this
+   size. Poll completions don't get lost even if the completion queue
+   overflows (IORING_FEAT_NODROP), so this only affects how often the
+   submissions need to be flushed before waiting. */
+#define IO_URING_SQ_ENTRIES 256
+
+/* user_data layout: the two highest bits specify the request type. Poll
+   requests have the fd in the lowest 32 bits and the fd's generation in the
+   bits between them, so that completions for already removed (or re-added)
+   polls can be recognized and ignored. */
+#define IO_URING_DATA_TYPE_SHIFT 62
+#define IO_URING_DATA_TYPE_POLL 0ULL
+#define IO_URING_DATA_TYPE_IGNORE 1ULL
+#define IO_URING_DATA_GEN_MASK 0x3fffffffU
+
+#define IO_URING_ERROR (POLLERR | POLLHUP | POLLNVAL)
+#define IO_URING_INPUT (POLLIN | POLLPRI | IO_URING_ERROR)
+#define IO_URING_OUTPUT (POLLOUT | IO_URING_ERROR)
+
+struct io_uring_fd {
+	struct io_list list;
+
+	/* generation of the currently armed poll request */
+	uint32_t gen;
+	/* events the currently armed poll request is waiting for */
+	unsigned int armed_events;
+
+	/* poll request is currently armed in the kernel */
+	bool armed:1;
+	/* fd is in dirty_fds and its poll request needs to be updated */
+	bool dirty:1;
+	/* all ios were removed from the fd, so the fd may have been closed
+	   and reused. the armed poll must not be kept. */
+	bool rearm:1;
+	/* an io was added to the fd after its poll request was last
+	   completed */
+	bool added:1;
+};
+
+struct io_uring_event {
+	int fd;
+	unsigned int revents;
+};
+
+struct ioloop_handler_context {
+	struct uring ring;
+
+	ARRAY(struct io_uring_fd *) fd_index;
+	ARRAY(int) dirty_fds;
+	ARRAY(struct io_uring_event) events;
+	ARRAY(struct io_uring_event) added_events;
+};
+
+void io_loop_handler_init(struct ioloop *ioloop, unsigned int initial_fd_count)
+{
+	struct ioloop_handler_context *ctx;
+	const char *error;
+
+	ioloop->handler_context = ctx = i_new(struct ioloop_handler_context, 1);
+
+	i_array_init(&ctx->fd_index, initial_fd_count);
+	i_array_init(&ctx->dirty_fds, initial_fd_count);
+	i_array_init(&ctx->events, initial_fd_count);
+	i_array_init(&ctx->added_events, initial_fd_count);
+
+	if (uring_init(&ctx->ring, IO_URING_SQ_ENTRIES, &error) < 0) {
+		if (errno != ENOSYS && errno != EPERM)
+			i_fatal("%s failed: %m", error);
+		i_fatal("%s failed: %m (io_uring may be disabled by "
+			"the kernel or a seccomp policy - rebuild with "
+			"--with-ioloop=epoll)", error);
+	}
+	if ((ctx->ring.features & IORING_FEAT_NODROP) == 0 ||
+	    (ctx->ring.features & IORING_FEAT_EXT_ARG) == 0) {
+		i_fatal("io_uring: Kernel is too old "
+			"(Linux v5.11+ required for the uring ioloop)");
+	}
+}
+
+void io_loop_handler_deinit(struct ioloop *ioloop)
+{
+	struct ioloop_handler_context *ctx = ioloop->handler_context;
+	struct io_uring_fd **list;
+	unsigned int i, count;
+
+	list = array_get_modifiable(&ctx->fd_index, &count);
+	for (i = 0; i < count; i++)
+		i_free(list[i]);
+
+	/* closing the ring cancels all the pending poll requests */
+	uring_deinit(&ctx->ring);
+	array_free(&ctx->fd_index);
+	array_free(&ctx->dirty_fds);
+	array_free(&ctx->events);
+	array_free(&ctx->added_events);
+	i_free(ioloop->handler_context);
+}
+
+static unsigned int io_uring_event_mask(const struct io_list *list)
+{
+	unsigned int events = 0;
+	struct io_file *io;
+	int i;
+
+	for (i = 0; i < IOLOOP_IOLIST_IOS_PER_FD; i++) {
+		io = list->ios[i];
+
+		if (io == NULL)
+			continue;
+
+		if ((io->io.condition & IO_READ) != 0)
+			events |= IO_URING_INPUT;
+		if ((io->io.condition & IO_WRITE) != 0)
+			events |= IO_URING_OUTPUT;
+		if ((io->io.condition & IO_ERROR) != 0)
+			events |= IO_URING_ERROR;
+	}
+	return events;
+}
+
+static uint64_t io_uring_poll_data(int fd, uint32_t gen)
+{
+	return (IO_URING_DATA_TYPE_POLL << IO_URING_DATA_TYPE_SHIFT) |
+		((uint64_t)(gen & IO_URING_DATA_GEN_MASK) << 32) |
+		(unsigned int)fd;
+}
+
+static void
+io_uring_fd_update(struct ioloop_handler_context *ctx, int fd,
+		   struct io_uring_fd *ufd)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int events = io_uring_event_mask(&ufd->list);
+
+	if (ufd->armed && (ufd->rearm || ufd->armed_events != events)) {
+		sqe = uring_get_sqe(&ctx->ring);
+		sqe->opcode = IORING_OP_POLL_REMOVE;
+		sqe->fd = -1;
+		sqe->addr = io_uring_poll_data(fd, ufd->gen);
+		sqe->user_data = IO_URING_DATA_TYPE_IGNORE <<
+			IO_URING_DATA_TYPE_SHIFT;
+		ufd->armed = FALSE;
+	}
+	ufd->rearm = FALSE;
+
+	if (!ufd->armed && events != 0) {
+		ufd->gen = (ufd->gen + 1) & IO_URING_DATA_GEN_MASK;
+		sqe = uring_get_sqe(&ctx->ring);
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = fd;
+		sqe->poll32_events = events;
+		sqe->user_data = io_uring_poll_data(fd, ufd->gen);
+		ufd->armed = TRUE;
+		ufd->armed_events = events;
+	}
+}
+
+static void io_uring_flush_dirty(struct ioloop_handler_context *ctx)
+{
+	struct io_uring_fd *ufd;
+	int fd;
+
+	array_foreach_elem(&ctx->dirty_fds, fd) {
+		ufd = array_idx_elem(&ctx->fd_index, fd);
+		i_assert(ufd->dirty);
+		ufd->dirty = FALSE;
+		io_uring_fd_update(ctx, fd, ufd);
+	}
+	array_clear(&ctx->dirty_fds);
+}
+
+static void
+io_uring_fd_set_dirty(struct ioloop_handler_context *ctx, int fd,
+		      struct io_uring_fd *ufd)
+{
+	if (!ufd->dirty) {
+		ufd->dirty = TRUE;
+		array_push_back(&ctx->dirty_fds, &fd);
+	}
+}
+
+void io_loop_handle_add(struct io_file *io)
+{
+	struct ioloop_handler_context *ctx = io->io.ioloop->handler_context;
+	struct io_uring_fd **ufdp;
+
+	ufdp = array_idx_get_space(&ctx->fd_index, io->fd);
+	if (*ufdp == NULL)
+		*ufdp = i_new(struct io_uring_fd, 1);
+
+	/* the poll request is submitted only when the ioloop runs the next
+	   time, so adds/removes done by the callbacks get batched into a
+	   single io_uring_enter() call. */
+	(void)ioloop_iolist_add(&(*ufdp)->list, io);
+	(*ufdp)->added = TRUE;
+	io_uring_fd_set_dirty(ctx, io->fd, *ufdp);
+}
+
+void io_loop_handle_remove(struct io_file *io, bool closed ATTR_UNUSED)
+{
+	struct ioloop_handler_context *ctx = io->io.ioloop->handler_context;
+	struct io_uring_fd *ufd;
+
+	/* unlike with epoll the poll request must be removed even if the fd
+	   was already closed: the request keeps a reference to the file. */
+	ufd = array_idx_elem(&ctx->fd_index, io->fd);
+	if (ioloop_iolist_del(&ufd->list, io)) {
+		ufd->rearm = TRUE;
+		if (ufd->armed) {
+			/* Remove the poll request immediately. Otherwise the
+			   file stays open after the caller's close() until the
+			   next run, which may never come if the ioloop is being
+			   destroyed. */
+			io_uring_fd_update(ctx, io->fd, ufd);
+			if (uring_submit(&ctx->ring) < 0)
+				i_fatal("io_uring_enter(submit) failed: %m");
+		}
+	}
+	io_uring_fd_set_dirty(ctx, io->fd, ufd);
+	i_free(io);
+}
+
+static void
+io_uring_handle_cqe(struct ioloop_handler_context *ctx,
+		    const struct io_uring_cqe *cqe)
+{
+	struct io_uring_fd *ufd;
+	struct io_uring_event *event;
+	uint32_t gen;
+	int fd;
+
+	if ((cqe->user_data >> IO_URING_DATA_TYPE_SHIFT) !=
+	    IO_URING_DATA_TYPE_POLL)
+		return;
+
+	fd = (int)(cqe->user_data & 0xffffffffU);
+	gen = (cqe->user_data >> 32) & IO_URING_DATA_GEN_MASK;
+	if ((unsigned int)fd >= array_count(&ctx->fd_index))
+		return;
+	ufd = array_idx_elem(&ctx->fd_index, fd);
+	if (ufd == NULL || !ufd->armed || ufd->gen != gen) {
+		/* completion for an already removed poll request */
+		return;
+	}
+
+	/* poll requests are one-shot - re-arm it on the next run */
+	ufd->armed = FALSE;
+	io_uring_fd_set_dirty(ctx, fd, ufd);
+
+	if (cqe->res < 0) {
+		errno = -cqe->res;
+		i_panic("io_uring poll_add(%d) failed: %m", fd);
+	}
+	if (ufd->added) {
+		ufd->added = FALSE;
+		event = array_append_space(&ctx->added_events);
+	} else {
+		event = array_append_space(&ctx->events);
+	}
+	event->fd = fd;
+	event->revents = cqe->res;
+}
+
+static void io_uring_reap_completions(struct ioloop_handler_context *ctx)
+{
+	const struct io_uring_cqe *cqe;
+	const struct io_uring_event *event;
+	unsigned int i;
+
+	array_clear(&ctx->events);
+	array_clear(&ctx->added_events);
+	while ((cqe = uring_peek_cqe(&ctx->ring)) != NULL) {
+		io_uring_handle_cqe(ctx, cqe);
+		uring_cqe_seen(&ctx->ring);
+	}
+
+	/* The polls of newly added ios are submitted together on the next
+	   run, so the fds that were already ready by then complete in the
+	   order in which the ios were added, rather than in the order in
+	   which they became ready. Call the most recently added ones first,
+	   like ioloop-poll does. */
+	for (i = array_count(&ctx->added_events); i > 0; i--) {
+		event = array_idx(&ctx->added_events, i - 1);
+		array_push_back(&ctx->events, event);
+	}
+}
+
+void io_loop_handler_run_internal(struct ioloop *ioloop)
+{
+	struct ioloop_handler_context *ctx = ioloop->handler_context;
+	const struct io_uring_event *event;
+	struct io_uring_fd *ufd;
+	struct io_file *io;
+	struct timeval tv;
+	unsigned int i, count;
+	int msecs, j;
+	bool call;
+
+	i_assert(ctx != NULL);
+
+	/* get the time left for next timeout task */
+	msecs = io_loop_run_get_wait_time(ioloop, &tv);
+
+	io_uring_flush_dirty(ctx);
+	if (ioloop->io_files != NULL) {
+		if (uring_submit_and_wait(&ctx->ring, msecs) < 0)
+			i_fatal("io_uring_enter(): %m");
+		io_uring_reap_completions(ctx);
+	} else {
+		/* no I/Os, but we should have some timeouts.
+		   just wait for them. */
+		i_assert(msecs >= 0);
+		if (uring_submit(&ctx->ring) < 0)
+			i_fatal("io_uring_enter(submit) failed: %m");
+		io_uring_reap_completions(ctx);
+		i_sleep_intr_msecs(msecs);
+	}
+
+	/* execute timeout handlers */
+	io_loop_handle_timeouts(ioloop);
+
+	if (!ioloop->running)
+		return;
+
+	count = array_count(&ctx->events);
+	for (i = 0; i < count; i++) {
+		/* io_loop_handle_add() may cause fd_index array reallocation,
+		   so we have use array_idx() */
+		event = array_idx(&ctx->events, i);
+		ufd = array_idx_elem(&ctx->fd_index, event->fd);
+
+		for (j = 0; j < IOLOOP_IOLIST_IOS_PER_FD; j++) {
+			io = ufd->list.ios[j];
+			if (io == NULL)
+				continue;
+
+			call = FALSE;
+			if ((event->revents & (POLLHUP | POLLERR | POLLNVAL)) != 0)
+				call = TRUE;
+			else if ((io->io.condition & IO_READ) != 0)
+				call = (event->revents & (POLLIN | POLLPRI)) != 0;
+			else if ((io->io.condition & IO_WRITE) != 0)
+				call = (event->revents & POLLOUT) != 0;
+			else if ((io->io.condition & IO_ERROR) != 0)
+				call = (event->revents & IO_URING_ERROR) != 0;
+
+			if (call) {
+				io_loop_call_io(&io->io);
+				if (!ioloop->running)
+					return;
+			}
+		}
+	}
+}
+
+#endif	/* IOLOOP_URING */
@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "array.h"
 #include "backtrace-string.h"
+#include "hash.h"
 #include "llist.h"
 #include "time-util.h"
 #include "istream-private.h"
@@ -24,6 +25,18 @@
    a larger value for larger timeouts. */
 #define IOLOOP_TIME_MOVED_FORWARDS_MIN_USECS_LARGE (1000000)
 
+#ifdef CLOCK_MONOTONIC
+#  define IOLOOP_CALLBACK_WALL_CLOCK CLOCK_MONOTONIC
+#else
+#  define IOLOOP_CALLBACK_WALL_CLOCK CLOCK_REALTIME
+#endif
+
+struct ioloop_callback_measure {
+	struct ioloop_callback_stats *stats;
+	struct timespec wall_start, cpu_start;
+	bool cpu_sampled;
+};
+
 time_t ioloop_time = 0;
 struct timeval ioloop_timeval;
 struct ioloop *current_ioloop = NULL;
@@ -35,6 +48,17 @@ static bool panic_on_leak = FALSE, panic_on_leak_set = FALSE;
 
 static time_t data_stack_last_free_unused = 0;
 
+static struct event_category event_category_ioloop = {
+	.name = "ioloop",
+};
+static pool_t callback_stats_pool = NULL;
+static HASH_TABLE(struct ioloop_callback_stats *,
+		  struct ioloop_callback_stats *) callback_stats_hash;
+static bool callback_stats_enabled = FALSE;
+static unsigned int callback_stats_cpu_sample_rate = 0;
+static unsigned int callback_stats_cpu_sample_counter = 0;
+static uint64_t callback_stats_slow_usecs = 0;
+
 static void io_loop_initialize_handler(struct ioloop *ioloop)
 {
 	unsigned int initial_fd_count;
@@ -120,8 +144,10 @@ struct io *io_add_istream_to(struct ioloop *ioloop, struct istream *input,
 			     io_callback_t *callback, void *context)
 {
 	struct io_file *io;
+	int fd = i_stream_get_root_io(input)->real_stream->io_pending_only ?
+		-1 : i_stream_get_fd(input);
 
-	io = io_add_file(ioloop, i_stream_get_fd(input), IO_READ,
+	io = io_add_file(ioloop, fd, IO_READ,
 			 source_filename, source_linenum, callback, context);
 	io->istream = input;
 	i_stream_ref(io->istream);
@@ -259,6 +285,44 @@ static void timeout_update_next(struct timeout *timeout, struct timeval *tv_now)
 	}
 }
 
+/* Convert timeval to the timer wheel's millisecond ticks */
+static uint64_t timeout_timeval_to_tick(const struct timeval *tv, bool round_up)
+{
+	return (uint64_t)tv->tv_sec * 1000 +
+		(tv->tv_usec + (round_up ? 999 : 0)) / 1000;
+}
+
+static bool timeout_is_queued(const struct timeout *timeout)
+{
+	return timeout->item.idx != UINT_MAX ||
+		timer_wheel_item_is_queued(&timeout->wheel_item);
+}
+
+static void timeout_queue(struct timeout *timeout)
+{
+	if (timeout->msecs > 0 && !timeout->one_shot) {
+		/* Repeating timeouts have millisecond accuracy, and there
+		   can be a lot of them. They're kept in the timer wheel, so
+		   resetting them stays cheap. */
+		timer_wheel_add(timeout->ioloop->timeout_wheel,
+				&timeout->wheel_item,
+				timeout_timeval_to_tick(&timeout->next_run,
+							TRUE));
+	} else {
+		priorityq_add(timeout->ioloop->timeouts, &timeout->item);
+	}
+}
+
+static void timeout_unqueue(struct timeout *timeout)
+{
+	if (timer_wheel_item_is_queued(&timeout->wheel_item)) {
+		timer_wheel_remove(timeout->ioloop->timeout_wheel,
+				   &timeout->wheel_item);
+	} else {
+		priorityq_remove(timeout->ioloop->timeouts, &timeout->item);
+	}
+}
+
 static struct timeout *
 timeout_add_common(struct ioloop *ioloop, const char *source_filename,
 		   unsigned int source_linenum,
@@ -304,7 +368,7 @@ struct timeout *timeout_add_to(struct ioloop *ioloop, unsigned int msecs,
 		   in case a timeout callback keeps recreating the 0-timeout. */
 		timeout_update_next(timeout, timeout->ioloop->running ?
 			    NULL : &ioloop_timeval);
-		priorityq_add(timeout->ioloop->timeouts, &timeout->item);
+		timeout_queue(timeout);
 	}
 	return timeout;
 }
@@ -354,7 +418,7 @@ timeout_add_absolute_to(struct ioloop *ioloop, const struct timeval *time,
 	timeout->one_shot = TRUE;
 	timeout->next_run = *time;
 
-	priorityq_add(timeout->ioloop->timeouts, &timeout->item);
+	timeout_queue(timeout);
 	return timeout;
 }
 
@@ -382,8 +446,8 @@ timeout_copy(const struct timeout *old_to, struct ioloop *ioloop)
 	new_to->msecs = old_to->msecs;
 	new_to->next_run = old_to->next_run;
 
-	if (old_to->item.idx != UINT_MAX)
-		priorityq_add(new_to->ioloop->timeouts, &new_to->item);
+	if (timeout_is_queued(old_to))
+		timeout_queue(new_to);
 	else if (!new_to->one_shot) {
 		i_assert(new_to->msecs > 0);
 		array_push_back(&new_to->ioloop->timeouts_new, &new_to);
@@ -410,8 +474,8 @@ void timeout_remove(struct timeout **_timeout)
 	ioloop = timeout->ioloop;
 
 	*_timeout = NULL;
-	if (timeout->item.idx != UINT_MAX)
-		priorityq_remove(timeout->ioloop->timeouts, &timeout->item);
+	if (timeout_is_queued(timeout))
+		timeout_unqueue(timeout);
 	else if (!timeout->one_shot && timeout->msecs > 0) {
 		unsigned int idx;
 
@@ -425,7 +489,7 @@ void timeout_remove(struct timeout **_timeout)
 static void ATTR_NULL(2)
 timeout_reset_timeval(struct timeout *timeout, struct timeval *tv_now)
 {
-	if (timeout->item.idx == UINT_MAX)
+	if (!timeout_is_queued(timeout))
 		return;
 
 	timeout_update_next(timeout, tv_now);
@@ -442,8 +506,8 @@ timeout_reset_timeval(struct timeout *timeout, struct timeval *tv_now)
 		timeout->next_run = *tv_now;
 		timeval_add_usecs(&timeout->next_run, 1);
 	}
-	priorityq_remove(timeout->ioloop->timeouts, &timeout->item);
-	priorityq_add(timeout->ioloop->timeouts, &timeout->item);
+	timeout_unqueue(timeout);
+	timeout_queue(timeout);
 }
 
 void timeout_reset(struct timeout *timeout)
@@ -452,8 +516,9 @@ void timeout_reset(struct timeout *timeout)
 	timeout_reset_timeval(timeout, NULL);
 }
 
-static int timeout_get_wait_time(struct timeout *timeout, struct timeval *tv_r,
-				 struct timeval *tv_now, bool in_timeout_loop)
+static int timeout_get_wait_time(const struct timeval *next_run,
+				 struct timeval *tv_r, struct timeval *tv_now,
+				 bool in_timeout_loop)
 {
 	int ret;
 
@@ -463,10 +528,10 @@ static int timeout_get_wait_time(struct timeout *timeout, struct timeval *tv_r,
 	tv_r->tv_usec = tv_now->tv_usec;
 
 	i_assert(tv_r->tv_sec > 0);
-	i_assert(timeout->next_run.tv_sec > 0);
+	i_assert(next_run->tv_sec > 0);
 
-	tv_r->tv_sec = timeout->next_run.tv_sec - tv_r->tv_sec;
-	tv_r->tv_usec = timeout->next_run.tv_usec - tv_r->tv_usec;
+	tv_r->tv_sec = next_run->tv_sec - tv_r->tv_sec;
+	tv_r->tv_usec = next_run->tv_usec - tv_r->tv_usec;
 	if (tv_r->tv_usec < 0) {
 		tv_r->tv_sec--;
 		tv_r->tv_usec += 1000000;
@@ -493,20 +558,45 @@ static int timeout_get_wait_time(struct timeout *timeout, struct timeval *tv_r,
 	return ret;
 }
 
-static int io_loop_get_wait_time(struct ioloop *ioloop, struct timeval *tv_r)
+static bool
+io_loop_get_next_run(struct ioloop *ioloop, struct timeout **timeout_r,
+		     struct timeval *next_run_r)
 {
-	struct timeval tv_now;
 	struct priorityq_item *item;
+	struct timeval tv;
+	uint64_t tick;
+
+	item = priorityq_peek(ioloop->timeouts);
+	*timeout_r = (struct timeout *)item;
+	if (*timeout_r != NULL)
+		*next_run_r = (*timeout_r)->next_run;
+
+	/* this may be earlier than the next timeout in the wheel, but waking
+	   up at that time is needed for the wheel to cascade its timeouts. */
+	if (!timer_wheel_get_next_tick(ioloop->timeout_wheel, &tick))
+		return *timeout_r != NULL;
+	tv.tv_sec = tick / 1000;
+	tv.tv_usec = (tick % 1000) * 1000;
+	if (*timeout_r == NULL || timeval_cmp(&tv, next_run_r) < 0) {
+		*timeout_r = NULL;
+		*next_run_r = tv;
+	}
+	return TRUE;
+}
+
+static int io_loop_get_wait_time(struct ioloop *ioloop, struct timeval *tv_r)
+{
+	struct timeval tv_now, next_run;
 	struct timeout *timeout;
+	bool have_timeouts;
 	int msecs;
 
-	item = priorityq_peek(ioloop->timeouts);
-	timeout = (struct timeout *)item;
+	have_timeouts = io_loop_get_next_run(ioloop, &timeout, &next_run);
 
 	/* we need to see if there are pending IO waiting,
 	   if there is, we set msecs = 0 to ensure they are
 	   processed without delay */
-	if (timeout == NULL && ioloop->io_pending_count == 0) {
+	if (!have_timeouts && ioloop->io_pending_count == 0) {
 		/* no timeouts. use INT_MAX msecs for timeval and
 		   return -1 for poll/epoll infinity. */
 		tv_r->tv_sec = INT_MAX / 1000;
@@ -523,7 +613,7 @@ static int io_loop_get_wait_time(struct ioloop *ioloop, struct timeval *tv_r)
 		tv_r->tv_usec = 0;
 	} else {
 		tv_now.tv_sec = 0;
-		msecs = timeout_get_wait_time(timeout, tv_r, &tv_now, FALSE);
+		msecs = timeout_get_wait_time(&next_run, tv_r, &tv_now, FALSE);
 	}
 	ioloop->next_max_time = tv_now;
 	timeval_add_msecs(&ioloop->next_max_time, msecs);
@@ -533,7 +623,8 @@ static int io_loop_get_wait_time(struct ioloop *ioloop, struct timeval *tv_r)
 	   ioloop and after that we update ioloop_timeval immediately again. */
 	ioloop_timeval = tv_now;
 	ioloop_time = tv_now.tv_sec;
-	i_assert(msecs == 0 || timeout->msecs > 0 || timeout->one_shot);
+	i_assert(msecs == 0 || timeout == NULL ||
+		 timeout->msecs > 0 || timeout->one_shot);
 	return msecs;
 }
 
@@ -589,26 +680,47 @@ static void io_loop_timeouts_start_new(struct ioloop *ioloop)
 		i_assert(!timeout->one_shot);
 		i_assert(timeout->msecs > 0);
 		timeout_update_next(timeout, &ioloop_timeval);
-		priorityq_add(ioloop->timeouts, &timeout->item);
+		timeout_queue(timeout);
 	}
 	array_clear(&ioloop->timeouts_new);
 }
 
+static void timeout_move_next_run(struct timeout *to, long long diff_usecs)
+{
+	if (diff_usecs > 0)
+		timeval_add_usecs(&to->next_run, diff_usecs);
+	else
+		timeval_sub_usecs(&to->next_run, -diff_usecs);
+}
+
 static void io_loop_timeouts_update(struct ioloop *ioloop, long long diff_usecs)
 {
 	struct priorityq_item *const *items;
+	struct timer_wheel_item *wheel_item;
+	ARRAY(struct timeout *) wheel_timeouts;
+	struct timeout *to;
 	unsigned int i, count;
 
 	count = priorityq_count(ioloop->timeouts);
 	items = priorityq_items(ioloop->timeouts);
 	for (i = 0; i < count; i++) {
-		struct timeout *to = (struct timeout *)items[i];
+		to = (struct timeout *)items[i];
+		timeout_move_next_run(to, diff_usecs);
+	}
 
-		if (diff_usecs > 0)
-			timeval_add_usecs(&to->next_run, diff_usecs);
-		else
-			timeval_sub_usecs(&to->next_run, -diff_usecs);
+	/* The wheel's slots are relative to its current time, so the
+	   timeouts need to be re-added with the new time. */
+	t_array_init(&wheel_timeouts,
+		     timer_wheel_count(ioloop->timeout_wheel) + 1);
+	while ((wheel_item = timer_wheel_pop(ioloop->timeout_wheel)) != NULL) {
+		to = container_of(wheel_item, struct timeout, wheel_item);
+		timeout_move_next_run(to, diff_usecs);
+		array_push_back(&wheel_timeouts, &to);
 	}
+	timer_wheel_set_time(ioloop->timeout_wheel,
+			     timeout_timeval_to_tick(&ioloop_timeval, FALSE));
+	array_foreach_elem(&wheel_timeouts, to)
+		timeout_queue(to);
 }
 
 static void io_loops_timeouts_update(long long diff_usecs)
@@ -637,12 +749,169 @@ static void ioloop_add_wait_time(struct ioloop *ioloop)
 		timer->usecs += diff;
 }
 
-static void io_loop_handle_timeouts_real(struct ioloop *ioloop)
+static struct timeout *
+io_loop_get_expired_timeout(struct ioloop *ioloop, struct timeval *tv_now)
 {
 	struct priorityq_item *item;
-	struct timeval tv_old, tv, tv_call;
+	struct timer_wheel_item *wheel_item;
+	struct timeout *timeout = NULL, *wheel_timeout;
+	struct timeval tv;
+
+	item = priorityq_peek(ioloop->timeouts);
+	if (item != NULL) {
+		timeout = (struct timeout *)item;
+		if (timeout_get_wait_time(&timeout->next_run, &tv,
+					  tv_now, TRUE) > 0)
+			timeout = NULL;
+	}
+
+	wheel_item = timer_wheel_peek_expired(ioloop->timeout_wheel,
+		timeout_timeval_to_tick(tv_now, FALSE));
+	if (wheel_item == NULL)
+		return timeout;
+	wheel_timeout = container_of(wheel_item, struct timeout, wheel_item);
+	if (timeout != NULL &&
+	    timeval_cmp(&timeout->next_run, &wheel_timeout->next_run) <= 0)
+		return timeout;
+	return wheel_timeout;
+}
+
+static unsigned int
+ioloop_callback_stats_hash(const struct ioloop_callback_stats *stats)
+{
+	return str_hash(stats->source_filename) ^ stats->source_linenum;
+}
+
+static int
+ioloop_callback_stats_cmp(const struct ioloop_callback_stats *stats1,
+			  const struct ioloop_callback_stats *stats2)
+{
+	if (stats1->source_linenum != stats2->source_linenum)
+		return stats1->source_linenum < stats2->source_linenum ? -1 : 1;
+	return strcmp(stats1->source_filename, stats2->source_filename);
+}
+
+static struct ioloop_callback_stats *
+io_loop_callback_stats_lookup(struct ioloop_callback_stats **cached_stats,
+			      const char *source_filename,
+			      unsigned int source_linenum)
+{
+	struct ioloop_callback_stats key, *stats;
+
+	if (*cached_stats != NULL)
+		return *cached_stats;
+
+	i_zero(&key);
+	key.source_filename = source_filename;
+	key.source_linenum = source_linenum;
+	stats = hash_table_lookup(callback_stats_hash, &key);
+	if (stats == NULL) {
+		/* The filename is copied, because the io may have been added
+		   by a plugin that gets unloaded. */
+		stats = p_new(callback_stats_pool,
+			      struct ioloop_callback_stats, 1);
+		stats->source_filename =
+			p_strdup(callback_stats_pool, source_filename);
+		stats->source_linenum = source_linenum;
+		hash_table_insert(callback_stats_hash, stats, stats);
+	}
+	*cached_stats = stats;
+	return stats;
+}
+
+static uint64_t
+timespec_diff_usecs(const struct timespec *ts1, const struct timespec *ts2)
+{
+	long long diff = (ts1->tv_sec - ts2->tv_sec) * 1000000LL +
+		(ts1->tv_nsec - ts2->tv_nsec) / 1000;
+
+	return diff < 0 ? 0 : diff;
+}
+
+static void
+io_loop_callback_measure_begin(struct ioloop_callback_measure *measure_r,
+			       struct ioloop_callback_stats **cached_stats,
+			       const char *source_filename,
+			       unsigned int source_linenum)
+{
+	measure_r->stats = io_loop_callback_stats_lookup(cached_stats,
+		source_filename, source_linenum);
+	measure_r->cpu_sampled = FALSE;
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	if (callback_stats_cpu_sample_rate != 0 &&
+	    ++callback_stats_cpu_sample_counter >=
+	    callback_stats_cpu_sample_rate) {
+		callback_stats_cpu_sample_counter = 0;
+		measure_r->cpu_sampled =
+			clock_gettime(CLOCK_THREAD_CPUTIME_ID,
+				      &measure_r->cpu_start) == 0;
+	}
+#endif
+	if (clock_gettime(IOLOOP_CALLBACK_WALL_CLOCK,
+			  &measure_r->wall_start) < 0)
+		i_fatal("clock_gettime() failed: %m");
+}
+
+static void
+io_loop_callback_send_slow_event(const struct ioloop_callback_stats *stats,
+				 uint64_t usecs, bool cpu_sampled,
+				 uint64_t cpu_usecs)
+{
+	struct event *event = event_create(NULL);
+
+	event_set_name(event, "ioloop_callback_slow");
+	event_add_category(event, &event_category_ioloop);
+	event_set_source(event, stats->source_filename,
+			 stats->source_linenum, TRUE);
+	event_add_str(event, "source", t_strdup_printf("%s:%u",
+		stats->source_filename, stats->source_linenum));
+	event_add_int(event, "wall_usecs", usecs);
+	if (cpu_sampled)
+		event_add_int(event, "cpu_usecs", cpu_usecs);
+	e_debug(event, "Callback added at %s:%u took %"PRIu64" ms",
+		stats->source_filename, stats->source_linenum, usecs / 1000);
+	event_unref(&event);
+}
+
+static void
+io_loop_callback_measure_end(struct ioloop_callback_measure *measure)
+{
+	struct ioloop_callback_stats *stats = measure->stats;
+	struct timespec now;
+	uint64_t usecs, cpu_usecs = 0;
+
+	if (clock_gettime(IOLOOP_CALLBACK_WALL_CLOCK, &now) < 0)
+		i_fatal("clock_gettime() failed: %m");
+	usecs = timespec_diff_usecs(&now, &measure->wall_start);
+	stats->call_count++;
+	stats->total_usecs += usecs;
+	if (stats->max_usecs < usecs)
+		stats->max_usecs = usecs;
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	if (measure->cpu_sampled &&
+	    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now) == 0) {
+		cpu_usecs = timespec_diff_usecs(&now, &measure->cpu_start);
+		stats->cpu_sample_count++;
+		stats->cpu_usecs += cpu_usecs;
+	} else {
+		measure->cpu_sampled = FALSE;
+	}
+#endif
+	if (callback_stats_slow_usecs != 0 &&
+	    usecs >= callback_stats_slow_usecs) T_BEGIN {
+		io_loop_callback_send_slow_event(stats, usecs,
+			measure->cpu_sampled, cpu_usecs);
+	} T_END;
+}
+
+static void io_loop_handle_timeouts_real(struct ioloop *ioloop)
+{
+	struct ioloop_callback_measure measure;
+	struct timeout *timeout;
+	struct timeval tv_old, tv_call;
 	long long diff_usecs;
 	data_stack_frame_t t_id;
+	bool measure_callback;
 
 	tv_old = ioloop_timeval;
 	i_gettimeofday(&ioloop_timeval);
@@ -675,18 +944,13 @@ static void io_loop_handle_timeouts_real(struct ioloop *ioloop)
 	ioloop_time = ioloop_timeval.tv_sec;
 	tv_call = ioloop_timeval;
 
+	/* use tv_call to make sure we don't get to infinite loop in
+	   case callbacks update ioloop_timeval. */
 	while (ioloop->running &&
-	       (item = priorityq_peek(ioloop->timeouts)) != NULL) {
-		struct timeout *timeout = (struct timeout *)item;
-
-		/* use tv_call to make sure we don't get to infinite loop in
-		   case callbacks update ioloop_timeval. */
-		if (timeout_get_wait_time(timeout, &tv, &tv_call, TRUE) > 0)
-			break;
-
+	       (timeout = io_loop_get_expired_timeout(ioloop, &tv_call)) != NULL) {
 		if (timeout->one_shot) {
 			/* remove timeout from queue */
-			priorityq_remove(timeout->ioloop->timeouts, &timeout->item);
+			timeout_unqueue(timeout);
 		} else {
 			/* update timeout's next_run and reposition it in the queue */
 			timeout_reset_timeval(timeout, &tv_call);
@@ -696,7 +960,16 @@ static void io_loop_handle_timeouts_real(struct ioloop *ioloop)
 			io_loop_context_activate(timeout->ctx);
 		t_id = t_push_named("ioloop timeout handler %p",
 				    (void *)timeout->callback);
+		/* the timeout may be freed by the callback */
+		measure_callback = callback_stats_enabled;
+		if (unlikely(measure_callback)) {
+			io_loop_callback_measure_begin(&measure,
+				&timeout->stats, timeout->source_filename,
+				timeout->source_linenum);
+		}
 		timeout->callback(timeout->context);
+		if (unlikely(measure_callback))
+			io_loop_callback_measure_end(&measure);
 		if (!t_pop(&t_id)) {
 			i_panic("Leaked a t_pop() call in timeout handler %p",
 				(void *)timeout->callback);
@@ -728,7 +1001,9 @@ void io_loop_handle_timeouts(struct ioloop *ioloop)
 void io_loop_call_io(struct io *io)
 {
 	struct ioloop *ioloop = io->ioloop;
+	struct ioloop_callback_measure measure;
 	data_stack_frame_t t_id;
+	bool measure_callback = callback_stats_enabled;
 
 	if (io->pending) {
 		i_assert(ioloop->io_pending_count > 0);
@@ -740,7 +1015,14 @@ void io_loop_call_io(struct io *io)
 		io_loop_context_activate(io->ctx);
 	t_id = t_push_named("ioloop handler %p",
 			    (void *)io->callback);
+	/* the io may be freed by the callback */
+	if (unlikely(measure_callback)) {
+		io_loop_callback_measure_begin(&measure, &io->stats,
+			io->source_filename, io->source_linenum);
+	}
 	io->callback(io->context);
+	if (unlikely(measure_callback))
+		io_loop_callback_measure_end(&measure);
 	if (!t_pop(&t_id)) {
 		i_panic("Leaked a t_pop() call in I/O handler %p",
 			(void *)io->callback);
@@ -847,6 +1129,8 @@ struct ioloop *io_loop_create(void)
 
         ioloop = i_new(struct ioloop, 1);
 	ioloop->timeouts = priorityq_init(timeout_cmp, 32);
+	ioloop->timeout_wheel = timer_wheel_init(
+		timeout_timeval_to_tick(&ioloop_timeval, FALSE));
 	i_array_init(&ioloop->timeouts_new, 8);
 
 	ioloop->time_moved_callback = current_ioloop != NULL ?
@@ -858,11 +1142,26 @@ struct ioloop *io_loop_create(void)
         return ioloop;
 }
 
+static void timeout_leaked(struct timeout *to)
+{
+	const char *error = t_strdup_printf(
+		"Timeout leak: %p (%s:%u)", (void *)to->callback,
+		to->source_filename,
+		to->source_linenum);
+
+	if (panic_on_leak)
+		i_panic("%s", error);
+	else
+		i_warning("%s", error);
+	timeout_free(to);
+}
+
 void io_loop_destroy(struct ioloop **_ioloop)
 {
 	struct ioloop *ioloop = *_ioloop;
 	struct timeout *to;
 	struct priorityq_item *item;
+	struct timer_wheel_item *wheel_item;
 	bool leaks = FALSE;
 
 	*_ioloop = NULL;
@@ -900,36 +1199,24 @@ void io_loop_destroy(struct ioloop **_ioloop)
 	i_assert(ioloop->io_pending_count == 0);
 
 	array_foreach_elem(&ioloop->timeouts_new, to) {
-		const char *error = t_strdup_printf(
-			"Timeout leak: %p (%s:%u)", (void *)to->callback,
-			to->source_filename,
-			to->source_linenum);
-
-		if (panic_on_leak)
-			i_panic("%s", error);
-		else
-			i_warning("%s", error);
-		timeout_free(to);
+		timeout_leaked(to);
 		leaks = TRUE;
 	}
 	array_free(&ioloop->timeouts_new);
 
 	while ((item = priorityq_pop(ioloop->timeouts)) != NULL) {
-		struct timeout *to = (struct timeout *)item;
-		const char *error = t_strdup_printf(
-			"Timeout leak: %p (%s:%u)", (void *)to->callback,
-			to->source_filename,
-			to->source_linenum);
-
-		if (panic_on_leak)
-			i_panic("%s", error);
-		else
-			i_warning("%s", error);
-		timeout_free(to);
+		timeout_leaked((struct timeout *)item);
 		leaks = TRUE;
 	}
 	priorityq_deinit(&ioloop->timeouts);
 
+	while ((wheel_item = timer_wheel_pop(ioloop->timeout_wheel)) != NULL) {
+		timeout_leaked(container_of(wheel_item, struct timeout,
+					    wheel_item));
+		leaks = TRUE;
+	}
+	timer_wheel_deinit(&ioloop->timeout_wheel);
+
 	while (ioloop->wait_timers != NULL) {
 		struct io_wait_timer *timer = ioloop->wait_timers;
 		const char *error = t_strdup_printf(
@@ -1297,6 +1584,7 @@ bool io_loop_is_empty(struct ioloop *ioloop)
 {
 	return ioloop->io_files == NULL &&
 		priorityq_count(ioloop->timeouts) == 0 &&
+		timer_wheel_count(ioloop->timeout_wheel) == 0 &&
 		array_count(&ioloop->timeouts_new) == 0;
 }
 
@@ -1381,3 +1669,91 @@ struct event *io_loop_get_active_global_root(void)
 		return NULL;
 	return current_ioloop->cur_ctx->root_global_event;
 }
+
+void io_loop_callback_stats_enable(unsigned int cpu_sample_rate,
+				   unsigned int slow_msecs)
+{
+	if (callback_stats_pool == NULL) {
+		callback_stats_pool =
+			pool_alloconly_create("ioloop callback stats", 4096);
+		hash_table_create(&callback_stats_hash, default_pool, 0,
+				  ioloop_callback_stats_hash,
+				  ioloop_callback_stats_cmp);
+	}
+	callback_stats_cpu_sample_rate = cpu_sample_rate;
+	callback_stats_cpu_sample_counter = 0;
+	callback_stats_slow_usecs = (uint64_t)slow_msecs * 1000;
+	callback_stats_enabled = TRUE;
+}
+
+void io_loop_callback_stats_disable(void)
+{
+	callback_stats_enabled = FALSE;
+}
+
+bool io_loop_callback_stats_is_enabled(void)
+{
+	return callback_stats_enabled;
+}
+
+static int
+ioloop_callback_stats_cmp_max(const struct ioloop_callback_stats *const *stats1,
+			      const struct ioloop_callback_stats *const *stats2)
+{
+	if ((*stats1)->max_usecs != (*stats2)->max_usecs)
+		return (*stats1)->max_usecs > (*stats2)->max_usecs ? -1 : 1;
+	if ((*stats1)->total_usecs != (*stats2)->total_usecs)
+		return (*stats1)->total_usecs > (*stats2)->total_usecs ? -1 : 1;
+	return ioloop_callback_stats_cmp(*stats1, *stats2);
+}
+
+const struct ioloop_callback_stats *const *
+io_loop_callback_stats_get_sorted(unsigned int *count_r)
+{
+	ARRAY(const struct ioloop_callback_stats *) sorted;
+	struct hash_iterate_context *iter;
+	struct ioloop_callback_stats *key, *stats;
+
+	if (callback_stats_pool == NULL) {
+		*count_r = 0;
+		return NULL;
+	}
+
+	t_array_init(&sorted, hash_table_count(callback_stats_hash) + 1);
+	iter = hash_table_iterate_init(callback_stats_hash);
+	while (hash_table_iterate(iter, callback_stats_hash, &key, &stats)) {
+		const struct ioloop_callback_stats *const_stats = stats;
+		array_push_back(&sorted, &const_stats);
+	}
+	hash_table_iterate_deinit(&iter);
+	array_sort(&sorted, ioloop_callback_stats_cmp_max);
+	return array_get(&sorted, count_r);
+}
+
+void io_loop_callback_stats_reset(void)
+{
+	struct hash_iterate_context *iter;
+	struct ioloop_callback_stats *key, *stats;
+
+	if (callback_stats_pool == NULL)
+		return;
+
+	iter = hash_table_iterate_init(callback_stats_hash);
+	while (hash_table_iterate(iter, callback_stats_hash, &key, &stats)) {
+		stats->call_count = 0;
+		stats->total_usecs = 0;
+		stats->max_usecs = 0;
+		stats->cpu_sample_count = 0;
+		stats->cpu_usecs = 0;
+	}
+	hash_table_iterate_deinit(&iter);
+}
+
+void io_loop_callback_stats_deinit(void)
+{
+	callback_stats_enabled = FALSE;
+	if (callback_stats_pool == NULL)
+		return;
+	hash_table_destroy(&callback_stats_hash);
+	pool_unref(&callback_stats_pool);
+}
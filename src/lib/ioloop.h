@@ -321,6 +321,44 @@ uint64_t io_loop_get_wait_usecs(struct ioloop *ioloop);
    all the file ios in the ioloop. */
 enum io_condition io_loop_find_fd_conditions(struct ioloop *ioloop, int fd);
 
+/* Callback latency accounting: */
+struct ioloop_callback_stats {
+	/* Where the io or timeout was added */
+	const char *source_filename;
+	unsigned int source_linenum;
+
+	/* Number of calls and the wall clock time spent in them. The time
+	   includes any nested ioloops run by the callback. */
+	uint64_t call_count;
+	uint64_t total_usecs;
+	uint64_t max_usecs;
+	/* Number of calls whose CPU time was sampled, and the user+system
+	   CPU time used by them. */
+	uint64_t cpu_sample_count;
+	uint64_t cpu_usecs;
+};
+
+/* Start measuring how long io and timeout callbacks take in all ioloops.
+   The wall clock time is measured for every call, which costs two
+   clock_gettime() calls. The CPU time is measured only for every
+   cpu_sample_rate'th call, because it's more expensive (0 = never). If a
+   callback takes at least slow_msecs (0 = never), an "ioloop_callback_slow"
+   event is sent with the callback's source location. */
+void io_loop_callback_stats_enable(unsigned int cpu_sample_rate,
+				   unsigned int slow_msecs);
+/* Stop measuring. The collected statistics are preserved. */
+void io_loop_callback_stats_disable(void);
+/* Returns TRUE if callback statistics are being collected. */
+bool io_loop_callback_stats_is_enabled(void);
+/* Returns all the collected statistics sorted by max_usecs, the slowest
+   first. The returned array is allocated from data stack. */
+const struct ioloop_callback_stats *const *
+io_loop_callback_stats_get_sorted(unsigned int *count_r);
+/* Zero all the collected statistics. */
+void io_loop_callback_stats_reset(void);
+/* Free the collected statistics. Called by lib_deinit(). */
+void io_loop_callback_stats_deinit(void);
+
 #ifdef IOLOOP_KQUEUE
 void io_loop_recreate(struct ioloop *ioloop);
 #else
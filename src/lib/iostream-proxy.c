@@ -5,6 +5,7 @@
 #include "str.h"
 #include "iostream-pump.h"
 #include "iostream-proxy.h"
+#include "ostream.h"
 #include <unistd.h>
 
 #undef iostream_proxy_set_completion_callback
@@ -70,6 +71,10 @@ iostream_proxy_create(struct istream *left_input, struct ostream *left_output,
 
 	proxy->ltr = iostream_pump_create(left_input, right_output);
 	proxy->rtl = iostream_pump_create(right_input, left_output);
+	/* the data is only passed through, so when both sides are plain
+	   sockets it can be moved with splice() without copying it */
+	o_stream_set_splice(left_output, TRUE);
+	o_stream_set_splice(right_output, TRUE);
 
 	iostream_pump_set_completion_callback(proxy->ltr, iostream_proxy_ltr_completion, proxy);
 	iostream_pump_set_completion_callback(proxy->rtl, iostream_proxy_rtl_completion, proxy);
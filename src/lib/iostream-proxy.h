@@ -19,6 +19,11 @@ indicate whether it ended with error.
 The istreams and ostreams are reffed on creation and unreffed
 on unref.
 
+When an istream and the other side's ostream are both plain
+nonblocking fd streams, the data is moved between them with
+splice() without copying it through userspace. This uses a pipe
+(two extra fds) for each such ostream.
+
 **/
 
 struct istream;
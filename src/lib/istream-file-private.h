@@ -3,14 +3,21 @@
 
 #include "istream-private.h"
 
+struct file_istream_aio_read;
+
 struct file_istream {
 	struct istream_private istream;
 
 	uoff_t skip_left;
+	/* Asynchronous read state with i_stream_file_set_async(). Its
+	   buffer is kept allocated until the stream is closed. */
+	struct file_istream_aio_read *aio_read;
 
 	bool file:1;
 	bool autoclose_fd:1;
 	bool seen_eof:1;
+	bool aio:1;
+	bool aio_nonblocking:1;
 };
 
 struct istream *
@@ -20,4 +27,17 @@ i_stream_create_file_common(struct file_istream *fstream,
 ssize_t i_stream_file_read(struct istream_private *stream);
 void i_stream_file_close(struct iostream_private *stream, bool close_parent);
 
+#ifdef HAVE_SPLICE
+/* Returns TRUE if data can be moved directly from the istream's fd with
+   i_stream_file_splice(). This requires a nonblocking socket/pipe fd istream
+   without any buffered data. */
+bool i_stream_file_can_splice(struct istream *input);
+/* Move up to size bytes from the istream's fd into pipe_fd with splice().
+   The istream's offset is updated as if the data was read and skipped.
+   Returns the number of bytes moved, 0 if more input needs to be waited for,
+   -1 on EOF/error (same as i_stream_read()) and -2 if splice() isn't
+   supported for the fd. */
+ssize_t i_stream_file_splice(struct istream *input, int pipe_fd, size_t size);
+#endif
+
 #endif
@@ -2,15 +2,269 @@
 
 /* @UNSAFE: whole file */
 
+#define _GNU_SOURCE /* for preadv2() and splice() */
 #include "lib.h"
 #include "ioloop.h"
 #include "istream-file-private.h"
 #include "net.h"
+#include "uring.h"
 
 #include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+/* All the async file istreams share the same ring. The requests are
+   submitted immediately, so it doesn't need to be large. */
+#define FILE_ISTREAM_AIO_RING_ENTRIES 64
+
+struct file_istream_aio_read {
+	struct file_istream *fstream;
+
+	/* allocated once and reused for all the reads of the stream */
+	unsigned char *data;
+	size_t data_size;
+
+	uoff_t offset;
+	size_t pos;
+	/* number of bytes read, or -errno on failure */
+	int ret;
+	/* read was submitted and its data isn't fully consumed yet */
+	bool active;
+	bool done;
+};
+
+static struct uring file_aio_ring;
+static struct io *file_aio_io;
+static unsigned int file_aio_pending_count;
+static bool file_aio_initialized = FALSE, file_aio_init_failed = FALSE;
+
+static void file_aio_deinit(void)
+{
+	i_assert(file_aio_pending_count == 0);
+	i_assert(file_aio_io == NULL);
+
+	uring_deinit(&file_aio_ring);
+	file_aio_initialized = FALSE;
+}
+
+static bool file_aio_init(void)
+{
+	const char *error;
+
+	if (file_aio_initialized)
+		return TRUE;
+	if (file_aio_init_failed)
+		return FALSE;
+
+	if (uring_init(&file_aio_ring, FILE_ISTREAM_AIO_RING_ENTRIES,
+		       &error) < 0) {
+		if (errno != ENOSYS && errno != EPERM)
+			i_error("file_istream: %s failed: %m", error);
+		file_aio_init_failed = TRUE;
+		return FALSE;
+	}
+	file_aio_initialized = TRUE;
+	lib_atexit(file_aio_deinit);
+	return TRUE;
+}
+
+static void file_aio_handle_completions(void)
+{
+	const struct io_uring_cqe *cqe;
+	struct file_istream_aio_read *aio_read;
+
+	while ((cqe = uring_peek_cqe(&file_aio_ring)) != NULL) {
+		aio_read = (void *)(uintptr_t)cqe->user_data;
+		if (aio_read != NULL) {
+			i_assert(!aio_read->done);
+			i_assert(file_aio_pending_count > 0);
+			aio_read->ret = cqe->res;
+			aio_read->done = TRUE;
+			file_aio_pending_count--;
+			if (aio_read->fstream->aio_nonblocking) {
+				i_stream_set_input_pending(
+					&aio_read->fstream->istream.istream,
+					TRUE);
+			}
+		}
+		uring_cqe_seen(&file_aio_ring);
+	}
+	if (file_aio_pending_count == 0)
+		io_remove(&file_aio_io);
+}
+
+static void file_aio_input(void *context ATTR_UNUSED)
+{
+	file_aio_handle_completions();
+}
+
+static void file_aio_wait(struct file_istream_aio_read *aio_read)
+{
+	while (!aio_read->done) {
+		if (uring_submit_and_wait(&file_aio_ring, -1) < 0)
+			i_fatal("io_uring_enter() failed: %m");
+		file_aio_handle_completions();
+	}
+}
+
+static void
+file_aio_read_submit(struct file_istream *fstream, uoff_t offset, size_t size)
+{
+	struct file_istream_aio_read *aio_read = fstream->aio_read;
+	struct io_uring_sqe *sqe;
+
+	if (aio_read == NULL) {
+		aio_read = i_new(struct file_istream_aio_read, 1);
+		aio_read->fstream = fstream;
+		fstream->aio_read = aio_read;
+	}
+	i_assert(!aio_read->active);
+
+	if (aio_read->data_size < size) {
+		i_free(aio_read->data);
+		aio_read->data = i_malloc(size);
+		aio_read->data_size = size;
+	}
+	aio_read->offset = offset;
+	aio_read->pos = 0;
+	aio_read->ret = 0;
+	aio_read->done = FALSE;
+	aio_read->active = TRUE;
+
+	sqe = uring_get_sqe(&file_aio_ring);
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fstream->istream.fd;
+	sqe->addr = (uintptr_t)aio_read->data;
+	sqe->len = size;
+	sqe->off = offset;
+	sqe->user_data = (uintptr_t)aio_read;
+	file_aio_pending_count++;
+	if (uring_submit(&file_aio_ring) < 0)
+		i_fatal("io_uring_enter(submit) failed: %m");
+
+	if (fstream->aio_nonblocking) {
+		if (file_aio_io == NULL) {
+			file_aio_io = io_add(file_aio_ring.fd, IO_READ,
+					     file_aio_input, NULL);
+		} else {
+			file_aio_io = io_loop_move_io(&file_aio_io);
+		}
+	}
+}
+
+static void file_aio_read_cancel(struct file_istream *fstream)
+{
+	struct file_istream_aio_read *aio_read = fstream->aio_read;
+	struct io_uring_sqe *sqe;
+
+	if (aio_read == NULL || !aio_read->active)
+		return;
+
+	if (!aio_read->done) {
+		/* the kernel may still be writing to the buffer - cancel the
+		   read and wait for it to finish before reusing it. */
+		sqe = uring_get_sqe(&file_aio_ring);
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = (uintptr_t)aio_read;
+		sqe->user_data = 0;
+		file_aio_wait(aio_read);
+	}
+	aio_read->active = FALSE;
+}
+
+static void file_aio_read_free(struct file_istream *fstream)
+{
+	struct file_istream_aio_read *aio_read = fstream->aio_read;
+
+	if (aio_read == NULL)
+		return;
+
+	file_aio_read_cancel(fstream);
+	fstream->aio_read = NULL;
+	i_free(aio_read->data);
+	i_free(aio_read);
+}
+
+#ifdef HAVE_PREADV2
+/* Read without blocking in case the data is already in page cache. Returns
+   the same as pread(), or -2 if the read would have to wait for the disk. */
+static ssize_t
+i_stream_file_pread_nowait(struct file_istream *fstream, void *buf,
+			   size_t size, uoff_t offset)
+{
+	struct iovec iov = { .iov_base = buf, .iov_len = size };
+	ssize_t ret;
+
+	ret = preadv2(fstream->istream.fd, &iov, 1, offset, RWF_NOWAIT);
+	if (ret >= 0 || (errno != EAGAIN && errno != EOPNOTSUPP))
+		return ret;
+	return -2;
+}
+#endif
+
+/* Returns the same as pread(), or -2 if the stream is nonblocking and the
+   data hasn't been read yet. */
+static ssize_t
+i_stream_file_aio_pread(struct file_istream *fstream, void *buf, size_t size,
+			uoff_t offset)
+{
+	struct file_istream_aio_read *aio_read = fstream->aio_read;
+	size_t avail;
+	ssize_t ret;
+
+	if (aio_read != NULL && aio_read->active &&
+	    aio_read->offset + aio_read->pos != offset) {
+		/* seeked elsewhere */
+		file_aio_read_cancel(fstream);
+	}
+
+	if (aio_read == NULL || !aio_read->active) {
+#ifdef HAVE_PREADV2
+		/* Most reads are served from page cache. Only the ones that
+		   would block go through the ring. */
+		ret = i_stream_file_pread_nowait(fstream, buf, size, offset);
+		if (ret != -2)
+			return ret;
+#endif
+		if (!fstream->aio_nonblocking) {
+			/* waiting for an async read wouldn't help with this
+			   block, but read the next one while the caller is
+			   processing this one */
+			ret = pread(fstream->istream.fd, buf, size, offset);
+			if (ret > 0 && (size_t)ret == size)
+				file_aio_read_submit(fstream, offset + ret, size);
+			return ret;
+		}
+		file_aio_read_submit(fstream, offset, size);
+		aio_read = fstream->aio_read;
+	}
+
+	if (!aio_read->done) {
+		if (fstream->aio_nonblocking)
+			return -2;
+		file_aio_wait(aio_read);
+	}
+	if (aio_read->ret < 0) {
+		int read_errno = -aio_read->ret;
+
+		aio_read->active = FALSE;
+		errno = read_errno;
+		return -1;
+	}
+
+	avail = (size_t)aio_read->ret - aio_read->pos;
+	size = I_MIN(size, avail);
+	memcpy(buf, aio_read->data + aio_read->pos, size);
+	aio_read->pos += size;
+	if (aio_read->pos == (size_t)aio_read->ret)
+		aio_read->active = FALSE;
+	return size;
+}
+#endif
 
 void i_stream_file_close(struct iostream_private *stream,
 			 bool close_parent ATTR_UNUSED)
@@ -20,6 +274,9 @@ void i_stream_file_close(struct iostream_private *stream,
 	struct file_istream *fstream =
 		container_of(_stream, struct file_istream, istream);
 
+#ifdef HAVE_LINUX_IO_URING_H
+	file_aio_read_free(fstream);
+#endif
 	if (fstream->autoclose_fd && _stream->fd != -1) {
 		/* Ignore ECONNRESET because we don't really care about it here,
 		   as we are closing the socket down in any case. There might be
@@ -66,6 +323,14 @@ ssize_t i_stream_file_read(struct istream_private *stream)
 	offset = stream->istream.v_offset + (stream->pos - stream->skip);
 
 	if (fstream->file) {
+#ifdef HAVE_LINUX_IO_URING_H
+		if (fstream->aio) {
+			ret = i_stream_file_aio_pread(fstream,
+				stream->w_buffer + stream->pos, size, offset);
+			if (ret == -2)
+				return 0;
+		} else
+#endif
 		ret = pread(stream->fd, stream->w_buffer + stream->pos,
 			    size, offset);
 	} else if (fstream->seen_eof) {
@@ -128,6 +393,61 @@ ssize_t i_stream_file_read(struct istream_private *stream)
 	return ret;
 }
 
+#ifdef HAVE_SPLICE
+bool i_stream_file_can_splice(struct istream *input)
+{
+	struct istream_private *stream = input->real_stream;
+	struct file_istream *fstream =
+		container_of(stream, struct file_istream, istream);
+
+	/* Only a plain socket/pipe istream without any buffered data can be
+	   bypassed. Filter istreams have a different read() and would need
+	   to see the data. */
+	return stream->read == i_stream_file_read && !fstream->file &&
+		!input->blocking && !input->closed && stream->fd != -1 &&
+		input->stream_errno == 0 && !fstream->seen_eof &&
+		fstream->skip_left == 0 && stream->skip == stream->pos;
+}
+
+ssize_t i_stream_file_splice(struct istream *input, int pipe_fd, size_t size)
+{
+	struct istream_private *stream = input->real_stream;
+	struct file_istream *fstream =
+		container_of(stream, struct file_istream, istream);
+	ssize_t ret;
+
+	i_assert(i_stream_file_can_splice(input));
+
+	ret = splice(stream->fd, NULL, pipe_fd, NULL, size,
+		     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (ret == 0) {
+		/* EOF */
+		input->eof = TRUE;
+		fstream->seen_eof = TRUE;
+		return -1;
+	}
+	if (unlikely(ret < 0)) {
+		if (errno == EINTR || errno == EAGAIN)
+			return 0;
+		if (errno == EINVAL) {
+			/* splice() not supported with this fd */
+			return -2;
+		}
+		i_assert(errno != EBADF);
+		io_stream_set_error(&stream->iostream,
+				    "splice(size=%zu) failed: %m", size);
+		input->stream_errno = errno;
+		input->eof = TRUE;
+		return -1;
+	}
+	/* the data was consumed without going through the buffer */
+	input->v_offset += ret;
+	stream->access_counter++;
+	stream->last_read_timeval = ioloop_timeval;
+	return ret;
+}
+#endif
+
 static void i_stream_file_seek(struct istream_private *stream, uoff_t v_offset,
 			       bool mark ATTR_UNUSED)
 {
@@ -151,6 +471,12 @@ static void i_stream_file_sync(struct istream_private *stream)
 		/* can't do anything or data would be lost */
 		return;
 	}
+#ifdef HAVE_LINUX_IO_URING_H
+	/* the file may have changed - drop any read-ahead data */
+	struct file_istream *fstream =
+		container_of(stream, struct file_istream, istream);
+	file_aio_read_cancel(fstream);
+#endif
 
 	stream->skip = stream->pos = 0;
 	stream->istream.eof = FALSE;
@@ -280,3 +606,27 @@ struct istream *i_stream_create_file(const char *path, size_t max_buffer_size)
 	i_stream_set_name(input, path);
 	return input;
 }
+
+bool i_stream_file_set_async(struct istream *input, bool nonblocking)
+{
+	struct istream_private *stream = input->real_stream;
+	struct file_istream *fstream =
+		container_of(stream, struct file_istream, istream);
+
+	if (stream->read != i_stream_file_read || !fstream->file)
+		return FALSE;
+#ifdef HAVE_LINUX_IO_URING_H
+	if (!file_aio_init())
+		return FALSE;
+	fstream->aio = TRUE;
+	if (nonblocking) {
+		fstream->aio_nonblocking = TRUE;
+		stream->io_pending_only = TRUE;
+		input->blocking = FALSE;
+	}
+	return TRUE;
+#else
+	(void)nonblocking;
+	return FALSE;
+#endif
+}
@@ -68,6 +68,10 @@ struct istream_private {
 	bool stream_size_passthrough:1; /* stream is parent's size */
 	bool nonpersistent_buffers:1;
 	bool io_pending:1;
+	/* The fd can't be waited on with io_add() (e.g. asynchronously read
+	   regular file). io_add_istream() gets notified only via
+	   i_stream_set_input_pending(). */
+	bool io_pending_only:1;
 };
 
 struct istream_snapshot {
@@ -44,6 +44,15 @@ struct istream *i_stream_create_fd_autoclose(int *fd, size_t max_buffer_size);
 /* Open the given path only when something is actually tried to be read from
    the stream. */
 struct istream *i_stream_create_file(const char *path, size_t max_buffer_size);
+/* Read the file stream using asynchronous kernel I/O (io_uring). Data that
+   isn't already in the page cache is read without blocking the process, and
+   the following block is read ahead while the caller is processing the
+   current one. If nonblocking is TRUE, i_stream_read() returns 0 while the
+   data is being read and io_add_istream() callbacks are called once it has
+   arrived. Otherwise reads still block, but benefit from the read-ahead.
+   Returns FALSE if asynchronous reads aren't supported by the OS, or if the
+   stream isn't a regular file. The stream is unchanged then. */
+bool i_stream_file_set_async(struct istream *input, bool nonblocking);
 /* Create an input stream using the provided data block. That data block must
 remain allocated during the full lifetime of the stream. */
 struct istream *i_stream_create_from_data(const void *data, size_t size);
@@ -13,6 +13,9 @@
 
 #include <ctype.h>
 
+/* Maximum number of freed events' pools that are kept for new events */
+#define EVENT_POOL_CACHE_MAX_COUNT 64
+
 HASH_TABLE_DEFINE_TYPE(category_set, void *, const struct event_category *);
 
 enum event_code {
@@ -80,6 +83,7 @@ static ARRAY(event_category_callback_t *) event_category_callbacks;
 static ARRAY(struct event_internal_category *) event_registered_categories_internal;
 static ARRAY(struct event_category *) event_registered_categories_representative;
 static ARRAY(struct event *) global_event_stack;
+static ARRAY(pool_t) event_pool_cache;
 static uint64_t event_id_counter = 0;
 
 static void get_self_rusage(struct rusage *ru_r)
@@ -90,7 +94,7 @@ static void get_self_rusage(struct rusage *ru_r)
 
 static struct event *
 event_create_internal(struct event *parent, const char *source_filename,
-		      unsigned int source_linenum);
+		      unsigned int source_linenum, bool literal_fname);
 static struct event_internal_category *
 event_category_find_internal(const char *name);
 
@@ -234,7 +238,7 @@ struct event *event_dup(const struct event *source)
 {
 	struct event *ret =
 		event_create_internal(source->parent, source->source_filename,
-				      source->source_linenum);
+				      source->source_linenum, FALSE);
 	string_t *str = t_str_new(256);
 	const char *err;
 	event_export(source, str);
@@ -272,7 +276,7 @@ struct event *event_flatten(struct event *src)
 	/* We have to flatten the event. */
 
 	dst = event_create_internal(NULL, src->source_filename,
-				    src->source_linenum);
+				    src->source_linenum, FALSE);
 	dst = event_set_name(dst, src->sending_name);
 
 	if (current_global_event != NULL)
@@ -402,12 +406,41 @@ struct event *event_minimize(struct event *event)
 	return new_event;
 }
 
+static pool_t event_pool_get(void)
+{
+	pool_t pool;
+	unsigned int count = array_count(&event_pool_cache);
+
+	if (count == 0)
+		return pool_alloconly_create(MEMPOOL_GROWING"event", 1024);
+
+	/* reuse a pool of an earlier freed event */
+	pool = array_idx_elem(&event_pool_cache, count - 1);
+	array_delete(&event_pool_cache, count - 1, 1);
+	return pool;
+}
+
+static void event_pool_put(pool_t *_pool)
+{
+	pool_t pool = *_pool;
+
+	*_pool = NULL;
+	if (array_count(&event_pool_cache) >= EVENT_POOL_CACHE_MAX_COUNT) {
+		pool_unref(&pool);
+		return;
+	}
+	/* Clearing frees everything except the pool's first block, so the
+	   cached pools stay small even if the event had grown large. */
+	p_clear(pool);
+	array_push_back(&event_pool_cache, &pool);
+}
+
 static struct event *
 event_create_internal(struct event *parent, const char *source_filename,
-		      unsigned int source_linenum)
+		      unsigned int source_linenum, bool literal_fname)
 {
 	struct event *event;
-	pool_t pool = pool_alloconly_create(MEMPOOL_GROWING"event", 1024);
+	pool_t pool = event_pool_get();
 
 	event = p_new(pool, struct event, 1);
 	event->refcount = 1;
@@ -416,7 +449,8 @@ event_create_internal(struct event *parent, const char *source_filename,
 	event->tv_created_ioloop = ioloop_timeval;
 	event->min_log_level = LOG_TYPE_INFO;
 	i_gettimeofday(&event->tv_created);
-	event->source_filename = p_strdup(pool, source_filename);
+	event->source_filename = literal_fname ? source_filename :
+		p_strdup(pool, source_filename);
 	event->source_linenum = source_linenum;
 	event->change_id = 1;
 	if (parent != NULL) {
@@ -434,7 +468,8 @@ struct event *event_create(struct event *parent, const char *source_filename,
 {
 	struct event *event;
 
-	event = event_create_internal(parent, source_filename, source_linenum);
+	event = event_create_internal(parent, source_filename, source_linenum,
+				      TRUE);
 	(void)event_call_callbacks_noargs(event, EVENT_CALLBACK_TYPE_CREATE);
 	return event;
 }
@@ -496,7 +531,7 @@ void event_unref(struct event **_event)
 	event_unref(&event->parent);
 
 	DLLIST_REMOVE(&events, event);
-	pool_unref(&event->pool);
+	event_pool_put(&event->pool);
 }
 
 struct event *events_get_head(void)
@@ -1869,11 +1904,13 @@ void lib_event_init(void)
 	i_array_init(&event_category_callbacks, 4);
 	i_array_init(&event_registered_categories_internal, 16);
 	i_array_init(&event_registered_categories_representative, 16);
+	i_array_init(&event_pool_cache, EVENT_POOL_CACHE_MAX_COUNT);
 }
 
 void lib_event_deinit(void)
 {
 	struct event_internal_category *internal;
+	pool_t *pool;
 
 	event_unset_global_debug_log_filter();
 	event_unset_global_debug_send_filter();
@@ -1893,4 +1930,7 @@ void lib_event_deinit(void)
 	array_free(&event_registered_categories_internal);
 	array_free(&event_registered_categories_representative);
 	array_free(&global_event_stack);
+	array_foreach_modifiable(&event_pool_cache, pool)
+		pool_unref(pool);
+	array_free(&event_pool_cache);
 }
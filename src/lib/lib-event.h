@@ -149,7 +149,9 @@ void event_copy_categories(struct event *to, struct event *from);
    Parent events' fields aren't copied. */
 void event_copy_fields(struct event *to, struct event *from);
 
-/* Create a new empty event under the parent event, or NULL for root event. */
+/* Create a new empty event under the parent event, or NULL for root event.
+   The source_filename isn't copied, so it must be a static string (as
+   __FILE__ is). */
 struct event *event_create(struct event *parent, const char *source_filename,
 			   unsigned int source_linenum);
 #define event_create(parent) \
@@ -393,7 +395,9 @@ void event_field_clear(struct event *event, const char *key);
 
 /* Returns the parent event, or NULL if it doesn't exist. */
 struct event *event_get_parent(const struct event *event);
-/* Returns the memory pool used by the event. */
+/* Returns the memory pool used by the event. The pool is cleared and reused
+   for another event after the event is freed, so it must not be referenced
+   beyond the event's lifetime. */
 pool_t event_get_pool(const struct event *event);
 /* Get the event's creation time. */
 void event_get_create_time(const struct event *event, struct timeval *tv_r);
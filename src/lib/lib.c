@@ -6,6 +6,7 @@
 #include "event-filter.h"
 #include "env-util.h"
 #include "hostpid.h"
+#include "ioloop.h"
 #include "ipwd.h"
 #include "process-title.h"
 #include "restrict-access.h"
@@ -214,6 +215,7 @@ void lib_deinit(void)
 	hostpid_deinit();
 	event_filter_deinit();
 	data_stack_deinit_event();
+	io_loop_callback_stats_deinit();
 	lib_event_deinit();
 	restrict_access_deinit();
 	i_close_fd(&dev_null_fd);
@@ -221,6 +223,7 @@ void lib_deinit(void)
 	failures_deinit();
 	process_title_deinit();
 	random_deinit();
+	pool_slab_deinit();
 
 	lib_clean_exit = TRUE;
 }
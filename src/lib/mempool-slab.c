@@ -0,0 +1,391 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+/* @UNSAFE: whole file */
+#include "lib.h"
+#include "bits.h"
+#include "llist.h"
+#include "lib-event.h"
+#include "mempool.h"
+
+/*
+ * Slab pools support both allocating and freeing memory, similar to
+ * allocfree pools. They're meant for short-lived objects that are created
+ * and destroyed at a high rate, such as per-command and per-request state.
+ *
+ * Implementation
+ * ==============
+ *
+ * Small allocations are rounded up to one of the size classes. Each size
+ * class has a process-wide free list, which is shared by all the slab pools
+ * in the process. Freeing an object puts it back to its class's free list,
+ * and the next allocation of the same class reuses it without calling
+ * malloc(). When the free list is empty, the object is carved out of the
+ * class's current slab, which is a large malloc()ed block. Slabs are never
+ * returned to the system before lib_deinit(), so after a peak the memory
+ * stays available for reuse by the process.
+ *
+ * Allocations larger than the largest size class are malloc()ed directly.
+ *
+ * Each allocation has a small header that links it to the pool's list of
+ * live objects, so clearing and destroying the pool can free everything.
+ * The pool structure itself is allocated from the size classes as well, so
+ * creating and destroying a pool doesn't call malloc() in the steady state.
+ *
+ * Statistics of all the slab pools are available with pool_slab_get_stats()
+ * and can be added to an event with pool_slab_event_add_stats().
+ */
+
+#define SLAB_SIZE (64 * 1024)
+#define SLAB_CLASS_LARGE UINT_MAX
+
+#ifdef DEBUG
+#  define CLEAR_CHR 0xde
+#else
+#  define CLEAR_CHR 0
+#endif
+
+struct slab_pool {
+	struct pool pool;
+	int refcount;
+
+	struct slab_object *objects;
+#ifdef DEBUG
+	char *name;
+#endif
+};
+
+struct slab_object {
+	/* In the pool's objects list, or the next in the free list */
+	struct slab_object *prev, *next;
+	/* Size requested by the caller */
+	size_t size;
+
+	/* unsigned char data[]; */
+};
+#define SIZEOF_SLAB_OBJECT MEM_ALIGN(sizeof(struct slab_object))
+#define SLAB_OBJECT_DATA(obj) \
+	((unsigned char *)(obj) + SIZEOF_SLAB_OBJECT)
+
+struct slab {
+	struct slab *next;
+};
+#define SIZEOF_SLAB MEM_ALIGN(sizeof(struct slab))
+
+struct slab_class {
+	struct slab_object *free_list;
+	unsigned char *slab_pos, *slab_end;
+};
+
+static const unsigned int slab_class_sizes[] = {
+	16, 32, 48, 64, 80, 96, 112, 128,
+	160, 192, 224, 256,
+	320, 384, 448, 512,
+	640, 768, 896, 1024
+};
+#define SLAB_CLASS_COUNT N_ELEMENTS(slab_class_sizes)
+#define SLAB_MAX_OBJECT_SIZE slab_class_sizes[SLAB_CLASS_COUNT-1]
+
+static struct slab_class slab_classes[SLAB_CLASS_COUNT];
+static struct slab *slabs = NULL;
+static struct pool_slab_stats slab_stats;
+
+static const char *pool_slab_get_name(pool_t pool);
+static void pool_slab_ref(pool_t pool);
+static void pool_slab_unref(pool_t *pool);
+static void *pool_slab_malloc(pool_t pool, size_t size);
+static void pool_slab_free(pool_t pool, void *mem);
+static void *pool_slab_realloc(pool_t pool, void *mem,
+			       size_t old_size, size_t new_size);
+static void pool_slab_clear(pool_t pool);
+static size_t pool_slab_get_max_easy_alloc_size(pool_t pool);
+
+static const struct pool_vfuncs static_slab_pool_vfuncs = {
+	pool_slab_get_name,
+
+	pool_slab_ref,
+	pool_slab_unref,
+
+	pool_slab_malloc,
+	pool_slab_free,
+
+	pool_slab_realloc,
+
+	pool_slab_clear,
+	pool_slab_get_max_easy_alloc_size
+};
+
+static const struct pool static_slab_pool = {
+	.v = &static_slab_pool_vfuncs,
+
+	.alloconly_pool = FALSE,
+	.datastack_pool = FALSE
+};
+
+static unsigned int slab_size_class(size_t size)
+{
+	unsigned int bits;
+
+	i_assert(size > 0);
+
+	if (size > SLAB_MAX_OBJECT_SIZE)
+		return SLAB_CLASS_LARGE;
+	if (size <= 128)
+		return (size - 1) / 16;
+	/* 4 classes for each power of two above 128 */
+	bits = bits_required32(size - 1);
+	return 8 + (bits - 8) * 4 + ((size - 1) >> (bits - 3)) - 4;
+}
+
+static struct slab_object *slab_object_alloc(size_t size)
+{
+	unsigned int class_idx = slab_size_class(size);
+	struct slab_class *class;
+	struct slab_object *obj;
+	size_t obj_size;
+	struct slab *slab;
+
+	if (class_idx == SLAB_CLASS_LARGE) {
+		obj = calloc(1, SIZEOF_SLAB_OBJECT + size);
+		if (obj == NULL) {
+			i_fatal_status(FATAL_OUTOFMEM,
+				       "calloc(1, %zu): Out of memory",
+				       SIZEOF_SLAB_OBJECT + size);
+		}
+		obj->size = size;
+		slab_stats.large_alloc_count++;
+		slab_stats.large_bytes += size;
+		return obj;
+	}
+
+	class = &slab_classes[class_idx];
+	obj_size = SIZEOF_SLAB_OBJECT + slab_class_sizes[class_idx];
+	if (class->free_list != NULL) {
+		obj = class->free_list;
+		class->free_list = obj->next;
+		slab_stats.reuse_count++;
+		slab_stats.free_bytes -= slab_class_sizes[class_idx];
+	} else {
+		if ((size_t)(class->slab_end - class->slab_pos) < obj_size) {
+			slab = malloc(SLAB_SIZE);
+			if (slab == NULL) {
+				i_fatal_status(FATAL_OUTOFMEM,
+					       "malloc(%d): Out of memory",
+					       SLAB_SIZE);
+			}
+			slab->next = slabs;
+			slabs = slab;
+			class->slab_pos = PTR_OFFSET(slab, SIZEOF_SLAB);
+			class->slab_end = PTR_OFFSET(slab, SLAB_SIZE);
+			slab_stats.slab_count++;
+			slab_stats.slab_bytes += SLAB_SIZE;
+		}
+		obj = (struct slab_object *)class->slab_pos;
+		class->slab_pos += obj_size;
+	}
+	memset(obj, 0, SIZEOF_SLAB_OBJECT + size);
+	obj->size = size;
+	slab_stats.alloc_count++;
+	slab_stats.used_bytes += size;
+	slab_stats.waste_bytes += slab_class_sizes[class_idx] - size;
+	return obj;
+}
+
+static void slab_object_free(struct slab_object *obj)
+{
+	unsigned int class_idx = slab_size_class(obj->size);
+	struct slab_class *class;
+
+	if (class_idx == SLAB_CLASS_LARGE) {
+		i_assert(slab_stats.large_bytes >= obj->size);
+		slab_stats.large_bytes -= obj->size;
+		free(obj);
+		return;
+	}
+
+	i_assert(slab_stats.used_bytes >= obj->size);
+	slab_stats.used_bytes -= obj->size;
+	slab_stats.waste_bytes -= slab_class_sizes[class_idx] - obj->size;
+	slab_stats.free_bytes += slab_class_sizes[class_idx];
+#ifdef DEBUG
+	memset(SLAB_OBJECT_DATA(obj), CLEAR_CHR, obj->size);
+#endif
+	class = &slab_classes[class_idx];
+	obj->prev = NULL;
+	obj->next = class->free_list;
+	class->free_list = obj;
+}
+
+static struct slab_object *
+pool_slab_object_detach(struct slab_pool *spool, unsigned char *mem)
+{
+	/* cannot use PTR_OFFSET because of negative value */
+	i_assert((uintptr_t)mem >= SIZEOF_SLAB_OBJECT);
+	struct slab_object *obj =
+		(struct slab_object *)(mem - SIZEOF_SLAB_OBJECT);
+
+	i_assert((obj->prev == NULL || obj->prev->next == obj) &&
+		 (obj->next == NULL || obj->next->prev == obj));
+	DLLIST_REMOVE(&spool->objects, obj);
+	return obj;
+}
+
+pool_t pool_slab_create(const char *name ATTR_UNUSED)
+{
+	struct slab_object *obj;
+	struct slab_pool *spool;
+
+	/* the pool itself isn't in the objects list */
+	obj = slab_object_alloc(sizeof(*spool));
+	spool = (struct slab_pool *)SLAB_OBJECT_DATA(obj);
+#ifdef DEBUG
+	spool->name = strdup(name);
+#endif
+	spool->pool = static_slab_pool;
+	spool->refcount = 1;
+	return &spool->pool;
+}
+
+static void pool_slab_destroy(struct slab_pool *spool)
+{
+	pool_slab_clear(&spool->pool);
+#ifdef DEBUG
+	free(spool->name);
+#endif
+	slab_object_free((struct slab_object *)
+			 ((unsigned char *)spool - SIZEOF_SLAB_OBJECT));
+}
+
+static const char *pool_slab_get_name(pool_t pool ATTR_UNUSED)
+{
+#ifdef DEBUG
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+
+	return spool->name;
+#else
+	return "slab";
+#endif
+}
+
+static void pool_slab_ref(pool_t pool)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+
+	i_assert(spool->refcount > 0);
+	spool->refcount++;
+}
+
+static void pool_slab_unref(pool_t *_pool)
+{
+	pool_t pool = *_pool;
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+
+	i_assert(spool->refcount > 0);
+
+	/* erase the pointer before freeing anything, as the pointer may
+	   exist inside the pool's memory area */
+	*_pool = NULL;
+
+	if (--spool->refcount > 0)
+		return;
+
+	pool_slab_destroy(spool);
+}
+
+static void *pool_slab_malloc(pool_t pool, size_t size)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	struct slab_object *obj;
+
+	obj = slab_object_alloc(size);
+	DLLIST_PREPEND(&spool->objects, obj);
+	return SLAB_OBJECT_DATA(obj);
+}
+
+static void pool_slab_free(pool_t pool, void *mem)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+
+	slab_object_free(pool_slab_object_detach(spool, mem));
+}
+
+static void *pool_slab_realloc(pool_t pool, void *mem,
+			       size_t old_size ATTR_UNUSED, size_t new_size)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	struct slab_object *obj, *new_obj;
+	unsigned int class_idx;
+
+	obj = pool_slab_object_detach(spool, mem);
+	if (new_size <= obj->size) {
+		/* keep the old size, so the waste stays correct */
+		DLLIST_PREPEND(&spool->objects, obj);
+		return mem;
+	}
+
+	class_idx = slab_size_class(obj->size);
+	if (class_idx != SLAB_CLASS_LARGE &&
+	    new_size <= slab_class_sizes[class_idx]) {
+		/* fits within the same size class */
+		memset(SLAB_OBJECT_DATA(obj) + obj->size, 0,
+		       new_size - obj->size);
+		slab_stats.used_bytes += new_size - obj->size;
+		slab_stats.waste_bytes -= new_size - obj->size;
+		obj->size = new_size;
+		DLLIST_PREPEND(&spool->objects, obj);
+		return mem;
+	}
+
+	new_obj = slab_object_alloc(new_size);
+	memcpy(SLAB_OBJECT_DATA(new_obj), mem, obj->size);
+	slab_object_free(obj);
+	DLLIST_PREPEND(&spool->objects, new_obj);
+	return SLAB_OBJECT_DATA(new_obj);
+}
+
+static void pool_slab_clear(pool_t pool)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	struct slab_object *obj;
+
+	while (spool->objects != NULL) {
+		obj = spool->objects;
+		spool->objects = obj->next;
+		slab_object_free(obj);
+	}
+}
+
+static size_t pool_slab_get_max_easy_alloc_size(pool_t pool ATTR_UNUSED)
+{
+	return 0;
+}
+
+void pool_slab_get_stats(struct pool_slab_stats *stats_r)
+{
+	*stats_r = slab_stats;
+}
+
+void pool_slab_event_add_stats(struct event *event)
+{
+	event_add_int(event, "slab_count", slab_stats.slab_count);
+	event_add_int(event, "slab_bytes", slab_stats.slab_bytes);
+	event_add_int(event, "slab_alloc_count", slab_stats.alloc_count);
+	event_add_int(event, "slab_reuse_count", slab_stats.reuse_count);
+	event_add_int(event, "slab_used_bytes", slab_stats.used_bytes);
+	event_add_int(event, "slab_waste_bytes", slab_stats.waste_bytes);
+	event_add_int(event, "slab_free_bytes", slab_stats.free_bytes);
+	event_add_int(event, "slab_large_alloc_count",
+		      slab_stats.large_alloc_count);
+}
+
+void pool_slab_deinit(void)
+{
+	struct slab *slab;
+
+	while (slabs != NULL) {
+		slab = slabs;
+		slabs = slab->next;
+		free(slab);
+	}
+	i_zero(&slab_classes);
+	i_zero(&slab_stats);
+}
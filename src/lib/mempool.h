@@ -19,6 +19,8 @@
    zeroed, it will cost only a few CPU cycles and may well save some debug
    time. */
 
+struct event;
+
 typedef struct pool *pool_t;
 
 struct pool_vfuncs {
@@ -87,6 +89,12 @@ pool_t pool_allocfree_create(const char *name);
    See pool_alloconly_create_clean. */
 pool_t pool_allocfree_create_clean(const char *name);
 
+/* Create a new slab pool. It supports both allocating and freeing memory.
+   Small allocations are rounded up to size classes and recycled through
+   process-wide free lists, so short-lived pools that are created and freed
+   at a high rate mostly don't need to call malloc(). */
+pool_t pool_slab_create(const char *name);
+
 /* Similar to nearest_power(), but try not to exceed buffer's easy
    allocation size. If you don't have any explicit minimum size, use
    old_size + 1. */
@@ -189,8 +197,31 @@ size_t pool_allocfree_get_total_used_size(pool_t pool);
 /* Returns how much system memory has been allocated for this pool. */
 size_t pool_allocfree_get_total_alloc_size(pool_t pool);
 
+struct pool_slab_stats {
+	/* Number of slabs allocated from the system and their total size */
+	unsigned int slab_count;
+	uint64_t slab_bytes;
+	/* Number of small allocations, and how many of them reused memory that
+	   was previously freed */
+	uint64_t alloc_count, reuse_count;
+	/* Bytes currently allocated from the size classes, and how much more is
+	   lost to rounding them up to the size class */
+	uint64_t used_bytes, waste_bytes;
+	/* Bytes in freed objects waiting for reuse */
+	uint64_t free_bytes;
+	/* Allocations too large for the size classes are malloc()ed
+	   directly. The number of them and the currently allocated bytes. */
+	uint64_t large_alloc_count, large_bytes;
+};
+
+/* Returns statistics of all the slab pools in this process. */
+void pool_slab_get_stats(struct pool_slab_stats *stats_r);
+/* Add the slab pool statistics as slab_* fields to the event. */
+void pool_slab_event_add_stats(struct event *event);
+
 /* private: */
 void pool_system_free(pool_t pool, void *mem);
 void pool_external_refs_unref(pool_t pool);
+void pool_slab_deinit(void);
 
 #endif
@@ -19,6 +19,13 @@ struct file_ostream {
 	size_t buffer_size, optimal_block_size;
 	size_t head, tail; /* first unsent/unused byte */
 
+	/* pipe used for splice(), and how much data is in it. The data in
+	   the pipe is always older than the data in the ring-buffer. */
+	int splice_pipe[2];
+	size_t splice_pipe_used;
+	/* total number of bytes moved with splice() - for debugging */
+	uoff_t spliced_bytes;
+
 	bool full:1; /* if head == tail, is buffer empty or full? */
 	bool file:1;
 	bool flush_pending:1;
@@ -28,6 +35,8 @@ struct file_ostream {
 	bool no_socket_quickack:1;
 	bool no_delay_enabled:1;
 	bool no_sendfile:1;
+	bool no_splice:1;
+	bool no_copy_file_range:1;
 	bool autoclose_fd:1;
 };
 
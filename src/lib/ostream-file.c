@@ -2,13 +2,15 @@
 
 /* @UNSAFE: whole file */
 
+#define _GNU_SOURCE /* for splice() */
 #include "lib.h"
 #include "ioloop.h"
 #include "write-full.h"
 #include "net.h"
+#include "fd-util.h"
 #include "sendfile-util.h"
 #include "istream.h"
-#include "istream-private.h"
+#include "istream-file-private.h"
 #include "ostream-file-private.h"
 
 #include <unistd.h>
@@ -23,8 +25,14 @@
 #define DEFAULT_OPTIMAL_BLOCK_SIZE IO_BLOCK_SIZE
 #define MAX_OPTIMAL_BLOCK_SIZE (128*1024)
 
-#define IS_STREAM_EMPTY(fstream) \
+/* try to move this much data at a time with splice(). this is the default
+   pipe capacity in Linux. */
+#define SPLICE_MAX_SIZE (64*1024)
+
+#define IS_BUFFER_EMPTY(fstream) \
 	((fstream)->head == (fstream)->tail && !(fstream)->full)
+#define IS_STREAM_EMPTY(fstream) \
+	(IS_BUFFER_EMPTY(fstream) && (fstream)->splice_pipe_used == 0)
 
 #define MAX_SSIZE_T(size) \
 	((size) < SSIZE_T_MAX ? (size_t)(size) : SSIZE_T_MAX)
@@ -33,9 +41,20 @@ static void stream_send_io(struct file_ostream *fstream);
 static struct ostream * o_stream_create_fd_common(int fd,
 		size_t max_buffer_size, bool autoclose_fd);
 
+static void splice_pipe_close(struct file_ostream *fstream)
+{
+	if (fstream->splice_pipe[0] == -1)
+		return;
+
+	i_close_fd(&fstream->splice_pipe[0]);
+	i_close_fd(&fstream->splice_pipe[1]);
+	fstream->splice_pipe_used = 0;
+}
+
 static void stream_closed(struct file_ostream *fstream)
 {
 	io_remove(&fstream->io);
+	splice_pipe_close(fstream);
 
 	if (fstream->autoclose_fd && fstream->fd != -1) {
 		/* Ignore ECONNRESET because we don't really care about it here,
@@ -65,6 +84,7 @@ static void o_stream_file_destroy(struct iostream_private *stream)
 	struct file_ostream *fstream =
 		container_of(stream, struct file_ostream, ostream.iostream);
 
+	splice_pipe_close(fstream);
 	i_free(fstream->buffer);
 }
 
@@ -86,7 +106,7 @@ static void update_buffer(struct file_ostream *fstream, size_t size)
 {
 	size_t used;
 
-	if (IS_STREAM_EMPTY(fstream) || size == 0)
+	if (IS_BUFFER_EMPTY(fstream) || size == 0)
 		return;
 
 	if (fstream->head < fstream->tail) {
@@ -325,7 +345,7 @@ o_stream_file_writev_full(struct file_ostream *fstream,
 static int o_stream_fill_iovec(struct file_ostream *fstream,
 			       struct const_iovec iov[2])
 {
-	if (IS_STREAM_EMPTY(fstream))
+	if (IS_BUFFER_EMPTY(fstream))
 		return 0;
 
 	if (fstream->head < fstream->tail) {
@@ -345,12 +365,49 @@ static int o_stream_fill_iovec(struct file_ostream *fstream,
 	}
 }
 
+#ifdef HAVE_SPLICE
+static int splice_pipe_flush(struct file_ostream *fstream)
+{
+	ssize_t ret;
+
+	while (fstream->splice_pipe_used > 0) {
+		ret = splice(fstream->splice_pipe[0], NULL, fstream->fd, NULL,
+			     fstream->splice_pipe_used,
+			     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				return 0;
+			io_stream_set_error(&fstream->ostream.iostream,
+					    "splice() failed: %m");
+			fstream->ostream.ostream.stream_errno = errno;
+			stream_closed(fstream);
+			return -1;
+		}
+		i_assert(ret > 0 && (size_t)ret <= fstream->splice_pipe_used);
+		fstream->splice_pipe_used -= ret;
+		fstream->real_offset += ret;
+		fstream->buffer_offset += ret;
+	}
+	return 1;
+}
+#endif
+
 static int buffer_flush(struct file_ostream *fstream)
 {
 	struct const_iovec iov[2];
 	int iov_len;
 	ssize_t ret;
 
+#ifdef HAVE_SPLICE
+	/* data in the splice pipe was added before the buffered data */
+	if (fstream->splice_pipe_used > 0) {
+		o_stream_socket_cork(fstream);
+		if ((ret = splice_pipe_flush(fstream)) <= 0)
+			return ret;
+	}
+#endif
 	iov_len = o_stream_fill_iovec(fstream, iov);
 	if (iov_len > 0) {
 		ret = o_stream_file_writev_full(fstream, iov, iov_len);
@@ -469,7 +526,8 @@ o_stream_file_get_buffer_used_size(const struct ostream_private *stream)
 	const struct file_ostream *fstream =
 		container_of(stream, const struct file_ostream, ostream);
 
-	return fstream->buffer_size - get_unused_space(fstream);
+	return fstream->buffer_size - get_unused_space(fstream) +
+		fstream->splice_pipe_used;
 }
 
 static int o_stream_file_seek(struct ostream_private *stream, uoff_t offset)
@@ -516,7 +574,7 @@ static void o_stream_grow_buffer(struct file_ostream *fstream, size_t bytes)
 	fstream->buffer = i_realloc(fstream->buffer,
 				    fstream->buffer_size, size);
 
-	if (fstream->tail <= fstream->head && !IS_STREAM_EMPTY(fstream)) {
+	if (fstream->tail <= fstream->head && !IS_BUFFER_EMPTY(fstream)) {
 		/* move head forward to end of buffer */
 		end_size = fstream->buffer_size - fstream->head;
 		memmove(fstream->buffer + size - end_size,
@@ -864,6 +922,167 @@ io_stream_sendfile(struct ostream_private *outstream,
 	return TRUE;
 }
 
+#ifdef HAVE_COPY_FILE_RANGE
+static bool
+io_stream_copy_file_range(struct ostream_private *outstream,
+			  struct istream *instream, int in_fd,
+			  enum ostream_send_istream_result *res_r)
+{
+	struct file_ostream *foutstream =
+		container_of(outstream, struct file_ostream, ostream);
+	uoff_t in_size, v_offset, abs_start_offset;
+	loff_t in_offset;
+	ssize_t ret;
+
+	/* Copy between two files within the kernel. Depending on the
+	   filesystem this may share the data blocks instead of copying
+	   them. */
+	if ((ret = i_stream_get_size(instream, TRUE, &in_size)) < 0) {
+		*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_INPUT;
+		return TRUE;
+	}
+	if (ret == 0)
+		return FALSE;
+
+	/* flush out any data in buffer */
+	if ((ret = buffer_flush(foutstream)) < 0) {
+		*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT;
+		return TRUE;
+	} else if (ret == 0) {
+		*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT;
+		return TRUE;
+	}
+	if (o_stream_lseek(foutstream) < 0) {
+		*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT;
+		return TRUE;
+	}
+
+	v_offset = instream->v_offset;
+	abs_start_offset = i_stream_get_absolute_offset(instream) - v_offset;
+	while (v_offset < in_size) {
+		in_offset = abs_start_offset + v_offset;
+		ret = copy_file_range(in_fd, &in_offset, foutstream->fd, NULL,
+				      MAX_SSIZE_T(in_size - v_offset), 0);
+		if (ret == 0) {
+			/* Unexpectedly early EOF at input */
+			break;
+		}
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (v_offset == instream->v_offset &&
+			    (errno == EXDEV || errno == EINVAL ||
+			     errno == ENOSYS || errno == EOPNOTSUPP ||
+			     errno == EBADF)) {
+				/* not supported with these fds */
+				return FALSE;
+			}
+			io_stream_set_error(&outstream->iostream,
+					    "copy_file_range() failed: %m");
+			outstream->ostream.stream_errno = errno;
+			stream_closed(foutstream);
+			i_stream_seek(instream, v_offset);
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT;
+			return TRUE;
+		}
+
+		v_offset += ret;
+		foutstream->real_offset += ret;
+		foutstream->buffer_offset += ret;
+		outstream->ostream.offset += ret;
+	}
+
+	i_stream_seek(instream, v_offset);
+	instream->eof = TRUE;
+	*res_r = OSTREAM_SEND_ISTREAM_RESULT_FINISHED;
+	return TRUE;
+}
+#endif
+
+#ifdef HAVE_SPLICE
+static bool splice_pipe_open(struct file_ostream *fstream)
+{
+	if (fstream->splice_pipe[0] != -1)
+		return TRUE;
+
+	if (pipe(fstream->splice_pipe) < 0) {
+		/* most likely out of fds - just fallback to copying */
+		if (errno != EMFILE && errno != ENFILE)
+			i_error("pipe() failed: %m");
+		fstream->splice_pipe[0] = fstream->splice_pipe[1] = -1;
+		return FALSE;
+	}
+	fd_set_nonblock(fstream->splice_pipe[0], TRUE);
+	fd_set_nonblock(fstream->splice_pipe[1], TRUE);
+	fd_close_on_exec(fstream->splice_pipe[0], TRUE);
+	fd_close_on_exec(fstream->splice_pipe[1], TRUE);
+	return TRUE;
+}
+
+static bool
+io_stream_splice(struct ostream_private *outstream, struct istream *instream,
+		 enum ostream_send_istream_result *res_r)
+{
+	struct file_ostream *foutstream =
+		container_of(outstream, struct file_ostream, ostream);
+	struct iostream_private *iostream = &outstream->iostream;
+	ssize_t ret;
+
+	if (!splice_pipe_open(foutstream))
+		return FALSE;
+
+	/* flush out any data in buffer */
+	if ((ret = buffer_flush(foutstream)) < 0) {
+		*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT;
+		return TRUE;
+	} else if (ret == 0) {
+		*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT;
+		return TRUE;
+	}
+	o_stream_socket_cork(foutstream);
+
+	for (;;) {
+		i_assert(foutstream->splice_pipe_used == 0);
+		ret = i_stream_file_splice(instream, foutstream->splice_pipe[1],
+					   SPLICE_MAX_SIZE);
+		if (ret == -2) {
+			/* nothing was moved yet, so it's safe to fallback */
+			return FALSE;
+		}
+		if (ret < 0) {
+			*res_r = instream->stream_errno != 0 ?
+				OSTREAM_SEND_ISTREAM_RESULT_ERROR_INPUT :
+				OSTREAM_SEND_ISTREAM_RESULT_FINISHED;
+			return TRUE;
+		}
+		if (ret == 0) {
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT;
+			return TRUE;
+		}
+		foutstream->splice_pipe_used = ret;
+		foutstream->spliced_bytes += ret;
+		outstream->ostream.offset += ret;
+
+		if ((ret = splice_pipe_flush(foutstream)) < 0) {
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT;
+			return TRUE;
+		}
+		if (ret == 0) {
+			/* the rest is sent from the pipe when the fd becomes
+			   writable again */
+			if (foutstream->io == NULL && !outstream->corked) {
+				foutstream->io = io_add_to(
+					io_stream_get_ioloop(iostream),
+					foutstream->fd, IO_WRITE,
+					stream_send_io, foutstream);
+			}
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT;
+			return TRUE;
+		}
+	}
+}
+#endif
+
 static enum ostream_send_istream_result
 io_stream_copy_backwards(struct ostream_private *outstream,
 			 struct istream *instream, uoff_t in_size)
@@ -1005,6 +1224,32 @@ o_stream_file_send_istream(struct ostream_private *outstream,
 		   regular sending. */
 		foutstream->no_sendfile = TRUE;
 	}
+#ifdef HAVE_COPY_FILE_RANGE
+	if (foutstream->file && !foutstream->no_copy_file_range &&
+	    in_fd != -1 && in_fd != foutstream->fd && instream->seekable) {
+		if (io_stream_copy_file_range(outstream, instream, in_fd, &res))
+			return res;
+
+		/* copy_file_range() not supported (with these fds),
+		   fallback to regular copying. */
+		foutstream->no_copy_file_range = TRUE;
+	}
+#endif
+#ifdef HAVE_SPLICE
+	if (outstream->allow_splice && !foutstream->no_splice &&
+	    !foutstream->file && foutstream->fd != -1 &&
+	    !outstream->ostream.blocking &&
+	    foutstream->writev == o_stream_file_writev &&
+	    in_fd != -1 && in_fd != foutstream->fd &&
+	    i_stream_file_can_splice(instream)) {
+		if (io_stream_splice(outstream, instream, &res))
+			return res;
+
+		/* splice() not supported (with this fd), fallback to
+		   regular sending. */
+		foutstream->no_splice = TRUE;
+	}
+#endif
 
 	same_stream = i_stream_get_fd(instream) == foutstream->fd &&
 		foutstream->fd != -1;
@@ -1031,6 +1276,7 @@ o_stream_create_file_common(struct file_ostream *fstream,
 
 	fstream->fd = fd;
 	fstream->autoclose_fd = autoclose_fd;
+	fstream->splice_pipe[0] = fstream->splice_pipe[1] = -1;
 	fstream->optimal_block_size = DEFAULT_OPTIMAL_BLOCK_SIZE;
 
 	fstream->ostream.iostream.close = o_stream_file_close;
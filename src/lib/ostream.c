@@ -398,6 +398,11 @@ void o_stream_set_no_error_handling(struct ostream *stream, bool set)
 	stream->real_stream->error_handling_disabled = set;
 }
 
+void o_stream_set_splice(struct ostream *stream, bool set)
+{
+	stream->real_stream->allow_splice = set;
+}
+
 enum ostream_send_istream_result
 o_stream_send_istream(struct ostream *outstream, struct istream *instream)
 {
@@ -234,6 +234,12 @@ void o_stream_abort(struct ostream *stream);
    When creating wrapper streams, they copy this behavior from the parent
    stream. */
 void o_stream_set_no_error_handling(struct ostream *stream, bool set);
+/* Allow o_stream_send_istream() to move data from a nonblocking socket/pipe
+   fd istream to this fd ostream with splice() via a pipe, so the data isn't
+   copied through userspace. The pipe is created on first use and it keeps
+   two extra fds open until the ostream is destroyed. Ignored for ostreams
+   that don't support it. */
+void o_stream_set_splice(struct ostream *stream, bool set);
 /* Send all of the instream to outstream.
 
    On non-failure instream is skips over all data written to outstream.
@@ -1,70 +1,236 @@
 /* Copyright (c) 2015-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "bits.h"
 #include "stats-dist.h"
-#include "sort.h"
 
-/* In order to have a vaguely accurate 95th percentile, you need way
-   more than 20 in your subsample. */
-#define TIMING_DEFAULT_SUBSAMPLING_BUFFER (20*24) /* 20*24 fits in a page */
+/* The values are counted in a log-linear histogram (like HdrHistogram):
+   each power of two range is split into 2^STATS_DIST_SUB_BUCKET_BITS
+   equally sized buckets. Values up to 2^(STATS_DIST_SUB_BUCKET_BITS+1)
+   have their own buckets. Larger values are counted in buckets whose width
+   is at most 1/2^STATS_DIST_SUB_BUCKET_BITS (~3%) of the value. Only the
+   buckets between the smallest and the largest value are allocated, which
+   is usually a few kilobytes. The worst case is ~8 kB.
+
+   A bucket covers values in the range (lower, upper], so that powers of two
+   are always bucket upper boundaries. This way the number of values <= a
+   power of two can be returned exactly. The value 0 is counted
+   separately. */
+#define STATS_DIST_SUB_BUCKET_BITS 5
+#define STATS_DIST_SUB_BUCKET_COUNT (1U << STATS_DIST_SUB_BUCKET_BITS)
+#define STATS_DIST_EXACT_KEY_LIMIT (2U << STATS_DIST_SUB_BUCKET_BITS)
 
 struct stats_dist {
-	unsigned int sample_count;
 	unsigned int count;
-	bool     sorted;
 	uint64_t min;
 	uint64_t max;
 	uint64_t sum;
-	uint64_t samples[];
+	/* running mean and sum of squared differences from it (Welford) */
+	double mean, m2;
+
+	unsigned int zero_count;
+	/* counts for bucket indexes [bucket_first, bucket_first+bucket_count) */
+	unsigned int bucket_first, bucket_count;
+	unsigned int *buckets;
 };
 
-struct stats_dist *stats_dist_init(void)
+static unsigned int stats_dist_bucket_idx(uint64_t value)
 {
-	return stats_dist_init_with_size(TIMING_DEFAULT_SUBSAMPLING_BUFFER);
+	uint64_t key = value - 1;
+	unsigned int shift;
+
+	i_assert(value > 0);
+	if (key < STATS_DIST_EXACT_KEY_LIMIT)
+		return key;
+	shift = bits_required64(key) - 1 - STATS_DIST_SUB_BUCKET_BITS;
+	return shift * STATS_DIST_SUB_BUCKET_COUNT + (key >> shift);
 }
 
-struct stats_dist *stats_dist_init_with_size(unsigned int sample_count)
+/* Returns the smallest and the largest value counted in the bucket. */
+static void
+stats_dist_bucket_range(unsigned int idx, uint64_t *first_r, uint64_t *last_r)
 {
-	i_assert(sample_count > 0);
+	unsigned int shift;
+	uint64_t key;
+
+	if (idx < STATS_DIST_EXACT_KEY_LIMIT) {
+		*first_r = *last_r = idx + 1;
+		return;
+	}
+	shift = idx / STATS_DIST_SUB_BUCKET_COUNT - 1;
+	key = (uint64_t)(idx % STATS_DIST_SUB_BUCKET_COUNT +
+			 STATS_DIST_SUB_BUCKET_COUNT) << shift;
+	*first_r = key + 1;
+	*last_r = key + ((1ULL << shift) - 1);
+	if (*last_r < UINT64_MAX)
+		(*last_r)++;
+}
+
+static void
+stats_dist_buckets_grow(struct stats_dist *stats, unsigned int first,
+			unsigned int last)
+{
+	unsigned int new_first, new_count;
+
+	if (stats->bucket_count > 0) {
+		new_first = I_MIN(first, stats->bucket_first);
+		last = I_MAX(last, stats->bucket_first +
+			     stats->bucket_count - 1);
+	} else {
+		new_first = first;
+	}
+	new_count = last - new_first + 1;
+	if (new_first == stats->bucket_first &&
+	    new_count == stats->bucket_count)
+		return;
+
+	stats->buckets = i_realloc_type(stats->buckets, unsigned int,
+					stats->bucket_count, new_count);
+	if (stats->bucket_count > 0 && new_first < stats->bucket_first) {
+		unsigned int diff = stats->bucket_first - new_first;
+
+		memmove(stats->buckets + diff, stats->buckets,
+			stats->bucket_count * sizeof(*stats->buckets));
+		memset(stats->buckets, 0, diff * sizeof(*stats->buckets));
+	}
+	stats->bucket_first = new_first;
+	stats->bucket_count = new_count;
+}
 
-	struct stats_dist *stats =
-		i_malloc(sizeof(struct stats_dist) +
-			 sizeof(uint64_t) * sample_count);
-	stats->sample_count = sample_count;
-	return stats;
+struct stats_dist *stats_dist_init(void)
+{
+	return i_new(struct stats_dist, 1);
 }
 
 void stats_dist_deinit(struct stats_dist **_stats)
 {
-	i_free_and_null(*_stats);
+	struct stats_dist *stats = *_stats;
+
+	if (stats == NULL)
+		return;
+	*_stats = NULL;
+
+	i_free(stats->buckets);
+	i_free(stats);
 }
 
 void stats_dist_reset(struct stats_dist *stats)
 {
-	unsigned int sample_count = stats->sample_count;
+	i_free(stats->buckets);
 	i_zero(stats);
-	stats->sample_count = sample_count;
 }
 
 void stats_dist_add(struct stats_dist *stats, uint64_t value)
 {
-	if (stats->count < stats->sample_count) {
-		stats->samples[stats->count] = value;
-		if (stats->count == 0)
-			stats->min = stats->max = value;
-	} else {
-		unsigned int idx = i_rand_limit(stats->count);
-		if (idx < stats->sample_count)
-			stats->samples[idx] = value;
+	double delta;
+
+	if (value == 0)
+		stats->zero_count++;
+	else {
+		unsigned int idx = stats_dist_bucket_idx(value);
+
+		if (idx < stats->bucket_first ||
+		    idx >= stats->bucket_first + stats->bucket_count)
+			stats_dist_buckets_grow(stats, idx, idx);
+		stats->buckets[idx - stats->bucket_first]++;
 	}
 
+	if (stats->count == 0)
+		stats->min = stats->max = value;
 	stats->count++;
 	stats->sum += value;
 	if (stats->max < value)
 		stats->max = value;
 	if (stats->min > value)
 		stats->min = value;
-	stats->sorted = FALSE;
+
+	delta = value - stats->mean;
+	stats->mean += delta / stats->count;
+	stats->m2 += delta * (value - stats->mean);
+}
+
+static void
+stats_dist_merge_moments(struct stats_dist *dest, unsigned int count,
+			 uint64_t sum, uint64_t min, uint64_t max,
+			 double mean, double m2)
+{
+	double delta;
+
+	if (dest->count == 0) {
+		dest->min = min;
+		dest->max = max;
+	} else {
+		dest->min = I_MIN(dest->min, min);
+		dest->max = I_MAX(dest->max, max);
+	}
+	delta = mean - dest->mean;
+	dest->m2 += m2 + delta * delta *
+		((double)dest->count * count / (dest->count + count));
+	dest->mean += delta * count / (dest->count + count);
+	dest->count += count;
+	dest->sum += sum;
+}
+
+void stats_dist_merge(struct stats_dist *dest, const struct stats_dist *src)
+{
+	unsigned int i;
+
+	if (src->count == 0)
+		return;
+
+	if (src->bucket_count > 0) {
+		stats_dist_buckets_grow(dest, src->bucket_first,
+			src->bucket_first + src->bucket_count - 1);
+		unsigned int offset = src->bucket_first - dest->bucket_first;
+		for (i = 0; i < src->bucket_count; i++)
+			dest->buckets[offset + i] += src->buckets[i];
+	}
+	dest->zero_count += src->zero_count;
+	stats_dist_merge_moments(dest, src->count, src->sum, src->min,
+				 src->max, src->mean, src->m2);
+}
+
+unsigned int stats_dist_get_bucket_index(uint64_t value)
+{
+	return value == 0 ? 0 : stats_dist_bucket_idx(value) + 1;
+}
+
+void stats_dist_add_buckets(struct stats_dist *stats,
+			    const uint32_t *buckets, unsigned int bucket_count,
+			    uint64_t sum, uint64_t min, uint64_t max,
+			    double sum_squares)
+{
+	unsigned int i, first = UINT_MAX, last = 0, count = 0;
+	double mean, m2;
+
+	for (i = 0; i < bucket_count; i++) {
+		if (buckets[i] == 0)
+			continue;
+		count += buckets[i];
+		if (i == 0)
+			continue;
+		if (first == UINT_MAX)
+			first = i - 1;
+		last = i - 1;
+	}
+	if (count == 0)
+		return;
+
+	if (first != UINT_MAX) {
+		stats_dist_buckets_grow(stats, first, last);
+		unsigned int offset = first - stats->bucket_first;
+		for (i = first; i <= last; i++)
+			stats->buckets[offset++] += buckets[i + 1];
+	}
+	stats->zero_count += buckets[0];
+
+	mean = (double)sum / count;
+	m2 = sum_squares - mean * sum;
+	if (m2 < 0) {
+		/* rounding error */
+		m2 = 0;
+	}
+	stats_dist_merge_moments(stats, count, sum, min, max, mean, m2);
 }
 
 unsigned int stats_dist_get_count(const struct stats_dist *stats)
@@ -95,48 +261,54 @@ double stats_dist_get_avg(const struct stats_dist *stats)
 	return (double)stats->sum / stats->count;
 }
 
-static void stats_dist_ensure_sorted(struct stats_dist *stats)
+/* Returns the approximate value of the rank'th smallest value (0..count-1).
+   Values in wider buckets are estimated to be in the middle of the
+   bucket. */
+static uint64_t
+stats_dist_get_rank_value(const struct stats_dist *stats, unsigned int rank)
 {
-	if (stats->sorted)
-		return;
+	uint64_t first, last, value;
+	unsigned int i, seen = stats->zero_count;
+
+	i_assert(rank < stats->count);
+
+	/* min and max are exact */
+	if (rank == 0)
+		return stats->min;
+	if (rank == stats->count - 1)
+		return stats->max;
+	if (rank < seen)
+		return 0;
+	for (i = 0; i < stats->bucket_count; i++) {
+		seen += stats->buckets[i];
+		if (rank < seen)
+			break;
+	}
+	i_assert(i < stats->bucket_count);
 
-	unsigned int count = (stats->count < stats->sample_count)
-		? stats->count
-		: stats->sample_count;
-	i_qsort(stats->samples, count, sizeof(*stats->samples),
-		uint64_cmp);
-	stats->sorted = TRUE;
+	stats_dist_bucket_range(stats->bucket_first + i, &first, &last);
+	value = first + (last - first) / 2;
+	if (value < stats->min)
+		value = stats->min;
+	if (value > stats->max)
+		value = stats->max;
+	return value;
 }
 
-uint64_t stats_dist_get_median(struct stats_dist *stats)
+uint64_t stats_dist_get_median(const struct stats_dist *stats)
 {
 	if (stats->count == 0)
 		return 0;
-	/* cast-away const - reading requires sorting */
-	stats_dist_ensure_sorted(stats);
-	unsigned int count = (stats->count < stats->sample_count)
-		? stats->count
-		: stats->sample_count;
-	unsigned int idx1 = (count-1)/2, idx2 = count/2;
-	return (stats->samples[idx1] + stats->samples[idx2]) / 2;
+	unsigned int idx1 = (stats->count-1)/2, idx2 = stats->count/2;
+	return (stats_dist_get_rank_value(stats, idx1) +
+		stats_dist_get_rank_value(stats, idx2)) / 2;
 }
 
 double stats_dist_get_variance(const struct stats_dist *stats)
 {
-	double sum = 0;
 	if (stats->count == 0)
 		return 0;
-
-	double avg = stats_dist_get_avg(stats);
-	double count = (stats->count < stats->sample_count)
-		? stats->count
-		: stats->sample_count;
-
-	for(unsigned int i = 0; i < count; i++) {
-		sum += (stats->samples[i] - avg)*(stats->samples[i] - avg);
-	}
-
-	return sum / count;
+	return stats->m2 / stats->count;
 }
 
 /* This is independent of the stats framework, useful for any selection task */
@@ -161,23 +333,38 @@ static unsigned int stats_dist_get_index(unsigned int range, double fraction)
 	return idx;
 }
 
-uint64_t stats_dist_get_percentile(struct stats_dist *stats, double fraction)
+uint64_t stats_dist_get_percentile(const struct stats_dist *stats,
+				   double fraction)
 {
 	if (stats->count == 0)
 		return 0;
-	stats_dist_ensure_sorted(stats);
-	unsigned int count = (stats->count < stats->sample_count)
-		? stats->count
-		: stats->sample_count;
-	unsigned int idx = stats_dist_get_index(count, fraction);
-	return stats->samples[idx];
+	unsigned int idx = stats_dist_get_index(stats->count, fraction);
+	return stats_dist_get_rank_value(stats, idx);
 }
 
-const uint64_t *stats_dist_get_samples(const struct stats_dist *stats,
-				       unsigned int *count_r)
+uint64_t stats_dist_get_count_le(const struct stats_dist *stats,
+				 uint64_t limit)
 {
-	*count_r = (stats->count < stats->sample_count)
-		? stats->count
-		: stats->sample_count;
-	return stats->samples;
+	uint64_t first, last, count = stats->zero_count;
+	unsigned int i, idx;
+
+	if (limit == 0 || stats->bucket_count == 0)
+		return count;
+	if (limit >= stats->max)
+		return stats->count;
+
+	idx = stats_dist_bucket_idx(limit);
+	for (i = 0; i < stats->bucket_count; i++) {
+		if (stats->bucket_first + i >= idx)
+			break;
+		count += stats->buckets[i];
+	}
+	if (idx >= stats->bucket_first &&
+	    idx < stats->bucket_first + stats->bucket_count) {
+		/* interpolate within the bucket that has the limit */
+		stats_dist_bucket_range(idx, &first, &last);
+		count += (double)stats->buckets[idx - stats->bucket_first] *
+			(limit - first + 1) / (last - first + 1);
+	}
+	return count;
 }
@@ -1,8 +1,11 @@
 #ifndef STATS_DIST_H
 #define STATS_DIST_H
 
+/* Distribution of added values. The values are counted in a log-linear
+   histogram with bounded memory usage. Count, sum, min, max, average and
+   variance are exact. Median and percentiles are accurate within ~1.6%. */
+
 struct stats_dist *stats_dist_init(void);
-struct stats_dist *stats_dist_init_with_size(unsigned int sample_count);
 void stats_dist_deinit(struct stats_dist **stats);
 
 /* Reset all events. */
@@ -10,6 +13,22 @@ void stats_dist_reset(struct stats_dist *stats);
 
 /* Add a new event. */
 void stats_dist_add(struct stats_dist *stats, uint64_t value);
+/* Add all events from src to dest. The result is the same as if the events
+   had been added to dest directly. */
+void stats_dist_merge(struct stats_dist *dest, const struct stats_dist *src);
+
+/* Returns the histogram bucket index for the value. This allows counting
+   the values elsewhere, e.g. in shared memory, and adding them later with
+   stats_dist_add_buckets(). Larger values have larger indexes, and 0 has
+   its own bucket 0. */
+unsigned int stats_dist_get_bucket_index(uint64_t value);
+/* Add events that were counted into buckets[stats_dist_get_bucket_index()].
+   The sum, min, max and sum of squares of the events' values must be given
+   separately. */
+void stats_dist_add_buckets(struct stats_dist *stats,
+			    const uint32_t *buckets, unsigned int bucket_count,
+			    uint64_t sum, uint64_t min, uint64_t max,
+			    double sum_squares);
 
 /* Returns number of events added. */
 unsigned int stats_dist_get_count(const struct stats_dist *stats);
@@ -22,19 +41,23 @@ uint64_t stats_dist_get_min(const struct stats_dist *stats);
 uint64_t stats_dist_get_max(const struct stats_dist *stats);
 /* Returns events' average. */
 double stats_dist_get_avg(const struct stats_dist *stats);
-/* Returns events' approximate (through random subsampling) median. */
-uint64_t stats_dist_get_median(struct stats_dist *stats);
+/* Returns events' approximate median. */
+uint64_t stats_dist_get_median(const struct stats_dist *stats);
 /* Returns events' variance */
 double stats_dist_get_variance(const struct stats_dist *stats);
-/* Returns events' approximate (through random subsampling) percentile.
-   fraction parameter is in the range (0., 1.], so 95th %-ile is 0.95. */
-uint64_t stats_dist_get_percentile(struct stats_dist *stats, double fraction);
-/* Returns events' approximate (through random subsampling) 95th percentile. */
-static inline uint64_t stats_dist_get_95th(struct stats_dist *stats)
+/* Returns events' approximate percentile. fraction parameter is in the
+   range (0., 1.], so 95th %-ile is 0.95. */
+uint64_t stats_dist_get_percentile(const struct stats_dist *stats,
+				   double fraction);
+/* Returns events' approximate 95th percentile. */
+static inline uint64_t stats_dist_get_95th(const struct stats_dist *stats)
 {
 	return stats_dist_get_percentile(stats, 0.95);
 }
-/* Returns the sample array */
-const uint64_t *stats_dist_get_samples(const struct stats_dist *stats,
-				       unsigned int *count_r);
+/* Returns the number of events whose value is <= limit. This is exact when
+   limit is a power of two or less than 64. Otherwise the count within the
+   histogram bucket containing limit is interpolated. Using powers of two as
+   histogram boundaries gives exact and mergeable bucket counts. */
+uint64_t stats_dist_get_count_le(const struct stats_dist *stats,
+				 uint64_t limit);
 #endif
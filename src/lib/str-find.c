@@ -5,10 +5,28 @@
 #include "lib.h"
 #include "str-find.h"
 
+/* The first and last byte of the key are searched with SIMD compares. Only
+   the positions where both of them match are compared fully. SSE2 is always
+   available with x86_64, AVX2 is checked at runtime. */
+#if defined(__x86_64__) && defined(__GNUC__) && \
+	(__GNUC__ >= 5 || defined(__clang__))
+#  define HAVE_STR_FIND_X86_SIMD
+#  include <immintrin.h>
+#  define ATTR_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
 struct str_find_context {
 	pool_t pool;
+	/* The key is lowercased with icase */
 	unsigned char *key;
 	unsigned int key_len;
+	bool icase;
+
+	/* The first and the last byte of the key in lowercase and in
+	   uppercase. These are the same if the search isn't icase. */
+	unsigned char first_lc, first_uc, last_lc, last_uc;
+	/* Maps input data to the characters in the key */
+	const unsigned char *fold;
 
 	unsigned int *matches;
 	unsigned int match_count;
@@ -19,6 +37,24 @@ struct str_find_context {
 	int goodtab[FLEXIBLE_ARRAY_MEMBER];
 };
 
+#ifdef HAVE_STR_FIND_X86_SIMD
+static int str_find_avx2 = -1;
+#endif
+static unsigned char str_find_fold_none[UCHAR_MAX+1];
+static unsigned char str_find_fold_icase[UCHAR_MAX+1];
+static bool str_find_fold_initialized = FALSE;
+
+static void str_find_fold_init(void)
+{
+	unsigned int i;
+
+	for (i = 0; i <= UCHAR_MAX; i++) {
+		str_find_fold_none[i] = i;
+		str_find_fold_icase[i] = i >= 'A' && i <= 'Z' ? i + 32 : i;
+	}
+	str_find_fold_initialized = TRUE;
+}
+
 static void init_badtab(struct str_find_context *ctx)
 {
 	unsigned int i, len_1 = ctx->key_len - 1;
@@ -75,10 +111,11 @@ static void init_goodtab(struct str_find_context *ctx)
 		ctx->goodtab[len_1 - suffixes[i]] = len_1 - i;
 }
 
-struct str_find_context *str_find_init(pool_t pool, const char *key)
+static struct str_find_context *
+str_find_init_full(pool_t pool, const char *key, bool icase)
 {
 	struct str_find_context *ctx;
-	size_t key_len = strlen(key);
+	size_t i, key_len = strlen(key);
 
 	i_assert(key_len > 0);
 	i_assert(key_len < INT_MAX);
@@ -91,11 +128,36 @@ struct str_find_context *str_find_init(pool_t pool, const char *key)
 	ctx->key = p_malloc(pool, key_len);
 	memcpy(ctx->key, key, key_len);
 
+	if (!str_find_fold_initialized)
+		str_find_fold_init();
+	ctx->icase = icase;
+	ctx->fold = icase ? str_find_fold_icase : str_find_fold_none;
+	for (i = 0; i < key_len; i++)
+		ctx->key[i] = ctx->fold[ctx->key[i]];
+	ctx->first_lc = ctx->key[0];
+	ctx->last_lc = ctx->key[key_len - 1];
+	ctx->first_uc = ctx->first_lc;
+	ctx->last_uc = ctx->last_lc;
+	if (icase && ctx->first_lc >= 'a' && ctx->first_lc <= 'z')
+		ctx->first_uc -= 32;
+	if (icase && ctx->last_lc >= 'a' && ctx->last_lc <= 'z')
+		ctx->last_uc -= 32;
+
 	init_goodtab(ctx);
 	init_badtab(ctx);
 	return ctx;
 }
 
+struct str_find_context *str_find_init(pool_t pool, const char *key)
+{
+	return str_find_init_full(pool, key, FALSE);
+}
+
+struct str_find_context *str_find_init_icase(pool_t pool, const char *key)
+{
+	return str_find_init_full(pool, key, TRUE);
+}
+
 void str_find_deinit(struct str_find_context **_ctx)
 {
 	struct str_find_context *ctx = *_ctx;
@@ -106,19 +168,165 @@ void str_find_deinit(struct str_find_context **_ctx)
 	p_free(ctx->pool, ctx);
 }
 
+/* Returns TRUE if the key matches data at pos, where the first and the last
+   bytes are already known to match. */
+static inline bool
+str_find_verify(const struct str_find_context *ctx,
+		const unsigned char *data, size_t pos)
+{
+	unsigned int i;
+
+	if (!ctx->icase) {
+		return ctx->key_len <= 2 ||
+			memcmp(ctx->key + 1, data + pos + 1,
+			       ctx->key_len - 2) == 0;
+	}
+	for (i = 1; i + 1 < ctx->key_len; i++) {
+		if (ctx->key[i] != ctx->fold[data[pos + i]])
+			return FALSE;
+	}
+	return TRUE;
+}
+
+#ifdef HAVE_STR_FIND_X86_SIMD
+static inline __m128i
+str_find_cmp_sse2(__m128i block, unsigned char lc, unsigned char uc)
+{
+	__m128i eq = _mm_cmpeq_epi8(block, _mm_set1_epi8(lc));
+
+	if (lc != uc)
+		eq = _mm_or_si128(eq, _mm_cmpeq_epi8(block, _mm_set1_epi8(uc)));
+	return eq;
+}
+
+static bool
+str_find_block_sse2(const struct str_find_context *ctx,
+		    const unsigned char *data, size_t size, size_t *pos)
+{
+	size_t j, last_offset = ctx->key_len - 1;
+	unsigned int mask;
+	__m128i first, last;
+
+	for (j = *pos; j + last_offset + 16 <= size; j += 16) {
+		first = _mm_loadu_si128((const void *)(data + j));
+		last = _mm_loadu_si128((const void *)(data + j + last_offset));
+		mask = _mm_movemask_epi8(_mm_and_si128(
+			str_find_cmp_sse2(first, ctx->first_lc, ctx->first_uc),
+			str_find_cmp_sse2(last, ctx->last_lc, ctx->last_uc)));
+		for (; mask != 0; mask &= mask - 1) {
+			if (str_find_verify(ctx, data, j + __builtin_ctz(mask))) {
+				*pos = j + __builtin_ctz(mask);
+				return TRUE;
+			}
+		}
+	}
+	*pos = j;
+	return FALSE;
+}
+
+static inline __m256i ATTR_TARGET_AVX2
+str_find_cmp_avx2(__m256i block, unsigned char lc, unsigned char uc)
+{
+	__m256i eq = _mm256_cmpeq_epi8(block, _mm256_set1_epi8(lc));
+
+	if (lc != uc) {
+		eq = _mm256_or_si256(eq, _mm256_cmpeq_epi8(
+			block, _mm256_set1_epi8(uc)));
+	}
+	return eq;
+}
+
+static bool ATTR_TARGET_AVX2
+str_find_block_avx2(const struct str_find_context *ctx,
+		    const unsigned char *data, size_t size, size_t *pos)
+{
+	size_t j, last_offset = ctx->key_len - 1;
+	unsigned int mask;
+	__m256i first, last;
+
+	for (j = *pos; j + last_offset + 32 <= size; j += 32) {
+		first = _mm256_loadu_si256((const void *)(data + j));
+		last = _mm256_loadu_si256(
+			(const void *)(data + j + last_offset));
+		mask = _mm256_movemask_epi8(_mm256_and_si256(
+			str_find_cmp_avx2(first, ctx->first_lc, ctx->first_uc),
+			str_find_cmp_avx2(last, ctx->last_lc, ctx->last_uc)));
+		for (; mask != 0; mask &= mask - 1) {
+			if (str_find_verify(ctx, data, j + __builtin_ctz(mask))) {
+				*pos = j + __builtin_ctz(mask);
+				return TRUE;
+			}
+		}
+	}
+	*pos = j;
+	return FALSE;
+}
+#endif
+
+/* Search for the key fully within data, starting from *pos. Returns TRUE and
+   updates *pos to the beginning of the match if it was found. Otherwise *pos
+   is updated to the position where the key no longer fits into data. */
+static bool
+str_find_block(const struct str_find_context *ctx,
+	       const unsigned char *data, size_t size, size_t *pos)
+{
+	unsigned int key_len = ctx->key_len;
+	unsigned int i;
+	size_t j = *pos;
+	int bad_value;
+
+#ifdef HAVE_STR_FIND_X86_SIMD
+	if (unlikely(str_find_avx2 < 0)) {
+		__builtin_cpu_init();
+		str_find_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+	}
+	if (str_find_avx2 > 0 && str_find_block_avx2(ctx, data, size, &j)) {
+		*pos = j;
+		return TRUE;
+	}
+	/* the AVX2 code leaves a tail that can still be searched 16 bytes at
+	   a time */
+	if (str_find_block_sse2(ctx, data, size, &j)) {
+		*pos = j;
+		return TRUE;
+	}
+#endif
+
+	/* Boyer-Moore searching */
+	while (j + key_len <= size) {
+		i = key_len - 1;
+		while (ctx->key[i] == ctx->fold[data[i + j]]) {
+			if (i == 0) {
+				*pos = j;
+				return TRUE;
+			}
+			i--;
+		}
+
+		bad_value = (int)(ctx->badtab[ctx->fold[data[i + j]]] + i + 1) -
+			(int)key_len;
+		j += I_MAX(ctx->goodtab[i], bad_value);
+	}
+	i_assert(j <= size);
+	*pos = j;
+	return FALSE;
+}
+
 bool str_find_more(struct str_find_context *ctx,
 		    const unsigned char *data, size_t size)
 {
+	const unsigned char *fold = ctx->fold;
 	unsigned int key_len = ctx->key_len;
 	unsigned int i, j, a, b;
-	int bad_value;
+	size_t pos;
 
 	for (i = j = 0; i < ctx->match_count; i++) {
 		a = ctx->matches[i];
 		if (ctx->matches[i] + size >= key_len) {
 			/* we can fully determine this match now */
 			for (; a < key_len; a++) {
-				if (ctx->key[a] != data[a - ctx->matches[i]])
+				if (ctx->key[a] !=
+				    fold[data[a - ctx->matches[i]]])
 					break;
 			}
 
@@ -128,7 +336,7 @@ bool str_find_more(struct str_find_context *ctx,
 			}
 		} else {
 			for (b = 0; b < size; b++) {
-				if (ctx->key[a+b] != data[b])
+				if (ctx->key[a+b] != fold[data[b]])
 					break;
 			}
 
@@ -141,29 +349,18 @@ bool str_find_more(struct str_find_context *ctx,
 		ctx->match_count = j;
 		j = 0;
 	} else {
-		/* Boyer-Moore searching */
-		j = 0;
-		while (j + key_len <= size) {
-			i = key_len - 1;
-			while (ctx->key[i] == data[i + j]) {
-				if (i == 0) {
-					ctx->match_end_pos = j + key_len;
-					return TRUE;
-				}
-				i--;
-			}
-
-			bad_value = (int)(ctx->badtab[data[i + j]] + i + 1) -
-				(int)key_len;
-			j += I_MAX(ctx->goodtab[i], bad_value);
+		pos = 0;
+		if (str_find_block(ctx, data, size, &pos)) {
+			ctx->match_end_pos = pos + key_len;
+			return TRUE;
 		}
-		i_assert(j <= size);
+		j = pos;
 		ctx->match_count = 0;
 	}
 
 	for (; j < size; j++) {
 		for (i = j; i < size; i++) {
-			if (ctx->key[i-j] != data[i])
+			if (ctx->key[i-j] != fold[data[i]])
 				break;
 		}
 		if (i == size)
@@ -4,6 +4,9 @@
 struct str_find_context;
 
 struct str_find_context *str_find_init(pool_t pool, const char *key);
+/* Same as str_find_init(), but the key matches case-insensitively. Only
+   ASCII characters are compared case-insensitively. */
+struct str_find_context *str_find_init_icase(pool_t pool, const char *key);
 void str_find_deinit(struct str_find_context **ctx);
 
 /* Returns TRUE if key is found. It's possible to send the data in arbitrary
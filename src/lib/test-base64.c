@@ -1304,6 +1304,69 @@ static void test_base64_encode_lines(void)
 	test_end();
 }
 
+static void
+test_base64_simd_one(const struct base64_scheme *b64,
+		     const unsigned char *data, size_t size,
+		     size_t max_line_len, unsigned int idx)
+{
+	string_t *enc_simd = t_str_new(256), *enc_ref = t_str_new(256);
+	buffer_t *dec_simd = t_buffer_create(256);
+	buffer_t *dec_ref = t_buffer_create(256);
+	struct base64_decoder dec;
+	size_t pos_simd, pos_ref;
+	int ret_simd, ret_ref;
+
+	base64_set_simd(TRUE);
+	base64_scheme_encode(b64, 0, max_line_len, data, size, enc_simd);
+	base64_set_simd(FALSE);
+	base64_scheme_encode(b64, 0, max_line_len, data, size, enc_ref);
+	test_assert_idx(str_equals(enc_simd, enc_ref), idx);
+
+	/* replace a random character with garbage */
+	if (str_len(enc_ref) > 0 && i_rand_limit(3) == 0) {
+		str_c_modifiable(enc_ref)[i_rand_limit(str_len(enc_ref))] =
+			i_rand_limit(2) == 0 ? '\xc3' : ':';
+	}
+
+	base64_set_simd(TRUE);
+	base64_decode_init(&dec, b64, BASE64_DECODE_FLAG_EXPECT_BOUNDARY);
+	ret_simd = base64_decode_more(&dec, str_data(enc_ref), str_len(enc_ref),
+				      &pos_simd, dec_simd);
+	base64_set_simd(FALSE);
+	base64_decode_init(&dec, b64, BASE64_DECODE_FLAG_EXPECT_BOUNDARY);
+	ret_ref = base64_decode_more(&dec, str_data(enc_ref), str_len(enc_ref),
+				     &pos_ref, dec_ref);
+	test_assert_idx(ret_simd == ret_ref, idx);
+	test_assert_idx(pos_simd == pos_ref, idx);
+	test_assert_idx(buffer_cmp(dec_simd, dec_ref), idx);
+	if (str_equals(enc_simd, enc_ref)) {
+		test_assert_idx(dec_ref->used == size &&
+				memcmp(dec_ref->data, data, size) == 0, idx);
+	}
+}
+
+static void test_base64_simd(void)
+{
+	unsigned char buf[1024];
+	unsigned int i, j, size;
+
+	test_begin(t_strdup_printf("base64 SIMD (%s)",
+		   base64_get_simd() == NULL ? "none" : base64_get_simd()));
+	for (i = 0; i < loop_count; i++) {
+		size = i_rand_limit(sizeof(buf));
+		for (j = 0; j < size; j++)
+			buf[j] = i_rand_uchar();
+		T_BEGIN {
+			test_base64_simd_one(&base64_scheme, buf, size,
+					     i % 2 == 0 ? 0 : 76, i);
+			test_base64_simd_one(&base64url_scheme, buf, size,
+					     i % 3 == 0 ? 0 : 1 + i % 80, i);
+		} T_END;
+	}
+	base64_set_simd(TRUE);
+	test_end();
+}
+
 void test_base64(void)
 {
 	loop_count = ON_VALGRIND ? 100 : 1000;
@@ -1317,4 +1380,5 @@ void test_base64(void)
 	test_base64_decode_lowlevel();
 	test_base64_random_lowlevel();
 	test_base64_encode_lines();
+	test_base64_simd();
 }
@@ -3,6 +3,45 @@
 #include "test-lib.h"
 #include "crc32.h"
 
+static uint32_t test_crc32_bitwise(uint32_t crc, const unsigned char *data,
+				   size_t size)
+{
+	unsigned int i;
+
+	crc ^= 0xffffffff;
+	for (; size > 0; size--, data++) {
+		crc ^= *data;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+	}
+	return crc ^ 0xffffffff;
+}
+
+static void test_crc32_random(void)
+{
+	unsigned char buf[1024 + 16];
+	unsigned int i, offset, size, split;
+	uint32_t crc;
+
+	test_begin("crc32 random");
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = i_rand_uchar();
+	for (i = 0; i < 1000; i++) {
+		/* test also the unaligned starts and sizes that leave a
+		   tail for the slower code */
+		offset = i_rand_limit(16);
+		size = i < 300 ? i : i_rand_limit(1024 + 1);
+		crc = test_crc32_bitwise(0, buf + offset, size);
+		test_assert_idx(crc32_data(buf + offset, size) == crc, i);
+
+		split = i_rand_limit(size + 1);
+		test_assert_idx(crc32_data_more(crc32_data(buf + offset, split),
+						buf + offset + split,
+						size - split) == crc, i);
+	}
+	test_end();
+}
+
 void test_crc32(void)
 {
 	const char str[] = "foo\0bar";
@@ -10,5 +49,9 @@ void test_crc32(void)
 	test_begin("crc32");
 	test_assert(crc32_str(str) == 0x8c736521);
 	test_assert(crc32_data(str, sizeof(str)) == 0x32c9723d);
+	test_assert(crc32_str_more(crc32_str("foo"), "bar") ==
+		    crc32_str("foobar"));
 	test_end();
+
+	test_crc32_random();
 }
@@ -2,6 +2,7 @@
 
 #include "test-lib.h"
 #include "ioloop.h"
+#include "str.h"
 #include "event-filter-private.h"
 
 #ifdef __FreeBSD__
@@ -1123,6 +1124,90 @@ static void test_event_filter_timeval_values(void)
 	test_end();
 }
 
+static void
+test_event_filter_name_index_check(struct event_filter *filter,
+				   struct event *event, int *contexts,
+				   const char *expected)
+{
+	const struct failure_context failure_ctx = {
+		.type = LOG_TYPE_DEBUG
+	};
+	struct event_filter_match_iter *iter;
+	string_t *str = t_str_new(16);
+	int *ctx;
+
+	iter = event_filter_match_iter_init(filter, event, &failure_ctx);
+	while ((ctx = event_filter_match_iter_next(iter)) != NULL)
+		str_printfa(str, "%d", (int)(ctx - contexts));
+	event_filter_match_iter_deinit(&iter);
+	test_assert_strcmp(str_c(str), expected);
+	test_assert(event_filter_match(filter, event, &failure_ctx) ==
+		    (expected[0] != '\0'));
+}
+
+static void test_event_filter_name_index(void)
+{
+	static const char *queries[] = {
+		"event=a",
+		"event=b AND str=x",
+		"str=x",
+		"event=a OR event=b",
+		"event=a OR str=y",
+		"NOT event=a",
+		"event=a AND (event=a OR event=c)",
+	};
+	struct event_filter *filter, *query_filter;
+	int contexts[N_ELEMENTS(queries) + 1];
+	const char *error;
+	unsigned int i;
+
+	test_begin("event filter: event name index");
+	filter = event_filter_create();
+	for (i = 0; i < N_ELEMENTS(queries); i++) {
+		query_filter = event_filter_create();
+		test_assert(event_filter_parse(queries[i], query_filter, &error) == 0);
+		event_filter_merge_with_context(filter, query_filter,
+						EVENT_FILTER_MERGE_OP_OR,
+						&contexts[i]);
+		event_filter_unref(&query_filter);
+	}
+
+	struct event *e_a = event_create(NULL);
+	event_set_name(e_a, "a");
+	event_add_str(e_a, "str", "x");
+	struct event *e_b = event_create(NULL);
+	event_set_name(e_b, "b");
+	event_add_str(e_b, "str", "x");
+	struct event *e_c = event_create(NULL);
+	event_set_name(e_c, "c");
+	struct event *e_noname = event_create(NULL);
+	event_add_str(e_noname, "str", "y");
+
+	test_event_filter_name_index_check(filter, e_a, contexts, "02346");
+	test_event_filter_name_index_check(filter, e_b, contexts, "1235");
+	test_event_filter_name_index_check(filter, e_c, contexts, "5");
+	test_event_filter_name_index_check(filter, e_noname, contexts, "45");
+
+	/* the index is updated when the queries change */
+	test_assert(event_filter_remove_queries_with_context(filter, &contexts[2]));
+	test_event_filter_name_index_check(filter, e_a, contexts, "0346");
+	query_filter = event_filter_create();
+	test_assert(event_filter_parse("event=c", query_filter, &error) == 0);
+	event_filter_merge_with_context(filter, query_filter,
+					EVENT_FILTER_MERGE_OP_OR,
+					&contexts[N_ELEMENTS(queries)]);
+	event_filter_unref(&query_filter);
+	test_event_filter_name_index_check(filter, e_c, contexts, "57");
+	test_event_filter_name_index_check(filter, e_a, contexts, "0346");
+
+	event_filter_unref(&filter);
+	event_unref(&e_a);
+	event_unref(&e_b);
+	event_unref(&e_c);
+	event_unref(&e_noname);
+	test_end();
+}
+
 void test_event_filter(void)
 {
 	test_event_filter_strings();
@@ -1145,4 +1230,5 @@ void test_event_filter(void)
 	test_event_filter_interval_values();
 	test_event_filter_ambiguous_units();
 	test_event_filter_timeval_values();
+	test_event_filter_name_index();
 }
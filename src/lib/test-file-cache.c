@@ -284,6 +284,142 @@ static void test_file_cache_errors(void)
 	test_end();
 }
 
+static void test_file_cache_mmap(void)
+{
+	test_begin("file_cache_mmap");
+
+	size_t page_size = mmap_get_page_size();
+	int fd = open(TEST_FILENAME, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	i_assert(fd > -1);
+	struct file_cache *cache =
+		file_cache_new_full(fd, TEST_FILENAME, FILE_CACHE_FLAG_MMAP);
+
+	/* empty file */
+	size_t size;
+	test_assert(file_cache_read(cache, 0, 13) == 0);
+	const unsigned char *map = file_cache_get_map(cache, &size);
+	test_assert(map == NULL && size == 0);
+
+	test_assert(pwrite(fd, "initial data\n", 13, 0) == 13);
+	test_assert(file_cache_read(cache, 0, 100) == 13);
+	map = file_cache_get_map(cache, &size);
+	test_assert(map != NULL && size == 13 &&
+		    memcmp(map, "initial data\n", 13) == 0);
+
+	/* writes to the file are visible without re-reading */
+	test_assert(pwrite(fd, "updated", 7, 0) == 7);
+	file_cache_write(cache, "updated", 7, 0);
+	file_cache_invalidate(cache, 0, 7);
+	test_assert(memcmp(map, "updated data\n", 13) == 0);
+	test_assert(file_cache_read(cache, 0, 13) == 13);
+	test_assert(file_cache_get_map(cache, &size) == map && size == 13);
+
+	/* growing the file maps it again on the next read */
+	test_assert(pwrite(fd, "appended", 8, page_size * 2) == 8);
+	file_cache_write(cache, "appended", 8, page_size * 2);
+	test_assert(file_cache_read(cache, page_size * 2, 100) == 8);
+	map = file_cache_get_map(cache, &size);
+	test_assert(size == page_size * 2 + 8);
+	test_assert(memcmp(map, "updated data\n", 13) == 0);
+	test_assert(memcmp(map + page_size * 2, "appended", 8) == 0);
+	test_assert(file_cache_read(cache, page_size * 3, 100) == 0);
+
+	/* changing the fd drops the mapping */
+	file_cache_set_fd(cache, fd);
+	map = file_cache_get_map(cache, &size);
+	test_assert(map == NULL && size == 0);
+	test_assert(file_cache_read(cache, 0, 13) == 13);
+
+	file_cache_free(&cache);
+	i_close_fd(&fd);
+	i_unlink(TEST_FILENAME);
+	test_end();
+}
+
+static void test_file_cache_mmap_fallback(void)
+{
+#if defined(HAVE_RLIMIT_AS) && defined(__linux__)
+	test_begin("file_cache_mmap fallback");
+
+	size_t page_size = mmap_get_page_size();
+	int fd = open(TEST_FILENAME, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	i_assert(fd > -1);
+	struct file_cache *cache =
+		file_cache_new_full(fd, TEST_FILENAME, FILE_CACHE_FLAG_MMAP);
+	test_assert(pwrite(fd, "initial data\n", 13, 0) == 13);
+
+	/* allow growing the address space only a little, so that mapping
+	   the file (at least FILE_CACHE_MMAP_MIN_GROW) fails, but the
+	   single page needed by the fallback can still be allocated */
+	char statm[128];
+	const char *endp;
+	unsigned long vm_pages = 0;
+	int statm_fd = open("/proc/self/statm", O_RDONLY);
+	i_assert(statm_fd > -1);
+	ssize_t len = read(statm_fd, statm, sizeof(statm) - 1);
+	i_assert(len > 0);
+	statm[len] = '\0';
+	i_close_fd(&statm_fd);
+	test_assert(str_parse_ulong(statm, &vm_pages, &endp) == 0);
+	struct rlimit rl_cur;
+	test_assert(getrlimit(RLIMIT_AS, &rl_cur) == 0);
+	struct rlimit rl_new = {
+		.rlim_cur = vm_pages * page_size + 256*1024,
+		.rlim_max = rl_cur.rlim_max
+	};
+	test_expect_error_string("falling back to reading the file");
+	test_assert(setrlimit(RLIMIT_AS, &rl_new) == 0);
+	ssize_t ret = file_cache_read(cache, 0, 100);
+	test_assert(setrlimit(RLIMIT_AS, &rl_cur) == 0);
+	test_expect_no_more_errors();
+	test_assert(ret == 13);
+
+	size_t size;
+	const unsigned char *map = file_cache_get_map(cache, &size);
+	test_assert(map != NULL && size == 13 &&
+		    memcmp(map, "initial data\n", 13) == 0);
+
+	/* the cache keeps working in the copying mode */
+	test_assert(pwrite(fd, "updated", 7, 0) == 7);
+	file_cache_write(cache, "updated", 7, 0);
+	test_assert(file_cache_read(cache, 0, 13) == 13);
+	map = file_cache_get_map(cache, &size);
+	test_assert(memcmp(map, "updated data\n", 13) == 0);
+	file_cache_invalidate(cache, 0, 13);
+	test_assert(file_cache_read(cache, 0, 13) == 13);
+
+	file_cache_free(&cache);
+	i_close_fd(&fd);
+	i_unlink(TEST_FILENAME);
+	test_end();
+#endif
+}
+
+static void test_file_cache_mmap_invalidate(void)
+{
+	test_begin("file_cache_mmap invalidate");
+
+	int fd = open(TEST_FILENAME, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	i_assert(fd > -1);
+	struct file_cache *cache =
+		file_cache_new_full(fd, TEST_FILENAME, FILE_CACHE_FLAG_MMAP);
+
+	/* nothing is mapped yet */
+	file_cache_invalidate(cache, 0, 100);
+	test_assert(pwrite(fd, "initial data\n", 13, 0) == 13);
+	test_assert(file_cache_read(cache, 0, 13) == 13);
+	/* areas past the mapped file are ignored */
+	file_cache_invalidate(cache, 13, 100);
+	file_cache_invalidate(cache, 1000, 100);
+	file_cache_invalidate(cache, 5, UOFF_T_MAX - 5);
+	test_assert(file_cache_read(cache, 0, 13) == 13);
+
+	file_cache_free(&cache);
+	i_close_fd(&fd);
+	i_unlink(TEST_FILENAME);
+	test_end();
+}
+
 void test_file_cache(void)
 {
 	test_file_cache_read();
@@ -293,4 +429,7 @@ void test_file_cache(void)
 	test_file_cache_anon();
 	test_file_cache_switch_fd();
 	test_file_cache_errors();
+	test_file_cache_mmap();
+	test_file_cache_mmap_fallback();
+	test_file_cache_mmap_invalidate();
 }
@@ -4,7 +4,7 @@
 #include "hash.h"
 
 
-static void test_hash_random_pool(pool_t pool)
+static void test_hash_random_pool(pool_t pool, bool flat)
 {
 	const unsigned int keymax = ON_VALGRIND ? 10000 : 100000;
 	HASH_TABLE(void *, void *) hash;
@@ -12,7 +12,10 @@ static void test_hash_random_pool(pool_t pool)
 	unsigned int i, key, keyidx, delidx;
 
 	keys = i_new(unsigned int, keymax); keyidx = 0;
-	hash_table_create_direct(&hash, pool, 0);
+	if (flat)
+		hash_table_create_direct_flat(&hash, pool, 0);
+	else
+		hash_table_create_direct(&hash, pool, 0);
 	for (i = 0; i < keymax; i++) {
 		key = (i_rand_limit(keymax)) + 1;
 		if (i_rand_limit(5) > 0) {
@@ -35,15 +38,88 @@ static void test_hash_random_pool(pool_t pool)
 	i_free(keys);
 }
 
+static void test_hash_flat(void)
+{
+	HASH_TABLE(char *, char *) hash, hash2;
+	struct hash_iterate_context *iter;
+	char *keys[1000], *key, *value, *orig_key;
+	const char *key0 = "key0", *missing_key = "key1000";
+	unsigned int i, count;
+
+	test_begin("hash table (flat)");
+	hash_table_create_flat(&hash, default_pool, 0, str_hash, strcmp);
+	for (i = 0; i < N_ELEMENTS(keys); i++) {
+		keys[i] = i_strdup_printf("key%u", i);
+		hash_table_insert(hash, keys[i], keys[i]);
+	}
+	test_assert(hash_table_count(hash) == N_ELEMENTS(keys));
+	for (i = 0; i < N_ELEMENTS(keys); i++) {
+		const char *lookup = t_strdup_printf("key%u", i);
+
+		test_assert_idx(hash_table_lookup(hash, lookup) == keys[i], i);
+		test_assert_idx(hash_table_lookup_full(hash, lookup,
+						       &orig_key, &value) &&
+				orig_key == keys[i], i);
+	}
+	test_assert(hash_table_lookup(hash, missing_key) == NULL);
+	hash_table_update(hash, keys[0], keys[1]);
+	test_assert(hash_table_lookup(hash, key0) == keys[1]);
+	hash_table_update(hash, keys[0], keys[0]);
+
+	/* removing while iterating doesn't skip any nodes */
+	count = 0;
+	iter = hash_table_iterate_init(hash);
+	while (hash_table_iterate(iter, hash, &key, &value)) {
+		test_assert(key == value);
+		if (count++ % 2 == 0)
+			hash_table_remove(hash, key);
+	}
+	hash_table_iterate_deinit(&iter);
+	test_assert(count == N_ELEMENTS(keys));
+	test_assert(hash_table_count(hash) == N_ELEMENTS(keys) / 2);
+
+	/* adding while frozen uses the spare space */
+	hash_table_freeze(hash);
+	for (i = 0; i < N_ELEMENTS(keys); i++) {
+		if (hash_table_lookup(hash, keys[i]) == NULL)
+			hash_table_insert(hash, keys[i], keys[i]);
+	}
+	hash_table_thaw(hash);
+	test_assert(hash_table_count(hash) == N_ELEMENTS(keys));
+
+	hash_table_create_flat(&hash2, default_pool, 0, str_hash, strcmp);
+	hash_table_copy(hash2, hash);
+	test_assert(hash_table_count(hash2) == N_ELEMENTS(keys));
+	for (i = 0; i < N_ELEMENTS(keys); i++)
+		hash_table_remove(hash2, keys[i]);
+	test_assert(hash_table_count(hash2) == 0);
+	test_assert(!hash_table_try_remove(hash2, keys[0]));
+	hash_table_destroy(&hash2);
+
+	hash_table_clear(hash, TRUE);
+	test_assert(hash_table_count(hash) == 0);
+	test_assert(hash_table_lookup(hash, key0) == NULL);
+	hash_table_destroy(&hash);
+	for (i = 0; i < N_ELEMENTS(keys); i++)
+		i_free(keys[i]);
+	test_end();
+}
+
 void test_hash(void)
 {
 	pool_t pool;
 
 	test_begin("hash table (random)");
-	test_hash_random_pool(default_pool);
+	test_hash_random_pool(default_pool, FALSE);
 
 	pool = pool_alloconly_create("test hash", 1024);
-	test_hash_random_pool(pool);
+	test_hash_random_pool(pool, FALSE);
 	pool_unref(&pool);
 	test_end();
+
+	test_begin("hash table (flat random)");
+	test_hash_random_pool(default_pool, TRUE);
+	test_end();
+
+	test_hash_flat();
 }
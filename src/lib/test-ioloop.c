@@ -5,6 +5,8 @@
 #include "time-util.h"
 #include "ioloop.h"
 #include "istream.h"
+#include "event-filter.h"
+#include "lib-event-private.h"
 
 #include <unistd.h>
 
@@ -391,6 +393,103 @@ static void test_ioloop_context_events(void)
 	test_end();
 }
 
+static unsigned int test_slow_event_count;
+
+static void test_callback_slow(void *context ATTR_UNUSED)
+{
+	usleep(20000);
+}
+
+static void test_callback_stop(struct ioloop *ioloop)
+{
+	io_loop_stop(ioloop);
+}
+
+static bool
+test_ioloop_callback_stats_event(struct event *event,
+				 enum event_callback_type type,
+				 struct failure_context *ctx ATTR_UNUSED,
+				 const char *fmt ATTR_UNUSED,
+				 va_list args ATTR_UNUSED)
+{
+	if (type == EVENT_CALLBACK_TYPE_SEND &&
+	    strcmp(event->sending_name, "ioloop_callback_slow") == 0) {
+		test_assert(event_find_field_recursive(event,
+						       "wall_usecs") != NULL);
+		test_assert(event_find_field_recursive(event,
+						       "cpu_usecs") != NULL);
+		test_slow_event_count++;
+	}
+	return TRUE;
+}
+
+static void test_ioloop_callback_stats(void)
+{
+	const struct ioloop_callback_stats *const *stats;
+	struct event_filter *filter;
+	struct timeout *to_slow, *to_stop;
+	unsigned int i, count, slow_line, stop_line;
+	const char *error;
+
+	test_begin("ioloop callback stats");
+	/* the event is sent only when wanted, like by stats */
+	filter = event_filter_create();
+	test_assert(event_filter_parse("event=ioloop_callback_slow",
+				       filter, &error) == 0);
+	event_set_global_debug_send_filter(filter);
+	event_filter_unref(&filter);
+
+	struct ioloop *ioloop = io_loop_create();
+	io_loop_callback_stats_enable(1, 10);
+	event_register_callback(test_ioloop_callback_stats_event);
+	test_slow_event_count = 0;
+
+	slow_line = __LINE__ + 1;
+	to_slow = timeout_add_short(0, test_callback_slow, NULL);
+	stop_line = __LINE__ + 1;
+	to_stop = timeout_add_short(30, test_callback_stop, ioloop);
+	io_loop_run(ioloop);
+	timeout_remove(&to_stop);
+	timeout_remove(&to_slow);
+	io_loop_callback_stats_disable();
+	event_unregister_callback(test_ioloop_callback_stats_event);
+	event_unset_global_debug_send_filter();
+	test_assert(test_slow_event_count >= 1);
+
+	stats = io_loop_callback_stats_get_sorted(&count);
+	for (i = 0; i < count; i++) {
+		if (stats[i]->source_linenum == slow_line)
+			break;
+	}
+	/* the slow callback is the slowest one */
+	test_assert(i == 0 && count >= 2);
+	if (i < count) {
+		test_assert(strcmp(stats[i]->source_filename, __FILE__) == 0);
+		test_assert(stats[i]->call_count >= 1);
+		test_assert(stats[i]->max_usecs >= 20000);
+		test_assert(stats[i]->total_usecs >= stats[i]->max_usecs);
+		test_assert(stats[i]->cpu_sample_count == stats[i]->call_count);
+		/* sleeping doesn't use CPU */
+		test_assert(stats[i]->cpu_usecs < stats[i]->total_usecs);
+	}
+	for (i = 0; i < count; i++) {
+		if (stats[i]->source_linenum == stop_line)
+			break;
+	}
+	test_assert(i < count && stats[i]->call_count == 1);
+
+	/* nothing is measured after disabling */
+	to_stop = timeout_add_short(0, test_callback_stop, ioloop);
+	io_loop_run(ioloop);
+	timeout_remove(&to_stop);
+	test_assert(i < count && stats[i]->call_count == 1);
+
+	io_loop_callback_stats_reset();
+	test_assert(stats[0]->call_count == 0 && stats[0]->max_usecs == 0);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
 void test_ioloop(void)
 {
 	test_ioloop_timeout();
@@ -401,4 +500,5 @@ void test_ioloop(void)
 	test_ioloop_fd();
 	test_ioloop_context();
 	test_ioloop_context_events();
+	test_ioloop_callback_stats();
 }
@@ -5,6 +5,7 @@
 #include "ostream.h"
 #include "buffer.h"
 #include "ioloop.h"
+#include "ostream-file-private.h"
 #include "iostream-proxy.h"
 
 #include <unistd.h>
@@ -105,9 +106,165 @@ void test_iostream_proxy_simple(void)
 	test_end();
 }
 
+#define TEST_PROXY_LARGE_SIZE (1024*1024 + 123)
+
+struct test_proxy_large_ctx {
+	const buffer_t *data;
+	size_t sent;
+	struct ostream *output;
+
+	struct istream *input;
+	buffer_t *received;
+
+	bool proxy_finished;
+};
+
+static void test_proxy_large_check_done(struct test_proxy_large_ctx *ctx)
+{
+	if (ctx->proxy_finished && ctx->received->used >= ctx->data->used)
+		io_loop_stop(current_ioloop);
+}
+
+static void
+test_proxy_large_completed(enum iostream_proxy_side side,
+			   enum iostream_proxy_status status,
+			   struct test_proxy_large_ctx *ctx)
+{
+	test_assert(side == IOSTREAM_PROXY_SIDE_LEFT);
+	test_assert(status == IOSTREAM_PROXY_STATUS_INPUT_EOF);
+	ctx->proxy_finished = TRUE;
+	test_proxy_large_check_done(ctx);
+}
+
+static int test_proxy_large_output(struct test_proxy_large_ctx *ctx)
+{
+	ssize_t ret;
+
+	if (o_stream_flush(ctx->output) < 0)
+		return -1;
+	while (ctx->sent < ctx->data->used) {
+		ret = o_stream_send(ctx->output,
+				    CONST_PTR_OFFSET(ctx->data->data, ctx->sent),
+				    I_MIN(ctx->data->used - ctx->sent, 10000));
+		if (ret < 0)
+			return -1;
+		if (ret == 0)
+			return 0;
+		ctx->sent += ret;
+	}
+	if ((ret = o_stream_flush(ctx->output)) > 0) {
+		/* everything sent - let the proxy see EOF */
+		test_assert(shutdown(o_stream_get_fd(ctx->output),
+				     SHUT_WR) == 0);
+		o_stream_unset_flush_callback(ctx->output);
+	}
+	return ret;
+}
+
+static void test_proxy_large_input(struct test_proxy_large_ctx *ctx)
+{
+	const unsigned char *data;
+	size_t size;
+
+	while (i_stream_read_more(ctx->input, &data, &size) > 0) {
+		buffer_append(ctx->received, data, size);
+		i_stream_skip(ctx->input, size);
+	}
+	if (ctx->input->stream_errno != 0 || ctx->input->eof)
+		io_loop_stop(current_ioloop);
+	else
+		test_proxy_large_check_done(ctx);
+}
+
+static void test_iostream_proxy_large(void)
+{
+	struct test_proxy_large_ctx ctx;
+	struct iostream_proxy *proxy;
+	struct istream *left_in, *right_in;
+	struct ostream *left_out, *right_out;
+	struct ioloop *ioloop;
+	struct io *io;
+	buffer_t *data;
+	int sfdl[2], sfdr[2];
+	unsigned int i;
+
+	test_begin("iostream_proxy large");
+	data = buffer_create_dynamic(default_pool, TEST_PROXY_LARGE_SIZE);
+	for (i = 0; i < TEST_PROXY_LARGE_SIZE; i++)
+		buffer_append_c(data, (i * 13 + i / 1000) & 0xff);
+
+	test_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sfdl) == 0);
+	test_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sfdr) == 0);
+	fd_set_nonblock(sfdl[0], TRUE);
+	fd_set_nonblock(sfdl[1], TRUE);
+	fd_set_nonblock(sfdr[0], TRUE);
+	fd_set_nonblock(sfdr[1], TRUE);
+
+	ioloop = io_loop_create();
+
+	left_in = i_stream_create_fd(sfdl[1], IO_BLOCK_SIZE);
+	left_out = o_stream_create_fd(sfdl[1], IO_BLOCK_SIZE);
+	right_in = i_stream_create_fd(sfdr[1], IO_BLOCK_SIZE);
+	right_out = o_stream_create_fd(sfdr[1], IO_BLOCK_SIZE);
+	/* only the left-to-right direction is finished by the test */
+	o_stream_set_no_error_handling(left_out, TRUE);
+	proxy = iostream_proxy_create(left_in, left_out, right_in, right_out);
+	i_stream_unref(&left_in);
+	o_stream_unref(&left_out);
+	i_stream_unref(&right_in);
+	i_zero(&ctx);
+	iostream_proxy_set_completion_callback(proxy,
+		test_proxy_large_completed, &ctx);
+	iostream_proxy_start(proxy);
+
+	/* write to the left side and read from the right side at the same
+	   time, so the proxy has to wait for both input and output */
+	ctx.data = data;
+	ctx.output = o_stream_create_fd(sfdl[0], IO_BLOCK_SIZE);
+	ctx.input = i_stream_create_fd(sfdr[0], IO_BLOCK_SIZE);
+	ctx.received = buffer_create_dynamic(default_pool,
+					     TEST_PROXY_LARGE_SIZE);
+	o_stream_set_flush_callback(ctx.output, test_proxy_large_output, &ctx);
+	o_stream_set_flush_pending(ctx.output, TRUE);
+	io = io_add_istream(ctx.input, test_proxy_large_input, &ctx);
+
+	io_loop_run(ioloop);
+
+	test_assert(ctx.sent == data->used);
+	test_assert(o_stream_flush(ctx.output) > 0);
+	test_assert(ctx.proxy_finished);
+	test_assert(ctx.input->stream_errno == 0);
+	test_assert(buffer_cmp(ctx.received, data));
+#ifdef HAVE_SPLICE
+	/* the data must have been moved without copying it to userspace */
+	struct file_ostream *fstream =
+		container_of(right_out->real_stream, struct file_ostream,
+			     ostream);
+	test_assert(fstream->spliced_bytes == data->used);
+#endif
+
+	io_remove(&io);
+	o_stream_unref(&right_out);
+	iostream_proxy_unref(&proxy);
+	o_stream_unref(&ctx.output);
+	i_stream_unref(&ctx.input);
+	io_loop_destroy(&ioloop);
+
+	i_close_fd(&sfdl[0]);
+	i_close_fd(&sfdl[1]);
+	i_close_fd(&sfdr[0]);
+	i_close_fd(&sfdr[1]);
+	buffer_free(&ctx.received);
+	buffer_free(&data);
+	test_end();
+}
+
 void test_iostream_proxy(void)
 {
 	T_BEGIN {
 		test_iostream_proxy_simple();
 	} T_END;
+	T_BEGIN {
+		test_iostream_proxy_large();
+	} T_END;
 }
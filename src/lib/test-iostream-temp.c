@@ -141,10 +141,53 @@ static void test_iostream_temp_istream(void)
 	test_end();
 }
 
+static void test_iostream_temp_copy_to_file(void)
+{
+	struct ostream *output, *file_output;
+	struct istream *input;
+	unsigned char data[10000];
+	char buf[sizeof(data) + 6];
+	unsigned int i;
+	int fd;
+
+	test_begin("iostream_temp copy to file");
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = i % 251;
+	output = iostream_temp_create_sized(".intentional-temp-copy-",
+					    0, "test", 4);
+	test_assert(o_stream_send(output, data, sizeof(data)) == sizeof(data));
+	test_assert(o_stream_get_fd(output) != -1);
+	input = iostream_temp_finish(&output, 128);
+
+	/* copy it after some buffered data in the destination file */
+	fd = open(".temp.ostream", O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1)
+		i_fatal("creat(.temp.ostream) failed: %m");
+	file_output = o_stream_create_fd(fd, 0);
+	o_stream_nsend_str(file_output, "head:");
+	test_assert(o_stream_send_istream(file_output, input) ==
+		    OSTREAM_SEND_ISTREAM_RESULT_FINISHED);
+	o_stream_nsend_str(file_output, "!");
+	test_assert(o_stream_finish(file_output) > 0);
+	test_assert(file_output->offset == sizeof(buf));
+	test_assert(pread(fd, buf, sizeof(buf), 0) == (ssize_t)sizeof(buf));
+	test_assert(memcmp(buf, "head:", 5) == 0 &&
+		    memcmp(buf + 5, data, sizeof(data)) == 0 &&
+		    buf[sizeof(buf)-1] == '!');
+	test_assert(input->eof && input->v_offset == sizeof(data));
+
+	o_stream_destroy(&file_output);
+	i_stream_destroy(&input);
+	i_close_fd(&fd);
+	i_unlink(".temp.ostream");
+	test_end();
+}
+
 void test_iostream_temp(void)
 {
 	test_iostream_temp_create_sized_memory();
 	test_iostream_temp_create_sized_disk();
 	test_iostream_temp_create_write_error();
 	test_iostream_temp_istream();
+	test_iostream_temp_copy_to_file();
 }
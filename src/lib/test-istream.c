@@ -1,9 +1,17 @@
 /* Copyright (c) 2014-2018 Dovecot authors, see the included COPYING file */
 
 #include "test-lib.h"
+#include "buffer.h"
+#include "ioloop.h"
 #include "istream.h"
 #include "istream-crlf.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#define TEST_ASYNC_FILENAME ".test-istream-file-async"
+#define TEST_ASYNC_FILE_SIZE (256*1024 + 123)
+
 static void test_istream_children(void)
 {
 	struct istream *parent, *child1, *child2;
@@ -373,9 +381,117 @@ static void test_istream_read_next_line(void)
 	test_end();
 }
 
+static struct istream *test_istream_file_async_create(bool nonblocking)
+{
+	struct istream *input;
+	int fd;
+
+	fd = open(TEST_ASYNC_FILENAME, O_RDONLY);
+	if (fd == -1)
+		i_fatal("open(%s) failed: %m", TEST_ASYNC_FILENAME);
+#ifdef HAVE_POSIX_FADVISE
+	/* drop the file from page cache, so the reads are really async */
+	(void)posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+	input = i_stream_create_fd_autoclose(&fd, 8192);
+	if (!i_stream_file_set_async(input, nonblocking))
+		i_stream_unref(&input);
+	return input;
+}
+
+static void
+test_istream_file_async_read_all(struct istream *input, buffer_t *output)
+{
+	const unsigned char *data;
+	size_t size;
+
+	while (i_stream_read_more(input, &data, &size) > 0) {
+		buffer_append(output, data, size);
+		i_stream_skip(input, size);
+	}
+}
+
+struct test_istream_file_async_ctx {
+	struct istream *input;
+	buffer_t *output;
+};
+
+static void
+test_istream_file_async_input(struct test_istream_file_async_ctx *ctx)
+{
+	test_istream_file_async_read_all(ctx->input, ctx->output);
+	if (ctx->input->eof || ctx->input->stream_errno != 0)
+		io_loop_stop(current_ioloop);
+}
+
+static void test_istream_file_async(void)
+{
+	struct test_istream_file_async_ctx ctx;
+	struct ioloop *ioloop;
+	struct istream *input;
+	struct io *io;
+	buffer_t *data, *output;
+	const unsigned char *ptr;
+	size_t size;
+	unsigned int i;
+	int fd;
+
+	data = buffer_create_dynamic(default_pool, TEST_ASYNC_FILE_SIZE);
+	for (i = 0; i < TEST_ASYNC_FILE_SIZE; i++)
+		buffer_append_c(data, (i * 7 + i / 256) & 0xff);
+	fd = open(TEST_ASYNC_FILENAME, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1)
+		i_fatal("open(%s) failed: %m", TEST_ASYNC_FILENAME);
+	if (write(fd, data->data, data->used) != (ssize_t)data->used ||
+	    fdatasync(fd) < 0)
+		i_fatal("write(%s) failed: %m", TEST_ASYNC_FILENAME);
+	i_close_fd(&fd);
+	output = buffer_create_dynamic(default_pool, TEST_ASYNC_FILE_SIZE);
+
+	test_begin("istream file async blocking");
+	input = test_istream_file_async_create(FALSE);
+	if (input != NULL) {
+		test_istream_file_async_read_all(input, output);
+		test_assert(input->eof && input->stream_errno == 0);
+		test_assert(buffer_cmp(data, output));
+
+		/* seek back in the middle of the file */
+		i_stream_seek(input, 100000);
+		test_assert(i_stream_read_more(input, &ptr, &size) > 0);
+		test_assert(memcmp(ptr, CONST_PTR_OFFSET(data->data, 100000),
+				   size) == 0);
+		i_stream_unref(&input);
+	}
+	test_end();
+
+	test_begin("istream file async nonblocking");
+	buffer_set_used_size(output, 0);
+	ioloop = io_loop_create();
+	input = test_istream_file_async_create(TRUE);
+	if (input != NULL) {
+		test_assert(!input->blocking);
+		ctx.input = input;
+		ctx.output = output;
+		io = io_add_istream(input, test_istream_file_async_input, &ctx);
+		i_stream_set_input_pending(input, TRUE);
+		io_loop_run(ioloop);
+		io_remove(&io);
+		test_assert(input->eof && input->stream_errno == 0);
+		test_assert(buffer_cmp(data, output));
+		i_stream_unref(&input);
+	}
+	io_loop_destroy(&ioloop);
+	test_end();
+
+	buffer_free(&output);
+	buffer_free(&data);
+	i_unlink(TEST_ASYNC_FILENAME);
+}
+
 void test_istream(void)
 {
 	test_istream_children();
 	test_istream_next_line();
 	test_istream_read_next_line();
+	test_istream_file_async();
 }
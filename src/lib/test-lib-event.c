@@ -2,6 +2,7 @@
 
 #include "test-lib.h"
 #include "array.h"
+#include "lib-event-private.h"
 
 static void test_event_fields(void)
 {
@@ -87,6 +88,40 @@ static void test_event_strlist(void)
 	test_end();
 }
 
+static void test_event_pool_reuse(void)
+{
+	static const char source_filename[] = "test-source.c";
+
+	test_begin("event pool reuse");
+	/* source filename isn't copied */
+	struct event *e1 = (event_create)(NULL, source_filename, 1);
+	pool_t pool = event_get_pool(e1);
+	test_assert(e1->source_filename == source_filename);
+	event_add_str(e1, "key", "value");
+	/* grow the pool past its first block */
+	(void)p_malloc(pool, 4096);
+	event_unref(&e1);
+
+	/* the freed event's pool is cleared and used for the next event */
+	struct event *e2 = event_create(NULL);
+	test_assert(event_get_pool(e2) == pool);
+	test_assert(event_find_field_nonrecursive(e2, "key") == NULL);
+	test_assert(event_get_parent(e2) == NULL);
+	test_assert(e2->sending_name == NULL);
+	event_add_str(e2, "key", "value2");
+	test_assert_strcmp(event_find_field_recursive_str(e2, "key"), "value2");
+
+	/* event_dup() copies the source filename */
+	struct event *e3 = event_dup(e2);
+	test_assert(event_get_pool(e3) != pool);
+	test_assert(e3->source_filename != e2->source_filename);
+	test_assert_strcmp(e3->source_filename, e2->source_filename);
+	test_assert_strcmp(event_find_field_recursive_str(e3, "key"), "value2");
+	event_unref(&e2);
+	event_unref(&e3);
+	test_end();
+}
+
 static void test_lib_event_reason_code(void)
 {
 	test_begin("event reason codes");
@@ -101,6 +136,7 @@ void test_lib_event(void)
 {
 	test_event_fields();
 	test_event_strlist();
+	test_event_pool_reuse();
 	test_lib_event_reason_code();
 }
 
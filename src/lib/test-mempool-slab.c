@@ -0,0 +1,125 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+#include "lib-event.h"
+
+static bool mem_is_zero(const void *mem, size_t size)
+{
+	const unsigned char *bytes = mem;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (bytes[i] != 0)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void test_mempool_slab_alloc(void)
+{
+	struct pool_slab_stats stats1, stats2;
+	unsigned char *mem[2000];
+	unsigned int i, sizes[N_ELEMENTS(mem)];
+	pool_t pool;
+
+	test_begin("mempool slab alloc");
+	pool_slab_get_stats(&stats1);
+	pool = pool_slab_create("test");
+	for (i = 0; i < N_ELEMENTS(mem); i++) {
+		sizes[i] = 1 + i_rand_limit(i % 10 == 0 ? 4000 : 300);
+		mem[i] = p_malloc(pool, sizes[i]);
+		test_assert_idx(mem_is_zero(mem[i], sizes[i]), i);
+		memset(mem[i], i & 0xff, sizes[i]);
+	}
+	/* free half, and reallocate the rest */
+	for (i = 0; i < N_ELEMENTS(mem); i += 2)
+		p_free(pool, mem[i]);
+	for (i = 1; i < N_ELEMENTS(mem); i += 2) {
+		unsigned int new_size = sizes[i] + i_rand_limit(100);
+
+		mem[i] = p_realloc(pool, mem[i], sizes[i], new_size);
+		test_assert_idx(mem[i][0] == (i & 0xff) &&
+				mem[i][sizes[i]-1] == (i & 0xff), i);
+		test_assert_idx(mem_is_zero(mem[i] + sizes[i],
+					    new_size - sizes[i]), i);
+		sizes[i] = new_size;
+	}
+	/* the freed objects are reused and zeroed */
+	for (i = 0; i < N_ELEMENTS(mem); i += 2) {
+		mem[i] = p_malloc(pool, sizes[i]);
+		test_assert_idx(mem_is_zero(mem[i], sizes[i]), i);
+	}
+	pool_slab_get_stats(&stats2);
+	test_assert(stats2.reuse_count > stats1.reuse_count);
+	test_assert(stats2.alloc_count > stats1.alloc_count);
+	test_assert(stats2.large_alloc_count > stats1.large_alloc_count);
+	test_assert(stats2.slab_count >= stats1.slab_count);
+
+	/* all the memory is returned to the free lists */
+	pool_unref(&pool);
+	pool_slab_get_stats(&stats2);
+	test_assert(stats2.used_bytes == stats1.used_bytes);
+	test_assert(stats2.waste_bytes == stats1.waste_bytes);
+	test_assert(stats2.large_bytes == stats1.large_bytes);
+	test_assert(stats2.free_bytes > 0);
+	test_end();
+}
+
+static void test_mempool_slab_reuse(void)
+{
+	struct pool_slab_stats stats1, stats2;
+	unsigned int i, j;
+	pool_t pool;
+	char *str;
+
+	test_begin("mempool slab reuse");
+	/* warm up */
+	pool = pool_slab_create("test");
+	for (j = 0; j < 100; j++)
+		(void)p_strdup_printf(pool, "string %u", j);
+	pool_unref(&pool);
+
+	pool_slab_get_stats(&stats1);
+	for (i = 0; i < 100; i++) {
+		pool = pool_slab_create("test");
+		for (j = 0; j < 100; j++) {
+			str = p_strdup_printf(pool, "string %u", j);
+			test_assert(strcmp(str, t_strdup_printf("string %u", j)) == 0);
+		}
+		p_clear(pool);
+		str = p_strdup(pool, "foo");
+		pool_unref(&pool);
+	}
+	pool_slab_get_stats(&stats2);
+	/* the pools don't need any new slabs */
+	test_assert(stats2.slab_count == stats1.slab_count);
+	test_assert(stats2.alloc_count - stats1.alloc_count ==
+		    stats2.reuse_count - stats1.reuse_count);
+	test_end();
+}
+
+static void test_mempool_slab_event(void)
+{
+	struct event *event = event_create(NULL);
+	const struct event_field *field;
+	struct pool_slab_stats stats;
+
+	test_begin("mempool slab event");
+	pool_slab_get_stats(&stats);
+	pool_slab_event_add_stats(event);
+	field = event_find_field_nonrecursive(event, "slab_count");
+	test_assert(field != NULL &&
+		    field->value.intmax == (intmax_t)stats.slab_count);
+	field = event_find_field_nonrecursive(event, "slab_reuse_count");
+	test_assert(field != NULL &&
+		    field->value.intmax == (intmax_t)stats.reuse_count);
+	event_unref(&event);
+	test_end();
+}
+
+void test_mempool_slab(void)
+{
+	test_mempool_slab_alloc();
+	test_mempool_slab_reuse();
+	test_mempool_slab_event();
+}
@@ -13,7 +13,7 @@ static void test_random_median(void)
 	uint64_t tmp;
 	double median, average;
 
-	struct stats_dist *s = stats_dist_init_with_size(TEST_RAND_SIZE_MEDIAN);
+	struct stats_dist *s = stats_dist_init();
 	test_begin("test_random (median & average)");
 	for(unsigned int i = 0; i < TEST_RAND_SIZE_MEDIAN; i++) {
 		uint64_t value;
@@ -79,6 +79,107 @@ static void test_stats_dist_get_variance(void)
 	test_end();
 }
 
+static void test_stats_dist_percentiles(void)
+{
+	struct stats_dist *t;
+	uint64_t value, p50, p99, p999;
+	unsigned int i;
+
+	test_begin("stats_dists percentiles");
+	t = stats_dist_init();
+	/* 1..100000 us, as in latencies */
+	for (i = 1; i <= 100000; i++)
+		stats_dist_add(t, i);
+	p50 = stats_dist_get_median(t);
+	p99 = stats_dist_get_percentile(t, 0.99);
+	p999 = stats_dist_get_percentile(t, 0.999);
+	test_assert(p50 >= 50000*0.984 && p50 <= 50000*1.016);
+	test_assert(p99 >= 99000*0.984 && p99 <= 99000*1.016);
+	test_assert(p999 >= 99900*0.984 && p999 <= 100000);
+	test_assert(stats_dist_get_percentile(t, 1.0) == 100000);
+	test_assert(DBL_EQ(stats_dist_get_variance(t), (100000.0*100000-1)/12));
+
+	/* a few slow outliers are visible in the tail */
+	stats_dist_reset(t);
+	for (i = 0; i < 9990; i++)
+		stats_dist_add(t, 100 + i % 10);
+	for (i = 0; i < 10; i++)
+		stats_dist_add(t, 5000000);
+	test_assert(stats_dist_get_percentile(t, 0.99) <= 109);
+	value = stats_dist_get_percentile(t, 0.9995);
+	test_assert(value >= 5000000*0.984 && value <= 5000000);
+	stats_dist_deinit(&t);
+	test_end();
+}
+
+static void test_stats_dist_count_le(void)
+{
+	struct stats_dist *t;
+	unsigned int i;
+
+	test_begin("stats_dists count le");
+	t = stats_dist_init();
+	test_assert(stats_dist_get_count_le(t, 100) == 0);
+	for (i = 0; i <= 10000; i++)
+		stats_dist_add(t, i);
+	test_assert(stats_dist_get_count_le(t, 0) == 1);
+	test_assert(stats_dist_get_count_le(t, 1) == 2);
+	test_assert(stats_dist_get_count_le(t, 63) == 64);
+	/* powers of two are exact */
+	for (i = 64; i <= 8192; i *= 2)
+		test_assert_idx(stats_dist_get_count_le(t, i) == i + 1, i);
+	test_assert(stats_dist_get_count_le(t, 10000) == 10001);
+	test_assert(stats_dist_get_count_le(t, UINT64_MAX) == 10001);
+	/* others are interpolated */
+	test_assert(stats_dist_get_count_le(t, 5000) >= 4900 &&
+		    stats_dist_get_count_le(t, 5000) <= 5100);
+	stats_dist_deinit(&t);
+	test_end();
+}
+
+static void test_stats_dist_merge(void)
+{
+	struct stats_dist *t1, *t2, *all;
+	unsigned int i;
+
+	test_begin("stats_dists merge");
+	t1 = stats_dist_init();
+	t2 = stats_dist_init();
+	all = stats_dist_init();
+	for (i = 0; i < 1000; i++) {
+		uint64_t value = i_rand_limit(1000000);
+		stats_dist_add(i % 3 == 0 ? t1 : t2, value);
+		stats_dist_add(all, value);
+	}
+	/* t1 may have a smaller bucket range than t2 */
+	stats_dist_add(t2, 1);
+	stats_dist_add(all, 1);
+	stats_dist_merge(t1, t2);
+	test_assert(stats_dist_get_count(t1) == stats_dist_get_count(all));
+	test_assert(stats_dist_get_sum(t1) == stats_dist_get_sum(all));
+	test_assert(stats_dist_get_min(t1) == stats_dist_get_min(all));
+	test_assert(stats_dist_get_max(t1) == stats_dist_get_max(all));
+	test_assert(fabs(stats_dist_get_variance(t1) -
+			 stats_dist_get_variance(all)) <
+		    stats_dist_get_variance(all) * 1e-9);
+	test_assert(stats_dist_get_median(t1) == stats_dist_get_median(all));
+	test_assert(stats_dist_get_95th(t1) == stats_dist_get_95th(all));
+	for (i = 1; i < 1000000; i *= 2) {
+		test_assert_idx(stats_dist_get_count_le(t1, i) ==
+				stats_dist_get_count_le(all, i), i);
+	}
+
+	/* merging to empty */
+	stats_dist_reset(t2);
+	stats_dist_merge(t2, all);
+	test_assert(stats_dist_get_min(t2) == 1);
+	test_assert(stats_dist_get_95th(t2) == stats_dist_get_95th(all));
+	stats_dist_deinit(&t1);
+	stats_dist_deinit(&t2);
+	stats_dist_deinit(&all);
+	test_end();
+}
+
 void test_stats_dist(void)
 {
 	static int64_t test_input1[] = {
@@ -129,4 +230,7 @@ void test_stats_dist(void)
 	test_end();
 
 	test_stats_dist_get_variance();
+	test_stats_dist_percentiles();
+	test_stats_dist_count_le();
+	test_stats_dist_merge();
 }
@@ -51,6 +51,82 @@ static bool test_str_find_substring(const char *key, int expected_pos)
 	return TRUE;
 }
 
+static const unsigned char *
+test_str_find_naive(const unsigned char *data, size_t size, const char *key,
+		    bool icase)
+{
+	size_t i, key_len = strlen(key);
+
+	for (i = 0; i + key_len <= size; i++) {
+		if ((icase ? strncasecmp((const char *)data + i, key, key_len) :
+		     strncmp((const char *)data + i, key, key_len)) == 0)
+			return data + i;
+	}
+	return NULL;
+}
+
+static void test_str_find_random(void)
+{
+	unsigned char data[1024];
+	char key[40];
+	const unsigned char *match;
+	struct str_find_context *ctx;
+	unsigned int i, j, key_len, size, pos, block_size;
+	bool icase, found;
+
+	test_begin("str_find() random");
+	for (i = 0; i < 2000; i++) {
+		/* Small alphabet so that there are many partial matches.
+		   No NULs, because they would stop strncmp(). */
+		size = i_rand_limit(sizeof(data) + 1);
+		for (j = 0; j < size; j++)
+			data[j] = "abAB\xc3"[i_rand_limit(5)];
+		key_len = 1 + i_rand_limit(i % 2 == 0 ? 4 : sizeof(key) - 1);
+		for (j = 0; j < key_len; j++)
+			key[j] = "abAB\xc3"[i_rand_limit(5)];
+		key[key_len] = '\0';
+		icase = i_rand_limit(2) == 0;
+		match = test_str_find_naive(data, size, key, icase);
+
+		ctx = icase ? str_find_init_icase(default_pool, key) :
+			str_find_init(default_pool, key);
+		found = FALSE;
+		for (pos = 0; pos < size && !found; pos += block_size) {
+			block_size = i_rand_limit(3) == 0 ?
+				size - pos : 1 + i_rand_limit(size - pos);
+			found = str_find_more(ctx, data + pos, block_size);
+		}
+		test_assert_idx(found == (match != NULL), i);
+		if (found && match != NULL) {
+			pos -= block_size;
+			test_assert_idx(pos + str_find_get_match_end_pos(ctx) ==
+					(size_t)(match - data) + key_len, i);
+		}
+		str_find_deinit(&ctx);
+	}
+	test_end();
+}
+
+static void test_str_find_icase(void)
+{
+	static const unsigned char text[] =
+		"From: user@Example.COM\r\nSubject: HeLLo wORLD";
+	struct str_find_context *ctx;
+
+	test_begin("str_find() icase");
+	ctx = str_find_init_icase(default_pool, "hello World");
+	test_assert(str_find_more(ctx, text, sizeof(text) - 1));
+	test_assert(str_find_get_match_end_pos(ctx) == sizeof(text) - 1);
+	str_find_reset(ctx);
+	test_assert(!str_find_more(ctx, text, sizeof(text) - 2));
+	str_find_deinit(&ctx);
+
+	ctx = str_find_init(default_pool, "hello World");
+	test_assert(!str_find_more(ctx, text, sizeof(text) - 1));
+	str_find_deinit(&ctx);
+	test_end();
+}
+
 struct str_find_input {
 	const char *str;
 	int pos;
@@ -83,4 +159,7 @@ void test_str_find(void)
 	for (i = 0; i < N_ELEMENTS(fail_input) && success; i++)
 		success = test_str_find_substring(fail_input[i], -1);
 	test_out("str_find()", success);
+
+	test_str_find_icase();
+	test_str_find_random();
 }
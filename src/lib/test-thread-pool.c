@@ -0,0 +1,146 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+#include "ioloop.h"
+#include "thread-pool.h"
+
+#include <unistd.h>
+
+#define TEST_JOB_COUNT 100
+
+struct test_job {
+	unsigned int input;
+	uint64_t result;
+	unsigned int *callbacks;
+	int wait_fd;
+	struct thread_pool_job **abort_job;
+	bool finished;
+};
+
+static void test_job_work(struct test_job *job)
+{
+	uint64_t i, sum = 0;
+	char c;
+
+	/* workers may not touch anything else than the context */
+	if (job->wait_fd != -1) {
+		if (read(job->wait_fd, &c, 1) != 1)
+			abort();
+	}
+	for (i = 0; i <= job->input; i++)
+		sum += i * i;
+	job->result = sum;
+}
+
+static void test_job_callback(struct test_job *job)
+{
+	job->finished = TRUE;
+	if (job->abort_job != NULL)
+		thread_pool_job_abort(job->abort_job);
+	if (++(*job->callbacks) == TEST_JOB_COUNT)
+		io_loop_stop(current_ioloop);
+}
+
+static uint64_t test_job_expected(unsigned int input)
+{
+	uint64_t n = input;
+
+	return n * (n + 1) * (2 * n + 1) / 6;
+}
+
+static void test_thread_pool_run(void)
+{
+	struct test_job jobs[TEST_JOB_COUNT];
+	struct ioloop *ioloop;
+	struct thread_pool *pool;
+	unsigned int i, callbacks = 0;
+
+	test_begin("thread pool run");
+	ioloop = io_loop_create();
+	pool = thread_pool_init(4);
+	i_zero(&jobs);
+	for (i = 0; i < TEST_JOB_COUNT; i++) {
+		jobs[i].input = 1000 + i_rand_limit(100000);
+		jobs[i].callbacks = &callbacks;
+		jobs[i].wait_fd = -1;
+		(void)thread_pool_run(pool, test_job_work, test_job_callback,
+				      &jobs[i]);
+	}
+	/* callbacks are called only from the ioloop */
+	test_assert(callbacks == 0);
+	test_assert(thread_pool_get_job_count(pool) == TEST_JOB_COUNT);
+	io_loop_run(ioloop);
+
+	test_assert(callbacks == TEST_JOB_COUNT);
+	test_assert(thread_pool_get_job_count(pool) == 0);
+	for (i = 0; i < TEST_JOB_COUNT; i++) {
+		test_assert_idx(jobs[i].finished &&
+				jobs[i].result == test_job_expected(jobs[i].input), i);
+	}
+	thread_pool_deinit(&pool);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+static void test_thread_pool_abort(void)
+{
+	struct test_job jobs[3];
+	struct thread_pool_job *job2, *job3;
+	struct ioloop *ioloop;
+	struct thread_pool *pool;
+	unsigned int callbacks = TEST_JOB_COUNT - 1;
+	int fd[2];
+
+	test_begin("thread pool abort");
+	if (pipe(fd) < 0)
+		i_fatal("pipe() failed: %m");
+#ifndef HAVE_PTHREAD
+	/* the work is done synchronously - don't block on it */
+	if (write(fd[1], "", 1) != 1)
+		i_fatal("write() failed: %m");
+#endif
+	ioloop = io_loop_create();
+	pool = thread_pool_init(1);
+	i_zero(&jobs);
+	jobs[0].wait_fd = fd[0];
+	jobs[1].wait_fd = -1;
+	jobs[2].wait_fd = -1;
+	jobs[0].callbacks = jobs[1].callbacks = jobs[2].callbacks = &callbacks;
+	/* job3 is either running or finished by the time the first job's
+	   callback is called. Either way its callback is never called. */
+	jobs[0].abort_job = &job3;
+
+	/* the first job blocks the only thread until the pipe is written to,
+	   so the next ones stay queued */
+	(void)thread_pool_run(pool, test_job_work, test_job_callback, &jobs[0]);
+	job2 = thread_pool_run(pool, test_job_work, test_job_callback, &jobs[1]);
+	job3 = thread_pool_run(pool, test_job_work, test_job_callback, &jobs[2]);
+	thread_pool_job_abort(&job2);
+	test_assert(job2 == NULL);
+	test_assert(thread_pool_get_job_count(pool) == 2);
+
+#ifdef HAVE_PTHREAD
+	if (write(fd[1], "", 1) != 1)
+		i_fatal("write() failed: %m");
+#endif
+	io_loop_run(ioloop);
+	test_assert(job3 == NULL);
+	test_assert(jobs[0].finished);
+	test_assert(!jobs[1].finished && jobs[1].result == 0);
+	test_assert(!jobs[2].finished);
+	test_assert(jobs[2].result == 0 ||
+		    jobs[2].result == test_job_expected(0));
+	test_assert(thread_pool_get_job_count(pool) == 0);
+
+	thread_pool_deinit(&pool);
+	io_loop_destroy(&ioloop);
+	i_close_fd(&fd[0]);
+	i_close_fd(&fd[1]);
+	test_end();
+}
+
+void test_thread_pool(void)
+{
+	test_thread_pool_run();
+	test_thread_pool_abort();
+}
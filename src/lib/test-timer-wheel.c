@@ -0,0 +1,173 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+#include "timer-wheel.h"
+
+#define TW_MAX_ITEMS 200
+
+struct tw_test_item {
+	struct timer_wheel_item item;
+	uint64_t expires;
+	bool queued;
+};
+
+static void test_timer_wheel_basic(void)
+{
+	static const uint64_t input[] = {
+		1005, 1000, 1255, 1256, 1300, 20000, 1000 + (1ULL << 20),
+		1000 + (1ULL << 32) + 5, 1000,
+	};
+	static const uint64_t output[] = {
+		1000, 1000, 1005, 1255, 1256, 1300, 20000, 1000 + (1ULL << 20),
+		1000 + (1ULL << 32) + 5,
+	};
+	struct tw_test_item items[N_ELEMENTS(input)];
+	struct timer_wheel_item *item;
+	struct timer_wheel *wheel;
+	uint64_t tick;
+	unsigned int i;
+
+	test_begin("timer wheel");
+	i_zero(&items);
+	wheel = timer_wheel_init(1000);
+	test_assert(!timer_wheel_get_next_tick(wheel, &tick));
+	test_assert(timer_wheel_peek_expired(wheel, 5000) == NULL);
+	timer_wheel_set_time(wheel, 1000);
+
+	for (i = 0; i < N_ELEMENTS(input); i++) {
+		items[i].expires = input[i];
+		timer_wheel_add(wheel, &items[i].item, input[i]);
+		test_assert(timer_wheel_item_is_queued(&items[i].item));
+	}
+	test_assert(timer_wheel_count(wheel) == N_ELEMENTS(input));
+	test_assert(timer_wheel_get_next_tick(wheel, &tick) && tick == 1000);
+	test_assert(timer_wheel_peek_expired(wheel, 999) == NULL);
+
+	for (i = 0; i < N_ELEMENTS(output); i++) {
+		/* nothing expires before its tick */
+		if (output[i] > 0 && (i == 0 || output[i-1] != output[i]))
+			test_assert(timer_wheel_peek_expired(wheel, output[i] - 1) == NULL);
+		test_assert(timer_wheel_get_next_tick(wheel, &tick) &&
+			    tick <= output[i]);
+		item = timer_wheel_peek_expired(wheel, output[i]);
+		test_assert_idx(item != NULL &&
+				((struct tw_test_item *)item)->expires == output[i], i);
+		if (item == NULL)
+			break;
+		timer_wheel_remove(wheel, item);
+		test_assert(!timer_wheel_item_is_queued(item));
+	}
+	test_assert(timer_wheel_count(wheel) == 0);
+	test_assert(!timer_wheel_get_next_tick(wheel, &tick));
+
+	/* already expired items are returned immediately */
+	timer_wheel_add(wheel, &items[0].item, 10);
+	test_assert(timer_wheel_get_next_tick(wheel, &tick) && tick == 10);
+	test_assert(timer_wheel_peek_expired(wheel, 20) == &items[0].item);
+	test_assert(timer_wheel_pop(wheel) == &items[0].item);
+	test_assert(timer_wheel_pop(wheel) == NULL);
+
+	/* time can be moved backwards when the wheel is empty */
+	timer_wheel_set_time(wheel, 100);
+	timer_wheel_add(wheel, &items[0].item, 110);
+	test_assert(timer_wheel_peek_expired(wheel, 109) == NULL);
+	test_assert(timer_wheel_peek_expired(wheel, 110) == &items[0].item);
+	timer_wheel_remove(wheel, &items[0].item);
+	timer_wheel_deinit(&wheel);
+	test_end();
+}
+
+static void test_timer_wheel_randomized(void)
+{
+	struct tw_test_item items[TW_MAX_ITEMS];
+	struct tw_test_item *titem;
+	struct timer_wheel_item *item;
+	struct timer_wheel *wheel;
+	uint64_t now, prev, tick, min_expires;
+	unsigned int i, j, count;
+
+	test_begin("timer wheel randomized");
+	for (i = 0; i < 50; i++) {
+		now = i_rand_limit(1 << 30);
+		wheel = timer_wheel_init(now);
+		i_zero(&items);
+		count = 0;
+		for (j = 0; j < TW_MAX_ITEMS; j++) {
+			switch (i_rand_limit(3)) {
+			case 0:
+				items[j].expires = now + i_rand_limit(300);
+				break;
+			case 1:
+				items[j].expires = now + i_rand_limit(100000);
+				break;
+			default:
+				items[j].expires = now + i_rand_limit(INT_MAX);
+				break;
+			}
+			timer_wheel_add(wheel, &items[j].item, items[j].expires);
+			items[j].queued = TRUE;
+			count++;
+		}
+		/* remove and re-add ("reset") some of them */
+		for (j = 0; j < TW_MAX_ITEMS; j++) {
+			if (i_rand_limit(3) != 0)
+				continue;
+			timer_wheel_remove(wheel, &items[j].item);
+			if (i_rand_limit(2) == 0) {
+				items[j].queued = FALSE;
+				count--;
+			} else {
+				items[j].expires += i_rand_limit(1000);
+				timer_wheel_add(wheel, &items[j].item,
+						items[j].expires);
+			}
+		}
+		test_assert(timer_wheel_count(wheel) == count);
+
+		prev = 0;
+		while (timer_wheel_count(wheel) > 0) {
+			min_expires = UINT64_MAX;
+			for (j = 0; j < TW_MAX_ITEMS; j++) {
+				if (items[j].queued &&
+				    items[j].expires < min_expires)
+					min_expires = items[j].expires;
+			}
+			/* the wheel never wants to sleep past the next
+			   expiry */
+			test_assert(timer_wheel_get_next_tick(wheel, &tick) &&
+				    tick <= min_expires);
+			if (tick < min_expires)
+				test_assert(timer_wheel_peek_expired(wheel, tick) == NULL);
+			/* advance the time in random steps */
+			if (i_rand_limit(2) == 0 && now < min_expires)
+				now += i_rand_limit(min_expires - now + 1);
+			else
+				now = min_expires;
+			item = timer_wheel_peek_expired(wheel, now);
+			if (now < min_expires) {
+				test_assert(item == NULL);
+				continue;
+			}
+			test_assert(item != NULL);
+			if (item == NULL)
+				break;
+			titem = (struct tw_test_item *)item;
+			test_assert(titem->queued &&
+				    titem->expires == min_expires &&
+				    prev <= titem->expires);
+			prev = titem->expires;
+			titem->queued = FALSE;
+			timer_wheel_remove(wheel, item);
+		}
+		for (j = 0; j < TW_MAX_ITEMS; j++)
+			test_assert(!items[j].queued);
+		timer_wheel_deinit(&wheel);
+	}
+	test_end();
+}
+
+void test_timer_wheel(void)
+{
+	test_timer_wheel_basic();
+	test_timer_wheel_randomized();
+}
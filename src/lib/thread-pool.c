@@ -0,0 +1,305 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "llist.h"
+#include "fd-util.h"
+#include "ioloop.h"
+#include "thread-pool.h"
+
+#include <signal.h>
+#include <unistd.h>
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+#endif
+
+enum thread_pool_job_state {
+	/* Waiting for a worker thread */
+	THREAD_POOL_JOB_STATE_QUEUED,
+	/* Work function is running in a worker thread */
+	THREAD_POOL_JOB_STATE_RUNNING,
+	/* Waiting for the callback to be called */
+	THREAD_POOL_JOB_STATE_DONE,
+};
+
+struct thread_pool_job {
+	/* Protected by pool->mutex */
+	struct thread_pool_job *prev, *next;
+	enum thread_pool_job_state state;
+
+	/* Only accessed by the main thread */
+	struct thread_pool_job *all_prev, *all_next;
+	struct thread_pool *pool;
+	const char *source_filename;
+	unsigned int source_linenum;
+	thread_pool_work_func_t *work;
+	thread_pool_callback_t *callback;
+	void *context;
+};
+
+struct thread_pool {
+	/* Only accessed by the main thread */
+	unsigned int max_threads;
+	unsigned int job_count;
+	/* All the jobs that haven't been freed yet */
+	struct thread_pool_job *jobs;
+	struct io *io;
+	int fd_notify[2];
+#ifdef HAVE_PTHREAD
+	ARRAY(pthread_t) threads;
+
+	/* Everything below is protected by the mutex */
+	pthread_mutex_t mutex;
+	/* Signalled when a job is queued or the pool is being stopped */
+	pthread_cond_t queue_cond;
+	/* Signalled when a running job is finished */
+	pthread_cond_t done_cond;
+	unsigned int idle_threads;
+	bool stopping;
+#endif
+	unsigned int queue_count;
+	struct thread_pool_job *queue_head, *queue_tail;
+	struct thread_pool_job *done_head, *done_tail;
+};
+
+static void thread_pool_notify(struct thread_pool *pool)
+{
+	const char c = 0;
+
+	/* Called with the mutex locked. The pipe needs to be written to only
+	   when the done list becomes non-empty. */
+	if (pool->done_head == NULL) {
+		if (write(pool->fd_notify[1], &c, 1) < 0 && errno != EAGAIN)
+			i_panic("write(thread pool notify) failed: %m");
+	}
+}
+
+#ifdef HAVE_PTHREAD
+static void *thread_pool_worker(void *context)
+{
+	struct thread_pool *pool = context;
+	struct thread_pool_job *job;
+
+	pthread_mutex_lock(&pool->mutex);
+	while (!pool->stopping) {
+		job = pool->queue_head;
+		if (job == NULL) {
+			pool->idle_threads++;
+			pthread_cond_wait(&pool->queue_cond, &pool->mutex);
+			pool->idle_threads--;
+			continue;
+		}
+		DLLIST2_REMOVE(&pool->queue_head, &pool->queue_tail, job);
+		pool->queue_count--;
+		job->state = THREAD_POOL_JOB_STATE_RUNNING;
+		pthread_mutex_unlock(&pool->mutex);
+
+		job->work(job->context);
+
+		pthread_mutex_lock(&pool->mutex);
+		thread_pool_notify(pool);
+		job->state = THREAD_POOL_JOB_STATE_DONE;
+		DLLIST2_APPEND(&pool->done_head, &pool->done_tail, job);
+		pthread_cond_broadcast(&pool->done_cond);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+static void thread_pool_start_thread(struct thread_pool *pool)
+{
+	sigset_t set, oldset;
+	pthread_t thread;
+	int ret;
+
+	/* Signals must be handled by the main thread. The new thread
+	   inherits the signal mask. */
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &oldset);
+	ret = pthread_create(&thread, NULL, thread_pool_worker, pool);
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	if (ret != 0) {
+		errno = ret;
+		i_panic("pthread_create() failed: %m");
+	}
+	array_push_back(&pool->threads, &thread);
+}
+#endif
+
+static void thread_pool_job_free(struct thread_pool_job *job)
+{
+	struct thread_pool *pool = job->pool;
+
+	i_assert(pool->job_count > 0);
+	pool->job_count--;
+	DLLIST_REMOVE_FULL(&pool->jobs, job, all_prev, all_next);
+	i_free(job);
+}
+
+static void thread_pool_input(struct thread_pool *pool)
+{
+	struct thread_pool_job *job;
+	char buf[128];
+
+	if (read(pool->fd_notify[0], buf, sizeof(buf)) < 0 && errno != EAGAIN)
+		i_fatal("read(thread pool notify) failed: %m");
+
+	/* Take the jobs one at a time, since the callbacks may abort the other
+	   finished jobs. */
+	for (;;) {
+#ifdef HAVE_PTHREAD
+		pthread_mutex_lock(&pool->mutex);
+#endif
+		job = pool->done_head;
+		if (job != NULL)
+			DLLIST2_REMOVE(&pool->done_head, &pool->done_tail, job);
+#ifdef HAVE_PTHREAD
+		pthread_mutex_unlock(&pool->mutex);
+#endif
+		if (job == NULL)
+			break;
+
+		job->callback(job->context);
+		thread_pool_job_free(job);
+	}
+}
+
+struct thread_pool *thread_pool_init(unsigned int max_threads)
+{
+	struct thread_pool *pool;
+
+	i_assert(max_threads > 0);
+
+	pool = i_new(struct thread_pool, 1);
+	pool->max_threads = max_threads;
+	if (pipe(pool->fd_notify) < 0)
+		i_fatal("pipe() failed: %m");
+	fd_set_nonblock(pool->fd_notify[0], TRUE);
+	fd_set_nonblock(pool->fd_notify[1], TRUE);
+	fd_close_on_exec(pool->fd_notify[0], TRUE);
+	fd_close_on_exec(pool->fd_notify[1], TRUE);
+	pool->io = io_add(pool->fd_notify[0], IO_READ, thread_pool_input, pool);
+#ifdef HAVE_PTHREAD
+	i_array_init(&pool->threads, max_threads);
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->queue_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+#endif
+	return pool;
+}
+
+void thread_pool_deinit(struct thread_pool **_pool)
+{
+	struct thread_pool *pool = *_pool;
+#ifdef HAVE_PTHREAD
+	pthread_t thread;
+#endif
+
+	if (pool == NULL)
+		return;
+	*_pool = NULL;
+
+	if (pool->jobs != NULL) {
+		i_panic("thread_pool_deinit(): %u jobs left "
+			"(one was added at %s:%u)", pool->job_count,
+			pool->jobs->source_filename,
+			pool->jobs->source_linenum);
+	}
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&pool->mutex);
+	pool->stopping = TRUE;
+	pthread_cond_broadcast(&pool->queue_cond);
+	pthread_mutex_unlock(&pool->mutex);
+	array_foreach_elem(&pool->threads, thread)
+		pthread_join(thread, NULL);
+	array_free(&pool->threads);
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->queue_cond);
+	pthread_mutex_destroy(&pool->mutex);
+#endif
+	io_remove(&pool->io);
+	i_close_fd(&pool->fd_notify[0]);
+	i_close_fd(&pool->fd_notify[1]);
+	i_free(pool);
+}
+
+void thread_pool_switch_ioloop(struct thread_pool *pool)
+{
+	pool->io = io_loop_move_io(&pool->io);
+}
+
+#undef thread_pool_run
+struct thread_pool_job *
+thread_pool_run(struct thread_pool *pool,
+		const char *source_filename, unsigned int source_linenum,
+		thread_pool_work_func_t *work,
+		thread_pool_callback_t *callback, void *context)
+{
+	struct thread_pool_job *job;
+
+	job = i_new(struct thread_pool_job, 1);
+	job->pool = pool;
+	job->source_filename = source_filename;
+	job->source_linenum = source_linenum;
+	job->work = work;
+	job->callback = callback;
+	job->context = context;
+	DLLIST_PREPEND_FULL(&pool->jobs, job, all_prev, all_next);
+	pool->job_count++;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&pool->mutex);
+	job->state = THREAD_POOL_JOB_STATE_QUEUED;
+	DLLIST2_APPEND(&pool->queue_head, &pool->queue_tail, job);
+	pool->queue_count++;
+	/* The idle threads may have been signalled already, but they might
+	   not have woken up yet. */
+	if (pool->queue_count > pool->idle_threads &&
+	    array_count(&pool->threads) < pool->max_threads)
+		thread_pool_start_thread(pool);
+	if (pool->idle_threads > 0)
+		pthread_cond_signal(&pool->queue_cond);
+	pthread_mutex_unlock(&pool->mutex);
+#else
+	job->work(job->context);
+	thread_pool_notify(pool);
+	job->state = THREAD_POOL_JOB_STATE_DONE;
+	DLLIST2_APPEND(&pool->done_head, &pool->done_tail, job);
+#endif
+	return job;
+}
+
+void thread_pool_job_abort(struct thread_pool_job **_job)
+{
+	struct thread_pool_job *job = *_job;
+	struct thread_pool *pool = job->pool;
+
+	*_job = NULL;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&pool->mutex);
+	while (job->state == THREAD_POOL_JOB_STATE_RUNNING)
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+#endif
+	switch (job->state) {
+	case THREAD_POOL_JOB_STATE_QUEUED:
+		DLLIST2_REMOVE(&pool->queue_head, &pool->queue_tail, job);
+		pool->queue_count--;
+		break;
+	case THREAD_POOL_JOB_STATE_RUNNING:
+		i_unreached();
+	case THREAD_POOL_JOB_STATE_DONE:
+		DLLIST2_REMOVE(&pool->done_head, &pool->done_tail, job);
+		break;
+	}
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&pool->mutex);
+#endif
+	thread_pool_job_free(job);
+}
+
+unsigned int thread_pool_get_job_count(struct thread_pool *pool)
+{
+	return pool->job_count;
+}
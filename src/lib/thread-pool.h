@@ -0,0 +1,63 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+/* Pool of worker threads for running CPU heavy work (hashing, compression,
+   encryption) without blocking the ioloop. The work function runs in a
+   worker thread. Afterwards the callback is called from the ioloop that the
+   pool belongs to, the same way as an io or timeout callback.
+
+   Dovecot's code isn't generally thread-safe, so the work function must be
+   fully self-contained:
+
+    - It must not use data stack (t_*() functions), memory pools or
+      i_malloc() & co. Use plain malloc() and free() if allocations are
+      needed.
+    - It must not log, use events, ioloops, streams or any other global
+      state of the process.
+    - It must access only the memory given to it via the context. The main
+      thread must not access that memory either until the callback is called
+      or the job is aborted.
+
+   If the system doesn't support threads, the work function is called
+   directly by thread_pool_run(). The callback is still called later from
+   the ioloop. */
+
+struct thread_pool;
+struct thread_pool_job;
+
+/* Called in a worker thread. */
+typedef void thread_pool_work_func_t(void *context);
+/* Called in the ioloop after the work function has finished. */
+typedef void thread_pool_callback_t(void *context);
+
+/* Create a new thread pool for the current ioloop. Up to max_threads
+   threads are started as jobs are added. */
+struct thread_pool *thread_pool_init(unsigned int max_threads);
+/* Stop all the threads. All the jobs must have finished or been aborted. */
+void thread_pool_deinit(struct thread_pool **pool);
+/* Move the pool's completion callbacks to the current ioloop. */
+void thread_pool_switch_ioloop(struct thread_pool *pool);
+
+/* Run work(context) in a worker thread, and callback(context) in the ioloop
+   after it has finished. The returned job is freed after the callback
+   returns. */
+struct thread_pool_job *
+thread_pool_run(struct thread_pool *pool,
+		const char *source_filename, unsigned int source_linenum,
+		thread_pool_work_func_t *work,
+		thread_pool_callback_t *callback, void *context) ATTR_NULL(6);
+#define thread_pool_run(pool, work, callback, context) \
+	thread_pool_run(pool, __FILE__, __LINE__ - \
+		CALLBACK_TYPECHECK(work, void (*)(typeof(context))) - \
+		CALLBACK_TYPECHECK(callback, void (*)(typeof(context))), \
+		(thread_pool_work_func_t *)work, \
+		(thread_pool_callback_t *)callback, context)
+/* Abort the job without calling its callback. If the work function is
+   currently running, this waits for it to finish. Afterwards the context can
+   be freed. This must not be called from the job's own callback. */
+void thread_pool_job_abort(struct thread_pool_job **job);
+
+/* Returns the number of jobs that haven't been finished or aborted yet. */
+unsigned int thread_pool_get_job_count(struct thread_pool *pool) ATTR_PURE;
+
+#endif
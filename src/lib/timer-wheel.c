@@ -0,0 +1,276 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "llist.h"
+#include "timer-wheel.h"
+
+/* The first level has 256 slots, each one tick long. Each of the following
+   levels has 64 slots, where each slot is as long as the whole previous
+   level. With 5 levels the wheel covers 2^32 ticks, which is more than any
+   timeout_add() can ask for. Items even further in the future are placed
+   to the furthest slot and re-added when they get cascaded from there. */
+#define TIMER_WHEEL_LEVELS 5
+#define TIMER_WHEEL_LEVEL0_BITS 8
+#define TIMER_WHEEL_LEVEL_BITS 6
+#define TIMER_WHEEL_MAX_BITS \
+	(TIMER_WHEEL_LEVEL0_BITS + \
+	 (TIMER_WHEEL_LEVELS - 1) * TIMER_WHEEL_LEVEL_BITS)
+
+#define TIMER_WHEEL_LEVEL_SLOTS(level) \
+	(1U << ((level) == 0 ? TIMER_WHEEL_LEVEL0_BITS : TIMER_WHEEL_LEVEL_BITS))
+/* log2 of the number of ticks in one slot of the level */
+#define TIMER_WHEEL_LEVEL_SHIFT(level) \
+	((level) == 0 ? 0 : \
+	 TIMER_WHEEL_LEVEL0_BITS + ((level) - 1) * TIMER_WHEEL_LEVEL_BITS)
+/* Index of the level's first slot in slots[] */
+#define TIMER_WHEEL_LEVEL_OFFSET(level) \
+	((level) == 0 ? 0 : \
+	 TIMER_WHEEL_LEVEL_SLOTS(0) + ((level) - 1) * TIMER_WHEEL_LEVEL_SLOTS(1))
+#define TIMER_WHEEL_SLOT_COUNT TIMER_WHEEL_LEVEL_OFFSET(TIMER_WHEEL_LEVELS)
+
+struct timer_wheel {
+	/* The next tick that hasn't been processed yet */
+	uint64_t cur;
+	unsigned int count;
+
+	struct timer_wheel_item *slots[TIMER_WHEEL_SLOT_COUNT];
+	/* Bit is set for each non-empty slot */
+	uint64_t slot_bitmap[TIMER_WHEEL_SLOT_COUNT / 64];
+	/* Items whose expiry tick has already been processed */
+	struct timer_wheel_item *expired;
+};
+
+struct timer_wheel *timer_wheel_init(uint64_t now)
+{
+	struct timer_wheel *wheel;
+
+	wheel = i_new(struct timer_wheel, 1);
+	wheel->cur = now;
+	return wheel;
+}
+
+void timer_wheel_deinit(struct timer_wheel **_wheel)
+{
+	struct timer_wheel *wheel = *_wheel;
+
+	*_wheel = NULL;
+	i_free(wheel);
+}
+
+unsigned int timer_wheel_count(const struct timer_wheel *wheel)
+{
+	return wheel->count;
+}
+
+static void
+timer_wheel_slot_set(struct timer_wheel *wheel, unsigned int slot)
+{
+	wheel->slot_bitmap[slot / 64] |= 1ULL << (slot % 64);
+}
+
+static void
+timer_wheel_slot_clear(struct timer_wheel *wheel, unsigned int slot)
+{
+	wheel->slot_bitmap[slot / 64] &= ~(1ULL << (slot % 64));
+}
+
+static void
+timer_wheel_queue(struct timer_wheel *wheel, struct timer_wheel_item *item)
+{
+	uint64_t expires = item->expires, delta;
+	unsigned int level, slot;
+
+	if (expires < wheel->cur) {
+		item->list = &wheel->expired;
+		DLLIST_PREPEND(item->list, item);
+		return;
+	}
+
+	delta = expires - wheel->cur;
+	if ((delta >> TIMER_WHEEL_MAX_BITS) != 0) {
+		/* too far in the future - place it as far as possible */
+		delta = (1ULL << TIMER_WHEEL_MAX_BITS) - 1;
+		expires = wheel->cur + delta;
+	}
+	for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+		if ((delta >> TIMER_WHEEL_LEVEL_SHIFT(level + 1)) == 0)
+			break;
+	}
+	slot = TIMER_WHEEL_LEVEL_OFFSET(level) +
+		((expires >> TIMER_WHEEL_LEVEL_SHIFT(level)) &
+		 (TIMER_WHEEL_LEVEL_SLOTS(level) - 1));
+
+	item->list = &wheel->slots[slot];
+	DLLIST_PREPEND(item->list, item);
+	timer_wheel_slot_set(wheel, slot);
+}
+
+void timer_wheel_add(struct timer_wheel *wheel, struct timer_wheel_item *item,
+		     uint64_t expires)
+{
+	i_assert(item->list == NULL);
+
+	item->expires = expires;
+	timer_wheel_queue(wheel, item);
+	wheel->count++;
+}
+
+void timer_wheel_remove(struct timer_wheel *wheel,
+			struct timer_wheel_item *item)
+{
+	struct timer_wheel_item **list = item->list;
+
+	i_assert(list == &wheel->expired ||
+		 (list >= wheel->slots &&
+		  list < wheel->slots + TIMER_WHEEL_SLOT_COUNT));
+	i_assert(wheel->count > 0);
+
+	DLLIST_REMOVE(list, item);
+	if (*list == NULL && list != &wheel->expired)
+		timer_wheel_slot_clear(wheel, list - wheel->slots);
+	item->list = NULL;
+	wheel->count--;
+}
+
+static bool
+timer_wheel_level_find(const struct timer_wheel *wheel, unsigned int level,
+		       unsigned int start, unsigned int *distance_r)
+{
+	const uint64_t *bitmap =
+		wheel->slot_bitmap + TIMER_WHEEL_LEVEL_OFFSET(level) / 64;
+	unsigned int slot_count = TIMER_WHEEL_LEVEL_SLOTS(level);
+	unsigned int word_count = slot_count / 64;
+	unsigned int i, word_idx = start / 64, pos;
+	uint64_t word;
+
+	/* find the first non-empty slot at or after start, wrapping around
+	   to the beginning of the level */
+	word = bitmap[word_idx] & (~0ULL << (start % 64));
+	for (i = 0;; i++) {
+		if (word != 0) {
+			pos = word_idx * 64 + __builtin_ctzll(word);
+			*distance_r = (pos + slot_count - start) % slot_count;
+			return TRUE;
+		}
+		if (i == word_count)
+			return FALSE;
+		word_idx = (word_idx + 1) % word_count;
+		word = bitmap[word_idx];
+	}
+}
+
+static bool timer_wheel_find_next(struct timer_wheel *wheel, uint64_t *tick_r)
+{
+	uint64_t period, tick;
+	unsigned int level, shift, distance;
+	bool found = FALSE;
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		/* The level's slots are processed at the ticks where the
+		   lower levels wrap around. Find the first such tick that
+		   hasn't been processed yet. */
+		shift = TIMER_WHEEL_LEVEL_SHIFT(level);
+		period = (wheel->cur + (1ULL << shift) - 1) >> shift;
+		if (!timer_wheel_level_find(wheel, level,
+				period & (TIMER_WHEEL_LEVEL_SLOTS(level) - 1),
+				&distance))
+			continue;
+
+		tick = (period + distance) << shift;
+		if (!found || tick < *tick_r) {
+			*tick_r = tick;
+			found = TRUE;
+		}
+	}
+	return found;
+}
+
+bool timer_wheel_get_next_tick(struct timer_wheel *wheel, uint64_t *tick_r)
+{
+	if (wheel->expired != NULL) {
+		*tick_r = wheel->expired->expires;
+		return TRUE;
+	}
+	return timer_wheel_find_next(wheel, tick_r);
+}
+
+static struct timer_wheel_item *
+timer_wheel_slot_take(struct timer_wheel *wheel, unsigned int slot)
+{
+	struct timer_wheel_item *list = wheel->slots[slot];
+
+	wheel->slots[slot] = NULL;
+	timer_wheel_slot_clear(wheel, slot);
+	return list;
+}
+
+static void timer_wheel_process_tick(struct timer_wheel *wheel, uint64_t tick)
+{
+	struct timer_wheel_item *item, *next;
+	unsigned int level, slot;
+
+	i_assert(tick >= wheel->cur);
+	wheel->cur = tick;
+
+	/* cascade the items from the coarser levels whose slot begins now */
+	for (level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+		if ((tick & ((1ULL << TIMER_WHEEL_LEVEL_SHIFT(level)) - 1)) != 0)
+			break;
+		slot = TIMER_WHEEL_LEVEL_OFFSET(level) +
+			((tick >> TIMER_WHEEL_LEVEL_SHIFT(level)) &
+			 (TIMER_WHEEL_LEVEL_SLOTS(level) - 1));
+		item = timer_wheel_slot_take(wheel, slot);
+		for (; item != NULL; item = next) {
+			next = item->next;
+			timer_wheel_queue(wheel, item);
+		}
+	}
+
+	item = timer_wheel_slot_take(wheel, tick % TIMER_WHEEL_LEVEL_SLOTS(0));
+	for (; item != NULL; item = next) {
+		next = item->next;
+		i_assert(item->expires == tick);
+		item->list = &wheel->expired;
+		DLLIST_PREPEND(item->list, item);
+	}
+	wheel->cur = tick + 1;
+}
+
+struct timer_wheel_item *
+timer_wheel_peek_expired(struct timer_wheel *wheel, uint64_t now)
+{
+	uint64_t tick;
+
+	while (wheel->expired == NULL) {
+		if (!timer_wheel_find_next(wheel, &tick) || tick > now) {
+			/* nothing to do until after now */
+			if (now >= wheel->cur)
+				wheel->cur = now + 1;
+			return NULL;
+		}
+		timer_wheel_process_tick(wheel, tick);
+	}
+	return wheel->expired;
+}
+
+struct timer_wheel_item *timer_wheel_pop(struct timer_wheel *wheel)
+{
+	struct timer_wheel_item *item = wheel->expired;
+	unsigned int i;
+
+	for (i = 0; item == NULL && i < N_ELEMENTS(wheel->slot_bitmap); i++) {
+		if (wheel->slot_bitmap[i] != 0) {
+			item = wheel->slots[i * 64 +
+				__builtin_ctzll(wheel->slot_bitmap[i])];
+		}
+	}
+	if (item != NULL)
+		timer_wheel_remove(wheel, item);
+	return item;
+}
+
+void timer_wheel_set_time(struct timer_wheel *wheel, uint64_t now)
+{
+	i_assert(wheel->count == 0);
+	wheel->cur = now;
+}
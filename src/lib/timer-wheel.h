@@ -0,0 +1,65 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+/* Hierarchical timer wheel. Unlike with priorityq, adding and removing an
+   item is O(1), which makes it a better fit for a large number of timers
+   that are mostly reset or removed before they expire.
+
+   Time is counted in ticks, which have no meaning to the wheel itself (ioloop
+   uses milliseconds). The first level has a slot for each of the next 256
+   ticks. Items further in the future are kept in coarser levels and they're
+   cascaded down to the finer levels as their expiry time comes closer, so
+   items still expire at their exact tick. The items you add to the wheel
+   must contain a struct timer_wheel_item. */
+
+struct timer_wheel_item {
+	/* All of these are private. The item must be zeroed before it's
+	   added the first time. */
+	struct timer_wheel_item *prev, *next;
+	/* List where the item is currently in, NULL if not in the wheel */
+	struct timer_wheel_item **list;
+	uint64_t expires;
+};
+
+/* Create a new timer wheel. now is the current tick. */
+struct timer_wheel *timer_wheel_init(uint64_t now);
+void timer_wheel_deinit(struct timer_wheel **wheel);
+
+/* Return number of items in the wheel. */
+unsigned int timer_wheel_count(const struct timer_wheel *wheel) ATTR_PURE;
+/* Returns TRUE if the item is currently in a wheel. */
+static inline bool
+timer_wheel_item_is_queued(const struct timer_wheel_item *item)
+{
+	return item->list != NULL;
+}
+
+/* Add a new item to the wheel, expiring at the given tick. Items whose
+   expiry tick has already passed are returned by the next
+   timer_wheel_peek_expired() call. */
+void timer_wheel_add(struct timer_wheel *wheel, struct timer_wheel_item *item,
+		     uint64_t expires);
+/* Remove the specified item from the wheel. */
+void timer_wheel_remove(struct timer_wheel *wheel,
+			struct timer_wheel_item *item);
+
+/* Returns the next tick when the wheel needs to be looked at, or FALSE if
+   the wheel is empty. The returned tick may be earlier than the earliest
+   item's expiry tick if items need to be cascaded from coarser levels at that
+   time. */
+bool timer_wheel_get_next_tick(struct timer_wheel *wheel, uint64_t *tick_r);
+/* Advance the wheel's time to now and return an item that has expired at or
+   before it, or NULL if there are none. The item stays in the wheel until
+   it's removed (or re-added). The items are returned in expiry order, except
+   that items with the same expiry tick are in no specific order. */
+struct timer_wheel_item *
+timer_wheel_peek_expired(struct timer_wheel *wheel, uint64_t now);
+/* Remove and return any item in the wheel, or NULL if it's empty. This is
+   mainly useful for freeing all the items. */
+struct timer_wheel_item *timer_wheel_pop(struct timer_wheel *wheel);
+
+/* Change the wheel's current tick. This can also move the time backwards.
+   The wheel must be empty. */
+void timer_wheel_set_time(struct timer_wheel *wheel, uint64_t now);
+
+#endif
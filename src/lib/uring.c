@@ -0,0 +1,198 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+/* @UNSAFE: whole file */
+
+#include "lib.h"
+#include "uring.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static int
+uring_enter(struct uring *ring, unsigned int min_complete, unsigned int flags,
+	    const void *arg, size_t argsz)
+{
+	return (int)syscall(__NR_io_uring_enter, ring->fd, ring->to_submit,
+			    min_complete, flags, arg, argsz);
+}
+
+static void *
+uring_mmap(struct uring *ring, size_t size, off_t offset)
+{
+	return mmap(NULL, size, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, ring->fd, offset);
+}
+
+int uring_init(struct uring *ring, unsigned int entries,
+	       const char **error_r)
+{
+	struct io_uring_params params;
+
+	i_zero(ring);
+	i_zero(&params);
+	ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+	if (ring->fd < 0) {
+		*error_r = "io_uring_setup()";
+		return -1;
+	}
+	fd_close_on_exec(ring->fd, TRUE);
+	ring->features = params.features;
+
+	ring->sq_ring_size = params.sq_off.array +
+		params.sq_entries * sizeof(unsigned int);
+	ring->cq_ring_size = params.cq_off.cqes +
+		params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sq_ring_ptr = ring->cq_ring_ptr = MAP_FAILED;
+	ring->sqes = MAP_FAILED;
+	if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+		ring->sq_ring_size = I_MAX(ring->sq_ring_size,
+					   ring->cq_ring_size);
+		ring->cq_ring_size = ring->sq_ring_size;
+		ring->sq_ring_ptr = uring_mmap(ring, ring->sq_ring_size,
+					       IORING_OFF_SQ_RING);
+		ring->cq_ring_ptr = ring->sq_ring_ptr;
+	} else {
+		ring->sq_ring_ptr = uring_mmap(ring, ring->sq_ring_size,
+					       IORING_OFF_SQ_RING);
+		if (ring->sq_ring_ptr != MAP_FAILED) {
+			ring->cq_ring_ptr = uring_mmap(ring, ring->cq_ring_size,
+						       IORING_OFF_CQ_RING);
+		}
+	}
+	if (ring->cq_ring_ptr != MAP_FAILED) {
+		ring->sqes_size = params.sq_entries *
+			sizeof(struct io_uring_sqe);
+		ring->sqes = uring_mmap(ring, ring->sqes_size, IORING_OFF_SQES);
+	}
+	if (ring->sqes == MAP_FAILED) {
+		*error_r = "mmap(io_uring)";
+		uring_deinit(ring);
+		return -1;
+	}
+
+	ring->sq_head = PTR_OFFSET(ring->sq_ring_ptr, params.sq_off.head);
+	ring->sq_tail = PTR_OFFSET(ring->sq_ring_ptr, params.sq_off.tail);
+	ring->sq_mask = PTR_OFFSET(ring->sq_ring_ptr, params.sq_off.ring_mask);
+	ring->sq_array = PTR_OFFSET(ring->sq_ring_ptr, params.sq_off.array);
+	ring->sq_entries = params.sq_entries;
+
+	ring->cq_head = PTR_OFFSET(ring->cq_ring_ptr, params.cq_off.head);
+	ring->cq_tail = PTR_OFFSET(ring->cq_ring_ptr, params.cq_off.tail);
+	ring->cq_mask = PTR_OFFSET(ring->cq_ring_ptr, params.cq_off.ring_mask);
+	ring->cqes = PTR_OFFSET(ring->cq_ring_ptr, params.cq_off.cqes);
+	return 0;
+}
+
+void uring_deinit(struct uring *ring)
+{
+	int old_errno = errno;
+
+	if (ring->sqes != MAP_FAILED &&
+	    munmap(ring->sqes, ring->sqes_size) < 0)
+		i_error("munmap(io_uring sqes) failed: %m");
+	if (ring->cq_ring_ptr != ring->sq_ring_ptr &&
+	    ring->cq_ring_ptr != MAP_FAILED &&
+	    munmap(ring->cq_ring_ptr, ring->cq_ring_size) < 0)
+		i_error("munmap(io_uring cq ring) failed: %m");
+	if (ring->sq_ring_ptr != MAP_FAILED &&
+	    munmap(ring->sq_ring_ptr, ring->sq_ring_size) < 0)
+		i_error("munmap(io_uring sq ring) failed: %m");
+	if (ring->fd != -1 && close(ring->fd) < 0)
+		i_error("close(io_uring) failed: %m");
+	ring->fd = -1;
+	errno = old_errno;
+}
+
+struct io_uring_sqe *uring_get_sqe(struct uring *ring)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int head, tail, idx;
+
+	tail = *ring->sq_tail;
+	head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	if (tail - head >= ring->sq_entries) {
+		/* submission queue is full - flush it to the kernel */
+		if (uring_submit(ring) < 0)
+			i_fatal("io_uring_enter(submit) failed: %m");
+		head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+		if (tail - head >= ring->sq_entries)
+			i_panic("io_uring: Submission queue stays full");
+	}
+	idx = tail & *ring->sq_mask;
+	sqe = &ring->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	ring->sq_array[idx] = idx;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->to_submit++;
+	return sqe;
+}
+
+int uring_submit(struct uring *ring)
+{
+	int ret;
+
+	while (ring->to_submit > 0) {
+		ret = uring_enter(ring, 0, 0, NULL, 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EBUSY) {
+				/* out of memory or completion queue is full.
+				   just try again later. */
+				return 0;
+			}
+			return -1;
+		}
+		i_assert((unsigned int)ret <= ring->to_submit);
+		ring->to_submit -= ret;
+	}
+	return 0;
+}
+
+int uring_submit_and_wait(struct uring *ring, int timeout_msecs)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	int ret;
+
+	if (timeout_msecs < 0) {
+		ret = uring_enter(ring, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+	} else {
+		i_assert((ring->features & IORING_FEAT_EXT_ARG) != 0);
+		i_zero(&arg);
+		ts.tv_sec = timeout_msecs / 1000;
+		ts.tv_nsec = (long long)(timeout_msecs % 1000) * 1000000;
+		arg.ts = (uintptr_t)&ts;
+		ret = uring_enter(ring, 1, IORING_ENTER_GETEVENTS |
+				  IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	}
+	if (ret >= 0) {
+		i_assert((unsigned int)ret <= ring->to_submit);
+		ring->to_submit -= ret;
+	} else if (errno != EINTR && errno != ETIME &&
+		   errno != EAGAIN && errno != EBUSY) {
+		return -1;
+	}
+	return 0;
+}
+
+const struct io_uring_cqe *uring_peek_cqe(struct uring *ring)
+{
+	unsigned int head, tail;
+
+	head = *ring->cq_head;
+	tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	if (head == tail)
+		return NULL;
+	return &ring->cqes[head & *ring->cq_mask];
+}
+
+void uring_cqe_seen(struct uring *ring)
+{
+	__atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef URING_H
+#define URING_H
+
+/* Minimal Linux io_uring wrapper using the raw syscalls, so liburing isn't
+   needed. Used by the uring ioloop handler and by asynchronous file
+   istreams. */
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+#include <linux/io_uring.h>
+
+struct uring {
+	int fd;
+
+	void *sq_ring_ptr, *cq_ring_ptr;
+	size_t sq_ring_size, cq_ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+	unsigned int sq_entries;
+	/* Number of SQEs queued with uring_get_sqe(), but not yet
+	   submitted to the kernel. */
+	unsigned int to_submit;
+
+	/* IORING_FEAT_* flags supported by the kernel */
+	unsigned int features;
+};
+
+/* Create a new ring. Returns 0 on success, -1 on failure with errno set and
+   error_r containing the failed syscall. */
+int uring_init(struct uring *ring, unsigned int entries,
+	       const char **error_r);
+/* Destroy the ring. Any requests still in progress are cancelled. */
+void uring_deinit(struct uring *ring);
+
+/* Return a new zeroed submission queue entry. If the submission queue is
+   full, the queued entries are submitted first. */
+struct io_uring_sqe *uring_get_sqe(struct uring *ring);
+/* Submit all the queued entries without waiting for any completions.
+   Returns 0 on success, -1 on failure with errno set. Temporary EAGAIN/EBUSY
+   failures leave the entries queued and return 0. */
+int uring_submit(struct uring *ring);
+/* Submit all the queued entries and wait until there's at least one
+   completion or until the timeout (-1 = infinite) is reached. Returns 0 on
+   success or timeout, -1 on failure with errno set. EINTR is returned as
+   success, so the caller can handle signals. */
+int uring_submit_and_wait(struct uring *ring, int timeout_msecs);
+
+/* Returns the next completion or NULL if there are none. The completion must
+   be released with uring_cqe_seen() before calling this again. */
+const struct io_uring_cqe *uring_peek_cqe(struct uring *ring);
+void uring_cqe_seen(struct uring *ring);
+
+#endif
+
+#endif
@@ -109,12 +109,21 @@ reader_client_dump_sub_metrics(struct ostream *output, const struct metric *metr
 		return;
 	string_t *str = t_str_new(128);
 	reader_client_append_sub_name(str, sub_name);
-	str_append_c(str, '_');
 	root_pos = str->used;
 
 	array_foreach(&metric->sub_metrics, sub_metrics) {
 		str_truncate(str, root_pos);
-		reader_client_append_sub_name(str, (*sub_metrics)->sub_name);
+		if ((*sub_metrics)->group_value.type ==
+		    METRIC_VALUE_TYPE_OTHER) {
+			/* The sub-names never contain spaces, so this can't be
+			   mixed up with a group_by value "other". */
+			str_append_c(str, ' ');
+			str_append(str, STATS_SUB_METRIC_OTHER_NAME);
+		} else {
+			str_append_c(str, '_');
+			reader_client_append_sub_name(str,
+						      (*sub_metrics)->sub_name);
+		}
 		name_pos = str->used;
 		reader_client_dump_metric(str, *sub_metrics, fields);
 		o_stream_nsend(output, str_data(str), str_len(str));
@@ -131,6 +140,7 @@ reader_client_input_dump(struct reader_client *client, const char *const *args)
 	const struct metric *metric;
 
 	o_stream_cork(client->conn.output);
+	client_writers_scrape_shm();
 	iter = stats_metrics_iterate_init(stats_metrics);
 	while ((metric = stats_metrics_iterate(iter)) != NULL) T_BEGIN {
 		string_t *str = t_str_new(128);
@@ -233,12 +243,15 @@ reader_client_input_metrics_remove(struct reader_client *client,
 		return -1;
 	}
 
+	client_writers_detach_shm();
 	if (stats_metrics_remove_dynamic(stats_metrics, args[0])) {
 		client_writer_update_connections();
 		o_stream_nsend(client->conn.output, "+\n", 2);
 	} else {
 		o_stream_nsend_str(client->conn.output,
 				   t_strdup_printf("-metrics '%s' not found\n", args[0]));
+		/* let the clients create new segments */
+		client_writer_update_connections();
 	}
 	return 1;
 }
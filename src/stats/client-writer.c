@@ -1,5 +1,6 @@
 /* Copyright (c) 2017-2018 Dovecot authors, see the included COPYING file */
 
+#define _GNU_SOURCE /* for F_GET_SEALS */
 #include "stats-common.h"
 #include "array.h"
 #include "llist.h"
@@ -8,15 +9,24 @@
 #include "strescape.h"
 #include "lib-event-private.h"
 #include "event-filter.h"
+#include "istream-unix.h"
 #include "ostream.h"
 #include "connection.h"
 #include "master-service.h"
+#include "stats-dist.h"
+#include "stats-shm.h"
 #include "stats-event-category.h"
 #include "stats-metrics.h"
 #include "stats-settings.h"
 #include "client-writer.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #define STATS_UPDATE_CLIENTS_DELAY_MSECS 1000
+/* The first minor version that supports shared memory metrics */
+#define STATS_CLIENT_SHM_MIN_MINOR_VERSION 1
 
 struct stats_event {
 	struct stats_event *prev, *next;
@@ -25,29 +35,282 @@ struct stats_event {
 	struct event *event;
 };
 
+struct writer_client_shm {
+	const struct stats_shm_header *hdr;
+	size_t size;
+	/* metrics in the same order as in the segment */
+	ARRAY_TYPE(metric_p) metrics;
+	/* private copy of the dists from the last scrape */
+	struct stats_shm_dist *prev_dists;
+};
+
 struct writer_client {
 	struct connection conn;
 
 	struct stats_event *events;
 	HASH_TABLE(struct stats_event *, struct stats_event *) events_hash;
+
+	/* Set when the client aggregates the metric_shared_memory=yes
+	   metrics into shared memory */
+	struct writer_client_shm *shm;
+	/* SHM-METRICS generation that was last sent to the client */
+	unsigned int shm_sent_generation;
 };
 
 static struct timeout *to_update_clients;
 static struct connection_list *writer_clients = NULL;
+/* Incremented whenever the existing shared memory segments become
+   unusable. */
+static unsigned int shm_generation = 1;
 
-static void client_writer_send_handshake(struct writer_client *client)
+static void client_writer_get_shm_metrics(ARRAY_TYPE(metric_p) *metrics)
+{
+	struct stats_metrics_iter *iter;
+	const struct metric *metric;
+
+	iter = stats_metrics_iterate_init(stats_metrics);
+	while ((metric = stats_metrics_iterate(iter)) != NULL) {
+		if (metric->set->shared_memory) {
+			struct metric *m = (struct metric *)metric;
+			array_push_back(metrics, &m);
+		}
+	}
+	stats_metrics_iterate_deinit(&iter);
+}
+
+static void client_writer_send_filter(struct writer_client *client)
 {
-	string_t *filter = t_str_new(128);
+	struct event_filter *filter =
+		stats_metrics_get_event_filter(stats_metrics);
+	string_t *filter_str = t_str_new(128);
 	string_t *str = t_str_new(128);
 
-	event_filter_export(stats_metrics_get_event_filter(stats_metrics), filter);
+	if (client->shm == NULL)
+		event_filter_export(filter, filter_str);
+	else {
+		/* the client doesn't need to send the events that only
+		   the shared memory metrics want */
+		struct stats_metrics_iter *iter;
+		const struct metric *metric;
+
+		filter = event_filter_create();
+		iter = stats_metrics_iterate_init(stats_metrics);
+		while ((metric = stats_metrics_iterate(iter)) != NULL) {
+			if (!metric->set->shared_memory) {
+				event_filter_merge(filter,
+						   metric->set->parsed_filter,
+						   EVENT_FILTER_MERGE_OP_OR);
+			}
+		}
+		stats_metrics_iterate_deinit(&iter);
+		event_filter_export(filter, filter_str);
+		event_filter_unref(&filter);
+	}
 
 	str_append(str, "FILTER\t");
-	str_append_tabescaped(str, str_c(filter));
+	str_append_tabescaped(str, str_c(filter_str));
 	str_append_c(str, '\n');
 	o_stream_nsend(client->conn.output, str_data(str), str_len(str));
 }
 
+static void client_writer_send_shm_metrics(struct writer_client *client)
+{
+	ARRAY_TYPE(metric_p) metrics;
+	struct metric *metric;
+
+	if (client->shm != NULL ||
+	    client->shm_sent_generation == shm_generation ||
+	    !connection_handshake_received(&client->conn) ||
+	    client->conn.minor_version < STATS_CLIENT_SHM_MIN_MINOR_VERSION)
+		return;
+
+	t_array_init(&metrics, 8);
+	client_writer_get_shm_metrics(&metrics);
+	if (array_is_empty(&metrics))
+		return;
+
+	string_t *str = t_str_new(256);
+	string_t *tmp = t_str_new(128);
+	str_printfa(str, "SHM-METRICS\t%u", shm_generation);
+	array_foreach_elem(&metrics, metric) {
+		str_truncate(tmp, 0);
+		event_filter_export(metric->set->parsed_filter, tmp);
+		str_append_c(str, '\t');
+		str_append_tabescaped(str, str_c(tmp));
+
+		str_truncate(tmp, 0);
+		for (unsigned int i = 0; i < metric->fields_count; i++) {
+			if (i > 0)
+				str_append_c(tmp, ' ');
+			str_append(tmp, metric->fields[i].field_key);
+		}
+		str_append_c(str, '\t');
+		str_append_tabescaped(str, str_c(tmp));
+	}
+	str_append_c(str, '\n');
+	o_stream_nsend(client->conn.output, str_data(str), str_len(str));
+
+	/* the client replies with SHM and the segment's fd */
+	client->shm_sent_generation = shm_generation;
+	i_stream_unix_set_read_fd(client->conn.input);
+}
+
+static void client_writer_send_handshake(struct writer_client *client)
+{
+	client_writer_send_filter(client);
+	client_writer_send_shm_metrics(client);
+}
+
+static void client_writer_handshake_ready(struct connection *conn)
+{
+	struct writer_client *client =
+		container_of(conn, struct writer_client, conn);
+
+	client_writer_send_shm_metrics(client);
+}
+
+static void writer_client_shm_scrape(struct writer_client_shm *shm)
+{
+	const struct stats_shm_dist *dists =
+		stats_shm_get_dists((struct stats_shm_header *)shm->hdr);
+	struct stats_shm_dist *prev = shm->prev_dists;
+	struct metric *metric;
+
+	array_foreach_elem(&shm->metrics, metric) {
+		stats_shm_dist_scrape(dists++, prev++, metric->duration_stats);
+		for (unsigned int i = 0; i < metric->fields_count; i++) {
+			stats_shm_dist_scrape(dists++, prev++,
+					      metric->fields[i].stats);
+		}
+	}
+}
+
+static void writer_client_shm_detach(struct writer_client *client)
+{
+	struct writer_client_shm *shm = client->shm;
+
+	if (shm == NULL)
+		return;
+	client->shm = NULL;
+
+	/* count the events the client added after the last scrape */
+	writer_client_shm_scrape(shm);
+	if (munmap((void *)shm->hdr, shm->size) < 0)
+		e_error(client->conn.event, "munmap(stats shm) failed: %m");
+	array_free(&shm->metrics);
+	i_free(shm->prev_dists);
+	i_free(shm);
+}
+
+static bool writer_client_shm_is_sealed(int fd, const char **error_r)
+{
+#ifdef F_GET_SEALS
+	int seals = fcntl(fd, F_GET_SEALS);
+
+	if (seals < 0) {
+		*error_r = t_strdup_printf(
+			"fcntl(shm, F_GET_SEALS) failed: %m");
+		return FALSE;
+	}
+	/* without the seals the client could shrink the segment while it's
+	   mapped, which would crash us with SIGBUS */
+	if ((seals & STATS_SHM_SEALS) != STATS_SHM_SEALS) {
+		*error_r = t_strdup_printf("shm isn't sealed (seals=0x%x)",
+					   seals);
+		return FALSE;
+	}
+	return TRUE;
+#else
+	*error_r = "shm sealing not supported";
+	return FALSE;
+#endif
+}
+
+static int
+writer_client_shm_map(struct writer_client_shm *shm, int fd,
+		      unsigned int generation, unsigned int dist_count,
+		      const char **error_r)
+{
+	const struct stats_shm_header *hdr;
+	struct stat st;
+	void *mem;
+
+	if (!writer_client_shm_is_sealed(fd, error_r))
+		return -1;
+	if (fstat(fd, &st) < 0) {
+		*error_r = t_strdup_printf("fstat(shm) failed: %m");
+		return -1;
+	}
+	if ((uoff_t)st.st_size != shm->size) {
+		*error_r = t_strdup_printf("Invalid shm size %"PRIuUOFF_T
+					   " (expected %zu)",
+					   (uoff_t)st.st_size, shm->size);
+		return -1;
+	}
+	mem = mmap(NULL, shm->size, PROT_READ, MAP_SHARED, fd, 0);
+	if (mem == MAP_FAILED) {
+		*error_r = t_strdup_printf("mmap(shm) failed: %m");
+		return -1;
+	}
+	hdr = mem;
+	if (hdr->magic != STATS_SHM_MAGIC || hdr->generation != generation ||
+	    hdr->dist_count != dist_count) {
+		*error_r = "Invalid shm header";
+		if (munmap(mem, shm->size) < 0)
+			i_error("munmap(stats shm) failed: %m");
+		return -1;
+	}
+	shm->hdr = hdr;
+	return 0;
+}
+
+static bool
+writer_client_input_shm(struct writer_client *client,
+			const char *const *args, const char **error_r)
+{
+	struct writer_client_shm *shm;
+	struct metric *metric;
+	unsigned int generation, dist_count = 0;
+	int fd, ret;
+
+	if (args[0] == NULL || str_to_uint(args[0], &generation) < 0) {
+		*error_r = "Invalid generation";
+		return FALSE;
+	}
+	fd = i_stream_unix_get_read_fd(client->conn.input);
+	if (fd == -1) {
+		*error_r = "Didn't receive fd";
+		return FALSE;
+	}
+	if (generation != shm_generation || client->shm != NULL) {
+		/* metrics changed after SHM-METRICS was sent. The new
+		   SHM-METRICS is sent soon. */
+		i_close_fd(&fd);
+		return TRUE;
+	}
+
+	shm = i_new(struct writer_client_shm, 1);
+	i_array_init(&shm->metrics, 8);
+	client_writer_get_shm_metrics(&shm->metrics);
+	array_foreach_elem(&shm->metrics, metric)
+		dist_count += 1 + metric->fields_count;
+	shm->size = stats_shm_get_size(dist_count);
+
+	ret = writer_client_shm_map(shm, fd, generation, dist_count, error_r);
+	i_close_fd(&fd);
+	if (ret < 0) {
+		array_free(&shm->metrics);
+		i_free(shm);
+		return FALSE;
+	}
+	shm->prev_dists = i_new(struct stats_shm_dist, dist_count);
+	client->shm = shm;
+
+	/* stop sending the events that are counted in shared memory */
+	client_writer_send_filter(client);
+	return TRUE;
+}
+
 static unsigned int stats_event_hash(const struct stats_event *event)
 {
 	return (unsigned int)event->id;
@@ -64,9 +327,11 @@ void client_writer_create(int fd)
 	struct writer_client *client;
 
 	client = i_new(struct writer_client, 1);
-	hash_table_create(&client->events_hash, default_pool, 0,
-			  stats_event_hash, stats_event_cmp);
+	hash_table_create_flat(&client->events_hash, default_pool, 0,
+			       stats_event_hash, stats_event_cmp);
 
+	/* shared memory segments' fds are sent via the socket */
+	client->conn.unix_socket = TRUE;
 	connection_init_server(writer_clients, &client->conn,
 			       "stats", fd, fd);
 	client_writer_send_handshake(client);
@@ -77,6 +342,8 @@ static void writer_client_destroy(struct connection *conn)
 	struct writer_client *client = (struct writer_client *)conn;
 	struct stats_event *event, *next;
 
+	writer_client_shm_detach(client);
+
 	for (event = client->events; event != NULL; event = next) {
 		next = event->next;
 		event_unref(&event->event);
@@ -131,7 +398,7 @@ writer_client_run_event(struct writer_client *client,
 		event_unref(&event);
 		return FALSE;
 	}
-	stats_metrics_event(stats_metrics, event, &ctx);
+	stats_metrics_event(stats_metrics, event, &ctx, client->shm != NULL);
 	*event_r = event;
 	return TRUE;
 }
@@ -312,6 +579,8 @@ writer_client_input_args(struct connection *conn, const char *const *args)
 		ret = writer_client_input_event_end(client, args+1, &error);
 	else if (strcmp(cmd, "CATEGORY") == 0)
 		ret = writer_client_input_category(client, args+1, &error);
+	else if (strcmp(cmd, "SHM") == 0)
+		ret = writer_client_input_shm(client, args+1, &error);
 	else {
 		error = "Unknown command";
 		ret = FALSE;
@@ -329,7 +598,7 @@ static struct connection_settings client_set = {
 	.service_name_in = "stats-client",
 	.service_name_out = "stats-server",
 	.major_version = 4,
-	.minor_version = 0,
+	.minor_version = 1,
 
 	.input_max_size = 1024*128, /* "big enough" */
 	.output_max_size = SIZE_MAX,
@@ -339,6 +608,7 @@ static struct connection_settings client_set = {
 static const struct connection_vfuncs client_vfuncs = {
 	.destroy = writer_client_destroy,
 	.input_args = writer_client_input_args,
+	.handshake_ready = client_writer_handshake_ready,
 };
 
 static void
@@ -362,6 +632,41 @@ void client_writer_update_connections(void)
 					NULL);
 }
 
+void client_writers_scrape_shm(void)
+{
+	struct connection *conn;
+
+	if (writer_clients == NULL)
+		return;
+
+	for (conn = writer_clients->connections; conn != NULL; conn = conn->next) {
+		struct writer_client *client =
+			container_of(conn, struct writer_client, conn);
+		if (client->shm != NULL)
+			writer_client_shm_scrape(client->shm);
+	}
+}
+
+void client_writers_detach_shm(void)
+{
+	struct connection *conn;
+
+	if (writer_clients == NULL)
+		return;
+
+	for (conn = writer_clients->connections; conn != NULL; conn = conn->next) {
+		struct writer_client *client =
+			container_of(conn, struct writer_client, conn);
+		if (client->shm != NULL) {
+			writer_client_shm_detach(client);
+			/* send all the events again until the client
+			   creates a new segment */
+			client_writer_send_filter(client);
+		}
+	}
+	shm_generation++;
+}
+
 void client_writers_init(void)
 {
 	writer_clients = connection_list_init(&client_set, &client_vfuncs);
@@ -7,6 +7,14 @@ void client_writer_create(int fd);
 
 void client_writer_update_connections(void);
 
+/* Add the events that clients have counted into shared memory to the
+   metrics. This needs to be called before the metrics are read. */
+void client_writers_scrape_shm(void);
+/* Scrape and stop using the clients' shared memory segments. This must be
+   called before metrics are removed. The clients are asked to create new
+   segments with client_writer_update_connections(). */
+void client_writers_detach_shm(void);
+
 void client_writers_init(void);
 void client_writers_deinit(void);
 
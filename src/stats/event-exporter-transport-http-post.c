@@ -3,10 +3,12 @@
 #include "lib.h"
 #include "ioloop.h"
 #include "str.h"
+#include "ostream.h"
 #include "event-exporter.h"
 #include "settings.h"
 #include "http-client.h"
 #include "iostream-ssl.h"
+#include "compression.h"
 #include "master-service.h"
 #include "master-service-settings.h"
 #include "stats-common.h"
@@ -15,27 +17,66 @@ struct http_post_event_exporter {
 	struct event_exporter exporter;
 	const struct event_exporter_http_post_settings *set;
 	struct http_client *client;
+	struct event *event;
+	const struct compression_handler *compress_handler;
+	const char *content_encoding;
+
+	/* formatted events waiting to be sent, separated by LFs */
+	buffer_t *batch;
+	unsigned int batch_event_count;
+	struct timeout *to_batch;
+
+	/* bytes in the batch and in the requests that aren't finished yet */
+	uoff_t queue_size;
+	/* number of events that were dropped because the queue was full or
+	   the request failed */
+	uint64_t dropped_events;
+	time_t last_drop_log;
+};
+
+struct http_post_event_exporter_request {
+	struct http_post_event_exporter *exporter;
+	size_t size;
+	unsigned int event_count;
 };
 
 struct event_exporter_http_post_settings {
 	pool_t pool;
 
 	const char *event_exporter_http_post_url;
+	unsigned int event_exporter_http_post_batch_max_events;
+	uoff_t event_exporter_http_post_batch_max_size;
+	unsigned int event_exporter_http_post_batch_max_delay_msecs;
+	const char *event_exporter_http_post_compression;
+	uoff_t event_exporter_http_post_queue_max_size;
 };
 
 #undef DEF
 #define DEF(type, name) \
 	SETTING_DEFINE_STRUCT_##type(#name, name, struct event_exporter_http_post_settings)
+#undef DEF_MSECS
+#define DEF_MSECS(type, name) \
+	SETTING_DEFINE_STRUCT_##type(#name, name##_msecs, struct event_exporter_http_post_settings)
 
 static const struct setting_define event_exporter_http_post_setting_defines[] = {
 	{ .type = SET_FILTER_NAME, .key = "event_exporter_http_post", },
 	DEF(STR, event_exporter_http_post_url),
+	DEF(UINT, event_exporter_http_post_batch_max_events),
+	DEF(SIZE, event_exporter_http_post_batch_max_size),
+	DEF_MSECS(TIME_MSECS, event_exporter_http_post_batch_max_delay),
+	DEF(ENUM, event_exporter_http_post_compression),
+	DEF(SIZE, event_exporter_http_post_queue_max_size),
 
 	SETTING_DEFINE_LIST_END
 };
 
 static const struct event_exporter_http_post_settings event_exporter_http_post_default_settings = {
 	.event_exporter_http_post_url = "",
+	.event_exporter_http_post_batch_max_events = 1,
+	.event_exporter_http_post_batch_max_size = 64 * 1024,
+	.event_exporter_http_post_batch_max_delay_msecs = 1000,
+	.event_exporter_http_post_compression = "none:gz:zstd",
+	.event_exporter_http_post_queue_max_size = 16 * 1024 * 1024,
 };
 
 static const struct setting_keyvalue event_exporter_http_post_default_settings_keyvalue[] = {
@@ -61,28 +102,56 @@ event_exporter_http_post_init(pool_t pool, struct event *event,
 {
 	struct http_post_event_exporter *exporter =
 		p_new(pool, struct http_post_event_exporter, 1);
+	const char *compression;
+
 	if (settings_get(event, &event_exporter_http_post_setting_parser_info,
 			 0, &exporter->set, error_r) < 0)
 		return -1;
-	if (http_client_init_auto(event, &exporter->client, error_r) < 0)
+
+	compression = exporter->set->event_exporter_http_post_compression;
+	if (strcmp(compression, "none") != 0) {
+		int ret = compression_lookup_handler(compression,
+						     &exporter->compress_handler);
+		if (ret <= 0) {
+			*error_r = t_strdup_printf(
+				"event_exporter_http_post_compression: "
+				"%s compression support not compiled in",
+				compression);
+			settings_free(exporter->set);
+			return -1;
+		}
+		/* HTTP content-coding name */
+		exporter->content_encoding =
+			strcmp(compression, "gz") == 0 ? "gzip" : compression;
+	}
+	if (http_client_init_auto(event, &exporter->client, error_r) < 0) {
+		settings_free(exporter->set);
 		return -1;
+	}
+	exporter->event = event;
+	event_ref(exporter->event);
+	exporter->batch = buffer_create_dynamic(default_pool, 1024);
 	*exporter_r = &exporter->exporter;
 	return 0;
 }
 
 static void
-event_exporter_http_post_deinit(struct event_exporter *_exporter)
+event_exporter_http_post_drop(struct http_post_event_exporter *exporter,
+			      unsigned int count, const char *reason)
 {
-	struct http_post_event_exporter *exporter =
-		container_of(_exporter, struct http_post_event_exporter,
-			     exporter);
+	exporter->dropped_events += count;
+	if (exporter->last_drop_log == ioloop_time)
+		return; /* don't spam the log */
+	exporter->last_drop_log = ioloop_time;
 
-	http_client_deinit(&exporter->client);
-	settings_free(exporter->set);
+	i_warning("Event exporter %s: Dropped %u events: %s "
+		  "(%"PRIu64" events dropped in total)",
+		  exporter->exporter.name, count, reason,
+		  exporter->dropped_events);
 }
 
 static void response_fxn(const struct http_response *response,
-			 void *context ATTR_UNUSED)
+			 struct http_post_event_exporter_request *request)
 {
 	static time_t last_log;
 	static unsigned int suppressed;
@@ -90,6 +159,7 @@ static void response_fxn(const struct http_response *response,
 	if (http_response_is_success(response))
 		return;
 
+	request->exporter->dropped_events += request->event_count;
 	if (last_log == ioloop_time) {
 		suppressed++;
 		return; /* don't spam the log */
@@ -106,6 +176,105 @@ static void response_fxn(const struct http_response *response,
 	suppressed = 0;
 }
 
+static void
+event_exporter_http_post_request_destroy(
+	struct http_post_event_exporter_request *request)
+{
+	i_assert(request->exporter->queue_size >= request->size);
+	request->exporter->queue_size -= request->size;
+	i_free(request);
+}
+
+static bool
+event_exporter_http_post_compress(struct http_post_event_exporter *exporter,
+				  buffer_t *dest)
+{
+	struct ostream *output, *compress_output;
+	bool ret = TRUE;
+
+	output = o_stream_create_buffer(dest);
+	compress_output =
+		exporter->compress_handler->create_ostream_auto(output,
+								exporter->event);
+	o_stream_nsend(compress_output, exporter->batch->data,
+		       exporter->batch->used);
+	if (o_stream_finish(compress_output) < 0) {
+		i_error("Event exporter %s: Failed to compress events: %s",
+			exporter->exporter.name,
+			o_stream_get_error(compress_output));
+		ret = FALSE;
+	}
+	o_stream_destroy(&compress_output);
+	o_stream_destroy(&output);
+	return ret;
+}
+
+static void
+event_exporter_http_post_flush(struct http_post_event_exporter *exporter)
+{
+	struct http_post_event_exporter_request *request;
+	struct http_client_request *req;
+	const char *content_type;
+
+	timeout_remove(&exporter->to_batch);
+	if (exporter->batch_event_count == 0)
+		return;
+
+	request = i_new(struct http_post_event_exporter_request, 1);
+	request->exporter = exporter;
+	request->size = exporter->batch->used;
+	request->event_count = exporter->batch_event_count;
+
+	content_type = exporter->set->event_exporter_http_post_batch_max_events > 1 ?
+		exporter->exporter.format_batch_mime_type :
+		exporter->exporter.format_mime_type;
+	req = http_client_request_url_str(exporter->client, "POST",
+		exporter->set->event_exporter_http_post_url,
+		response_fxn, request);
+	http_client_request_set_destroy_callback(req,
+		event_exporter_http_post_request_destroy, request);
+	http_client_request_add_header(req, "Content-Type", content_type);
+	if (exporter->compress_handler == NULL) {
+		http_client_request_set_payload_data(req,
+			exporter->batch->data, request->size);
+	} else T_BEGIN {
+		buffer_t *compressed = t_buffer_create(request->size / 4 + 64);
+
+		if (!event_exporter_http_post_compress(exporter, compressed)) {
+			event_exporter_http_post_drop(exporter,
+				request->event_count, "Compression failed");
+			http_client_request_abort(&req);
+		} else {
+			http_client_request_add_header(req, "Content-Encoding",
+						       exporter->content_encoding);
+			http_client_request_set_payload_data(req,
+				compressed->data, compressed->used);
+		}
+	} T_END;
+	/* The batch's data was copied to the request. Its size is still
+	   counted in the queue until the request is finished. */
+	buffer_set_used_size(exporter->batch, 0);
+	exporter->batch_event_count = 0;
+	if (req != NULL)
+		http_client_request_submit(req);
+}
+
+static void
+event_exporter_http_post_deinit(struct event_exporter *_exporter)
+{
+	struct http_post_event_exporter *exporter =
+		container_of(_exporter, struct http_post_event_exporter,
+			     exporter);
+
+	event_exporter_http_post_flush(exporter);
+	if (exporter->queue_size > 0)
+		http_client_wait(exporter->client);
+	http_client_deinit(&exporter->client);
+	buffer_free(&exporter->batch);
+	event_unref(&exporter->event);
+	settings_free(exporter->set);
+}
+
 static void
 event_exporter_http_post_send(struct event_exporter *_exporter,
 			      const buffer_t *buf)
@@ -113,15 +282,38 @@ event_exporter_http_post_send(struct event_exporter *_exporter,
 	struct http_post_event_exporter *exporter =
 		container_of(_exporter, struct http_post_event_exporter,
 			     exporter);
-	struct http_client_request *req;
+	const struct event_exporter_http_post_settings *set = exporter->set;
+	uoff_t batch_max_size = set->event_exporter_http_post_batch_max_size;
+	size_t size = buf->used + (exporter->batch->used > 0 ? 1 : 0);
 
-	req = http_client_request_url_str(exporter->client, "POST",
-		exporter->set->event_exporter_http_post_url,
-		response_fxn, NULL);
-	http_client_request_add_header(req, "Content-Type", _exporter->format_mime_type);
-	http_client_request_set_payload_data(req, buf->data, buf->used);
+	if (exporter->queue_size + size >
+	    set->event_exporter_http_post_queue_max_size) {
+		event_exporter_http_post_drop(exporter, 1,
+			"Queue is full (event_exporter_http_post_queue_max_size)");
+		return;
+	}
+	if (exporter->batch->used > 0 &&
+	    exporter->batch->used + size > batch_max_size) {
+		/* the event doesn't fit into the batch anymore */
+		event_exporter_http_post_flush(exporter);
+		size = buf->used;
+	}
+
+	if (exporter->batch->used > 0)
+		buffer_append_c(exporter->batch, '\n');
+	buffer_append_buf(exporter->batch, buf, 0, SIZE_MAX);
+	exporter->batch_event_count++;
+	exporter->queue_size += size;
 
-	http_client_request_submit(req);
+	if (exporter->batch_event_count >=
+	    set->event_exporter_http_post_batch_max_events ||
+	    exporter->batch->used >= batch_max_size)
+		event_exporter_http_post_flush(exporter);
+	else if (exporter->to_batch == NULL) {
+		exporter->to_batch = timeout_add(
+			set->event_exporter_http_post_batch_max_delay_msecs,
+			event_exporter_http_post_flush, exporter);
+	}
 }
 
 const struct event_exporter_transport event_exporter_transport_http_post = {
@@ -23,12 +23,14 @@ struct stats_metrics {
 	struct event_filter *filter; /* stats & export */
 	ARRAY(struct event_exporter *) exporters;
 	ARRAY(struct metric *) metrics;
+	unsigned int eviction_block_count;
 };
 
 static void
-stats_metric_event(struct metric *metric, struct event *event, pool_t pool);
+stats_metric_event(struct stats_metrics *metrics, struct metric *metric,
+		   struct event *event);
 static struct metric *
-stats_metric_sub_metric_alloc(struct metric *metric, const char *name, pool_t pool);
+stats_metric_sub_metric_alloc(struct metric *metric, const char *name);
 static void stats_metric_free(struct metric *metric);
 
 static int stats_exporters_add_set(struct stats_metrics *metrics,
@@ -55,12 +57,15 @@ static int stats_exporters_add_set(struct stats_metrics *metrics,
 	if (strcmp(set->format, "none") == 0) {
 		exporter->format = event_export_fmt_none;
 		exporter->format_mime_type = "application/octet-stream";
+		exporter->format_batch_mime_type = "application/octet-stream";
 	} else if (strcmp(set->format, "json") == 0) {
 		exporter->format = event_export_fmt_json;
 		exporter->format_mime_type = "application/json";
+		exporter->format_batch_mime_type = "application/x-ndjson";
 	} else if (strcmp(set->format, "tab-text") == 0) {
 		exporter->format = event_export_fmt_tabescaped_text;
 		exporter->format_mime_type = "text/plain";
+		exporter->format_batch_mime_type = "text/plain";
 	} else {
 		i_unreached();
 	}
@@ -153,6 +158,14 @@ static int stats_metrics_add_set(struct stats_metrics *metrics,
 		}
 	}
 
+	if (set->shared_memory &&
+	    (exporter != NULL || array_not_empty(group_by))) {
+		*error_r = t_strdup_printf("metric %s: metric_shared_memory "
+			"can't be used with metric_exporter or metric_group_by",
+			set->name);
+		return -1;
+	}
+
 	fields = settings_boollist_get(&set->fields);
 	metric = stats_metric_alloc(metrics->pool, set->name, set, fields);
 
@@ -485,15 +498,20 @@ int stats_metrics_init(struct event *event,
 static void stats_metric_free(struct metric *metric)
 {
 	struct metric *sub_metric;
+	pool_t pool = metric->pool;
+
 	stats_dist_deinit(&metric->duration_stats);
 	for (unsigned int i = 0; i < metric->fields_count; i++)
 		stats_dist_deinit(&metric->fields[i].stats);
 	settings_free(metric->set);
 
-	if (!array_is_created(&metric->sub_metrics))
-		return;
-	array_foreach_elem(&metric->sub_metrics, sub_metric)
-		stats_metric_free(sub_metric);
+	if (array_is_created(&metric->sub_metrics)) {
+		array_foreach_elem(&metric->sub_metrics, sub_metric)
+			stats_metric_free(sub_metric);
+		array_free(&metric->sub_metrics);
+	}
+	/* sub-metric is allocated from its own pool */
+	pool_unref(&pool);
 }
 
 void stats_metrics_deinit(struct stats_metrics **_metrics)
@@ -524,6 +542,17 @@ static void stats_metric_reset(struct metric *metric)
 		stats_metric_reset(sub_metric);
 }
 
+void stats_metrics_eviction_block(struct stats_metrics *metrics)
+{
+	metrics->eviction_block_count++;
+}
+
+void stats_metrics_eviction_unblock(struct stats_metrics *metrics)
+{
+	i_assert(metrics->eviction_block_count > 0);
+	metrics->eviction_block_count--;
+}
+
 void stats_metrics_reset(struct stats_metrics *metrics)
 {
 	struct metric *metric;
@@ -565,22 +594,28 @@ stats_metric_find_sub_metric(struct metric *metric,
 			if (sub_metrics->group_value.intmax == value->intmax)
 				return sub_metrics;
 			break;
+		case METRIC_VALUE_TYPE_OTHER:
+			break;
 		}
 	}
 	return NULL;
 }
 
 static struct metric *
-stats_metric_sub_metric_alloc(struct metric *metric, const char *name, pool_t pool)
+stats_metric_sub_metric_alloc(struct metric *metric, const char *name)
 {
 	struct metric *sub_metric;
 	ARRAY_TYPE(const_string) fields;
+	pool_t pool;
+
+	pool = pool_alloconly_create(MEMPOOL_GROWING"stats sub-metric", 512);
 	t_array_init(&fields, metric->fields_count);
 	for (unsigned int i = 0; i < metric->fields_count; i++)
 		array_append(&fields, &metric->fields[i].field_key, 1);
 	array_append_zero(&fields);
 	sub_metric = stats_metric_alloc(pool, metric->name, metric->set,
 					array_idx(&fields, 0));
+	sub_metric->pool = pool;
 	size_t max_len = STATS_SUB_METRIC_MAX_LENGTH - metric->sub_name_used_size;
 	sub_metric->sub_name = p_strdup(pool, str_sanitize_utf8(name, max_len));
 	sub_metric->sub_name_used_size =
@@ -758,28 +793,107 @@ stats_metric_group_by_value_label(const struct event_field *field,
 		return net_ip2addr(&field->value.ip);
 	case METRIC_VALUE_TYPE_BUCKET_INDEX:
 		return stats_metric_group_by_get_label(field, group_by, value);
+	case METRIC_VALUE_TYPE_OTHER:
+		break;
 	}
 	i_unreached();
 }
 
+static struct metric *stats_metric_get_other_sub_metric(struct metric *metric)
+{
+	if (metric->other_sub_metric == NULL) {
+		metric->other_sub_metric =
+			stats_metric_sub_metric_alloc(metric,
+				STATS_SUB_METRIC_OTHER_NAME);
+		metric->other_sub_metric->group_value.type =
+			METRIC_VALUE_TYPE_OTHER;
+	}
+	return metric->other_sub_metric;
+}
+
+static bool stats_metric_sub_metrics_full(struct metric *metric)
+{
+	unsigned int max_sub_metrics = metric->set->max_sub_metrics;
+	unsigned int count;
+
+	/* quantized sub-metrics are already limited by the ranges */
+	if (max_sub_metrics == 0 ||
+	    metric->group_by[0].func != STATS_METRIC_GROUPBY_DISCRETE)
+		return FALSE;
+
+	count = array_count(&metric->sub_metrics);
+	if (metric->other_sub_metric != NULL)
+		count--;
+	if (count < max_sub_metrics)
+		return FALSE;
+
+	if (!metric->max_sub_metrics_logged) {
+		i_warning("Metric %s reached metric_max_sub_metrics=%u - "
+			  "counting the least recently used sub-metrics in "
+			  "the '%s' sub-metric", metric->name, max_sub_metrics,
+			  STATS_SUB_METRIC_OTHER_NAME);
+		metric->max_sub_metrics_logged = TRUE;
+	}
+	return TRUE;
+}
+
+/* Merge the least recently used sub-metric to the "other" sub-metric and
+   free it. */
+static void stats_metric_evict_sub_metric(struct metric *metric)
+{
+	struct metric *other, *victim = NULL;
+	struct metric *const *sub_metrics;
+	unsigned int i, count, victim_idx = 0;
+
+	other = stats_metric_get_other_sub_metric(metric);
+	sub_metrics = array_get(&metric->sub_metrics, &count);
+	for (i = 0; i < count; i++) {
+		if (sub_metrics[i] == other)
+			continue;
+		if (victim == NULL ||
+		    sub_metrics[i]->last_used < victim->last_used) {
+			victim = sub_metrics[i];
+			victim_idx = i;
+		}
+	}
+	i_assert(victim != NULL);
+
+	stats_dist_merge(other->duration_stats, victim->duration_stats);
+	for (i = 0; i < victim->fields_count; i++) {
+		stats_dist_merge(other->fields[i].stats,
+				 victim->fields[i].stats);
+	}
+	array_delete(&metric->sub_metrics, victim_idx, 1);
+	stats_metric_free(victim);
+}
+
 static struct metric *
-stats_metric_get_sub_metric(struct metric *metric,
+stats_metric_get_sub_metric(struct stats_metrics *metrics,
+			    struct metric *metric,
 			    const struct event_field *field,
-			    const struct metric_value *value,
-			    pool_t pool)
+			    const struct metric_value *value)
 {
 	struct metric *sub_metric;
 
 	sub_metric = stats_metric_find_sub_metric(metric, value);
-	if (sub_metric != NULL)
+	if (sub_metric != NULL) {
+		sub_metric->last_used = ++metric->sub_metric_use_counter;
 		return sub_metric;
+	}
+
+	if (stats_metric_sub_metrics_full(metric)) {
+		if (metrics->eviction_block_count > 0) {
+			/* the sub-metrics are being iterated */
+			return stats_metric_get_other_sub_metric(metric);
+		}
+		stats_metric_evict_sub_metric(metric);
+	}
 
 	T_BEGIN {
 		const char *value_label =
 			stats_metric_group_by_value_label(field,
 				&metric->group_by[0], value);
-		sub_metric = stats_metric_sub_metric_alloc(metric, value_label,
-							   pool);
+		sub_metric = stats_metric_sub_metric_alloc(metric, value_label);
 	} T_END;
 	if (metric->group_by_count > 1) {
 		sub_metric->group_by_count = metric->group_by_count - 1;
@@ -789,12 +903,14 @@ stats_metric_get_sub_metric(struct metric *metric,
 	sub_metric->group_value.intmax = value->intmax;
 	sub_metric->group_value.ip = value->ip;
 	memcpy(sub_metric->group_value.hash, value->hash, SHA1_RESULTLEN);
+	sub_metric->last_used = ++metric->sub_metric_use_counter;
 	return sub_metric;
 }
 
 static void
-stats_metric_group_by_field(struct metric *metric, struct event *event,
-			    const struct event_field *field, pool_t pool)
+stats_metric_group_by_field(struct stats_metrics *metrics,
+			    struct metric *metric, struct event *event,
+			    const struct event_field *field)
 {
 	struct metric *sub_metric;
 	struct metric_value value;
@@ -805,12 +921,13 @@ stats_metric_group_by_field(struct metric *metric, struct event *event,
 	if (metric->sub_name_used_size >= STATS_SUB_METRIC_MAX_LENGTH)
 		return;
 	if (!array_is_created(&metric->sub_metrics))
-		p_array_init(&metric->sub_metrics, pool, 8);
-	sub_metric = stats_metric_get_sub_metric(metric, field, &value, pool);
+		i_array_init(&metric->sub_metrics, 8);
+	sub_metric = stats_metric_get_sub_metric(metrics, metric, field,
+						 &value);
 
 	/* sub-metrics are recursive, so each sub-metric can have additional
 	   sub-metrics. */
-	stats_metric_event(sub_metric, event, pool);
+	stats_metric_event(metrics, sub_metric, event);
 }
 
 static void
@@ -831,7 +948,8 @@ stats_event_get_strlist(struct event *event, const char *name,
 }
 
 static void
-stats_metric_group_by(struct metric *metric, struct event *event, pool_t pool)
+stats_metric_group_by(struct stats_metrics *metrics, struct metric *metric,
+		      struct event *event)
 {
 	const struct event_field *field =
 		event_find_field_recursive(event, metric->group_by[0].field);
@@ -845,10 +963,10 @@ stats_metric_group_by(struct metric *metric, struct event *event, pool_t pool)
 				.str = "",
 			},
 		};
-		stats_metric_group_by_field(metric, event, &empty_event_field,
-					    pool);
+		stats_metric_group_by_field(metrics, metric, event,
+					    &empty_event_field);
 	} else if (field->value_type != EVENT_FIELD_VALUE_TYPE_STRLIST)
-		stats_metric_group_by_field(metric, event, field, pool);
+		stats_metric_group_by_field(metrics, metric, event, field);
 	else {
 		/* Handle each string in strlist separately. The strlist needs
 		   to be combined from the event and its parents, as well as
@@ -872,8 +990,8 @@ stats_metric_group_by(struct metric *metric, struct event *event, pool_t pool)
 			if (str_field.value.str == NULL ||
 			    strcmp(str_field.value.str, str) != 0) {
 				str_field.value.str = str;
-				stats_metric_group_by_field(metric, event,
-							    &str_field, pool);
+				stats_metric_group_by_field(metrics, metric,
+							    event, &str_field);
 			}
 		}
 	}
@@ -908,7 +1026,8 @@ stats_metric_event_field(struct event *event, const char *fieldname,
 }
 
 static void
-stats_metric_event(struct metric *metric, struct event *event, pool_t pool)
+stats_metric_event(struct stats_metrics *metrics, struct metric *metric,
+		   struct event *event)
 {
 	/* duration is special - we always add it */
 	stats_metric_event_field(event, STATS_EVENT_FIELD_NAME_DURATION,
@@ -920,7 +1039,7 @@ stats_metric_event(struct metric *metric, struct event *event, pool_t pool)
 					 metric->fields[i].stats);
 
 	if (metric->group_by != NULL)
-		stats_metric_group_by(metric, event, pool);
+		stats_metric_group_by(metrics, metric, event);
 }
 
 static void
@@ -947,7 +1066,8 @@ stats_export_event(struct metric *metric, struct event *oldevent)
 }
 
 void stats_metrics_event(struct stats_metrics *metrics, struct event *event,
-			 const struct failure_context *ctx)
+			 const struct failure_context *ctx,
+			 bool skip_shared_memory)
 {
 	struct event_filter_match_iter *iter;
 	struct metric *metric;
@@ -962,8 +1082,12 @@ void stats_metrics_event(struct stats_metrics *metrics, struct event *event,
 	/* process stats & exports */
 	iter = event_filter_match_iter_init(metrics->filter, event, ctx);
 	while ((metric = event_filter_match_iter_next(iter)) != NULL) T_BEGIN {
+		if (skip_shared_memory && metric->set->shared_memory) {
+			/* the sender already counted it */
+			continue;
+		}
 		/* every metric is fed into stats */
-		stats_metric_event(metric, event, metrics->pool);
+		stats_metric_event(metrics, metric, event);
 
 		/* some metrics are exported */
 		if (metric->export_info.exporter != NULL)
@@ -5,6 +5,12 @@
 #include "sha1.h"
 
 #define STATS_EVENT_FIELD_NAME_DURATION "duration"
+/* sub_name of the sub-metric that counts the events of evicted and
+   non-allocated sub-metrics when metric_max_sub_metrics is reached. This is
+   only a display name - a group_by value can be "other" as well. The
+   sub-metric is identified by its METRIC_VALUE_TYPE_OTHER group_value, and
+   exporters must use that to keep the two apart. */
+#define STATS_SUB_METRIC_OTHER_NAME "other"
 
 struct metric;
 struct stats_metrics;
@@ -27,6 +33,8 @@ struct event_exporter {
 
 	/* mime type for the format */
 	const char *format_mime_type;
+	/* mime type for LF-separated batches of events in the format */
+	const char *format_batch_mime_type;
 
 	const struct event_exporter_transport *transport;
 };
@@ -54,6 +62,8 @@ enum metric_value_type {
 	METRIC_VALUE_TYPE_INT,
 	METRIC_VALUE_TYPE_IP,
 	METRIC_VALUE_TYPE_BUCKET_INDEX,
+	/* the "other" sub-metric - never matches any value */
+	METRIC_VALUE_TYPE_OTHER,
 };
 
 struct metric_value {
@@ -94,9 +104,22 @@ struct metric {
 	const struct stats_metric_settings_group_by *group_by;
 	struct metric_value group_value;
 	ARRAY(struct metric *) sub_metrics;
+	/* The "other" sub-metric in sub_metrics, or NULL if it hasn't been
+	   needed yet. */
+	struct metric *other_sub_metric;
+	/* Incremented each time a sub-metric is used. The sub-metric's
+	   last_used is set to it, so the least recently used sub-metric
+	   can be evicted. */
+	uint64_t sub_metric_use_counter;
+	uint64_t last_used;
+	/* Sub-metrics have their own pool, so they can be freed on
+	   eviction. NULL for the top-level metrics. */
+	pool_t pool;
+	bool max_sub_metrics_logged:1;
 
 	struct metric_export_info export_info;
 };
+ARRAY_DEFINE_TYPE(metric_p, struct metric *);
 
 bool stats_metrics_add_dynamic(struct stats_metrics *metrics,
 			       const struct stats_metric_settings *set,
@@ -111,6 +134,12 @@ int stats_metrics_init(struct event *event,
 		       struct stats_metrics **metrics_r, const char **error_r);
 void stats_metrics_deinit(struct stats_metrics **metrics);
 
+/* Don't evict sub-metrics until unblocked. This is used while sub-metrics
+   are iterated across ioloop runs. Any new sub-metrics beyond
+   metric_max_sub_metrics are counted in the "other" sub-metric instead. */
+void stats_metrics_eviction_block(struct stats_metrics *metrics);
+void stats_metrics_eviction_unblock(struct stats_metrics *metrics);
+
 /* Reset all metrics */
 void stats_metrics_reset(struct stats_metrics *metrics);
 
@@ -118,9 +147,12 @@ void stats_metrics_reset(struct stats_metrics *metrics);
 struct event_filter *
 stats_metrics_get_event_filter(struct stats_metrics *metrics);
 
-/* Update metrics with given event. */
+/* Update metrics with given event. If skip_shared_memory=TRUE, the metrics
+   with metric_shared_memory=yes aren't updated, because the sender already
+   counted the event in its shared memory segment. */
 void stats_metrics_event(struct stats_metrics *metrics, struct event *event,
-			 const struct failure_context *ctx);
+			 const struct failure_context *ctx,
+			 bool skip_shared_memory);
 
 /* Iterate through all the tracked metrics. */
 struct stats_metrics_iter *
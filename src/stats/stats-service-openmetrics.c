@@ -13,6 +13,7 @@
 #include "stats-settings.h"
 #include "stats-metrics.h"
 #include "stats-service-private.h"
+#include "client-writer.h"
 
 #define OPENMETRICS_CONTENT_VERSION "0.0.1"
 
@@ -25,6 +26,16 @@
 	"version=\""DOVECOT_VERSION"\""
 #endif
 
+/* Bucket upper limits in microseconds for metric_duration_histogram=yes.
+   They're powers of two, so the counts are exact, and they're the same for
+   all metrics and servers, so the histograms can be aggregated. */
+#define OPENMETRICS_DURATION_BUCKET_FIRST_USECS 64ULL
+#define OPENMETRICS_DURATION_BUCKET_COUNT 11
+
+/* Label added to the sub-metric counting the metric_max_sub_metrics
+   overflow */
+#define OPENMETRICS_OTHER_LABEL "dovecot_other"
+
 enum openmetrics_metric_type {
 	OPENMETRICS_METRIC_TYPE_COUNT,
 	OPENMETRICS_METRIC_TYPE_DURATION,
@@ -116,11 +127,65 @@ static void openmetrics_export_eof(string_t *out)
 	str_append(out, "# EOF\n");
 }
 
+static void
+openmetrics_export_duration_histogram_line(struct openmetrics_request *req,
+					   string_t *out, const char *suffix,
+					   const char *le)
+{
+	str_append(out, "dovecot_");
+	str_append(out, req->metric->name);
+	str_append(out, "_duration_seconds");
+	str_append(out, suffix);
+	if (str_len(req->labels) > 0 || le != NULL) {
+		str_append_c(out, '{');
+		str_append_str(out, req->labels);
+		if (le != NULL) {
+			if (str_len(req->labels) > 0)
+				str_append_c(out, ',');
+			str_printfa(out, "le=\"%s\"", le);
+		}
+		str_append_c(out, '}');
+	}
+}
+
+static void
+openmetrics_export_duration_histogram(struct openmetrics_request *req,
+				      string_t *out,
+				      const struct metric *metric)
+{
+	const struct stats_dist *stats = metric->duration_stats;
+	uint64_t limit = OPENMETRICS_DURATION_BUCKET_FIRST_USECS;
+
+	/* Buckets */
+	for (unsigned int i = 0; i < OPENMETRICS_DURATION_BUCKET_COUNT; i++) {
+		/* Convert from microseconds to seconds */
+		openmetrics_export_duration_histogram_line(req, out, "_bucket",
+			t_strdup_printf("%.6f", limit/1e6));
+		str_printfa(out, " %"PRIu64"\n",
+			    stats_dist_get_count_le(stats, limit));
+		limit *= 4;
+	}
+	openmetrics_export_duration_histogram_line(req, out, "_bucket", "+Inf");
+	str_printfa(out, " %u\n", stats_dist_get_count(stats));
+	/* Sum */
+	openmetrics_export_duration_histogram_line(req, out, "_sum", NULL);
+	str_printfa(out, " %.6f\n", stats_dist_get_sum(stats)/1e6);
+	/* Count */
+	openmetrics_export_duration_histogram_line(req, out, "_count", NULL);
+	str_printfa(out, " %u\n", stats_dist_get_count(stats));
+}
+
 static void
 openmetrics_export_metric_value(struct openmetrics_request *req, string_t *out,
 				const struct metric *metric)
 {
 	const struct metric_field *field;
+
+	if (req->metric_type == OPENMETRICS_METRIC_TYPE_DURATION &&
+	    req->metric->set->duration_histogram) {
+		openmetrics_export_duration_histogram(req, out, metric);
+		return;
+	}
 	/* Metric name */
 	str_append(out, "dovecot_");
 	str_append(out, req->metric->name);
@@ -294,7 +359,10 @@ openmetrics_export_metric_header(struct openmetrics_request *req, string_t *out)
 		str_append(out, " Total number of all events of this kind");
 		break;
 	case OPENMETRICS_METRIC_TYPE_DURATION:
-		str_append(out, "_duration_seconds Total duration of all events of this kind");
+		if (metric->set->duration_histogram)
+			str_append(out, "_duration_seconds Histogram of durations of all events of this kind");
+		else
+			str_append(out, "_duration_seconds Total duration of all events of this kind");
 		break;
 	case OPENMETRICS_METRIC_TYPE_FIELD:
 		field = &metric->fields[req->field_pos];
@@ -318,7 +386,10 @@ openmetrics_export_metric_header(struct openmetrics_request *req, string_t *out)
 		str_append(out, " counter\n");
 		break;
 	case OPENMETRICS_METRIC_TYPE_DURATION:
-		str_append(out, "_duration_seconds counter\n");
+		if (metric->set->duration_histogram)
+			str_append(out, "_duration_seconds histogram\n");
+		else
+			str_append(out, "_duration_seconds counter\n");
 		break;
 	case OPENMETRICS_METRIC_TYPE_FIELD:
 		field = &metric->fields[req->field_pos];
@@ -336,7 +407,12 @@ openmetrics_export_submetric(struct openmetrics_request *req, string_t *out,
 {
 	/* This metric may be a submetric and therefore have a label
 	   associated with it. */
-	if (metric->sub_name != NULL) {
+	if (metric->group_value.type == METRIC_VALUE_TYPE_OTHER) {
+		/* The metric_max_sub_metrics overflow. Any label value could
+		   also be a real group_by value, so mark it with a separate
+		   label instead. */
+		str_append(req->labels, "\"\","OPENMETRICS_OTHER_LABEL"=\"true\"");
+	} else if (metric->sub_name != NULL) {
 		str_append_c(req->labels, '"');
 		json_append_escaped(req->labels, metric->sub_name);
 		str_append_c(req->labels, '"');
@@ -604,7 +680,11 @@ openmetrics_export_continue(struct openmetrics_request *req, string_t *out)
 	case OPENMETRICS_REQUEST_STATE_INIT:
 		/* Export the Dovecot base metrics. */
 		i_assert(req->stats_iter == NULL);
+		client_writers_scrape_shm();
 		req->stats_iter = stats_metrics_iterate_init(stats_metrics);
+		/* The sub-metrics are walked across multiple ioloop runs.
+		   Make sure none of them are freed in the middle of it. */
+		stats_metrics_eviction_block(stats_metrics);
 		openmetrics_export_dovecot(out);
 		req->state = OPENMETRICS_REQUEST_STATE_METRIC;
 		break;
@@ -678,7 +758,10 @@ static void openmetrics_handle_write_error(struct openmetrics_request *req)
 
 static void openmetrics_request_deinit(struct openmetrics_request *req)
 {
-	stats_metrics_iterate_deinit(&req->stats_iter);
+	if (req->stats_iter != NULL) {
+		stats_metrics_eviction_unblock(stats_metrics);
+		stats_metrics_iterate_deinit(&req->stats_iter);
+	}
 	str_free(&req->labels);
 	array_free(&req->sub_metric_stack);
 }
@@ -760,6 +843,17 @@ static void openmetrics_request_destroy(struct openmetrics_request *req)
 	openmetrics_request_deinit(req);
 }
 
+void stats_service_openmetrics_export(struct ostream *output)
+{
+	struct openmetrics_request req;
+
+	i_zero(&req);
+	req.output = output;
+	o_stream_ref(output);
+	while (openmetrics_export(&req) == 0) ;
+	openmetrics_request_destroy(&req);
+}
+
 static void
 stats_service_openmetrics_request(void *context ATTR_UNUSED,
 				  struct http_server_request *hsreq,
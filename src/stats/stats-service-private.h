@@ -3,6 +3,11 @@
 
 #include "stats-service.h"
 
+struct ostream;
+
 void stats_service_openmetrics_init(void);
+/* Write all the metrics to the output stream in OpenMetrics format. The
+   output must accept all the data without blocking. */
+void stats_service_openmetrics_export(struct ostream *output);
 
 #endif
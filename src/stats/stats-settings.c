@@ -183,6 +183,9 @@ static const struct setting_define stats_metric_setting_defines[] = {
 	DEF(STR, exporter),
 	DEF(BOOLLIST, exporter_include),
 	DEF(STR, description),
+	DEF(BOOL, duration_histogram),
+	DEF(BOOL, shared_memory),
+	DEF(UINT, max_sub_metrics),
 
 	{ .type = SET_FILTER_ARRAY, .key = "metric_group_by",
 	  .offset = offsetof(struct stats_metric_settings, group_by),
@@ -198,6 +201,9 @@ const struct stats_metric_settings stats_metric_default_settings = {
 	.exporter = "",
 	.group_by = ARRAY_INIT,
 	.description = "",
+	.duration_histogram = FALSE,
+	.shared_memory = FALSE,
+	.max_sub_metrics = 0,
 };
 
 static const struct setting_keyvalue stats_metric_default_settings_keyvalue[] = {
@@ -132,6 +132,14 @@ struct stats_metric_settings {
 	ARRAY_TYPE(const_string) fields;
 	ARRAY_TYPE(const_string) group_by;
 	const char *filter;
+	/* Export the durations as an OpenMetrics histogram */
+	bool duration_histogram;
+	/* Processes aggregate the metric into shared memory instead of
+	   sending the events to the stats process */
+	bool shared_memory;
+	/* Maximum number of group_by sub-metrics for each discrete group_by
+	   level. 0 = unlimited. */
+	unsigned int max_sub_metrics;
 
 	struct event_filter *parsed_filter;
 
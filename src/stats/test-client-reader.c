@@ -36,7 +36,7 @@ bool test_stats_callback(struct event *event,
 			 va_list args ATTR_UNUSED)
 {
 	if (stats_metrics != NULL) {
-		stats_metrics_event(stats_metrics, event, ctx);
+		stats_metrics_event(stats_metrics, event, ctx, FALSE);
 		struct event_filter *filter =
 			stats_metrics_get_event_filter(stats_metrics);
 		return !event_filter_match(filter, event, ctx);
@@ -1,10 +1,24 @@
 /* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
 
+#define _GNU_SOURCE /* for memfd_create() and F_ADD_SEALS */
 #include "test-stats-common.h"
 #include "master-service-private.h"
 #include "client-writer.h"
 #include "connection.h"
+#include "ioloop.h"
 #include "ostream.h"
+#include "ostream-unix.h"
+#include "strescape.h"
+#include "stats-shm.h"
+#include "stats-client.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define TEST_SHM_SOCKET_PATH ".test-stats-writer"
+#define TEST_SHM_EVENT_COUNT 100
 
 static struct event *last_sent_event = NULL;
 static bool recurse_back = FALSE;
@@ -132,6 +146,250 @@ static void test_client_writer(void)
 	test_end();
 }
 
+static const char *const settings_blob_shm[] = {
+	"metric=test test2",
+	"metric/test/metric_name=test",
+	"metric/test/filter=event=test",
+	"metric/test/metric_fields=bytes",
+	"metric/test/metric_shared_memory=yes",
+	"metric/test2/metric_name=test2",
+	"metric/test2/filter=event=test2",
+	NULL
+};
+
+static void test_shm_client_run(void)
+{
+	struct stats_client *client;
+	struct ioloop *ioloop;
+	struct event *event;
+
+	/* don't feed the events to the parent's metrics */
+	stats_metrics = NULL;
+
+	ioloop = io_loop_create();
+	client = stats_client_init(TEST_SHM_SOCKET_PATH, FALSE);
+	/* wait for the shared memory to be set up */
+	struct timeout *to = timeout_add_short(100, io_loop_stop, ioloop);
+	io_loop_run(ioloop);
+	timeout_remove(&to);
+
+	for (unsigned int i = 0; i < TEST_SHM_EVENT_COUNT; i++) {
+		event = event_create(NULL);
+		event_add_category(event, &test_category);
+		event_set_name(event, i % 2 == 0 ? "test" : "test2");
+		event_add_int(event, "bytes", i);
+		test_event_send(event);
+		event_unref(&event);
+	}
+	stats_client_deinit(&client);
+	io_loop_destroy(&ioloop);
+}
+
+static void test_shm_listen_accept(int *listen_fd)
+{
+	int fd = net_accept(*listen_fd, NULL, NULL);
+
+	if (fd >= 0)
+		client_writer_create(fd);
+}
+
+static void test_shm_child_wait(pid_t *pid)
+{
+	int status;
+
+	if (*pid != -1 && waitpid(*pid, &status, WNOHANG) == *pid) {
+		test_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+		*pid = -1;
+		io_loop_stop(current_ioloop);
+	}
+}
+
+static void test_client_writer_shm(void)
+{
+	struct ioloop *ioloop;
+	struct io *io;
+	struct timeout *to;
+	int listen_fd;
+	pid_t pid;
+
+	test_begin("client writer shared memory");
+	test_init(settings_blob_shm);
+	client_writers_init();
+	recurse_back = TRUE;
+
+	i_unlink_if_exists(TEST_SHM_SOCKET_PATH);
+	listen_fd = net_listen_unix(TEST_SHM_SOCKET_PATH, 128);
+	if (listen_fd == -1)
+		i_fatal("net_listen_unix() failed: %m");
+
+	if ((pid = fork()) == (pid_t)-1)
+		i_fatal("fork() failed: %m");
+	if (pid == 0) {
+		i_close_fd(&listen_fd);
+		test_shm_client_run();
+		/* skip the parent's deinitialization */
+		_exit(0);
+	}
+
+	ioloop = io_loop_create();
+	io = io_add(listen_fd, IO_READ, test_shm_listen_accept, &listen_fd);
+	to = timeout_add_short(10, test_shm_child_wait, &pid);
+	io_loop_run(ioloop);
+	/* process the rest of the input and the disconnection */
+	for (unsigned int i = 0; i < 10; i++) {
+		io_loop_set_running(ioloop);
+		io_loop_handler_run(ioloop);
+	}
+	timeout_remove(&to);
+	io_remove(&io);
+	i_close_fd(&listen_fd);
+	i_unlink(TEST_SHM_SOCKET_PATH);
+
+	client_writers_scrape_shm();
+	test_assert(get_stats_dist_field("test", STATS_DIST_COUNT) ==
+		    TEST_SHM_EVENT_COUNT / 2);
+	test_assert(get_stats_dist_field("test2", STATS_DIST_COUNT) ==
+		    TEST_SHM_EVENT_COUNT / 2);
+
+	client_writers_deinit();
+	io_loop_destroy(&ioloop);
+	recurse_back = FALSE;
+	test_deinit();
+	test_end();
+}
+
+#if defined(HAVE_MEMFD_CREATE) && defined(F_ADD_SEALS)
+enum test_shm_invalid_type {
+	TEST_SHM_INVALID_HEADER,
+	TEST_SHM_INVALID_UNSEALED,
+};
+
+static enum test_shm_invalid_type test_shm_invalid_type;
+static bool test_shm_invalid_disconnected;
+/* kept open until the fd has been sent */
+static int test_shm_invalid_fd = -1;
+
+static void test_shm_invalid_destroy(struct connection *conn)
+{
+	test_shm_invalid_disconnected = TRUE;
+	io_loop_stop(conn->ioloop);
+}
+
+static void
+test_shm_invalid_send(struct connection *conn, const char *const *args)
+{
+	struct stats_shm_header *hdr;
+	unsigned int generation, dist_count = 0;
+	size_t size;
+	int fd;
+
+	test_assert(str_to_uint(args[0], &generation) == 0);
+	for (unsigned int i = 1; args[i] != NULL; i += 2) {
+		dist_count += 1 + str_array_length(t_strsplit_spaces(
+			t_str_tabunescape(args[i + 1]), " "));
+	}
+	size = stats_shm_get_size(dist_count);
+
+	fd = memfd_create("test-stats", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	test_assert(fd != -1);
+	test_assert(ftruncate(fd, size) == 0);
+	hdr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	test_assert(hdr != MAP_FAILED);
+	stats_shm_init(hdr, generation, dist_count);
+	switch (test_shm_invalid_type) {
+	case TEST_SHM_INVALID_HEADER:
+		hdr->magic = 0;
+		test_assert(fcntl(fd, F_ADD_SEALS, STATS_SHM_SEALS) == 0);
+		test_expect_error_string("Invalid shm header");
+		break;
+	case TEST_SHM_INVALID_UNSEALED:
+		test_expect_error_string("shm isn't sealed");
+		break;
+	}
+	test_assert(munmap(hdr, size) == 0);
+
+	test_assert(o_stream_unix_write_fd(conn->output, fd));
+	test_shm_invalid_fd = fd;
+	o_stream_nsend_str(conn->output,
+			   t_strdup_printf("SHM\t%u\n", generation));
+}
+
+static int
+test_shm_invalid_input_args(struct connection *conn, const char *const *args)
+{
+	if (strcmp(args[0], "SHM-METRICS") == 0)
+		test_shm_invalid_send(conn, args + 1);
+	return 1;
+}
+
+static const struct connection_settings shm_client_set = {
+	.service_name_in = "stats-server",
+	.service_name_out = "stats-client",
+	.major_version = 4,
+	.minor_version = 1,
+
+	.input_max_size = SIZE_MAX,
+	.output_max_size = SIZE_MAX,
+	.client = TRUE,
+};
+
+static const struct connection_vfuncs shm_client_vfuncs = {
+	.input_args = test_shm_invalid_input_args,
+	.destroy = test_shm_invalid_destroy,
+};
+
+static void test_client_writer_shm_invalid(void)
+{
+	static const enum test_shm_invalid_type types[] = {
+		TEST_SHM_INVALID_HEADER,
+		TEST_SHM_INVALID_UNSEALED,
+	};
+	struct connection_list *shm_conn_list;
+	struct connection *conn;
+	struct ioloop *ioloop;
+	struct timeout *to;
+	int fds[2];
+
+	test_begin("client writer shared memory invalid");
+	test_init(settings_blob_shm);
+	client_writers_init();
+	shm_conn_list = connection_list_init(&shm_client_set,
+					     &shm_client_vfuncs);
+	/* don't send the logged errors to the stats */
+	recurse_back = TRUE;
+
+	ioloop = io_loop_create();
+	for (unsigned int i = 0; i < N_ELEMENTS(types); i++) {
+		test_shm_invalid_type = types[i];
+		test_shm_invalid_disconnected = FALSE;
+
+		test_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+		client_writer_create(fds[1]);
+		conn = i_new(struct connection, 1);
+		conn->unix_socket = TRUE;
+		connection_init_client_fd(shm_conn_list, conn, "stats",
+					  fds[0], fds[0]);
+
+		/* the stats process disconnects the client */
+		to = timeout_add_short(5000, io_loop_stop, ioloop);
+		io_loop_run(ioloop);
+		timeout_remove(&to);
+		test_assert_idx(test_shm_invalid_disconnected, i);
+		i_close_fd(&test_shm_invalid_fd);
+
+		connection_deinit(conn);
+		i_free(conn);
+	}
+	io_loop_destroy(&ioloop);
+
+	recurse_back = FALSE;
+	client_writers_deinit();
+	connection_list_deinit(&shm_conn_list);
+	test_deinit();
+	test_end();
+}
+#endif
+
 int main(void) {
 	/* fake master service to pretend destroying
 	   connections. */
@@ -142,6 +400,10 @@ int main(void) {
 	};
 	void (*const test_functions[])(void) = {
 		test_client_writer,
+		test_client_writer_shm,
+#if defined(HAVE_MEMFD_CREATE) && defined(F_ADD_SEALS)
+		test_client_writer_shm_invalid,
+#endif
 		NULL
 	};
 
@@ -0,0 +1,326 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "test-stats-common.h"
+#include "array.h"
+#include "ioloop.h"
+#include "istream.h"
+#include "istream-zlib.h"
+#include "net.h"
+#include "http-client.h"
+#include "http-server.h"
+#include "event-exporter.h"
+
+#define TEST_EVENT_COUNT 100
+
+struct test_server_request {
+	struct http_server_request *req;
+	buffer_t *payload;
+};
+
+static struct ioloop *test_ioloop;
+static struct http_server *test_http_server;
+static struct io *test_io_listen;
+static int test_fd_listen;
+static in_port_t test_port;
+static struct http_server_settings test_http_set;
+
+static unsigned int test_received_requests, test_received_events;
+static unsigned int test_expected_events;
+static bool test_expect_gzip;
+
+bool test_stats_callback(struct event *event,
+			 enum event_callback_type type ATTR_UNUSED,
+			 struct failure_context *ctx, const char *fmt ATTR_UNUSED,
+			 va_list args ATTR_UNUSED)
+{
+	if (stats_metrics != NULL) {
+		stats_metrics_event(stats_metrics, event, ctx, FALSE);
+		struct event_filter *filter =
+			stats_metrics_get_event_filter(stats_metrics);
+		return !event_filter_match(filter, event, ctx);
+	}
+	return TRUE;
+}
+
+static void test_server_count_events(const buffer_t *payload)
+{
+	const unsigned char *data = payload->data;
+	size_t i;
+
+	test_assert(payload->used > 0 && data[payload->used-1] == '}');
+	test_received_events++;
+	for (i = 0; i < payload->used; i++) {
+		if (data[i] == '\n')
+			test_received_events++;
+	}
+}
+
+static void test_server_payload_finished(struct test_server_request *ctx)
+{
+	const struct http_request *hreq = http_server_request_get(ctx->req);
+	const struct http_header_field *hdr;
+	struct http_server_response *resp;
+
+	hdr = http_header_field_find(hreq->header, "Content-Type");
+	test_assert(hdr != NULL &&
+		    strcmp(hdr->value, "application/x-ndjson") == 0);
+	hdr = http_header_field_find(hreq->header, "Content-Encoding");
+	if (!test_expect_gzip) {
+		test_assert(hdr == NULL);
+		test_server_count_events(ctx->payload);
+	} else if (hdr == NULL || strcmp(hdr->value, "gzip") != 0) {
+		test_assert(FALSE);
+	} else {
+		struct istream *input, *gz_input;
+		const unsigned char *data;
+		size_t size;
+		buffer_t *payload = buffer_create_dynamic(default_pool, 1024);
+
+		input = i_stream_create_from_buffer(ctx->payload);
+		gz_input = i_stream_create_gz(input);
+		while (i_stream_read_more(gz_input, &data, &size) > 0) {
+			buffer_append(payload, data, size);
+			i_stream_skip(gz_input, size);
+		}
+		test_assert(gz_input->stream_errno == 0);
+		test_server_count_events(payload);
+		i_stream_unref(&gz_input);
+		i_stream_unref(&input);
+		buffer_free(&payload);
+	}
+	test_received_requests++;
+
+	resp = http_server_response_create(ctx->req, 200, "OK");
+	http_server_response_submit(resp);
+}
+
+static void test_server_request_destroyed(struct test_server_request *ctx)
+{
+	buffer_free(&ctx->payload);
+	i_free(ctx);
+
+	/* the response was sent */
+	if (test_received_events >= test_expected_events)
+		io_loop_stop(test_ioloop);
+}
+
+static void
+test_server_handle_request(void *context ATTR_UNUSED,
+			   struct http_server_request *req)
+{
+	struct test_server_request *ctx;
+
+	ctx = i_new(struct test_server_request, 1);
+	ctx->req = req;
+	ctx->payload = buffer_create_dynamic(default_pool, 1024);
+	http_server_request_set_destroy_callback(req,
+		test_server_request_destroyed, ctx);
+	http_server_request_buffer_payload(req, ctx->payload, SIZE_MAX,
+		test_server_payload_finished, ctx);
+}
+
+static void test_server_connection_destroy(void *context ATTR_UNUSED,
+					   const char *reason ATTR_UNUSED)
+{
+}
+
+static const struct http_server_callbacks test_server_callbacks = {
+	.handle_request = test_server_handle_request,
+	.connection_destroy = test_server_connection_destroy,
+};
+
+static void test_server_accept(void *context ATTR_UNUSED)
+{
+	int fd = net_accept(test_fd_listen, NULL, NULL);
+
+	if (fd >= 0) {
+		(void)http_server_connection_create(test_http_server, fd, fd,
+			FALSE, &test_server_callbacks, NULL);
+	}
+}
+
+static void test_server_init(void)
+{
+	struct ip_addr ip;
+
+	test_ioloop = io_loop_create();
+	test_assert(net_addr2ip("127.0.0.1", &ip) == 0);
+	test_port = 0;
+	test_fd_listen = net_listen(&ip, &test_port, 128);
+	if (test_fd_listen == -1)
+		i_fatal("listen(127.0.0.1) failed: %m");
+	test_io_listen = io_add(test_fd_listen, IO_READ,
+				test_server_accept, NULL);
+	http_server_settings_init(null_pool, &test_http_set);
+	test_http_server = http_server_init(&test_http_set, NULL);
+	test_received_requests = test_received_events = 0;
+}
+
+static void test_server_deinit(void)
+{
+	http_server_deinit(&test_http_server);
+	io_remove(&test_io_listen);
+	i_close_fd(&test_fd_listen);
+	io_loop_destroy(&test_ioloop);
+}
+
+static void test_init_exporter(const char *const *extra_settings)
+{
+	ARRAY_TYPE(const_string) settings;
+
+	t_array_init(&settings, 16);
+	const char *base_settings[] = {
+		"event_exporter=http",
+		"event_exporter/http/event_exporter_name=http",
+		"event_exporter/http/event_exporter_driver=http-post",
+		"event_exporter/http/event_exporter_format=json",
+		t_strdup_printf("event_exporter/http/event_exporter_http_post_url="
+				"http://127.0.0.1:%u/", test_port),
+		"metric=test",
+		"metric/test/metric_name=test",
+		"metric/test/filter=event=test",
+		"metric/test/metric_exporter=http",
+		"metric/test/metric_exporter_include=name fields",
+	};
+	array_append(&settings, base_settings, N_ELEMENTS(base_settings));
+	for (; *extra_settings != NULL; extra_settings++) {
+		const char *setting = t_strdup_printf("event_exporter/http/%s",
+						      *extra_settings);
+		array_push_back(&settings, &setting);
+	}
+	array_append_zero(&settings);
+	test_init(array_front(&settings));
+}
+
+static void test_deinit_exporter(void)
+{
+	/* free the global http-client context before test_deinit() checks
+	   for leaked settings */
+	event_exporters_deinit();
+	http_client_global_context_free();
+	test_deinit();
+}
+
+static void test_send_events(unsigned int count)
+{
+	for (unsigned int i = 0; i < count; i++) {
+		struct event *event = event_create(NULL);
+		event_add_category(event, &test_category);
+		event_set_name(event, "test");
+		event_add_int(event, "num", i);
+		test_event_send(event);
+		event_unref(&event);
+	}
+}
+
+static void test_run_server(void)
+{
+	struct timeout *to = timeout_add(5000, io_loop_stop, test_ioloop);
+	io_loop_run(test_ioloop);
+	timeout_remove(&to);
+}
+
+static void test_event_exporter_http_post_batch(void)
+{
+	const char *const settings[] = {
+		"event_exporter_http_post_batch_max_events=10",
+		NULL
+	};
+
+	test_begin("event exporter http-post batch max events");
+	test_server_init();
+	test_init_exporter(settings);
+	test_expected_events = TEST_EVENT_COUNT;
+	test_send_events(TEST_EVENT_COUNT);
+	test_run_server();
+	test_assert(test_received_events == TEST_EVENT_COUNT);
+	test_assert(test_received_requests == TEST_EVENT_COUNT / 10);
+	test_deinit_exporter();
+	test_server_deinit();
+	test_end();
+}
+
+static void test_event_exporter_http_post_batch_delay(void)
+{
+	const char *const settings[] = {
+		"event_exporter_http_post_batch_max_events=1000",
+		"event_exporter_http_post_batch_max_delay=10ms",
+		"event_exporter_http_post_compression=gz",
+		NULL
+	};
+
+	test_begin("event exporter http-post batch max delay");
+	test_server_init();
+	test_init_exporter(settings);
+	test_expect_gzip = TRUE;
+	test_expected_events = TEST_EVENT_COUNT;
+	test_send_events(TEST_EVENT_COUNT);
+	test_run_server();
+	test_assert(test_received_events == TEST_EVENT_COUNT);
+	test_assert(test_received_requests == 1);
+	test_expect_gzip = FALSE;
+	test_deinit_exporter();
+	test_server_deinit();
+	test_end();
+}
+
+static void test_event_exporter_http_post_batch_size(void)
+{
+	const char *const settings[] = {
+		"event_exporter_http_post_batch_max_events=1000",
+		"event_exporter_http_post_batch_max_size=1k",
+		NULL
+	};
+
+	test_begin("event exporter http-post batch max size");
+	test_server_init();
+	test_init_exporter(settings);
+	test_expected_events = TEST_EVENT_COUNT;
+	test_send_events(TEST_EVENT_COUNT);
+	test_run_server();
+	test_assert(test_received_events == TEST_EVENT_COUNT);
+	test_assert(test_received_requests > 1 &&
+		    test_received_requests < TEST_EVENT_COUNT);
+	test_deinit_exporter();
+	test_server_deinit();
+	test_end();
+}
+
+static void test_event_exporter_http_post_queue_full(void)
+{
+	const char *const settings[] = {
+		"event_exporter_http_post_batch_max_events=1000",
+		"event_exporter_http_post_batch_max_delay=10ms",
+		"event_exporter_http_post_queue_max_size=1k",
+		NULL
+	};
+
+	test_begin("event exporter http-post queue full");
+	test_server_init();
+	test_init_exporter(settings);
+	test_expected_events = 1;
+	test_expect_error_string("Dropped 1 events: Queue is full");
+	test_send_events(TEST_EVENT_COUNT);
+	test_expect_no_more_errors();
+	test_run_server();
+	test_assert(test_received_requests == 1);
+	test_assert(test_received_events > 1 &&
+		    test_received_events < TEST_EVENT_COUNT);
+	test_deinit_exporter();
+	test_server_deinit();
+	test_end();
+}
+
+int main(void)
+{
+	void (*const test_functions[])(void) = {
+		test_event_exporter_http_post_batch,
+		test_event_exporter_http_post_batch_delay,
+		test_event_exporter_http_post_batch_size,
+		test_event_exporter_http_post_queue_full,
+		NULL
+	};
+
+	int ret = test_run(test_functions);
+	return ret;
+}
@@ -56,10 +56,13 @@ void test_init(const char *const settings_blob[])
 	test_pool = pool_alloconly_create(MEMPOOL_GROWING"test pool", 2048);
 	stats_startup_time = time(NULL);
 
-	/* register test categories */
+	/* register test categories. The child's parent must be the
+	   registered "test" category, not test_category itself, or
+	   writer_client_input_category() rejects the child's CATEGORY line
+	   for changing its parent. */
 	stats_event_category_register(test_category.name, NULL);
 	stats_event_category_register(child_test_category.name,
-				      &test_category);
+		event_category_find_registered(test_category.name));
 
 	struct event *event;
 	stats_set = read_settings(settings_blob, &event);
@@ -9,7 +9,7 @@ bool test_stats_callback(struct event *event,
 			 va_list args ATTR_UNUSED)
 {
 	if (stats_metrics != NULL) {
-		stats_metrics_event(stats_metrics, event, ctx);
+		stats_metrics_event(stats_metrics, event, ctx, FALSE);
 		struct event_filter *filter =
 			stats_metrics_get_event_filter(stats_metrics);
 		return !event_filter_match(filter, event, ctx);
@@ -261,6 +261,96 @@ static void test_stats_metrics_group_by_discrete(void)
 		test_stats_metrics_group_by_discrete_real(&discrete_tests[i], i);
 }
 
+static const char *const settings_blob_max_sub_metrics[] = {
+	"metric=test",
+	"metric/test/metric_name=test",
+	"metric/test/filter=event=test",
+	"metric/test/metric_fields=bytes",
+	"metric/test/metric_max_sub_metrics=2",
+	"metric/test/group_by=test_name",
+	"metric/test/group_by/test_name/field=test_name",
+	NULL
+};
+
+static void test_stats_metrics_send_test_name(const char *test_name)
+{
+	struct event *event = event_create(NULL);
+	event_add_category(event, &test_category);
+	event_set_name(event, "test");
+	event_add_str(event, "test_name", test_name);
+	event_add_int(event, "bytes", 10);
+	test_event_send(event);
+	event_unref(&event);
+}
+
+static const struct metric *
+test_stats_metrics_find_sub_metric(const struct metric *metric,
+				   const char *sub_name)
+{
+	struct metric *sub_metric;
+
+	array_foreach_elem(&metric->sub_metrics, sub_metric) {
+		if (strcmp(sub_metric->sub_name, sub_name) == 0)
+			return sub_metric;
+	}
+	return NULL;
+}
+
+static void test_stats_metrics_max_sub_metrics(void)
+{
+	const struct metric *root_metric, *other;
+	struct stats_metrics_iter *iter;
+
+	test_begin("stats metrics (max sub-metrics)");
+	test_init(settings_blob_max_sub_metrics);
+	iter = stats_metrics_iterate_init(stats_metrics);
+	root_metric = stats_metrics_iterate(iter);
+	stats_metrics_iterate_deinit(&iter);
+
+	test_stats_metrics_send_test_name("a");
+	test_stats_metrics_send_test_name("b");
+	test_stats_metrics_send_test_name("a");
+	test_assert(array_count(&root_metric->sub_metrics) == 2);
+	test_assert(root_metric->other_sub_metric == NULL);
+
+	/* "b" is the least recently used and gets evicted */
+	test_expect_error_string("reached metric_max_sub_metrics=2");
+	test_stats_metrics_send_test_name("c");
+	test_expect_no_more_errors();
+	test_assert(array_count(&root_metric->sub_metrics) == 3);
+	test_assert(test_stats_metrics_find_sub_metric(root_metric, "a") != NULL);
+	test_assert(test_stats_metrics_find_sub_metric(root_metric, "b") == NULL);
+	test_assert(test_stats_metrics_find_sub_metric(root_metric, "c") != NULL);
+	other = root_metric->other_sub_metric;
+	test_assert(other != NULL &&
+		    test_stats_metrics_find_sub_metric(root_metric,
+			STATS_SUB_METRIC_OTHER_NAME) == other);
+	test_assert(stats_dist_get_count(other->duration_stats) == 1);
+	test_assert(stats_dist_get_sum(other->fields[0].stats) == 10);
+
+	/* nothing is evicted while blocked */
+	stats_metrics_eviction_block(stats_metrics);
+	test_stats_metrics_send_test_name("d");
+	test_stats_metrics_send_test_name("e");
+	stats_metrics_eviction_unblock(stats_metrics);
+	test_assert(array_count(&root_metric->sub_metrics) == 3);
+	test_assert(test_stats_metrics_find_sub_metric(root_metric, "a") != NULL);
+	test_assert(test_stats_metrics_find_sub_metric(root_metric, "c") != NULL);
+	test_assert(stats_dist_get_count(other->duration_stats) == 3);
+
+	/* "a" is now the least recently used */
+	test_stats_metrics_send_test_name("c");
+	test_stats_metrics_send_test_name("f");
+	test_assert(test_stats_metrics_find_sub_metric(root_metric, "a") == NULL);
+	test_assert(test_stats_metrics_find_sub_metric(root_metric, "f") != NULL);
+	test_assert(stats_dist_get_count(other->duration_stats) == 5);
+	test_assert(stats_dist_get_sum(other->fields[0].stats) == 50);
+	test_assert(get_stats_dist_field("test", STATS_DIST_COUNT) == 8);
+
+	test_deinit();
+	test_end();
+}
+
 #define QUANTIZED_TEST_VAL_COUNT	15
 struct quantized_test {
 	const char *const *settings_blob;
@@ -504,6 +594,7 @@ int main(void) {
 		test_stats_metrics_filter,
 		test_stats_metrics_group_by_discrete,
 		test_stats_metrics_group_by_quantized,
+		test_stats_metrics_max_sub_metrics,
 		NULL
 	};
 
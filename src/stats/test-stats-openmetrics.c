@@ -0,0 +1,180 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "test-stats-common.h"
+#include "ioloop.h"
+#include "ostream.h"
+#include "time-util.h"
+#include "stats-service-private.h"
+
+bool test_stats_callback(struct event *event,
+			 enum event_callback_type type ATTR_UNUSED,
+			 struct failure_context *ctx, const char *fmt ATTR_UNUSED,
+			 va_list args ATTR_UNUSED)
+{
+	if (stats_metrics != NULL) {
+		stats_metrics_event(stats_metrics, event, ctx, FALSE);
+		struct event_filter *filter =
+			stats_metrics_get_event_filter(stats_metrics);
+		return !event_filter_match(filter, event, ctx);
+	}
+	return TRUE;
+}
+
+static void test_event_send_duration(unsigned int duration_msecs)
+{
+	struct event *event = event_create(NULL);
+	event_add_category(event, &test_category);
+	event_set_name(event, "test");
+	i_gettimeofday(&event->tv_created);
+	timeval_sub_msecs(&event->tv_created, duration_msecs);
+	test_event_send(event);
+	event_unref(&event);
+}
+
+static const char *test_openmetrics_export(void)
+{
+	string_t *str = t_str_new(1024);
+	struct ostream *output = o_stream_create_buffer(str);
+
+	stats_service_openmetrics_export(output);
+	o_stream_unref(&output);
+	return str_c(str);
+}
+
+static const char *const settings_blob_duration_histogram[] = {
+	"metric=test",
+	"metric/test/metric_name=test",
+	"metric/test/filter=event=test",
+	"metric/test/metric_duration_histogram=yes",
+	NULL
+};
+
+static void test_stats_openmetrics_duration_histogram(void)
+{
+	static const char *const expected_lines[] = {
+		"# TYPE dovecot_test_duration_seconds histogram",
+		"dovecot_test_duration_seconds_bucket{le=\"0.000064\"} 0",
+		"dovecot_test_duration_seconds_bucket{le=\"0.000256\"} 0",
+		"dovecot_test_duration_seconds_bucket{le=\"0.001024\"} 0",
+		"dovecot_test_duration_seconds_bucket{le=\"0.004096\"} 0",
+		"dovecot_test_duration_seconds_bucket{le=\"0.016384\"} 0",
+		"dovecot_test_duration_seconds_bucket{le=\"0.065536\"} 0",
+		"dovecot_test_duration_seconds_bucket{le=\"0.262144\"} 1",
+		"dovecot_test_duration_seconds_bucket{le=\"1.048576\"} 1",
+		"dovecot_test_duration_seconds_bucket{le=\"4.194304\"} 3",
+		"dovecot_test_duration_seconds_bucket{le=\"16.777216\"} 3",
+		"dovecot_test_duration_seconds_bucket{le=\"67.108864\"} 3",
+		"dovecot_test_duration_seconds_bucket{le=\"+Inf\"} 4",
+		"dovecot_test_duration_seconds_count 4",
+		NULL
+	};
+	struct ioloop *ioloop;
+	const char *output, *const *lines, *sum_line, *p;
+	double sum;
+	unsigned int i;
+
+	test_begin("stats openmetrics (duration histogram)");
+	test_init(settings_blob_duration_histogram);
+	ioloop = io_loop_create();
+
+	/* durations are chosen far enough from the bucket limits that the
+	   time spent on sending the events doesn't move them */
+	test_event_send_duration(100);
+	test_event_send_duration(2000);
+	test_event_send_duration(3000);
+	test_event_send_duration(100000);
+
+	output = test_openmetrics_export();
+	lines = t_strsplit(output, "\n");
+	for (i = 0; expected_lines[i] != NULL; i++) {
+		if (!str_array_find(lines, expected_lines[i]))
+			test_failed(t_strdup_printf("Missing line: %s",
+						    expected_lines[i]));
+	}
+	/* the duration counter isn't exported separately */
+	test_assert(strstr(output, "_duration_seconds_total") == NULL);
+
+	sum_line = NULL;
+	for (i = 0; lines[i] != NULL; i++) {
+		if (str_begins(lines[i], "dovecot_test_duration_seconds_sum ",
+			       &p))
+			sum_line = p;
+	}
+	test_assert(sum_line != NULL);
+	if (sum_line != NULL) {
+		sum = strtod(sum_line, NULL);
+		test_assert(sum >= 105.1 && sum < 105.2);
+	}
+	test_assert(str_ends_with(output, "# EOF\n"));
+
+	io_loop_destroy(&ioloop);
+	test_deinit();
+	test_end();
+}
+
+static void test_event_send_test_name(const char *test_name)
+{
+	struct event *event = event_create(NULL);
+	event_add_category(event, &test_category);
+	event_set_name(event, "test");
+	event_add_str(event, "test_name", test_name);
+	test_event_send(event);
+	event_unref(&event);
+}
+
+static const char *const settings_blob_max_sub_metrics[] = {
+	"metric=test",
+	"metric/test/metric_name=test",
+	"metric/test/filter=event=test",
+	"metric/test/metric_max_sub_metrics=1",
+	"metric/test/group_by=test_name",
+	"metric/test/group_by/test_name/field=test_name",
+	NULL
+};
+
+static void test_stats_openmetrics_max_sub_metrics(void)
+{
+	static const char *const expected_lines[] = {
+		"dovecot_test_count 3",
+		"dovecot_test_total{test_name=\"other\"} 1",
+		"dovecot_test_total{test_name=\"\",dovecot_other=\"true\"} 2",
+		NULL
+	};
+	struct ioloop *ioloop;
+	const char *const *lines;
+
+	test_begin("stats openmetrics (max sub-metrics)");
+	test_init(settings_blob_max_sub_metrics);
+	ioloop = io_loop_create();
+
+	/* a real "other" value must not be mixed up with the overflow */
+	test_expect_error_string("reached metric_max_sub_metrics=1");
+	test_event_send_test_name("a");
+	test_event_send_test_name("b");
+	test_event_send_test_name("other");
+	test_expect_no_more_errors();
+
+	lines = t_strsplit(test_openmetrics_export(), "\n");
+	for (unsigned int i = 0; expected_lines[i] != NULL; i++) {
+		if (!str_array_find(lines, expected_lines[i]))
+			test_failed(t_strdup_printf("Missing line: %s",
+						    expected_lines[i]));
+	}
+
+	io_loop_destroy(&ioloop);
+	test_deinit();
+	test_end();
+}
+
+int main(void)
+{
+	void (*const test_functions[])(void) = {
+		test_stats_openmetrics_duration_histogram,
+		test_stats_openmetrics_max_sub_metrics,
+		NULL
+	};
+
+	int ret = test_run(test_functions);
+
+	return ret;
+}